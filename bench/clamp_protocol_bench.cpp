@@ -0,0 +1,427 @@
+/*
+ * Copyright (C) 2011 Weill Medical College of Cornell University
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License as
+ *  published by the Free Software Foundation; either version 2 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <benchmark/benchmark.h>
+
+#include "protocol_analysis.hpp"
+#include "protocol_cell.hpp"
+#include "protocol_csp.hpp"
+#include "protocol_engine.hpp"
+#include "protocol_hash.hpp"
+#include "protocol_model.hpp"
+#include "protocol_record.hpp"
+#include "protocol_synth.hpp"
+
+// Microbenchmarks for the protocol_core hot paths. Protocol sizes run from
+// 1 to 10^5 steps. Run the run_clamp_protocol_bench target, or pass
+// --benchmark_out=<file> --benchmark_out_format=json, to get JSON results
+// that can be compared between releases.
+
+namespace
+{
+
+constexpr int64_t period_ns = 50000;  // 20 kHz
+constexpr int64_t million = 1000000;
+
+// A protocol of `steps` steps in segments of up to 100 steps, alternating
+// holds and ramps. Step durations are chosen so the whole protocol lasts
+// about `total_samples` periods.
+clamp_protocol::Protocol makeProtocol(int64_t steps,
+                                      int64_t total_samples = million)
+{
+  const double step_ms = static_cast<double>(total_samples * period_ns)
+      / static_cast<double>(steps) * 1e-6;
+  clamp_protocol::Protocol protocol;
+  for (int64_t i = 0; i < steps; ++i) {
+    if (i % 100 == 0) {
+      protocol.appendSegment();
+    }
+    auto& segment = protocol.getSegment(protocol.numSegments() - 1);
+    if (i % 2 == 0) {
+      segment.hold(step_ms, -80.0 + static_cast<double>(i % 13));
+    } else {
+      segment.ramp(step_ms, -80.0, 40.0);
+    }
+  }
+  return protocol;
+}
+
+std::string makeCsp(const clamp_protocol::Protocol& protocol)
+{
+  std::string text =
+      "<?xml version=\"1.0\"?>\n<!DOCTYPE ClampProtocolML>\n"
+      "<Clamp-Suite-Protocol-v2.0>\n";
+  for (size_t seg = 0; seg < protocol.numSegments(); ++seg) {
+    text += " <segment numSweeps=\"" + std::to_string(protocol.numSweeps(seg))
+        + "\">\n";
+    for (size_t i = 0; i < protocol.segmentSize(seg); ++i) {
+      const clamp_protocol::ProtocolStep& step = protocol.getStep(seg, i);
+      const auto& p = step.parameters;
+      text += "  <step stepNumber=\"" + std::to_string(i) + "\" ampMode=\""
+          + std::to_string(step.ampMode) + "\" stepType=\""
+          + std::to_string(step.stepType) + "\" stepDuration=\""
+          + std::to_string(p[clamp_protocol::STEP_DURATION])
+          + "\" deltaStepDuration=\"0\" holdingLevel1=\""
+          + std::to_string(p[clamp_protocol::HOLDING_LEVEL_1])
+          + "\" deltaHoldingLevel1=\"0\" holdingLevel2=\""
+          + std::to_string(p[clamp_protocol::HOLDING_LEVEL_2])
+          + "\" deltaHoldingLevel2=\"0\"/>\n";
+    }
+    text += " </segment>\n";
+  }
+  text += "</Clamp-Suite-Protocol-v2.0>\n";
+  return text;
+}
+
+// Byte ring with the copy-in/copy-out behaviour of RT::OS::Fifo, so record
+// encoding is measured without the RTXI runtime
+class ByteRing
+{
+public:
+  explicit ByteRing(size_t capacity)
+      : buffer(capacity)
+  {
+  }
+
+  bool write(const void* data, size_t size)
+  {
+    if (buffer.size() - (head - tail) < size) {
+      return false;
+    }
+    copyIn(static_cast<const char*>(data), size);
+    return true;
+  }
+
+  size_t read(void* data, size_t size)
+  {
+    size = std::min(size, head - tail);
+    auto* out = static_cast<char*>(data);
+    const size_t offset = tail % buffer.size();
+    const size_t first = std::min(size, buffer.size() - offset);
+    std::memcpy(out, buffer.data() + offset, first);
+    std::memcpy(out + first, buffer.data(), size - first);
+    tail += size;
+    return size;
+  }
+
+private:
+  void copyIn(const char* data, size_t size)
+  {
+    const size_t offset = head % buffer.size();
+    const size_t first = std::min(size, buffer.size() - offset);
+    std::memcpy(buffer.data() + offset, data, first);
+    std::memcpy(buffer.data(), data + first, size - first);
+    head += size;
+  }
+
+  std::vector<char> buffer;
+  size_t head = 0;
+  size_t tail = 0;
+};
+
+void protocolSizes(benchmark::internal::Benchmark* bench)
+{
+  bench->RangeMultiplier(10)->Range(1, 100000);
+}
+
+// The per-tick work of Component::getProtocolAmplitude(): one engine sample
+// and, with the plot open, one data token
+void BM_EngineTick(benchmark::State& state)
+{
+  const auto compiled = makeProtocol(state.range(0)).compile();
+  clamp_protocol::ProtocolEngine engine;
+  engine.load(compiled.view(), period_ns);
+  for (auto _ : state) {
+    if (engine.finished()) {
+      engine.rewind();
+    }
+    benchmark::DoNotOptimize(engine.next());
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_EngineTick)->Apply(protocolSizes);
+
+void BM_EngineTickWithRecord(benchmark::State& state)
+{
+  const auto compiled = makeProtocol(state.range(0)).compile();
+  clamp_protocol::ProtocolEngine engine;
+  engine.load(compiled.view(), period_ns);
+  ByteRing fifo(1 << 20);
+  clamp_protocol::data_token_t drain[256];
+  int64_t time = 0;
+  int64_t step_start = 0;
+  for (auto _ : state) {
+    if (engine.finished()) {
+      engine.rewind();
+    }
+    const clamp_protocol::compiled_step_t& step = engine.step();
+    if (engine.stepSample() == 0) {
+      step_start = time;
+    }
+    const double value = engine.next();
+    clamp_protocol::data_token_t token {};
+    token.stepStart = step_start;
+    token.time = time;
+    token.value = value;
+    token.segment = static_cast<int>(step.segment);
+    token.sweep = static_cast<int>(step.sweep);
+    token.step = static_cast<int>(step.step);
+    if (!fifo.write(&token, sizeof(token))) {
+      fifo.read(drain, sizeof(drain));
+      fifo.write(&token, sizeof(token));
+    }
+    time += period_ns;
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_EngineTickWithRecord)->Apply(protocolSizes);
+
+// Rendering a million samples with ProtocolEngine::render()
+void BM_RenderBlock(benchmark::State& state)
+{
+  const auto compiled = makeProtocol(state.range(0)).compile();
+  clamp_protocol::ProtocolEngine engine;
+  std::vector<double> block(4096);
+  for (auto _ : state) {
+    engine.load(compiled.view(), period_ns);
+    int64_t rendered = 0;
+    while (rendered < million) {
+      const size_t written = engine.render(block.data(), block.size());
+      if (written == 0) {
+        break;
+      }
+      rendered += static_cast<int64_t>(written);
+      benchmark::ClobberMemory();
+    }
+    benchmark::DoNotOptimize(rendered);
+  }
+  state.SetItemsProcessed(state.iterations() * million);
+}
+BENCHMARK(BM_RenderBlock)->Apply(protocolSizes);
+
+// Protocol::dryrun() over a million samples, for comparison with the
+// engine
+void BM_Dryrun(benchmark::State& state)
+{
+  const auto protocol = makeProtocol(state.range(0));
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(protocol.dryrun(period_ns));
+  }
+  state.SetItemsProcessed(state.iterations() * million);
+}
+BENCHMARK(BM_Dryrun)->Apply(protocolSizes);
+
+// Rendering a window from the middle of the protocol, including the index
+// build and lookup
+void BM_RenderWindow(benchmark::State& state)
+{
+  const auto compiled = makeProtocol(state.range(0)).compile();
+  std::vector<double> window(4096);
+  for (auto _ : state) {
+    clamp_protocol::renderProtocol(compiled.view(),
+                                   period_ns,
+                                   million / 2,
+                                   window.data(),
+                                   window.size());
+    benchmark::ClobberMemory();
+  }
+  state.SetItemsProcessed(state.iterations()
+                          * static_cast<int64_t>(window.size()));
+}
+BENCHMARK(BM_RenderWindow)->Apply(protocolSizes);
+
+void BM_Compile(benchmark::State& state)
+{
+  const auto protocol = makeProtocol(state.range(0));
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(protocol.compile());
+  }
+  state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_Compile)->Apply(protocolSizes);
+
+void BM_HashProtocol(benchmark::State& state)
+{
+  const auto compiled = makeProtocol(state.range(0)).compile();
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(
+        clamp_protocol::hashProtocol(compiled.view(), period_ns, 0.0, 1.0));
+  }
+  state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_HashProtocol)->Apply(protocolSizes);
+
+// Streaming parse of .csp text with readCsp()
+void BM_ReadCsp(benchmark::State& state)
+{
+  const std::string text = makeCsp(makeProtocol(state.range(0)));
+  clamp_protocol::Protocol protocol;
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(clamp_protocol::readCsp(text, protocol));
+  }
+  state.SetBytesProcessed(state.iterations()
+                          * static_cast<int64_t>(text.size()));
+}
+BENCHMARK(BM_ReadCsp)->Apply(protocolSizes);
+
+// Reading and compiling irregular protocols: 1 to 10^4 segments of 1-20
+// mixed steps and 1-10 sweeps, a fifth of them with extreme values
+void BM_ReadSyntheticCsp(benchmark::State& state)
+{
+  clamp_protocol::synth_params params;
+  params.segments = static_cast<size_t>(state.range(0));
+  params.max_steps = 20;
+  params.ramp_fraction = 0.5;
+  params.extreme_fraction = 0.2;
+  std::ostringstream out;
+  clamp_protocol::writeSyntheticCsp(out, params);
+  const std::string text = out.str();
+  clamp_protocol::Protocol protocol;
+  for (auto _ : state) {
+    clamp_protocol::readCsp(text, protocol);
+    benchmark::DoNotOptimize(protocol.compile());
+  }
+  state.SetBytesProcessed(state.iterations()
+                          * static_cast<int64_t>(text.size()));
+}
+BENCHMARK(BM_ReadSyntheticCsp)->RangeMultiplier(10)->Range(1, 10000);
+
+#ifdef CLAMP_PROTOCOL_WITH_QT
+void BM_ToDoc(benchmark::State& state)
+{
+  auto protocol = makeProtocol(state.range(0));
+  for (auto _ : state) {
+    protocol.toDoc();
+  }
+  state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_ToDoc)->Apply(protocolSizes);
+
+void BM_FromDoc(benchmark::State& state)
+{
+  auto source = makeProtocol(state.range(0));
+  source.toDoc();
+  const QDomDocument doc = source.getProtocolDoc();
+  clamp_protocol::Protocol protocol;
+  for (auto _ : state) {
+    protocol.fromDoc(doc);
+  }
+  state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_FromDoc)->Apply(protocolSizes);
+#endif
+
+// One RT period of a model cell population, 1 to 4096 cells; passive cells
+// with range(1) == 0, HH cells otherwise
+void BM_CellPopulation(benchmark::State& state)
+{
+  const auto cells = static_cast<size_t>(state.range(0));
+  clamp_protocol::CellPopulation population(
+      cells,
+      state.range(1) == 0 ? clamp_protocol::cell_params {}
+                          : clamp_protocol::hodgkinHuxleyCell());
+  std::vector<double> command(cells, -20.0);
+  std::vector<double> current(cells);
+  const double dt_ms = static_cast<double>(period_ns) * 1e-6;
+  for (auto _ : state) {
+    population.step(command.data(), dt_ms, current.data());
+    benchmark::DoNotOptimize(current.data());
+  }
+  state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_CellPopulation)
+    ->ArgsProduct({benchmark::CreateRange(1, 4096, 8), {0, 1}});
+
+// Offline measurement and exponential fit of one sweep of 1k to 1M samples,
+// the unit of work of clamp_protocol_analyze
+void BM_MeasureSweep(benchmark::State& state)
+{
+  const auto samples = static_cast<size_t>(state.range(0));
+  clamp_protocol::acquired_sweep sweep;
+  sweep.period_ns = period_ns;
+  sweep.steps.resize(3);
+  sweep.steps[1].level1 = -20.0;
+  sweep.step_starts = {0,
+                       static_cast<int64_t>(samples / 4),
+                       static_cast<int64_t>(samples * 3 / 4),
+                       static_cast<int64_t>(samples)};
+  for (size_t i = 0; i < samples; ++i) {
+    const bool test = i >= samples / 4 && i < samples * 3 / 4;
+    sweep.samples.push_back(
+        test ? -2.0 * std::exp(-static_cast<double>(i - samples / 4) / 50.0)
+             : 0.0);
+  }
+  const clamp_protocol::analysis_params params;
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(clamp_protocol::measureSweep(sweep, params));
+  }
+  state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_MeasureSweep)->RangeMultiplier(10)->Range(1000, 1000000);
+
+// Data tokens through the FIFO, in the batch sizes the plot timer drains
+void BM_RecordEncode(benchmark::State& state)
+{
+  const auto batch = static_cast<size_t>(state.range(0));
+  ByteRing fifo(batch * sizeof(clamp_protocol::data_token_t));
+  std::vector<clamp_protocol::data_token_t> drain(batch);
+  clamp_protocol::data_token_t token {};
+  for (auto _ : state) {
+    for (size_t i = 0; i < batch; ++i) {
+      token.time += period_ns;
+      token.value = static_cast<double>(i);
+      fifo.write(&token, sizeof(token));
+    }
+    state.PauseTiming();
+    fifo.read(drain.data(), batch * sizeof(clamp_protocol::data_token_t));
+    state.ResumeTiming();
+  }
+  state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_RecordEncode)->Arg(1)->Arg(100)->Arg(10000);
+
+void BM_RecordDecode(benchmark::State& state)
+{
+  const auto batch = static_cast<size_t>(state.range(0));
+  ByteRing fifo(batch * sizeof(clamp_protocol::data_token_t));
+  std::vector<clamp_protocol::data_token_t> drain(batch);
+  const clamp_protocol::data_token_t token {};
+  for (auto _ : state) {
+    state.PauseTiming();
+    for (size_t i = 0; i < batch; ++i) {
+      fifo.write(&token, sizeof(token));
+    }
+    state.ResumeTiming();
+    benchmark::DoNotOptimize(fifo.read(
+        drain.data(), batch * sizeof(clamp_protocol::data_token_t)));
+    benchmark::ClobberMemory();
+  }
+  state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_RecordDecode)->Arg(1)->Arg(100)->Arg(10000);
+
+}  // namespace
+
+BENCHMARK_MAIN();
@@ -0,0 +1,66 @@
+/*
+ * Copyright (C) 2011 Weill Medical College of Cornell University
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License as
+ *  published by the Free Software Foundation; either version 2 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#include <cstdio>
+#include <string>
+
+#include <unistd.h>
+
+#include "fuzz_common.hpp"
+#include "protocol_archive.hpp"
+
+// Protocol archives (*.cpa). ProtocolArchive maps files, so each input is
+// written to a scratch file first.
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size)
+{
+  static const std::string path =
+      "/tmp/clamp_protocol_fuzz_" + std::to_string(getpid()) + ".cpa";
+  FILE* file = std::fopen(path.c_str(), "wb");
+  if (file == nullptr) {
+    return 0;
+  }
+  const bool written = std::fwrite(data, 1, size, file) == size;
+  if (std::fclose(file) != 0 || !written) {
+    return 0;
+  }
+
+  clamp_protocol::ProtocolArchive archive;
+  if (archive.open(path)) {
+    for (size_t i = 0; i < archive.size(); ++i) {
+      const clamp_protocol::compiled_view view = archive.protocol(i);
+      if (archive.find(archive.name(i)).steps == nullptr) {
+        std::abort();
+      }
+      clamp_protocol::hashProtocol(view, 0, 0.0, 1.0);
+      clamp_protocol::SampleIndex index;
+      index.build(view, clamp_protocol::fuzzing::period_ns);
+      clamp_protocol::ProtocolEngine engine;
+      engine.load(view, clamp_protocol::fuzzing::period_ns);
+      double samples[256];
+      for (int64_t played = 0;
+           played < clamp_protocol::fuzzing::max_samples
+           && engine.render(samples, 256) == 256;
+           played += 256)
+      {
+      }
+    }
+  }
+  archive.close();
+  std::remove(path.c_str());
+  return 0;
+}
@@ -0,0 +1,105 @@
+/*
+ * Copyright (C) 2011 Weill Medical College of Cornell University
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License as
+ *  published by the Free Software Foundation; either version 2 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+
+#include "protocol_engine.hpp"
+#include "protocol_hash.hpp"
+#include "protocol_model.hpp"
+
+// Shared checks for the fuzz targets. Anything wrong calls abort(), which
+// libFuzzer and the corpus replay both report as a crash.
+namespace clamp_protocol::fuzzing
+{
+
+// Caps that keep one input fast: expanded steps and samples played
+constexpr size_t max_compiled_steps = 1 << 16;
+constexpr int64_t max_samples = 1 << 16;
+constexpr int64_t period_ns = 50000;
+
+inline size_t expandedSteps(const Protocol& protocol)
+{
+  size_t total = 0;
+  for (size_t seg = 0; seg < protocol.numSegments(); ++seg) {
+    const size_t steps = protocol.segmentSize(seg);
+    const size_t sweeps = protocol.numSweeps(seg);
+    if (steps != 0 && sweeps > (max_compiled_steps - total) / steps) {
+      return max_compiled_steps + 1;
+    }
+    total += steps * sweeps;
+  }
+  return total;
+}
+
+inline bool sameSample(double a, double b)
+{
+  return a == b || (a != a && b != b);
+}
+
+// Everything downstream of a compiled protocol: hashing, the sample index,
+// playback and, for protocols short enough, agreement with dryrun()
+inline void exercise(const Protocol& protocol)
+{
+  if (expandedSteps(protocol) > max_compiled_steps) {
+    return;
+  }
+  const CompiledProtocol compiled = protocol.compile();
+  hashProtocol(compiled.view(), period_ns, 0.0, 1.0);
+  compiled.duration();
+
+  SampleIndex index;
+  index.build(compiled.view(), period_ns);
+  const int64_t total = index.totalSamples();
+  if (index.locate(total / 2) > compiled.steps.size()) {
+    std::abort();
+  }
+
+  ProtocolEngine engine;
+  engine.load(compiled.view(), period_ns);
+  double samples[256];
+  int64_t played = 0;
+  while (played < max_samples) {
+    const size_t count = engine.render(samples, 256);
+    played += static_cast<int64_t>(count);
+    if (count < 256) {
+      break;
+    }
+  }
+  if (total > max_samples) {
+    return;
+  }
+  if (played != total) {
+    std::abort();
+  }
+  const auto dryrun = protocol.dryrun(period_ns);
+  engine.rewind();
+  if (dryrun[1].size() != static_cast<size_t>(total)) {
+    std::abort();
+  }
+  for (const double expected : dryrun[1]) {
+    if (!sameSample(engine.next(), expected)) {
+      std::abort();
+    }
+  }
+}
+
+}  // namespace clamp_protocol::fuzzing
@@ -0,0 +1,85 @@
+/*
+ * Copyright (C) 2011 Weill Medical College of Cornell University
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License as
+ *  published by the Free Software Foundation; either version 2 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#include <algorithm>
+#include <cstring>
+
+#include "fuzz_common.hpp"
+
+// Protocols built straight from bytes through the builder interface, with
+// any bit pattern for the step parameters, so the compiler and engine see
+// values no file would contain
+namespace
+{
+
+class ByteReader
+{
+public:
+  ByteReader(const uint8_t* data, size_t size)
+      : data(data)
+      , size(size)
+  {
+  }
+
+  bool empty() const { return pos >= size; }
+  uint8_t byte() { return pos < size ? data[pos++] : 0; }
+  double number()
+  {
+    uint64_t bits = 0;
+    const size_t count = std::min(sizeof(bits), size - std::min(pos, size));
+    std::memcpy(&bits, data + pos, count);
+    pos += count;
+    double value = 0.0;
+    std::memcpy(&value, &bits, sizeof(value));
+    return value;
+  }
+
+private:
+  const uint8_t* data;
+  size_t size;
+  size_t pos = 0;
+};
+
+}  // namespace
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size)
+{
+  ByteReader input(data, size);
+  clamp_protocol::Protocol protocol;
+  const int segments = input.byte() % 8;
+  for (int seg = 0; seg < segments && !input.empty(); ++seg) {
+    auto& segment = protocol.appendSegment(input.byte() % 32);
+    const int steps = input.byte() % 16;
+    for (int i = 0; i < steps && !input.empty(); ++i) {
+      clamp_protocol::ProtocolStep step;
+      const uint8_t kind = input.byte();
+      step.ampMode = (kind & 1U) != 0 ? clamp_protocol::CURRENT
+                                      : clamp_protocol::VOLTAGE;
+      step.stepType =
+          (kind & 2U) != 0 ? clamp_protocol::RAMP : clamp_protocol::STEP;
+      for (double& parameter : step.parameters) {
+        // Mostly small values, which play, and sometimes raw bit patterns
+        parameter = (kind & 4U) != 0 ? input.number()
+                                     : static_cast<int8_t>(input.byte());
+      }
+      segment.step(step);
+    }
+  }
+  clamp_protocol::fuzzing::exercise(protocol);
+  return 0;
+}
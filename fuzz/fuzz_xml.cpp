@@ -0,0 +1,39 @@
+/*
+ * Copyright (C) 2011 Weill Medical College of Cornell University
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License as
+ *  published by the Free Software Foundation; either version 2 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#include <QByteArray>
+#include <QDomDocument>
+
+#include "fuzz_common.hpp"
+
+// .csp text through QDomDocument and Protocol::fromDoc(), the path the
+// plugin loads files with
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size)
+{
+  QDomDocument doc;
+  if (!doc.setContent(QByteArray::fromRawData(reinterpret_cast<const char*>(data),
+                                              static_cast<int>(size))))
+  {
+    return 0;
+  }
+  clamp_protocol::Protocol protocol;
+  if (protocol.fromDoc(doc)) {
+    clamp_protocol::fuzzing::exercise(protocol);
+  }
+  return 0;
+}
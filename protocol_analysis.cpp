@@ -0,0 +1,470 @@
+/*
+ * Copyright (C) 2011 Weill Medical College of Cornell University
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License as
+ *  published by the Free Software Foundation; either version 2 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <map>
+#include <tuple>
+
+#include "protocol_analysis.hpp"
+#include "protocol_engine.hpp"
+#include "protocol_replay.hpp"
+#include "protocol_session.hpp"
+
+namespace
+{
+
+constexpr double not_measured = std::numeric_limits<double>::quiet_NaN();
+
+// Index one past the last step of the sweep that starts at `first`
+size_t sweepEnd(clamp_protocol::compiled_view protocol, size_t first)
+{
+  size_t last = first;
+  while (last < protocol.size
+         && protocol.steps[last].segment == protocol.steps[first].segment
+         && protocol.steps[last].sweep == protocol.steps[first].sweep)
+  {
+    ++last;
+  }
+  return last;
+}
+
+// Sweep header and step layout for the steps [first, last)
+clamp_protocol::acquired_sweep sweepLayout(
+    clamp_protocol::compiled_view protocol,
+    size_t first,
+    size_t last,
+    uint64_t hash,
+    int64_t period_ns)
+{
+  clamp_protocol::acquired_sweep sweep;
+  sweep.hash = hash;
+  sweep.period_ns = period_ns;
+  sweep.segment = protocol.steps[first].segment;
+  sweep.sweep = protocol.steps[first].sweep;
+  sweep.steps.assign(protocol.steps + first, protocol.steps + last);
+  int64_t start = 0;
+  for (const auto& step : sweep.steps) {
+    sweep.step_starts.push_back(start);
+    start += clamp_protocol::stepSamples(step, period_ns);
+  }
+  sweep.step_starts.push_back(start);
+  return sweep;
+}
+
+double mean(const double* samples, size_t count)
+{
+  double sum = 0.0;
+  for (size_t i = 0; i < count; ++i) {
+    sum += samples[i];
+  }
+  return sum / static_cast<double>(count);
+}
+
+// Least squares amplitude and offset for one tau, returning the squared
+// residual. `sum_y` and `sum_yy` do not depend on tau and are passed in; the
+// exponential terms stop once they no longer matter, before they turn
+// denormal.
+double exponentialResidual(const double* samples,
+                           size_t count,
+                           double sum_y,
+                           double sum_yy,
+                           double decay,
+                           double& amplitude,
+                           double& offset)
+{
+  double e = 1.0;
+  double sum_e = 0.0;
+  double sum_ee = 0.0;
+  double sum_ey = 0.0;
+  for (size_t i = 0; i < count && e > 1e-150; ++i) {
+    sum_e += e;
+    sum_ee += e * e;
+    sum_ey += e * samples[i];
+    e *= decay;
+  }
+  const double n = static_cast<double>(count);
+  const double determinant = sum_ee * n - sum_e * sum_e;
+  if (!(determinant > 0.0)) {
+    amplitude = 0.0;
+    offset = sum_y / n;
+    return sum_yy - sum_y * offset;
+  }
+  amplitude = (n * sum_ey - sum_e * sum_y) / determinant;
+  offset = (sum_ee * sum_y - sum_e * sum_ey) / determinant;
+  return sum_yy - amplitude * sum_ey - offset * sum_y;
+}
+
+}  // namespace
+
+clamp_protocol::acquired_sweep clamp_protocol::layoutSweep(
+    compiled_view protocol,
+    uint32_t segment,
+    uint32_t sweep,
+    uint64_t hash,
+    int64_t period_ns)
+{
+  size_t first = 0;
+  while (first < protocol.size
+         && (protocol.steps[first].segment != segment
+             || protocol.steps[first].sweep != sweep))
+  {
+    ++first;
+  }
+  if (first == protocol.size) {
+    acquired_sweep missing;
+    missing.hash = hash;
+    missing.period_ns = period_ns;
+    missing.segment = segment;
+    missing.sweep = sweep;
+    missing.step_starts.push_back(0);
+    return missing;
+  }
+  return sweepLayout(
+      protocol, first, sweepEnd(protocol, first), hash, period_ns);
+}
+
+std::vector<clamp_protocol::acquired_sweep> clamp_protocol::splitSweeps(
+    compiled_view protocol,
+    uint64_t hash,
+    int64_t period_ns,
+    const double* samples,
+    size_t count)
+{
+  std::vector<acquired_sweep> layouts;
+  for (size_t first = 0; first < protocol.size;) {
+    const size_t last = sweepEnd(protocol, first);
+    layouts.push_back(sweepLayout(protocol, first, last, hash, period_ns));
+    first = last;
+  }
+
+  std::vector<acquired_sweep> sweeps;
+  const auto available = static_cast<int64_t>(count);
+  int64_t offset = 0;
+  for (int trial = 0;; ++trial) {
+    const int64_t trial_start = offset;
+    for (const auto& layout : layouts) {
+      const int64_t length = layout.step_starts.back();
+      if (length > available - offset) {
+        return sweeps;
+      }
+      acquired_sweep& sweep = sweeps.emplace_back(layout);
+      sweep.trial = trial;
+      sweep.samples.assign(samples + offset, samples + offset + length);
+      offset += length;
+    }
+    if (offset == trial_start) {  // Nothing plays
+      return sweeps;
+    }
+  }
+}
+
+std::vector<clamp_protocol::acquired_sweep> clamp_protocol::sessionSweeps(
+    SessionLog& log, size_t* incomplete)
+{
+  std::vector<acquired_sweep> sweeps;
+  size_t dropped = 0;
+  SessionPlayer player(log);
+  replay_tick_t tick;
+  acquired_sweep current;
+  bool open = false;
+  uint64_t gaps = 0;
+
+  const auto close = [&]()
+  {
+    if (open) {
+      ++dropped;
+      open = false;
+    }
+  };
+
+  while (player.next(tick)) {
+    if (player.gaps() != gaps) {
+      gaps = player.gaps();
+      close();
+    }
+    if (!tick.sample) {
+      close();
+      continue;
+    }
+    const data_token_t& token = tick.token;
+    const bool same_sweep = open && current.hash == token.protocolHash
+        && current.trial == token.trial
+        && current.segment == static_cast<uint32_t>(token.segment)
+        && current.sweep == static_cast<uint32_t>(token.sweep);
+    const size_t position = current.samples.size();
+    if (same_sweep) {
+      // The step playing must be the one the sample count says
+      const auto step = static_cast<size_t>(token.step);
+      const auto sample = static_cast<int64_t>(position);
+      if (step >= current.steps.size() || sample < current.step_starts[step]
+          || sample >= current.step_starts[step + 1]
+          || (sample == current.step_starts[step]) != (token.time
+                                                       == token.stepStart))
+      {
+        close();
+      }
+    } else {
+      close();
+    }
+
+    if (!open) {
+      // Only start at the first sample of a sweep
+      current = layoutSweep(player.runner().steps(),
+                            static_cast<uint32_t>(token.segment),
+                            static_cast<uint32_t>(token.sweep),
+                            token.protocolHash,
+                            player.runner().period());
+      current.trial = token.trial;
+      current.start_ns = token.sweepStart;
+      current.start_sample = token.sweepSample;
+      const auto step = static_cast<size_t>(token.step);
+      if (step >= current.steps.size() || current.step_starts[step] != 0
+          || token.time != token.stepStart)
+      {
+        continue;
+      }
+      current.samples.reserve(
+          static_cast<size_t>(current.step_starts.back()));
+      open = true;
+    }
+
+    current.samples.push_back(tick.input);
+    if (static_cast<int64_t>(current.samples.size())
+        == current.step_starts.back())
+    {
+      sweeps.push_back(std::move(current));
+      open = false;
+    }
+  }
+  close();
+  if (incomplete != nullptr) {
+    *incomplete = dropped;
+  }
+  return sweeps;
+}
+
+std::vector<clamp_protocol::acquired_sweep> clamp_protocol::averageTrials(
+    const std::vector<acquired_sweep>& sweeps)
+{
+  std::vector<acquired_sweep> averaged;
+  std::map<std::tuple<uint64_t, uint32_t, uint32_t, size_t>, size_t> index;
+  for (const auto& sweep : sweeps) {
+    const auto key = std::make_tuple(
+        sweep.hash, sweep.segment, sweep.sweep, sweep.samples.size());
+    const auto found = index.find(key);
+    if (found == index.end()) {
+      index.emplace(key, averaged.size());
+      averaged.push_back(sweep);
+      averaged.back().trial = -1;
+      continue;
+    }
+    acquired_sweep& sum = averaged[found->second];
+    for (size_t i = 0; i < sum.samples.size(); ++i) {
+      sum.samples[i] += sweep.samples[i];
+    }
+    sum.trials += sweep.trials;
+  }
+  for (auto& sweep : averaged) {
+    const double scale = 1.0 / static_cast<double>(sweep.trials);
+    for (auto& value : sweep.samples) {
+      value *= scale;
+    }
+  }
+  return averaged;
+}
+
+clamp_protocol::exp_fit_t clamp_protocol::fitExponential(const double* samples,
+                                                         size_t count,
+                                                         double dt_ms)
+{
+  exp_fit_t fit;
+  if (count < 3 || !(dt_ms > 0.0)) {
+    return fit;
+  }
+  // Golden section search over log(tau)
+  const double golden = (std::sqrt(5.0) - 1.0) / 2.0;
+  double low = std::log(dt_ms);
+  double high = std::log(dt_ms * static_cast<double>(count) * 10.0);
+  double sum_y = 0.0;
+  double sum_yy = 0.0;
+  for (size_t i = 0; i < count; ++i) {
+    sum_y += samples[i];
+    sum_yy += samples[i] * samples[i];
+  }
+  const auto residual = [&](double log_tau)
+  {
+    double amplitude = 0.0;
+    double offset = 0.0;
+    return exponentialResidual(samples,
+                               count,
+                               sum_y,
+                               sum_yy,
+                               std::exp(-dt_ms / std::exp(log_tau)),
+                               amplitude,
+                               offset);
+  };
+  double a = high - golden * (high - low);
+  double b = low + golden * (high - low);
+  double residual_a = residual(a);
+  double residual_b = residual(b);
+  for (int i = 0; i < 80 && high - low > 1e-9; ++i) {
+    if (residual_a < residual_b) {
+      high = b;
+      b = a;
+      residual_b = residual_a;
+      a = high - golden * (high - low);
+      residual_a = residual(a);
+    } else {
+      low = a;
+      a = b;
+      residual_a = residual_b;
+      b = low + golden * (high - low);
+      residual_b = residual(b);
+    }
+  }
+
+  fit.tau = std::exp((low + high) / 2.0);
+  const double decay = std::exp(-dt_ms / fit.tau);
+  exponentialResidual(
+      samples, count, sum_y, sum_yy, decay, fit.amplitude, fit.offset);
+  double squares = 0.0;
+  double e = 1.0;
+  for (size_t i = 0; i < count; ++i) {
+    const double error = samples[i] - (fit.amplitude * e + fit.offset);
+    squares += error * error;
+    e = e > 1e-150 ? e * decay : 0.0;
+  }
+  fit.rms = std::sqrt(squares / static_cast<double>(count));
+  fit.ok = std::isfinite(fit.amplitude) && std::isfinite(fit.offset)
+      && std::isfinite(fit.rms);
+  return fit;
+}
+
+clamp_protocol::sweep_summary clamp_protocol::measureSweep(
+    const acquired_sweep& sweep, const analysis_params& params)
+{
+  sweep_summary summary;
+  summary.hash = sweep.hash;
+  summary.trial = sweep.trial;
+  summary.trials = sweep.trials;
+  summary.segment = sweep.segment;
+  summary.sweep = sweep.sweep;
+  summary.start_ns = sweep.start_ns;
+  summary.start_sample = sweep.start_sample;
+  summary.command = not_measured;
+  summary.holding = not_measured;
+  summary.baseline = not_measured;
+  summary.peak = not_measured;
+  summary.peak_time = not_measured;
+  summary.steady = not_measured;
+  summary.fit.amplitude = not_measured;
+  summary.fit.tau = not_measured;
+  summary.fit.offset = not_measured;
+  summary.fit.rms = not_measured;
+  summary.leak = not_measured;
+  summary.peak_corrected = not_measured;
+  summary.steady_corrected = not_measured;
+
+  const size_t step_count = sweep.steps.size();
+  if (params.measure_step < step_count) {
+    summary.command = sweep.steps[params.measure_step].level1;
+  }
+  if (params.baseline_step < step_count) {
+    summary.holding = sweep.steps[params.baseline_step].level1;
+  }
+  if (params.measure_step >= step_count || params.baseline_step >= step_count)
+  {
+    return summary;
+  }
+  const auto begin = [&](size_t step)
+  { return static_cast<size_t>(sweep.step_starts[step]); };
+  const size_t baseline_first = begin(params.baseline_step);
+  const size_t baseline_last = begin(params.baseline_step + 1);
+  const double dt_ms = static_cast<double>(sweep.period_ns) * 1e-6;
+  const size_t step_first = begin(params.measure_step);
+  const size_t last = begin(params.measure_step + 1);
+  const size_t first = step_first
+      + static_cast<size_t>(std::max(0.0, std::round(params.skip_ms / dt_ms)));
+  if (baseline_first == baseline_last || first >= last
+      || last > sweep.samples.size())
+  {
+    return summary;
+  }
+  const double* samples = sweep.samples.data();
+  summary.baseline =
+      mean(samples + baseline_first, baseline_last - baseline_first);
+
+  size_t peak = first;
+  for (size_t i = first; i < last; ++i) {
+    if (std::abs(samples[i] - summary.baseline)
+        > std::abs(samples[peak] - summary.baseline))
+    {
+      peak = i;
+    }
+  }
+  summary.peak = samples[peak] - summary.baseline;
+  summary.peak_time = static_cast<double>(peak - step_first) * dt_ms;
+  const auto steady_count = std::clamp<size_t>(
+      static_cast<size_t>(std::max(0.0, std::round(params.steady_ms / dt_ms))),
+      1,
+      last - first);
+  summary.steady =
+      mean(samples + last - steady_count, steady_count) - summary.baseline;
+
+  if (params.fit) {
+    const exp_fit_t fit = fitExponential(samples + peak, last - peak, dt_ms);
+    if (fit.ok) {
+      summary.fit = fit;
+      summary.fit.offset -= summary.baseline;
+    }
+  }
+  return summary;
+}
+
+void clamp_protocol::subtractLeak(std::vector<sweep_summary>& summaries,
+                                  const analysis_params& params)
+{
+  // Slope through the origin of steady against command - holding, per
+  // protocol
+  std::map<uint64_t, std::pair<double, double>> sums;  // sum xy, sum xx
+  for (const auto& summary : summaries) {
+    const double x = summary.command - summary.holding;
+    if (summary.command <= params.leak_below && x != 0.0
+        && std::isfinite(summary.steady))
+    {
+      auto& sum = sums[summary.hash];
+      sum.first += x * summary.steady;
+      sum.second += x * x;
+    }
+  }
+  for (auto& summary : summaries) {
+    const auto found = sums.find(summary.hash);
+    if (found == sums.end()) {
+      summary.leak = not_measured;
+      summary.peak_corrected = not_measured;
+      summary.steady_corrected = not_measured;
+      continue;
+    }
+    const double slope = found->second.first / found->second.second;
+    summary.leak = slope * (summary.command - summary.holding);
+    summary.peak_corrected = summary.peak - summary.leak;
+    summary.steady_corrected = summary.steady - summary.leak;
+  }
+}
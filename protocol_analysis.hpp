@@ -0,0 +1,142 @@
+/*
+ * Copyright (C) 2011 Weill Medical College of Cornell University
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License as
+ *  published by the Free Software Foundation; either version 2 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "protocol_model.hpp"
+
+// Offline analysis of acquired sweeps: cutting recordings into sweeps by the
+// protocol timing, averaging trials, measuring, fitting and leak
+// subtraction. Input samples keep the units they were recorded in.
+namespace clamp_protocol
+{
+
+class SessionLog;
+
+// One sweep of input samples with the steps that were played over it
+struct acquired_sweep
+{
+  uint64_t hash = 0;  // Protocol hash from the data tokens
+  int64_t period_ns = 0;
+  int trial = 0;  // -1 once trials are averaged
+  int trials = 1;  // Trials that went into the samples
+  uint32_t segment = 0;
+  uint32_t sweep = 0;
+  // RT time and sample counter of the first sample, see data_token_t; zero
+  // when cut from a raw stream. Averages keep those of the first trial.
+  int64_t start_ns = 0;
+  int64_t start_sample = 0;
+  std::vector<compiled_step_t> steps;
+  std::vector<int64_t> step_starts;  // First sample of each step, then the end
+  std::vector<double> samples;
+};
+
+// Header and step layout, without samples, of sweep `sweep` of segment
+// `segment`. The steps are empty if the protocol has no such sweep.
+acquired_sweep layoutSweep(compiled_view protocol,
+                           uint32_t segment,
+                           uint32_t sweep,
+                           uint64_t hash,
+                           int64_t period_ns);
+
+// Cuts a raw sample stream, one input sample per RT period from the first
+// sample of the first trial with trials back to back, into sweeps. A sweep
+// cut short by the end of the stream is left out.
+std::vector<acquired_sweep> splitSweeps(compiled_view protocol,
+                                        uint64_t hash,
+                                        int64_t period_ns,
+                                        const double* samples,
+                                        size_t count);
+
+// Replays a session log and cuts the samples the protocol played into
+// sweeps, following the data tokens. Sweeps interrupted by a rewind, a
+// protocol change, a gap in the log or the end of the recording are left
+// out and counted in `incomplete`.
+std::vector<acquired_sweep> sessionSweeps(SessionLog& log,
+                                          size_t* incomplete = nullptr);
+
+// Averages every sweep with the trials of the same protocol, segment and
+// sweep, sample for sample. Sweeps keep the order of their first trial.
+std::vector<acquired_sweep> averageTrials(
+    const std::vector<acquired_sweep>& sweeps);
+
+struct analysis_params
+{
+  size_t baseline_step = 0;  // Step of the sweep averaged for the baseline
+  size_t measure_step = 1;  // Step the measurements are taken on
+  double skip_ms = 0.0;  // Left out at the start of the measured step
+  double steady_ms = 5.0;  // End of the measured step averaged for steady
+  bool fit = true;  // Exponential from the peak to the end of the step
+  // Sweeps whose measured step is at or below this command (mV) are taken
+  // as passive and fit with a line for the leak; NaN turns it off
+  double leak_below = -60.0;
+};
+
+// y(t) = amplitude * exp(-t / tau) + offset, t in ms from the first point
+struct exp_fit_t
+{
+  bool ok = false;
+  double amplitude = 0.0;
+  double tau = 0.0;  // ms
+  double offset = 0.0;
+  double rms = 0.0;  // Root mean square residual
+};
+
+// Least squares fit of a single exponential to `count` samples `dt_ms`
+// apart. Amplitude and offset are solved exactly for each trial tau, and tau
+// is found by golden section search between dt_ms and the trace length
+// times ten.
+exp_fit_t fitExponential(const double* samples, size_t count, double dt_ms);
+
+// Measurements of one sweep. Values are baseline subtracted and NaN where
+// they could not be taken.
+struct sweep_summary
+{
+  uint64_t hash = 0;
+  int trial = 0;
+  int trials = 1;
+  uint32_t segment = 0;
+  uint32_t sweep = 0;
+  int64_t start_ns = 0;  // First sample of the sweep, see acquired_sweep
+  int64_t start_sample = 0;
+  double command = 0.0;  // Level of the measured step (mV)
+  double holding = 0.0;  // Level of the baseline step (mV)
+  double baseline = 0.0;  // Raw mean of the baseline step
+  double peak = 0.0;  // Largest excursion from the baseline
+  double peak_time = 0.0;  // ms from the start of the measured step
+  double steady = 0.0;
+  exp_fit_t fit;
+  double leak = 0.0;  // Leak current at the command
+  double peak_corrected = 0.0;  // Less the leak
+  double steady_corrected = 0.0;
+};
+
+sweep_summary measureSweep(const acquired_sweep& sweep,
+                           const analysis_params& params);
+
+// Fits leak = slope * (command - holding) through the steady currents of
+// the passive sweeps of each protocol and fills the leak and corrected
+// fields. Protocols without a passive sweep away from holding get NaN.
+void subtractLeak(std::vector<sweep_summary>& summaries,
+                  const analysis_params& params);
+
+}  // namespace clamp_protocol
@@ -0,0 +1,262 @@
+/*
+ * Copyright (C) 2011 Weill Medical College of Cornell University
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License as
+ *  published by the Free Software Foundation; either version 2 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+#include "protocol_archive.hpp"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "protocol_hash.hpp"
+
+namespace
+{
+
+constexpr char archive_magic[8] = {'C', 'P', 'A', 'R', 'C', 'H', 'V', '\0'};
+constexpr uint32_t archive_version = 1;
+constexpr uint32_t byte_order_mark = 0x01020304;
+
+struct archive_header_t
+{
+  char magic[8];
+  uint32_t version;
+  uint32_t byte_order;
+  uint64_t entries;
+};
+
+struct archive_entry_t
+{
+  char name[clamp_protocol::ProtocolArchive::max_name_length + 1];
+  uint64_t hash;
+  uint64_t offset;  // Bytes from the start of the file
+  uint64_t steps;
+};
+
+static_assert(sizeof(archive_header_t) == 24);
+static_assert(
+    sizeof(archive_entry_t) % alignof(clamp_protocol::compiled_step_t) == 0);
+
+const archive_entry_t* entries_of(const unsigned char* data)
+{
+  return reinterpret_cast<const archive_entry_t*>(data
+                                                  + sizeof(archive_header_t));
+}
+
+}  // namespace
+
+clamp_protocol::ProtocolArchive::~ProtocolArchive()
+{
+  close();
+}
+
+bool clamp_protocol::ProtocolArchive::open(const std::string& path)
+{
+  close();
+  const int fd = ::open(path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    return false;
+  }
+  struct stat info {};
+  if (fstat(fd, &info) != 0
+      || static_cast<size_t>(info.st_size) < sizeof(archive_header_t))
+  {
+    ::close(fd);
+    return false;
+  }
+  const auto file_size = static_cast<size_t>(info.st_size);
+  void* mapping = mmap(nullptr, file_size, PROT_READ, MAP_SHARED, fd, 0);
+  ::close(fd);
+  if (mapping == MAP_FAILED) {
+    return false;
+  }
+  data = static_cast<const unsigned char*>(mapping);
+  length = file_size;
+
+  // Validate the header and every index entry before handing out views
+  archive_header_t header {};
+  std::memcpy(&header, data, sizeof(header));
+  if (std::memcmp(header.magic, archive_magic, sizeof(archive_magic)) != 0
+      || header.version != archive_version
+      || header.byte_order != byte_order_mark
+      || header.entries
+          > (length - sizeof(archive_header_t)) / sizeof(archive_entry_t))
+  {
+    close();
+    return false;
+  }
+  entry_count = header.entries;
+  const size_t blobs_begin =
+      sizeof(archive_header_t) + entry_count * sizeof(archive_entry_t);
+  const archive_entry_t* entries = entries_of(data);
+  index.reserve(entry_count);
+  for (size_t i = 0; i < entry_count; ++i) {
+    const archive_entry_t& entry = entries[i];
+    const size_t name_length = strnlen(entry.name, sizeof(entry.name));
+    if (name_length == sizeof(entry.name) || entry.offset < blobs_begin
+        || entry.offset > length
+        || entry.offset % alignof(compiled_step_t) != 0
+        || entry.steps > (length - entry.offset) / sizeof(compiled_step_t))
+    {
+      close();
+      return false;
+    }
+    index.emplace(std::string_view(entry.name, name_length), i);
+  }
+
+  // Then the steps themselves, which the engine plays from the mapping as
+  // they are and which must still match the stored hash
+  for (size_t i = 0; i < entry_count; ++i) {
+    const compiled_view steps = protocol(i);
+    for (size_t j = 0; j < steps.size; ++j) {
+      if (!validStep(steps.steps[j])) {
+        close();
+        return false;
+      }
+    }
+    if (hashProtocol(steps, 0, 0.0, 1.0) != entries[i].hash) {
+      close();
+      return false;
+    }
+  }
+  return true;
+}
+
+void clamp_protocol::ProtocolArchive::close()
+{
+  if (data != nullptr) {
+    munmap(const_cast<unsigned char*>(data), length);
+  }
+  data = nullptr;
+  length = 0;
+  entry_count = 0;
+  index.clear();
+}
+
+std::string_view clamp_protocol::ProtocolArchive::name(size_t entry) const
+{
+  const archive_entry_t& item = entries_of(data)[entry];
+  return {item.name, strnlen(item.name, sizeof(item.name))};
+}
+
+uint64_t clamp_protocol::ProtocolArchive::hash(size_t entry) const
+{
+  return entries_of(data)[entry].hash;
+}
+
+clamp_protocol::compiled_view clamp_protocol::ProtocolArchive::protocol(
+    size_t entry) const
+{
+  const archive_entry_t& item = entries_of(data)[entry];
+  return {reinterpret_cast<const compiled_step_t*>(data + item.offset),
+          static_cast<size_t>(item.steps)};
+}
+
+clamp_protocol::compiled_view clamp_protocol::ProtocolArchive::find(
+    std::string_view protocol_name) const
+{
+  auto it = index.find(protocol_name);
+  if (it == index.end()) {
+    return {};
+  }
+  return protocol(it->second);
+}
+
+bool clamp_protocol::ProtocolArchive::store(const std::string& path,
+                                            std::string_view protocol_name,
+                                            const CompiledProtocol& compiled)
+{
+  if (protocol_name.empty() || protocol_name.size() > max_name_length) {
+    return false;
+  }
+
+  // Collect the protocols already in the archive, minus the one replaced
+  struct pending_t
+  {
+    std::string name;
+    uint64_t hash;
+    compiled_view steps;
+  };
+  std::vector<pending_t> pending;
+  ProtocolArchive existing;
+  if (!existing.open(path)) {
+    // Only a missing file may be replaced by a new archive
+    struct stat info {};
+    if (::stat(path.c_str(), &info) == 0 || errno != ENOENT) {
+      return false;
+    }
+  } else {
+    for (size_t i = 0; i < existing.size(); ++i) {
+      if (existing.name(i) != protocol_name) {
+        pending.push_back({std::string(existing.name(i)),
+                           existing.hash(i),
+                           existing.protocol(i)});
+      }
+    }
+  }
+  pending.push_back({std::string(protocol_name),
+                     hashProtocol(compiled.view(), 0, 0.0, 1.0),
+                     compiled.view()});
+
+  // Lay out the header, index and blobs
+  archive_header_t header {};
+  std::memcpy(header.magic, archive_magic, sizeof(archive_magic));
+  header.version = archive_version;
+  header.byte_order = byte_order_mark;
+  header.entries = pending.size();
+  std::vector<archive_entry_t> entries(pending.size());
+  uint64_t offset =
+      sizeof(archive_header_t) + pending.size() * sizeof(archive_entry_t);
+  for (size_t i = 0; i < pending.size(); ++i) {
+    std::memset(&entries[i], 0, sizeof(archive_entry_t));
+    std::memcpy(
+        entries[i].name, pending[i].name.data(), pending[i].name.size());
+    entries[i].hash = pending[i].hash;
+    entries[i].offset = offset;
+    entries[i].steps = pending[i].steps.size;
+    offset += pending[i].steps.size * sizeof(compiled_step_t);
+  }
+
+  const std::string temporary = path + ".tmp";
+  FILE* file = std::fopen(temporary.c_str(), "wb");
+  if (file == nullptr) {
+    return false;
+  }
+  bool ok = std::fwrite(&header, sizeof(header), 1, file) == 1
+      && std::fwrite(
+             entries.data(), sizeof(archive_entry_t), entries.size(), file)
+          == entries.size();
+  for (const auto& item : pending) {
+    ok = ok
+        && std::fwrite(
+               item.steps.steps, sizeof(compiled_step_t), item.steps.size, file)
+            == item.steps.size;
+  }
+  ok = std::fclose(file) == 0 && ok;
+  existing.close();
+  if (!ok || std::rename(temporary.c_str(), path.c_str()) != 0) {
+    std::remove(temporary.c_str());
+    return false;
+  }
+  return true;
+}
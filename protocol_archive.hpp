@@ -0,0 +1,77 @@
+/*
+ * Copyright (C) 2011 Weill Medical College of Cornell University
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License as
+ *  published by the Free Software Foundation; either version 2 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+#include "protocol_model.hpp"
+
+namespace clamp_protocol
+{
+
+// Single-file collection of compiled protocols (*.cpa). The file starts with
+// a header and a fixed-size index of name, stimulus hash and offset, followed
+// by the compiled steps of every protocol stored verbatim. Opening an archive
+// maps it read-only; lookups by name are O(1) and the returned views point
+// straight into the mapping, so nothing is parsed or copied.
+//
+// Archives use the byte order of the machine that wrote them and are
+// rejected on a machine with a different one.
+class ProtocolArchive
+{
+public:
+  static constexpr size_t max_name_length = 111;
+
+  ProtocolArchive() = default;
+  ProtocolArchive(const ProtocolArchive&) = delete;
+  ProtocolArchive& operator=(const ProtocolArchive&) = delete;
+  ~ProtocolArchive();
+
+  // False if missing or malformed, including steps that fail their hash
+  bool open(const std::string& path);
+  void close();
+  bool isOpen() const { return data != nullptr; }
+
+  size_t size() const { return entry_count; }  // Number of protocols
+  std::string_view name(size_t entry) const;
+  // Hash of the steps alone: hashProtocol() with zero period, LJP and a
+  // scaling of one
+  uint64_t hash(size_t entry) const;
+  compiled_view protocol(size_t entry) const;
+  // Empty view if the archive has no protocol with that name
+  compiled_view find(std::string_view protocol_name) const;
+
+  // Adds a protocol to the archive at `path`, creating the archive if needed
+  // and replacing any protocol with the same name. The archive is rewritten
+  // to a temporary file and renamed over the original. False without
+  // touching the file if `path` exists but is not a valid archive.
+  static bool store(const std::string& path,
+                    std::string_view protocol_name,
+                    const CompiledProtocol& compiled);
+
+private:
+  const unsigned char* data = nullptr;
+  size_t length = 0;
+  size_t entry_count = 0;
+  std::unordered_map<std::string_view, size_t> index;
+};
+
+}  // namespace clamp_protocol
@@ -0,0 +1,240 @@
+/*
+ * Copyright (C) 2011 Weill Medical College of Cornell University
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License as
+ *  published by the Free Software Foundation; either version 2 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+
+#include "protocol_batch.hpp"
+#include "protocol_csp.hpp"
+#include "protocol_hash.hpp"
+#include "protocol_session.hpp"
+
+namespace
+{
+
+struct file_result
+{
+  clamp_protocol::ColumnTable table;
+  size_t sweeps = 0;
+  size_t incomplete = 0;
+  std::string error;  // Empty when the file was read
+};
+
+// Columns in the order they are written, so every file's table matches
+void addRows(const std::string& path,
+             const std::vector<clamp_protocol::sweep_summary>& summaries,
+             clamp_protocol::ColumnTable& table)
+{
+  auto& file = table.strings("file");
+  auto& hash = table.ints("hash");
+  auto& trial = table.ints("trial");
+  auto& trials = table.ints("trials");
+  auto& segment = table.ints("segment");
+  auto& sweep = table.ints("sweep");
+  auto& start_ns = table.ints("start_ns");
+  auto& start_sample = table.ints("start_sample");
+  auto& command = table.doubles("command");
+  auto& holding = table.doubles("holding");
+  auto& baseline = table.doubles("baseline");
+  auto& peak = table.doubles("peak");
+  auto& peak_time = table.doubles("peak_time");
+  auto& steady = table.doubles("steady");
+  auto& tau = table.doubles("tau");
+  auto& fit_amplitude = table.doubles("fit_amplitude");
+  auto& fit_offset = table.doubles("fit_offset");
+  auto& fit_rms = table.doubles("fit_rms");
+  auto& leak = table.doubles("leak");
+  auto& peak_corrected = table.doubles("peak_corrected");
+  auto& steady_corrected = table.doubles("steady_corrected");
+  for (const auto& summary : summaries) {
+    file.push_back(path);
+    hash.push_back(static_cast<int64_t>(summary.hash));
+    trial.push_back(summary.trial);
+    trials.push_back(summary.trials);
+    segment.push_back(summary.segment);
+    sweep.push_back(summary.sweep);
+    start_ns.push_back(summary.start_ns);
+    start_sample.push_back(summary.start_sample);
+    command.push_back(summary.command);
+    holding.push_back(summary.holding);
+    baseline.push_back(summary.baseline);
+    peak.push_back(summary.peak);
+    peak_time.push_back(summary.peak_time);
+    steady.push_back(summary.steady);
+    tau.push_back(summary.fit.tau);
+    fit_amplitude.push_back(summary.fit.amplitude);
+    fit_offset.push_back(summary.fit.offset);
+    fit_rms.push_back(summary.fit.rms);
+    leak.push_back(summary.leak);
+    peak_corrected.push_back(summary.peak_corrected);
+    steady_corrected.push_back(summary.steady_corrected);
+  }
+}
+
+bool readSweeps(const std::string& path,
+                const clamp_protocol::batch_params& params,
+                std::vector<clamp_protocol::acquired_sweep>& sweeps,
+                file_result& result)
+{
+  const std::filesystem::path file(path);
+  if (file.extension() == ".cps") {
+    clamp_protocol::SessionLog log;
+    if (!log.load(path)) {
+      result.error = "not a session log";
+      return false;
+    }
+    sweeps = clamp_protocol::sessionSweeps(log, &result.incomplete);
+    return true;
+  }
+
+  if (params.raw_period_ns <= 0) {
+    result.error = "raw recordings need an RT period";
+    return false;
+  }
+  clamp_protocol::Protocol protocol;
+  const std::string csp = std::filesystem::path(file).replace_extension(".csp");
+  if (!clamp_protocol::loadCspFile(csp, protocol)) {
+    result.error = "cannot read " + csp;
+    return false;
+  }
+  // Straight into the samples; recordings can be larger than the rest of
+  // the batch put together
+  std::ifstream in(path, std::ios::binary | std::ios::ate);
+  if (!in) {
+    result.error = "cannot open the recording";
+    return false;
+  }
+  std::vector<double> samples(static_cast<size_t>(in.tellg()) / sizeof(double));
+  in.seekg(0);
+  if (!in.read(reinterpret_cast<char*>(samples.data()),
+               static_cast<std::streamsize>(samples.size() * sizeof(double))))
+  {
+    result.error = "cannot read the recording";
+    return false;
+  }
+  const auto compiled = protocol.compile();
+  sweeps = clamp_protocol::splitSweeps(
+      compiled.view(),
+      clamp_protocol::hashProtocol(
+          compiled.view(), params.raw_period_ns, 0.0, 1.0),
+      params.raw_period_ns,
+      samples.data(),
+      samples.size());
+  return true;
+}
+
+void analyzeFile(const std::string& path,
+                 const clamp_protocol::batch_params& params,
+                 clamp_protocol::WorkStealingPool& pool,
+                 file_result& result)
+{
+  std::vector<clamp_protocol::acquired_sweep> sweeps;
+  if (!readSweeps(path, params, sweeps, result)) {
+    return;
+  }
+  if (params.average) {
+    sweeps = clamp_protocol::averageTrials(sweeps);
+  }
+  std::vector<clamp_protocol::sweep_summary> summaries(sweeps.size());
+  clamp_protocol::TaskGroup group;
+  for (size_t i = 0; i < sweeps.size(); ++i) {
+    pool.submit(group,
+                [&, i]()
+                {
+                  summaries[i] =
+                      clamp_protocol::measureSweep(sweeps[i], params.analysis);
+                });
+  }
+  pool.wait(group);
+  clamp_protocol::subtractLeak(summaries, params.analysis);
+  result.sweeps = summaries.size();
+  addRows(path, summaries, result.table);
+}
+
+}  // namespace
+
+std::vector<std::string> clamp_protocol::findRecordings(
+    const std::string& directory, std::vector<std::string>* errors)
+{
+  namespace fs = std::filesystem;
+  const auto report = [errors](const fs::path& path, std::error_code error)
+  {
+    if (errors != nullptr) {
+      errors->push_back(path.string() + ": " + error.message());
+    }
+  };
+  std::vector<std::string> paths;
+  std::error_code error;
+  fs::recursive_directory_iterator entry(
+      directory, fs::directory_options::skip_permission_denied, error);
+  for (const fs::recursive_directory_iterator end; !error && entry != end;
+       entry.increment(error))
+  {
+    std::error_code status;
+    if (entry->is_directory(status) && !entry->is_symlink(status)) {
+      // The iterator skips unreadable directories without a word, so look
+      // first and say which were left out
+      const fs::directory_iterator probe(entry->path(), status);
+      if (status) {
+        report(entry->path(), status);
+        entry.disable_recursion_pending();
+      }
+      continue;
+    }
+    const auto extension = entry->path().extension();
+    if (entry->is_regular_file(status)
+        && (extension == ".cps" || extension == ".f64"))
+    {
+      paths.push_back(entry->path().string());
+    }
+  }
+  if (error) {  // Anything else ends the scan
+    report(directory, error);
+  }
+  std::sort(paths.begin(), paths.end());
+  return paths;
+}
+
+clamp_protocol::batch_report clamp_protocol::analyzeRecordings(
+    const std::vector<std::string>& paths,
+    const batch_params& params,
+    WorkStealingPool& pool)
+{
+  std::vector<file_result> results(paths.size());
+  TaskGroup group;
+  for (size_t i = 0; i < paths.size(); ++i) {
+    pool.submit(group,
+                [&, i]() { analyzeFile(paths[i], params, pool, results[i]); });
+  }
+  pool.wait(group);
+
+  batch_report report;
+  addRows({}, {}, report.table);  // Columns even when nothing was read
+  for (size_t i = 0; i < paths.size(); ++i) {
+    if (!results[i].error.empty()) {
+      report.errors.push_back(paths[i] + ": " + results[i].error);
+      continue;
+    }
+    ++report.files;
+    report.sweeps += results[i].sweeps;
+    report.incomplete += results[i].incomplete;
+    report.table.append(results[i].table);
+  }
+  return report;
+}
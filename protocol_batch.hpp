@@ -0,0 +1,68 @@
+/*
+ * Copyright (C) 2011 Weill Medical College of Cornell University
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License as
+ *  published by the Free Software Foundation; either version 2 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "protocol_analysis.hpp"
+#include "protocol_columns.hpp"
+#include "protocol_pool.hpp"
+
+namespace clamp_protocol
+{
+
+// Recordings the batch analysis reads:
+//  - session logs (*.cps), which carry their protocols
+//  - raw recordings (*.f64), the input samples as native doubles, one per
+//    RT period from the first sample of the first trial, played with the
+//    protocol in the .csp file of the same name
+struct batch_params
+{
+  analysis_params analysis;
+  bool average = true;  // Average the trials of each sweep before measuring
+  int64_t raw_period_ns = 0;  // RT period of the raw recordings
+};
+
+struct batch_report
+{
+  // One row per sweep, in file order: file, hash, trial, trials, segment,
+  // sweep, then the sweep_summary measurements
+  ColumnTable table;
+  size_t files = 0;  // Read successfully
+  size_t sweeps = 0;
+  size_t incomplete = 0;  // Sweeps left out, see sessionSweeps()
+  std::vector<std::string> errors;  // One line per file that was not read
+};
+
+// Session logs and raw recordings under `directory` and its subdirectories,
+// sorted by path. Directories that cannot be read are left out and named in
+// `errors`, one line each, in the form of batch_report::errors.
+std::vector<std::string> findRecordings(
+    const std::string& directory, std::vector<std::string>* errors = nullptr);
+
+// Analyses the recordings on `pool`: one task per file, which cuts the file
+// into sweeps and measures them with one task per sweep
+batch_report analyzeRecordings(const std::vector<std::string>& paths,
+                               const batch_params& params,
+                               WorkStealingPool& pool);
+
+}  // namespace clamp_protocol
@@ -0,0 +1,214 @@
+/*
+ * Copyright (C) 2011 Weill Medical College of Cornell University
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License as
+ *  published by the Free Software Foundation; either version 2 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#include <algorithm>
+#include <cmath>
+
+#include "protocol_cell.hpp"
+
+namespace
+{
+
+// x / (exp(x / y) - 1), continuous through x = 0
+double vtrap(double x, double y)
+{
+  const double ratio = x / y;
+  if (std::abs(ratio) < 1e-6) {
+    return y * (1.0 - ratio / 2.0);
+  }
+  return x / std::expm1(ratio);
+}
+
+struct rates_t
+{
+  double alpha;
+  double beta;
+};
+
+// Hodgkin-Huxley rates (1/ms), modern sign convention with rest near -65 mV
+rates_t rateM(double v)
+{
+  return {0.1 * vtrap(-(v + 40.0), 10.0), 4.0 * std::exp(-(v + 65.0) / 18.0)};
+}
+
+rates_t rateH(double v)
+{
+  return {0.07 * std::exp(-(v + 65.0) / 20.0),
+          1.0 / (1.0 + std::exp(-(v + 35.0) / 10.0))};
+}
+
+rates_t rateN(double v)
+{
+  return {0.01 * vtrap(-(v + 55.0), 10.0),
+          0.125 * std::exp(-(v + 65.0) / 80.0)};
+}
+
+double steadyState(rates_t rates)
+{
+  return rates.alpha / (rates.alpha + rates.beta);
+}
+
+// Exponential Euler update of a gate over `dt`
+double advanceGate(double gate, rates_t rates, double dt)
+{
+  const double total = rates.alpha + rates.beta;
+  const double target = rates.alpha / total;
+  return target + (gate - target) * std::exp(-dt * total);
+}
+
+}  // namespace
+
+clamp_protocol::cell_params clamp_protocol::hodgkinHuxleyCell()
+{
+  // 120 and 36 mS/cm^2 over the 2000 um^2 of a 20 pF membrane
+  cell_params params;
+  params.rm = 1000.0 / 6.0;  // 0.3 mS/cm^2, 6 nS
+  params.e_leak = -54.4;
+  params.g_na = 2400.0;
+  params.g_k = 720.0;
+  return params;
+}
+
+clamp_protocol::CellPopulation::CellPopulation(size_t count,
+                                               const cell_params& params)
+    : g_s(count)
+    , g_m(count)
+    , c_m(count)
+    , e_leak(count)
+    , g_na(count)
+    , g_k(count)
+    , e_na(count)
+    , e_k(count)
+    , decay(count)
+    , v(count)
+    , m(count)
+    , h(count)
+    , n(count)
+    , uniform(count)
+{
+  for (size_t i = 0; i < count; ++i) {
+    setCell(i, params);
+  }
+}
+
+void clamp_protocol::CellPopulation::setCell(size_t cell,
+                                             const cell_params& params)
+{
+  g_s.at(cell) = 1000.0 / params.rs;
+  g_m[cell] = 1000.0 / params.rm;
+  c_m[cell] = params.cm;
+  e_leak[cell] = params.e_leak;
+  g_na[cell] = params.g_na;
+  g_k[cell] = params.g_k;
+  e_na[cell] = params.e_na;
+  e_k[cell] = params.e_k;
+  // Stays on once set; passive cells are still exact on the channel path
+  channels = channels || params.g_na != 0.0 || params.g_k != 0.0;
+  cached_dt = -1.0;
+
+  v[cell] = params.e_leak;
+  m[cell] = steadyState(rateM(v[cell]));
+  h[cell] = steadyState(rateH(v[cell]));
+  n[cell] = steadyState(rateN(v[cell]));
+}
+
+void clamp_protocol::CellPopulation::reset()
+{
+  for (size_t i = 0; i < size(); ++i) {
+    v[i] = e_leak[i];
+    m[i] = steadyState(rateM(v[i]));
+    h[i] = steadyState(rateH(v[i]));
+    n[i] = steadyState(rateN(v[i]));
+  }
+}
+
+void clamp_protocol::CellPopulation::step(const double* command_mv,
+                                          double dt_ms,
+                                          double* current_na)
+{
+  if (dt_ms > 0.0) {
+    if (channels) {
+      stepChannels(command_mv, dt_ms);
+    } else {
+      stepPassive(command_mv, dt_ms);
+    }
+  }
+  currents(command_mv, current_na);
+}
+
+void clamp_protocol::CellPopulation::step(double command_mv,
+                                          double dt_ms,
+                                          double* current_na)
+{
+  std::fill(uniform.begin(), uniform.end(), command_mv);
+  step(uniform.data(), dt_ms, current_na);
+}
+
+void clamp_protocol::CellPopulation::stepPassive(const double* command_mv,
+                                                 double dt_ms)
+{
+  const size_t count = size();
+  if (dt_ms != cached_dt) {
+    for (size_t i = 0; i < count; ++i) {
+      decay[i] = std::exp(-dt_ms * (g_s[i] + g_m[i]) / c_m[i]);
+    }
+    cached_dt = dt_ms;
+  }
+  // The membrane relaxes towards the conductance-weighted mean of the
+  // command and the leak reversal
+  for (size_t i = 0; i < count; ++i) {
+    const double target =
+        (g_s[i] * command_mv[i] + g_m[i] * e_leak[i]) / (g_s[i] + g_m[i]);
+    v[i] = target + (v[i] - target) * decay[i];
+  }
+}
+
+void clamp_protocol::CellPopulation::stepChannels(const double* command_mv,
+                                                  double dt_ms)
+{
+  const auto substeps =
+      static_cast<int>(std::ceil(dt_ms / maxSubstep() - 1e-9));
+  const double dt = dt_ms / substeps;
+  const size_t count = size();
+  for (int s = 0; s < substeps; ++s) {
+    for (size_t i = 0; i < count; ++i) {
+      // Channel conductances are frozen over the substep, which makes the
+      // membrane a linear RC again
+      const double gna = g_na[i] * m[i] * m[i] * m[i] * h[i];
+      const double gk = g_k[i] * n[i] * n[i] * n[i] * n[i];
+      const double total = g_s[i] + g_m[i] + gna + gk;
+      const double target = (g_s[i] * command_mv[i] + g_m[i] * e_leak[i]
+                             + gna * e_na[i] + gk * e_k[i])
+          / total;
+      const double voltage = v[i];
+      v[i] = target + (voltage - target) * std::exp(-dt * total / c_m[i]);
+      m[i] = advanceGate(m[i], rateM(voltage), dt);
+      h[i] = advanceGate(h[i], rateH(voltage), dt);
+      n[i] = advanceGate(n[i], rateN(voltage), dt);
+    }
+  }
+}
+
+void clamp_protocol::CellPopulation::currents(const double* command_mv,
+                                              double* current_na) const
+{
+  const size_t count = size();
+  for (size_t i = 0; i < count; ++i) {
+    current_na[i] = g_s[i] * (command_mv[i] - v[i]) * 1e-3;
+  }
+}
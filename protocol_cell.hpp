@@ -0,0 +1,101 @@
+/*
+ * Copyright (C) 2011 Weill Medical College of Cornell University
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License as
+ *  published by the Free Software Foundation; either version 2 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <vector>
+
+namespace clamp_protocol
+{
+
+// Whole-cell parameters of a model cell. Units are chosen so they compose
+// without factors: MOhm, pF, mV and nS give pA, and pA/pF is mV/ms.
+struct cell_params
+{
+  double rs = 10.0;  // Series (access) resistance (MOhm)
+  double rm = 500.0;  // Membrane resistance (MOhm)
+  double cm = 20.0;  // Membrane capacitance (pF)
+  double e_leak = -70.0;  // Leak reversal (mV)
+  // Hodgkin-Huxley sodium and potassium channels, off when both are zero
+  double g_na = 0.0;  // Maximal conductance (nS)
+  double g_k = 0.0;
+  double e_na = 50.0;  // Reversal potentials (mV)
+  double e_k = -77.0;
+};
+
+// Squid axon channel densities scaled to a 20 pF cell
+cell_params hodgkinHuxleyCell();
+
+// A population of voltage-clamped model cells, a stand-in for the amplifier
+// and preparation when testing without a rig. Each cell is a membrane RC
+// behind a series resistance, optionally with HH channels; the pipette
+// current is what the amplifier would report.
+//
+// Cells are stored as structure of arrays and advanced together with
+// exponential Euler, which is exact for the passive RC under a held command
+// and unconditionally stable with channels. Passive populations reuse the
+// per-cell decay factors between calls with the same time step, so their
+// loop has no transcendental calls and vectorizes.
+class CellPopulation
+{
+public:
+  explicit CellPopulation(size_t count, const cell_params& params = {});
+
+  size_t size() const { return v.size(); }
+  void setCell(size_t cell, const cell_params& params);
+  // Back to rest: leak reversal and steady-state gates
+  void reset();
+
+  // Holds the command (mV) for `dt_ms`, split into substeps no longer than
+  // maxSubstep(), and writes each cell's pipette current (nA) at the end
+  void step(const double* command_mv, double dt_ms, double* current_na);
+  void step(double command_mv, double dt_ms, double* current_na);
+
+  double membranePotential(size_t cell) const { return v[cell]; }
+  // Longest substep (ms) used when channels are present
+  static constexpr double maxSubstep() { return 0.01; }
+
+private:
+  void stepPassive(const double* command_mv, double dt_ms);
+  void stepChannels(const double* command_mv, double dt_ms);
+  void currents(const double* command_mv, double* current_na) const;
+
+  bool channels = false;  // Any cell with HH channels
+  double cached_dt = -1.0;  // Time step `decay` was computed for
+
+  // Per cell parameters
+  std::vector<double> g_s;  // Series conductance (nS)
+  std::vector<double> g_m;  // Leak conductance (nS)
+  std::vector<double> c_m;
+  std::vector<double> e_leak;
+  std::vector<double> g_na;
+  std::vector<double> g_k;
+  std::vector<double> e_na;
+  std::vector<double> e_k;
+  std::vector<double> decay;  // Passive: exp(-dt (g_s + g_m) / c_m)
+
+  // State
+  std::vector<double> v;  // Membrane potential (mV)
+  std::vector<double> m;
+  std::vector<double> h;
+  std::vector<double> n;
+  std::vector<double> uniform;  // Scratch for the single-command step()
+};
+
+}  // namespace clamp_protocol
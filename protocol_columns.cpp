@@ -0,0 +1,306 @@
+/*
+ * Copyright (C) 2011 Weill Medical College of Cornell University
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License as
+ *  published by the Free Software Foundation; either version 2 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <utility>
+
+#include "protocol_columns.hpp"
+
+namespace
+{
+
+constexpr char table_magic[8] = {'C', 'P', 'C', 'O', 'L', 'S', '\0', '\0'};
+constexpr uint32_t table_version = 1;
+constexpr uint32_t byte_order_mark = 0x01020304;
+constexpr uint32_t max_name_length = 255;
+
+struct table_header_t
+{
+  char magic[8];
+  uint32_t version;
+  uint32_t byte_order;
+  uint64_t rows;
+  uint64_t columns;
+};
+
+class Writer
+{
+public:
+  explicit Writer(FILE* file)
+      : file(file)
+  {
+  }
+  void raw(const void* data, size_t size)
+  {
+    ok = ok && (size == 0 || std::fwrite(data, size, 1, file) == 1);
+  }
+  template<typename T>
+  void value(T number)
+  {
+    raw(&number, sizeof(number));
+  }
+  bool good() const { return ok; }
+
+private:
+  FILE* file;
+  bool ok = true;
+};
+
+class Reader
+{
+public:
+  explicit Reader(const std::vector<char>& data)
+      : data(data)
+  {
+  }
+  bool raw(void* out, size_t size)
+  {
+    if (size > data.size() - pos) {
+      return false;
+    }
+    if (size != 0) {
+      std::memcpy(out, data.data() + pos, size);
+    }
+    pos += size;
+    return true;
+  }
+  template<typename T>
+  bool value(T& number)
+  {
+    return raw(&number, sizeof(number));
+  }
+  // Room for `count` items of `size` bytes, without overflowing
+  bool fits(uint64_t count, size_t size) const
+  {
+    return count <= (data.size() - pos) / size;
+  }
+
+private:
+  const std::vector<char>& data;
+  size_t pos = 0;
+};
+
+}  // namespace
+
+size_t clamp_protocol::column_t::size() const
+{
+  switch (type) {
+    case COLUMN_INT64:
+      return ints.size();
+    case COLUMN_DOUBLE:
+      return doubles.size();
+    case COLUMN_STRING:
+      return strings.size();
+  }
+  return 0;
+}
+
+std::vector<int64_t>& clamp_protocol::ColumnTable::ints(std::string_view name)
+{
+  return column(name, COLUMN_INT64).ints;
+}
+
+std::vector<double>& clamp_protocol::ColumnTable::doubles(
+    std::string_view name)
+{
+  return column(name, COLUMN_DOUBLE).doubles;
+}
+
+std::vector<std::string>& clamp_protocol::ColumnTable::strings(
+    std::string_view name)
+{
+  return column(name, COLUMN_STRING).strings;
+}
+
+const clamp_protocol::column_t* clamp_protocol::ColumnTable::find(
+    std::string_view name) const
+{
+  for (const auto& item : table) {
+    if (item.name == name) {
+      return &item;
+    }
+  }
+  return nullptr;
+}
+
+bool clamp_protocol::ColumnTable::append(const ColumnTable& other)
+{
+  if (other.table.size() != table.size()) {
+    return false;
+  }
+  for (size_t i = 0; i < table.size(); ++i) {
+    if (other.table[i].name != table[i].name
+        || other.table[i].type != table[i].type)
+    {
+      return false;
+    }
+  }
+  for (size_t i = 0; i < table.size(); ++i) {
+    const column_t& from = other.table[i];
+    column_t& to = table[i];
+    to.ints.insert(to.ints.end(), from.ints.begin(), from.ints.end());
+    to.doubles.insert(to.doubles.end(), from.doubles.begin(), from.doubles.end());
+    to.strings.insert(to.strings.end(), from.strings.begin(), from.strings.end());
+  }
+  return true;
+}
+
+bool clamp_protocol::ColumnTable::save(const std::string& path) const
+{
+  const size_t row_count = rows();
+  for (const auto& item : table) {
+    if (item.size() != row_count || item.name.size() > max_name_length) {
+      return false;
+    }
+  }
+
+  const std::string temporary = path + ".tmp";
+  FILE* file = std::fopen(temporary.c_str(), "wb");
+  if (file == nullptr) {
+    return false;
+  }
+  Writer out(file);
+  table_header_t header {};
+  std::memcpy(header.magic, table_magic, sizeof(table_magic));
+  header.version = table_version;
+  header.byte_order = byte_order_mark;
+  header.rows = row_count;
+  header.columns = table.size();
+  out.value(header);
+  for (const auto& item : table) {
+    out.value(static_cast<uint32_t>(item.name.size()));
+    out.raw(item.name.data(), item.name.size());
+    out.value(static_cast<uint8_t>(item.type));
+    switch (item.type) {
+      case COLUMN_INT64:
+        out.raw(item.ints.data(), item.ints.size() * sizeof(int64_t));
+        break;
+      case COLUMN_DOUBLE:
+        out.raw(item.doubles.data(), item.doubles.size() * sizeof(double));
+        break;
+      case COLUMN_STRING: {
+        // End offset of every string, then the characters
+        uint64_t offset = 0;
+        for (const auto& text : item.strings) {
+          offset += text.size();
+          out.value(offset);
+        }
+        for (const auto& text : item.strings) {
+          out.raw(text.data(), text.size());
+        }
+        break;
+      }
+    }
+  }
+  const bool ok = std::fclose(file) == 0 && out.good();
+  if (!ok || std::rename(temporary.c_str(), path.c_str()) != 0) {
+    std::remove(temporary.c_str());
+    return false;
+  }
+  return true;
+}
+
+bool clamp_protocol::ColumnTable::load(const std::string& path)
+{
+  std::ifstream file(path, std::ios::binary);
+  if (!file) {
+    return false;
+  }
+  const std::vector<char> data((std::istreambuf_iterator<char>(file)),
+                               std::istreambuf_iterator<char>());
+  Reader in(data);
+  table_header_t header {};
+  if (!in.value(header)
+      || std::memcmp(header.magic, table_magic, sizeof(table_magic)) != 0
+      || header.version != table_version
+      || header.byte_order != byte_order_mark)
+  {
+    return false;
+  }
+
+  std::deque<column_t> loaded;
+  for (uint64_t i = 0; i < header.columns; ++i) {
+    column_t item;
+    uint32_t name_length = 0;
+    uint8_t type = 0;
+    if (!in.value(name_length) || name_length > max_name_length) {
+      return false;
+    }
+    item.name.resize(name_length);
+    if (!in.raw(item.name.data(), name_length) || !in.value(type)) {
+      return false;
+    }
+    item.type = static_cast<column_type>(type);
+    switch (item.type) {
+      case COLUMN_INT64:
+        if (!in.fits(header.rows, sizeof(int64_t))) {
+          return false;
+        }
+        item.ints.resize(header.rows);
+        in.raw(item.ints.data(), header.rows * sizeof(int64_t));
+        break;
+      case COLUMN_DOUBLE:
+        if (!in.fits(header.rows, sizeof(double))) {
+          return false;
+        }
+        item.doubles.resize(header.rows);
+        in.raw(item.doubles.data(), header.rows * sizeof(double));
+        break;
+      case COLUMN_STRING: {
+        if (!in.fits(header.rows, sizeof(uint64_t))) {
+          return false;
+        }
+        std::vector<uint64_t> ends(header.rows);
+        in.raw(ends.data(), header.rows * sizeof(uint64_t));
+        uint64_t start = 0;
+        item.strings.resize(header.rows);
+        for (uint64_t row = 0; row < header.rows; ++row) {
+          if (ends[row] < start || !in.fits(ends[row] - start, 1)) {
+            return false;
+          }
+          item.strings[row].resize(ends[row] - start);
+          in.raw(item.strings[row].data(), ends[row] - start);
+          start = ends[row];
+        }
+        break;
+      }
+      default:
+        return false;
+    }
+    loaded.push_back(std::move(item));
+  }
+  table = std::move(loaded);
+  return true;
+}
+
+clamp_protocol::column_t& clamp_protocol::ColumnTable::column(
+    std::string_view name, column_type type)
+{
+  for (auto& item : table) {
+    if (item.name == name) {
+      return item;
+    }
+  }
+  column_t& added = table.emplace_back();
+  added.name = std::string(name);
+  added.type = type;
+  return added;
+}
@@ -0,0 +1,84 @@
+/*
+ * Copyright (C) 2011 Weill Medical College of Cornell University
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License as
+ *  published by the Free Software Foundation; either version 2 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <deque>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace clamp_protocol
+{
+
+enum column_type : uint8_t
+{
+  COLUMN_INT64 = 0,
+  COLUMN_DOUBLE,
+  COLUMN_STRING,
+};
+
+struct column_t
+{
+  std::string name;
+  column_type type = COLUMN_DOUBLE;
+  // Only the vector matching `type` is used
+  std::vector<int64_t> ints;
+  std::vector<double> doubles;
+  std::vector<std::string> strings;
+
+  size_t size() const;
+};
+
+// Column oriented table of analysis results (*.cpc). After a short header
+// every column is stored in one piece: its name, its type and all of its
+// values, so reading one measurement across a month of sweeps touches only
+// that column. Numbers are stored raw and strings as an offset array and a
+// character blob.
+//
+// Like protocol archives, tables use the byte order of the machine that
+// wrote them.
+class ColumnTable
+{
+public:
+  // Column with that name, added empty if missing. The references stay
+  // valid for the life of the table.
+  std::vector<int64_t>& ints(std::string_view name);
+  std::vector<double>& doubles(std::string_view name);
+  std::vector<std::string>& strings(std::string_view name);
+
+  // Null if there is no column with that name
+  const column_t* find(std::string_view name) const;
+  const std::deque<column_t>& columns() const { return table; }
+  size_t rows() const { return table.empty() ? 0 : table.front().size(); }
+  // Appends the rows of a table with the same columns. False, leaving this
+  // table untouched, if the columns differ.
+  bool append(const ColumnTable& other);
+
+  // False if the columns differ in length or writing fails
+  bool save(const std::string& path) const;
+  bool load(const std::string& path);  // False if missing or malformed
+
+private:
+  column_t& column(std::string_view name, column_type type);
+
+  std::deque<column_t> table;
+};
+
+}  // namespace clamp_protocol
@@ -0,0 +1,222 @@
+/*
+ * Copyright (C) 2011 Weill Medical College of Cornell University
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License as
+ *  published by the Free Software Foundation; either version 2 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#include <array>
+#include <charconv>
+#include <cmath>
+#include <fstream>
+#include <sstream>
+
+#include "protocol_csp.hpp"
+
+namespace
+{
+
+struct tag_t
+{
+  std::string_view name;
+  std::string_view attributes;
+  bool closing = false;  // </name>
+  bool empty = false;  // <name/>
+};
+
+bool isSpace(char c)
+{
+  return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+}
+
+// Advances `pos` past the next tag, skipping text, comments, the XML
+// declaration and the doctype. Returns false at the end of the text or on
+// an unterminated tag.
+bool nextTag(std::string_view text, size_t& pos, tag_t& tag, bool& error)
+{
+  while (true) {
+    pos = text.find('<', pos);
+    if (pos == std::string_view::npos) {
+      return false;
+    }
+    std::string_view rest = text.substr(pos);
+    std::string_view terminator = ">";
+    if (rest.substr(0, 4) == "<!--") {
+      terminator = "-->";
+    } else if (rest.substr(0, 2) == "<?") {
+      terminator = "?>";
+    }
+    const size_t end = text.find(terminator, pos + 1);
+    if (end == std::string_view::npos) {
+      error = true;
+      return false;
+    }
+    const size_t body_start = pos + 1;
+    pos = end + terminator.size();
+    if (terminator != ">" || rest[1] == '!') {
+      continue;
+    }
+
+    std::string_view body = text.substr(body_start, end - body_start);
+    tag = {};
+    if (!body.empty() && body.front() == '/') {
+      tag.closing = true;
+      body.remove_prefix(1);
+    }
+    if (!body.empty() && body.back() == '/') {
+      tag.empty = true;
+      body.remove_suffix(1);
+    }
+    size_t name_end = 0;
+    while (name_end < body.size() && !isSpace(body[name_end])) {
+      ++name_end;
+    }
+    tag.name = body.substr(0, name_end);
+    tag.attributes = body.substr(name_end);
+    if (tag.name.empty()) {
+      error = true;
+      return false;
+    }
+    return true;
+  }
+}
+
+// Parses attribute `name` into `value`. Returns false when the attribute is
+// present but not entirely a number; a missing attribute leaves `value` as it
+// is.
+template<typename T>
+bool attribute(std::string_view attributes, std::string_view name, T& value)
+{
+  size_t pos = 0;
+  while ((pos = attributes.find(name, pos)) != std::string_view::npos) {
+    const size_t after = pos + name.size();
+    const bool starts_word = pos == 0 || isSpace(attributes[pos - 1]);
+    pos = after;
+    if (!starts_word || after >= attributes.size() || attributes[after] != '=')
+    {
+      continue;
+    }
+    if (after + 1 >= attributes.size()) {
+      return false;
+    }
+    const char quote = attributes[after + 1];
+    const size_t value_end = attributes.find(quote, after + 2);
+    if (value_end == std::string_view::npos) {
+      return false;
+    }
+    const char* first = attributes.data() + after + 2;
+    const char* last = attributes.data() + value_end;
+    if (first != last && *first == '+') {
+      ++first;
+    }
+    const auto result = std::from_chars(first, last, value);
+    return result.ec == std::errc() && result.ptr == last;
+  }
+  return true;
+}
+
+// Reads one <step> element, rejecting unknown modes and types and values
+// that are not finite
+bool readStep(std::string_view attributes, clamp_protocol::ProtocolStep& step)
+{
+  int amp_mode = clamp_protocol::VOLTAGE;
+  int step_type = clamp_protocol::STEP;
+  if (!attribute(attributes, "ampMode", amp_mode)
+      || !attribute(attributes, "stepType", step_type)
+      || (amp_mode != clamp_protocol::VOLTAGE
+          && amp_mode != clamp_protocol::CURRENT)
+      || (step_type != clamp_protocol::STEP
+          && step_type != clamp_protocol::RAMP))
+  {
+    return false;
+  }
+  step.ampMode = static_cast<clamp_protocol::ampMode_t>(amp_mode);
+  step.stepType = static_cast<clamp_protocol::stepType_t>(step_type);
+
+  constexpr std::array<std::pair<clamp_protocol::protocol_parameters,
+                                 std::string_view>,
+                       clamp_protocol::PROTOCOL_PARAMETERS_SIZE>
+      names {{{clamp_protocol::STEP_DURATION, "stepDuration"},
+              {clamp_protocol::DELTA_STEP_DURATION, "deltaStepDuration"},
+              {clamp_protocol::HOLDING_LEVEL_1, "holdingLevel1"},
+              {clamp_protocol::DELTA_HOLDING_LEVEL_1, "deltaHoldingLevel1"},
+              {clamp_protocol::HOLDING_LEVEL_2, "holdingLevel2"},
+              {clamp_protocol::DELTA_HOLDING_LEVEL_2, "deltaHoldingLevel2"}}};
+  for (const auto& [parameter, name] : names) {
+    double& value = step.parameters[parameter];
+    if (!attribute(attributes, name, value) || !std::isfinite(value)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+}  // namespace
+
+bool clamp_protocol::readCsp(std::string_view text, Protocol& protocol)
+{
+  Protocol result;
+  size_t pos = 0;
+  tag_t tag;
+  bool error = false;
+  int depth = 0;  // 1 inside the root, 2 inside a segment, 3 inside a step
+  bool seen_root = false;
+  while (nextTag(text, pos, tag, error)) {
+    if (tag.closing) {
+      if (--depth < 0) {
+        return false;
+      }
+      continue;
+    }
+    if (depth == 0) {
+      if (seen_root) {
+        return false;
+      }
+      seen_root = true;
+    } else if (depth == 1) {
+      int64_t sweeps = 1;
+      if (!attribute(tag.attributes, "numSweeps", sweeps) || sweeps < 0
+          || sweeps > max_sweeps)
+      {
+        return false;
+      }
+      result.appendSegment(static_cast<size_t>(sweeps));
+    } else if (depth == 2) {
+      ProtocolStep step;
+      if (!readStep(tag.attributes, step)) {
+        return false;
+      }
+      result.getSegment(result.numSegments() - 1).step(step);
+    }
+    if (!tag.empty) {
+      ++depth;
+    }
+  }
+  if (error || depth != 0 || !seen_root) {
+    return false;
+  }
+  protocol = std::move(result);
+  return true;
+}
+
+bool clamp_protocol::loadCspFile(const std::string& path, Protocol& protocol)
+{
+  std::ifstream file(path, std::ios::binary);
+  if (!file) {
+    return false;
+  }
+  std::stringstream contents;
+  contents << file.rdbuf();
+  return readCsp(contents.str(), protocol);
+}
@@ -0,0 +1,40 @@
+/*
+ * Copyright (C) 2011 Weill Medical College of Cornell University
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License as
+ *  published by the Free Software Foundation; either version 2 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#pragma once
+
+#include <string>
+#include <string_view>
+
+#include "protocol_model.hpp"
+
+namespace clamp_protocol
+{
+
+// Reads a .csp protocol file without Qt. Only the subset of XML the editor
+// writes is understood: a root element holding <segment numSweeps="..">
+// elements, each holding <step .. /> elements. The same rules as
+// Protocol::fromDoc() apply: a missing numSweeps means one sweep and other
+// missing attributes read as zero, while malformed numbers, unknown step
+// types or amplifier modes, non-finite values and sweep counts outside
+// [0, max_sweeps] reject the file. Returns false, leaving `protocol`
+// untouched, when the text is not well formed or is rejected.
+bool readCsp(std::string_view text, Protocol& protocol);
+bool loadCspFile(const std::string& path, Protocol& protocol);
+
+}  // namespace clamp_protocol
@@ -0,0 +1,113 @@
+/*
+ * Copyright (C) 2011 Weill Medical College of Cornell University
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License as
+ *  published by the Free Software Foundation; either version 2 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#include <algorithm>
+
+#include "protocol_decimator.hpp"
+
+clamp_protocol::DisplayDecimator::DisplayDecimator(
+    const decimator_params& params)
+    : settings(params)
+{
+  settings.factor = std::max<uint32_t>(settings.factor, 2);
+}
+
+void clamp_protocol::DisplayDecimator::setCapacity(size_t bytes)
+{
+  engage_bytes = static_cast<size_t>(static_cast<double>(bytes)
+                                     * settings.engage_fill);
+  release_bytes = static_cast<size_t>(static_cast<double>(bytes)
+                                      * settings.release_fill);
+  if (bytes == 0) {
+    active = false;
+  }
+}
+
+bool clamp_protocol::DisplayDecimator::sameSweep(const data_token_t& a,
+                                                 const data_token_t& b)
+{
+  return a.protocolHash == b.protocolHash && a.trial == b.trial
+      && a.segment == b.segment && a.sweep == b.sweep;
+}
+
+void clamp_protocol::DisplayDecimator::reset()
+{
+  active = false;
+  count = 0;
+}
+
+size_t clamp_protocol::DisplayDecimator::flush(data_token_t* out)
+{
+  if (count == 0) {
+    return 0;
+  }
+  // Earlier of the two first; a run of one record goes out as it was
+  const bool low_first = low_index <= high_index;
+  out[0] = low_first ? low : high;
+  out[0].decimation = count;
+  size_t written = 1;
+  if (low_index != high_index) {
+    out[1] = low_first ? high : low;
+    out[1].decimation = count;
+    written = 2;
+  }
+  if (count > 1) {
+    folded += count;
+  }
+  count = 0;
+  return written;
+}
+
+size_t clamp_protocol::DisplayDecimator::feed(const data_token_t& token,
+                                              size_t fill,
+                                              data_token_t* out)
+{
+  if (!active) {
+    if (engage_bytes == 0 || fill < engage_bytes) {
+      out[0] = token;
+      return 1;
+    }
+    active = true;
+  } else if (fill <= release_bytes) {
+    active = false;
+    const size_t written = flush(out);
+    out[written] = token;
+    return written + 1;
+  }
+
+  size_t written = 0;
+  if (count > 0 && !sameSweep(token, low)) {
+    written = flush(out);
+  }
+  if (count == 0) {
+    low = token;
+    high = token;
+    low_index = 0;
+    high_index = 0;
+  } else if (token.value < low.value) {
+    low = token;
+    low_index = count;
+  } else if (token.value > high.value) {
+    high = token;
+    high_index = count;
+  }
+  if (++count == settings.factor) {
+    written += flush(out + written);
+  }
+  return written;
+}
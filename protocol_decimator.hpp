@@ -0,0 +1,82 @@
+/*
+ * Copyright (C) 2011 Weill Medical College of Cornell University
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License as
+ *  published by the Free Software Foundation; either version 2 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include "protocol_record.hpp"
+
+namespace clamp_protocol
+{
+
+struct decimator_params
+{
+  double engage_fill = 0.5;  // FIFO fraction full that starts decimating
+  double release_fill = 0.125;  // and below which full resolution resumes
+  uint32_t factor = 32;  // Records per minimum/maximum pair meanwhile
+};
+
+// Runner thread side of the display FIFO. Tokens pass straight through
+// while the FIFO has room. Once the GUI falls behind and the FIFO passes
+// `engage_fill`, every `factor` records of a sweep are folded into their
+// minimum and maximum, in the order they were sampled, so the plot keeps
+// the envelope instead of losing whole stretches when writes start to
+// fail. Only the display stream is thinned: the session recorder gets
+// every tick from the runner itself.
+class DisplayDecimator
+{
+public:
+  explicit DisplayDecimator(const decimator_params& params = {});
+
+  // FIFO size in bytes; zero never decimates. Call with the runner thread
+  // idle.
+  void setCapacity(size_t bytes);
+  static constexpr size_t max_out = 3;
+
+  // One runner token, with the FIFO `fill` bytes full. Writes the tokens to
+  // send now, oldest first, to `out` and returns how many (at most
+  // max_out).
+  size_t feed(const data_token_t& token, size_t fill, data_token_t* out);
+  // Closes a partly filled pair, e.g. when the protocol ends. Same output
+  // as feed().
+  size_t flush(data_token_t* out);
+  // Forgets the open pair and goes back to full resolution
+  void reset();
+
+  bool decimating() const { return active; }
+  // Records that reached the FIFO folded into a pair
+  uint64_t foldedRecords() const { return folded; }
+
+private:
+  static bool sameSweep(const data_token_t& a, const data_token_t& b);
+
+  decimator_params settings;
+  size_t engage_bytes = 0;
+  size_t release_bytes = 0;
+  bool active = false;
+  data_token_t low {};
+  data_token_t high {};
+  uint32_t low_index = 0;  // Position of the extremes in the open pair
+  uint32_t high_index = 0;
+  uint32_t count = 0;  // Records in the open pair
+  uint64_t folded = 0;
+};
+
+}  // namespace clamp_protocol
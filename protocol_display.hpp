@@ -0,0 +1,121 @@
+/*
+ * Copyright (C) 2011 Weill Medical College of Cornell University
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License as
+ *  published by the Free Software Foundation; either version 2 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include "protocol_decimator.hpp"
+#include "protocol_latency.hpp"
+#include "protocol_metrics.hpp"
+#include "protocol_record.hpp"
+#include "protocol_trace.hpp"
+
+namespace clamp_protocol
+{
+
+// What Component::execute() does with the tokens the runner produces.
+// While the plot is open they go through a DisplayDecimator into the
+// display FIFO, and every write is counted by the RtMonitor, offered to the
+// LatencyProbe and marked in the trace. `Fifo` needs RT::OS::Fifo's
+// writeRT(); the RT harness runs the same code over an in-memory FIFO.
+template<typename Fifo>
+class DisplayWriter
+{
+public:
+  DisplayWriter(RtMonitor& rt_monitor,
+                LatencyProbe& latency_probe,
+                const decimator_params& params = {})
+      : monitor(rt_monitor)
+      , probe(latency_probe)
+      , decimator(params)
+  {
+  }
+
+  // FIFO to write to and its size in bytes, which sets when decimation
+  // starts; zero never decimates. Call with the RT thread idle. Records
+  // left in the previous FIFO are counted as read, see fifoReplaced().
+  void setFifo(Fifo* display_fifo, size_t capacity)
+  {
+    if (fifo != nullptr && display_fifo != fifo) {
+      monitor.fifoReplaced();
+    }
+    fifo = display_fifo;
+    decimator.setCapacity(display_fifo != nullptr ? capacity : 0);
+  }
+  // Nothing is written while the plot is closed. Call with the RT thread
+  // idle; a pair the decimator had open is dropped.
+  void setPlotting(bool on)
+  {
+    plotting = on;
+    decimator.reset();
+  }
+  bool writing() const { return plotting && fifo != nullptr; }
+
+  // RT thread: the token of one tick
+  void write(const data_token_t& token, int64_t now_ns, TraceRing* trace)
+  {
+    if (!writing()) {
+      return;
+    }
+    data_token_t shown[DisplayDecimator::max_out];
+    send(shown,
+         decimator.feed(token, monitor.fifoFill(), shown),
+         now_ns,
+         trace);
+  }
+  // RT thread: the protocol has ended, send what the decimator holds
+  void finish(int64_t now_ns, TraceRing* trace)
+  {
+    if (!writing()) {
+      return;
+    }
+    data_token_t shown[DisplayDecimator::max_out];
+    send(shown, decimator.flush(shown), now_ns, trace);
+  }
+
+  uint64_t foldedRecords() const { return decimator.foldedRecords(); }
+
+private:
+  void send(const data_token_t* tokens,
+            size_t count,
+            int64_t now_ns,
+            TraceRing* trace)
+  {
+    for (size_t i = 0; i < count; ++i) {
+      const auto written = fifo->writeRT(&tokens[i], sizeof(data_token_t));
+      monitor.fifoWrite(now_ns, sizeof(data_token_t), written > 0);
+      if (written > 0) {
+        probe.recordWritten(now_ns, tokens[i].sample);
+      }
+      if (trace != nullptr) {
+        trace->instant(TRACE_FIFO_WRITE,
+                       written > 0 ? static_cast<uint64_t>(written) : 0);
+      }
+    }
+  }
+
+  RtMonitor& monitor;
+  LatencyProbe& probe;
+  DisplayDecimator decimator;
+  Fifo* fifo = nullptr;
+  bool plotting = false;
+};
+
+}  // namespace clamp_protocol
@@ -0,0 +1,141 @@
+/*
+ * Copyright (C) 2011 Weill Medical College of Cornell University
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License as
+ *  published by the Free Software Foundation; either version 2 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#include <algorithm>
+
+#include "protocol_engine.hpp"
+
+void clamp_protocol::ProtocolEngine::load(compiled_view new_protocol,
+                                          int64_t new_period_ns)
+{
+  protocol = new_protocol;
+  period_ns = std::max<int64_t>(new_period_ns, 1);
+  rewind();
+}
+
+void clamp_protocol::ProtocolEngine::rewind()
+{
+  index = 0;
+  enterStep();
+}
+
+void clamp_protocol::ProtocolEngine::enterStep()
+{
+  sample = 0;
+  step_samples = 0;
+  for (; index < protocol.size; ++index) {
+    const compiled_step_t& current = protocol.steps[index];
+    step_samples = stepSamples(current, period_ns);
+    if (step_samples > 0) {
+      slope = current.stepType == clamp_protocol::RAMP
+          ? (current.level2 - current.level1)
+              / static_cast<double>(step_samples)
+          : 0.0;
+      return;
+    }
+  }
+}
+
+double clamp_protocol::ProtocolEngine::next()
+{
+  if (finished()) {
+    return 0.0;
+  }
+  const double value =
+      protocol.steps[index].level1 + slope * static_cast<double>(sample);
+  if (++sample >= step_samples) {
+    ++index;
+    enterStep();
+  }
+  return value;
+}
+
+size_t clamp_protocol::ProtocolEngine::render(double* out, size_t count)
+{
+  size_t written = 0;
+  while (written < count && !finished()) {
+    const double level1 = protocol.steps[index].level1;
+    const auto run = static_cast<size_t>(std::min<int64_t>(
+        step_samples - sample, static_cast<int64_t>(count - written)));
+    for (size_t i = 0; i < run; ++i) {
+      out[written + i] = level1 + slope * static_cast<double>(sample + i);
+    }
+    written += run;
+    sample += static_cast<int64_t>(run);
+    if (sample >= step_samples) {
+      ++index;
+      enterStep();
+    }
+  }
+  return written;
+}
+
+void clamp_protocol::ProtocolEngine::seek(size_t step_index,
+                                          int64_t step_sample)
+{
+  index = step_index;
+  enterStep();
+  if (!finished() && index == step_index) {
+    sample = std::clamp<int64_t>(step_sample, 0, step_samples - 1);
+  }
+}
+
+void clamp_protocol::SampleIndex::build(compiled_view protocol,
+                                        int64_t period_ns)
+{
+  period_ns = std::max<int64_t>(period_ns, 1);
+  starts.resize(protocol.size + 1);
+  int64_t total = 0;
+  for (size_t i = 0; i < protocol.size; ++i) {
+    starts[i] = total;
+    // Saturates rather than overflowing on absurdly long protocols
+    total = std::min(total, INT64_MAX - max_step_samples)
+        + stepSamples(protocol.steps[i], period_ns);
+  }
+  starts[protocol.size] = total;
+}
+
+size_t clamp_protocol::SampleIndex::locate(int64_t sample) const
+{
+  if (starts.empty() || sample < 0) {
+    return 0;
+  }
+  // Last step starting at or before `sample`. Zero-sample steps share their
+  // start with the next step, so upper_bound skips over them.
+  auto it = std::upper_bound(starts.begin(), starts.end(), sample);
+  return static_cast<size_t>(it - starts.begin()) - 1;
+}
+
+void clamp_protocol::renderProtocol(compiled_view protocol,
+                                    int64_t period_ns,
+                                    int64_t first_sample,
+                                    double* out,
+                                    size_t count)
+{
+  SampleIndex sample_index;
+  sample_index.build(protocol, period_ns);
+  ProtocolEngine engine;
+  engine.load(protocol, period_ns);
+  const size_t step = sample_index.locate(first_sample);
+  size_t written = 0;
+  if (step < protocol.size) {
+    engine.seek(step, first_sample - sample_index.stepStart(step));
+    written = engine.render(out, count);
+  }
+  std::fill(out + written, out + count, 0.0);
+}
@@ -0,0 +1,102 @@
+/*
+ * Copyright (C) 2011 Weill Medical College of Cornell University
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License as
+ *  published by the Free Software Foundation; either version 2 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#pragma once
+
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+#include "protocol_model.hpp"
+
+namespace clamp_protocol
+{
+
+// Longest step the engine plays, 2^40 periods (12 days at 1 us). Longer
+// durations are clamped so sample counts cannot overflow.
+constexpr int64_t max_step_samples = int64_t {1} << 40;
+
+// Number of RT periods a compiled step lasts at the given period. Negative
+// and NaN durations last zero periods.
+inline int64_t stepSamples(const compiled_step_t& step, int64_t period_ns)
+{
+  const double samples = step.duration * 1e6 / static_cast<double>(period_ns);
+  if (!(samples >= 0.5)) {
+    return 0;
+  }
+  if (samples >= static_cast<double>(max_step_samples)) {
+    return max_step_samples;
+  }
+  return std::llround(samples);
+}
+
+// Plays a compiled protocol back one sample per RT period. A step lasts
+// round(duration / period) samples; ramps move linearly from level1 towards
+// level2 and steps of zero samples are skipped.
+class ProtocolEngine
+{
+public:
+  void load(compiled_view new_protocol, int64_t new_period_ns);
+  void rewind();  // Go back to the first sample
+  bool finished() const { return index >= protocol.size; }
+  // Step being played, only valid while the protocol is not finished
+  const compiled_step_t& step() const { return protocol.steps[index]; }
+  size_t stepIndex() const { return index; }
+  int64_t stepSample() const { return sample; }  // Sample within the step
+  double next();  // Amplitude of the current sample, then advance
+  // Fill `out` with up to `count` samples, one step at a time. Returns the
+  // number of samples written, less than `count` only at the end.
+  size_t render(double* out, size_t count);
+  // Continue from a sample within a step, e.g. one found with SampleIndex
+  void seek(size_t step_index, int64_t step_sample);
+
+private:
+  void enterStep();
+
+  compiled_view protocol;
+  int64_t period_ns = 1;
+  size_t index = 0;
+  int64_t sample = 0;
+  int64_t step_samples = 0;
+  double slope = 0.0;  // Level change per sample
+};
+
+// First sample of every step of a compiled protocol at a given period, for
+// mapping sample numbers to steps and back in O(log n)
+class SampleIndex
+{
+public:
+  void build(compiled_view protocol, int64_t period_ns);
+  int64_t totalSamples() const { return starts.empty() ? 0 : starts.back(); }
+  int64_t stepStart(size_t step) const { return starts.at(step); }
+  // Step playing at `sample`, or the number of steps past the end
+  size_t locate(int64_t sample) const;
+
+private:
+  std::vector<int64_t> starts;  // One entry per step plus the total
+};
+
+// Renders `count` samples starting at `first_sample` into `out`, as the
+// engine would play them. Samples past the end are zero.
+void renderProtocol(compiled_view protocol,
+                    int64_t period_ns,
+                    int64_t first_sample,
+                    double* out,
+                    size_t count);
+
+}  // namespace clamp_protocol
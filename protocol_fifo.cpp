@@ -0,0 +1,44 @@
+/*
+ * Copyright (C) 2011 Weill Medical College of Cornell University
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License as
+ *  published by the Free Software Foundation; either version 2 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#include <algorithm>
+#include <cmath>
+
+#include "protocol_fifo.hpp"
+
+size_t clamp_protocol::fifoCapacity(const fifo_sizing& sizing)
+{
+  constexpr size_t page = 4096;
+  const int64_t period_ns = std::max<int64_t>(sizing.period_ns, 1);
+  const int64_t backlog_ns = std::max<int64_t>(sizing.drain_period_ns, 0)
+      + std::max<int64_t>(sizing.stall_budget_ns, 0);
+  // Records that arrive while one drain is overdue by the whole budget, the
+  // partial period at either end included
+  const double records =
+      std::ceil(static_cast<double>(backlog_ns) / static_cast<double>(period_ns))
+      + 1.0;
+  const double fill = std::clamp(sizing.decimation_fill, 0.01, 1.0);
+  const double bytes =
+      records * static_cast<double>(sizing.record_bytes) / fill;
+  const auto limit = static_cast<double>(sizing.max_bytes);
+  size_t capacity = bytes >= limit ? sizing.max_bytes
+                                   : static_cast<size_t>(std::ceil(bytes));
+  capacity = std::max(capacity, sizing.min_bytes);
+  capacity = (capacity + page - 1) / page * page;
+  return std::min(capacity, std::max(sizing.max_bytes / page * page, page));
+}
@@ -0,0 +1,50 @@
+/*
+ * Copyright (C) 2011 Weill Medical College of Cornell University
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License as
+ *  published by the Free Software Foundation; either version 2 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include "protocol_record.hpp"
+
+namespace clamp_protocol
+{
+
+// What the display FIFO has to absorb: records arrive once per RT period
+// and leave on the drain cadence, except while the GUI is stalled
+struct fifo_sizing
+{
+  int64_t period_ns = 100000;
+  size_t record_bytes = sizeof(data_token_t);
+  int64_t drain_period_ns = 100000000;  // Panel plot timer
+  // Longest GUI stall (replot, dialog, swap) ridden out at full resolution
+  int64_t stall_budget_ns = 1000000000;
+  // Fill at which DisplayDecimator starts thinning; the backlog must fit
+  // below it
+  double decimation_fill = 0.5;
+  size_t min_bytes = 64 * 1024;
+  size_t max_bytes = 256 * 1024 * 1024;
+};
+
+// Bytes for a FIFO that holds a drain period plus the stall budget worth of
+// records below the decimation threshold, rounded up to whole pages and
+// kept within [min_bytes, max_bytes]
+size_t fifoCapacity(const fifo_sizing& sizing);
+
+}  // namespace clamp_protocol
@@ -0,0 +1,90 @@
+/*
+ * Copyright (C) 2011 Weill Medical College of Cornell University
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License as
+ *  published by the Free Software Foundation; either version 2 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#include <cmath>
+
+#include "protocol_generators.hpp"
+
+size_t clamp_protocol::generators::sweep_count(double from,
+                                               double to,
+                                               double increment)
+{
+  if (increment == 0.0 || (to - from) / increment < 0.0) {
+    return 1;
+  }
+  return static_cast<size_t>(std::floor((to - from) / increment + 0.5)) + 1;
+}
+
+clamp_protocol::Protocol clamp_protocol::generators::iv(
+    const iv_params& params)
+{
+  Protocol protocol;
+  protocol
+      .appendSegment(sweep_count(params.from, params.to, params.increment))
+      .hold(params.pre_duration, params.holding)
+      .hold(params.test_duration, {params.from, params.increment})
+      .hold(params.post_duration, params.holding);
+  return protocol;
+}
+
+clamp_protocol::Protocol clamp_protocol::generators::steady_state_inactivation(
+    const inactivation_params& params)
+{
+  Protocol protocol;
+  protocol
+      .appendSegment(sweep_count(params.from, params.to, params.increment))
+      .hold(params.conditioning_duration, {params.from, params.increment})
+      .hold(params.test_duration, params.test_level)
+      .hold(params.post_duration, params.holding);
+  return protocol;
+}
+
+clamp_protocol::Protocol clamp_protocol::generators::recovery_from_inactivation(
+    const recovery_params& params)
+{
+  Protocol protocol;
+  protocol.appendSegment(params.sweeps)
+      .hold(params.pulse_duration, params.pulse_level)
+      .hold({params.interval, params.interval_increment}, params.holding)
+      .hold(params.pulse_duration, params.pulse_level)
+      .hold(params.post_duration, params.holding);
+  return protocol;
+}
+
+clamp_protocol::Protocol clamp_protocol::generators::ramp(
+    const ramp_params& params)
+{
+  Protocol protocol;
+  protocol.appendSegment(params.sweeps)
+      .hold(params.pre_duration, params.holding)
+      .ramp(params.ramp_duration, params.from, params.to)
+      .hold(params.post_duration, params.holding);
+  return protocol;
+}
+
+clamp_protocol::Protocol clamp_protocol::generators::tail(
+    const tail_params& params)
+{
+  Protocol protocol;
+  protocol
+      .appendSegment(sweep_count(params.from, params.to, params.increment))
+      .hold(params.activation_duration, params.activation_level)
+      .hold(params.tail_duration, {params.from, params.increment})
+      .hold(params.post_duration, params.holding);
+  return protocol;
+}
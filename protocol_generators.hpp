@@ -0,0 +1,105 @@
+/*
+ * Copyright (C) 2011 Weill Medical College of Cornell University
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License as
+ *  published by the Free Software Foundation; either version 2 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#pragma once
+
+#include "protocol_model.hpp"
+
+// Generators for the standard voltage clamp protocol families. Levels are in
+// mV and durations in ms, as in the editor. Each generator returns the
+// editable Protocol rather than its compiled form, so the result can also be
+// saved as .csp or edited further; Protocol::compile() gives the compiled
+// protocol without any table or XML round trip.
+namespace clamp_protocol::generators
+{
+
+// Current-voltage relation: holding, test step swept from `from` to `to`,
+// back to holding
+struct iv_params
+{
+  double holding = -80.0;
+  double from = -80.0;
+  double to = 40.0;
+  double increment = 10.0;
+  double pre_duration = 50.0;
+  double test_duration = 100.0;
+  double post_duration = 50.0;
+};
+
+// Steady-state inactivation: swept conditioning prepulse followed by a fixed
+// test pulse
+struct inactivation_params
+{
+  double holding = -80.0;
+  double from = -120.0;
+  double to = 0.0;
+  double increment = 10.0;
+  double conditioning_duration = 500.0;
+  double test_level = 0.0;
+  double test_duration = 50.0;
+  double post_duration = 50.0;
+};
+
+// Recovery from inactivation: two identical pulses separated by an interval
+// at holding that grows by `interval_increment` every sweep
+struct recovery_params
+{
+  double holding = -80.0;
+  double pulse_level = 0.0;
+  double pulse_duration = 50.0;
+  double interval = 1.0;
+  double interval_increment = 5.0;
+  size_t sweeps = 10;
+  double post_duration = 50.0;
+};
+
+// Voltage ramp between two holding periods
+struct ramp_params
+{
+  double holding = -80.0;
+  double from = -100.0;
+  double to = 50.0;
+  double pre_duration = 50.0;
+  double ramp_duration = 500.0;
+  double post_duration = 50.0;
+  size_t sweeps = 1;
+};
+
+// Tail currents: fixed activating pulse followed by a swept tail step
+struct tail_params
+{
+  double holding = -80.0;
+  double activation_level = 20.0;
+  double activation_duration = 100.0;
+  double from = -120.0;
+  double to = 0.0;
+  double increment = 10.0;
+  double tail_duration = 200.0;
+  double post_duration = 50.0;
+};
+
+// Number of sweeps needed to go from `from` to `to` in steps of `increment`
+size_t sweep_count(double from, double to, double increment);
+
+Protocol iv(const iv_params& params);
+Protocol steady_state_inactivation(const inactivation_params& params);
+Protocol recovery_from_inactivation(const recovery_params& params);
+Protocol ramp(const ramp_params& params);
+Protocol tail(const tail_params& params);
+
+}  // namespace clamp_protocol::generators
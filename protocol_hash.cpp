@@ -0,0 +1,97 @@
+/*
+ * Copyright (C) 2011 Weill Medical College of Cornell University
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License as
+ *  published by the Free Software Foundation; either version 2 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#include <cmath>
+#include <cstring>
+#include <limits>
+
+#include "protocol_hash.hpp"
+
+namespace
+{
+
+// Bumped whenever the encoding below changes so old hashes never collide
+// with new ones
+constexpr uint64_t hash_format_version = 1;
+
+// 64-bit FNV-1a
+class hasher
+{
+public:
+  void add(uint64_t value)
+  {
+    for (int byte = 0; byte < 8; ++byte) {
+      state ^= (value >> (8 * byte)) & 0xffU;
+      state *= 0x100000001b3ULL;
+    }
+  }
+
+  void add(double value)
+  {
+    if (value == 0.0) {
+      value = 0.0;  // -0.0 and 0.0 are the same stimulus
+    } else if (std::isnan(value)) {
+      value = std::numeric_limits<double>::quiet_NaN();
+    }
+    uint64_t bits = 0;
+    std::memcpy(&bits, &value, sizeof(bits));
+    add(bits);
+  }
+
+  uint64_t digest() const { return state; }
+
+private:
+  uint64_t state = 0xcbf29ce484222325ULL;
+};
+
+}  // namespace
+
+uint64_t clamp_protocol::hashProtocol(compiled_view protocol,
+                                      int64_t period_ns,
+                                      double junction_potential_mv,
+                                      double output_factor)
+{
+  hasher hash;
+  hash.add(hash_format_version);
+  hash.add(static_cast<uint64_t>(period_ns));
+  hash.add(junction_potential_mv);
+  hash.add(output_factor);
+  hash.add(static_cast<uint64_t>(protocol.size));
+  for (size_t i = 0; i < protocol.size; ++i) {
+    const compiled_step_t& step = protocol.steps[i];
+    hash.add(static_cast<uint64_t>(step.segment));
+    hash.add(static_cast<uint64_t>(step.sweep));
+    hash.add(static_cast<uint64_t>(step.step));
+    hash.add(static_cast<uint64_t>(step.ampMode));
+    hash.add(static_cast<uint64_t>(step.stepType));
+    hash.add(step.duration);
+    hash.add(step.level1);
+    hash.add(step.level2);
+  }
+  return hash.digest();
+}
+
+std::string clamp_protocol::hashToString(uint64_t hash)
+{
+  static constexpr char digits[] = "0123456789abcdef";
+  std::string text(16, '0');
+  for (size_t i = 0; i < text.size(); ++i) {
+    text[text.size() - 1 - i] = digits[(hash >> (4 * i)) & 0xfU];
+  }
+  return text;
+}
@@ -0,0 +1,42 @@
+/*
+ * Copyright (C) 2011 Weill Medical College of Cornell University
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License as
+ *  published by the Free Software Foundation; either version 2 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+#include "protocol_model.hpp"
+
+namespace clamp_protocol
+{
+
+// Canonical 64-bit hash of the stimulus a compiled protocol produces. Every
+// step is hashed in execution order together with the RT period, the liquid
+// junction potential and the output scaling, using a fixed little-endian
+// encoding so the same stimulus hashes the same on every machine. Negative
+// zero and NaN payloads are normalized first.
+uint64_t hashProtocol(compiled_view protocol,
+                      int64_t period_ns,
+                      double junction_potential_mv,
+                      double output_factor);
+
+// Fixed width (16 digit) lowercase hexadecimal form used in metadata
+std::string hashToString(uint64_t hash);
+
+}  // namespace clamp_protocol
@@ -0,0 +1,57 @@
+/*
+ * Copyright (C) 2011 Weill Medical College of Cornell University
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License as
+ *  published by the Free Software Foundation; either version 2 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#include <algorithm>
+
+#include "protocol_latency.hpp"
+
+clamp_protocol::LatencyProbe::LatencyProbe(uint32_t interval, size_t capacity)
+    : interval(std::max<uint32_t>(interval, 1))
+    , tags(std::max<size_t>(capacity, 1))
+{
+}
+
+void clamp_protocol::LatencyProbe::recordWritten(int64_t now_ns,
+                                                 int64_t sample)
+{
+  if (written++ % interval != 0) {
+    return;
+  }
+  const size_t current_head = head.load(std::memory_order_relaxed);
+  if (current_head - tail.load(std::memory_order_acquire) == tags.size()) {
+    dropped.fetch_add(1, std::memory_order_relaxed);
+    return;
+  }
+  tags[current_head % tags.size()] = {sample, now_ns};
+  head.store(current_head + 1, std::memory_order_release);
+}
+
+void clamp_protocol::LatencyProbe::framePainted(int64_t now_ns)
+{
+  size_t current_tail = tail.load(std::memory_order_relaxed);
+  const size_t current_head = head.load(std::memory_order_acquire);
+  while (current_tail != current_head) {
+    const tag_t& tag = tags[current_tail % tags.size()];
+    if (tag.sample > plotted) {  // Not on screen yet
+      break;
+    }
+    latencies.add(now_ns - tag.tagged_ns);
+    ++current_tail;
+  }
+  tail.store(current_tail, std::memory_order_release);
+}
@@ -0,0 +1,77 @@
+/*
+ * Copyright (C) 2011 Weill Medical College of Cornell University
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License as
+ *  published by the Free Software Foundation; either version 2 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "protocol_metrics.hpp"
+
+namespace clamp_protocol
+{
+
+// Sample-to-pixel latency probe. The RT thread tags every `interval`-th
+// record it writes to the FIFO with the record's RT sample counter and the
+// RT time it was written; the GUI notes the newest sample it hands to the
+// plot and, after each painted frame, resolves every tag at or before it.
+// Going by sample counter rather than by counting records keeps tags in
+// step however the stream was thinned on the way. Tags travel through
+// their own small SPSC ring, so the records themselves are unchanged and
+// recording never allocates.
+class LatencyProbe
+{
+public:
+  explicit LatencyProbe(uint32_t interval = 1000, size_t capacity = 1024);
+
+  // RT thread: after each record successfully written to the FIFO, with
+  // its data_token_t::sample
+  void recordWritten(int64_t now_ns, int64_t sample);
+
+  // GUI thread: records up to RT sample counter `sample` were added to the
+  // plot
+  void samplesPlotted(int64_t sample) { plotted = std::max(plotted, sample); }
+  // GUI thread: after a frame was painted, with the RT clock
+  void framePainted(int64_t now_ns);
+  // GUI thread: forget the latencies seen so far
+  void reset() { latencies.reset(); }
+
+  const LatencyHistogram& histogram() const { return latencies; }
+  uint64_t droppedTags() const { return dropped.load(); }
+
+private:
+  struct tag_t
+  {
+    int64_t sample;  // RT sample counter of the tagged record
+    int64_t tagged_ns;
+  };
+
+  uint32_t interval;
+  std::vector<tag_t> tags;
+  std::atomic<size_t> head {0};
+  std::atomic<size_t> tail {0};
+  std::atomic<uint64_t> dropped {0};
+  uint64_t written = 0;  // RT thread
+  int64_t plotted = -1;  // GUI thread: newest sample on screen
+  LatencyHistogram latencies;  // GUI thread
+};
+
+}  // namespace clamp_protocol
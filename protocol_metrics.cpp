@@ -0,0 +1,167 @@
+/*
+ * Copyright (C) 2011 Weill Medical College of Cornell University
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License as
+ *  published by the Free Software Foundation; either version 2 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#include <algorithm>
+#include <cmath>
+
+#include "protocol_metrics.hpp"
+
+size_t clamp_protocol::LatencyHistogram::bucketOf(int64_t ns)
+{
+  if (ns < 4) {
+    return static_cast<size_t>(std::max<int64_t>(ns, 0));
+  }
+  const auto value = static_cast<uint64_t>(ns);
+  const int octave = 63 - __builtin_clzll(value);  // >= 2
+  const auto sub = static_cast<size_t>((value >> (octave - 2)) & 3U);
+  return std::min(static_cast<size_t>(octave - 1) * 4 + sub, bucket_count - 1);
+}
+
+int64_t clamp_protocol::LatencyHistogram::bucketUpperBound(size_t index)
+{
+  if (index < 4) {
+    return static_cast<int64_t>(index);
+  }
+  const size_t octave = index / 4 + 1;
+  const size_t sub = index % 4;
+  return static_cast<int64_t>(((4 + sub + 1) << (octave - 2)) - 1);
+}
+
+void clamp_protocol::LatencyHistogram::add(int64_t ns)
+{
+  ++buckets[bucketOf(ns)];
+  ++total;
+  largest = std::max(largest, ns);
+}
+
+void clamp_protocol::LatencyHistogram::reset()
+{
+  buckets.fill(0);
+  total = 0;
+  largest = 0;
+}
+
+int64_t clamp_protocol::LatencyHistogram::percentile(double q) const
+{
+  if (total == 0) {
+    return 0;
+  }
+  const auto rank = static_cast<uint64_t>(
+      std::ceil(std::clamp(q, 0.0, 1.0) * static_cast<double>(total)));
+  uint64_t seen = 0;
+  for (size_t i = 0; i < bucket_count; ++i) {
+    seen += buckets[i];
+    if (seen >= std::max<uint64_t>(rank, 1)) {
+      return std::min(bucketUpperBound(i), largest);
+    }
+  }
+  return largest;
+}
+
+clamp_protocol::RtMonitor::RtMonitor(runtime_metrics* shared,
+                                     uint32_t window)
+    : metrics(shared)
+    , window(std::max<uint32_t>(window, 1))
+{
+}
+
+void clamp_protocol::RtMonitor::fifoWrite(int64_t now_ns,
+                                          size_t bytes,
+                                          bool written_ok)
+{
+  if (!written_ok) {
+    ++dropped;
+    return;
+  }
+  written += bytes;
+  high_water = std::max(
+      high_water,
+      written - metrics->fifo_read.load(std::memory_order_relaxed));
+  if (metrics->first_pending_ns.load(std::memory_order_relaxed) < 0) {
+    metrics->first_pending_ns.store(now_ns, std::memory_order_relaxed);
+  }
+}
+
+bool clamp_protocol::RtMonitor::executeTime(int64_t ns)
+{
+  histogram.add(ns);
+  max_ns = std::max(max_ns, ns);
+  if (++ticks < window) {
+    return false;
+  }
+  metrics->execute_last_ns.store(ns, std::memory_order_relaxed);
+  metrics->execute_max_ns.store(max_ns, std::memory_order_relaxed);
+  metrics->execute_p99_ns.store(histogram.percentile(0.99),
+                                std::memory_order_relaxed);
+  metrics->fifo_written.store(written, std::memory_order_relaxed);
+  metrics->fifo_high_water.store(high_water, std::memory_order_relaxed);
+  metrics->dropped.store(dropped, std::memory_order_relaxed);
+  histogram.reset();
+  ticks = 0;
+  return true;
+}
+
+void clamp_protocol::RtMonitor::fifoReplaced()
+{
+  metrics->fifo_read.store(written, std::memory_order_relaxed);
+  metrics->fifo_written.store(written, std::memory_order_relaxed);
+  metrics->first_pending_ns.store(-1, std::memory_order_relaxed);
+}
+
+clamp_protocol::GuiMonitor::GuiMonitor(runtime_metrics* shared)
+    : metrics(shared)
+{
+}
+
+void clamp_protocol::GuiMonitor::draining(int64_t now_ns)
+{
+  // Writes after this point set a new first pending time, so they are
+  // measured at the next drain even if this one picks them up
+  const int64_t first_pending = metrics->first_pending_ns.exchange(-1);
+  if (first_pending >= 0) {
+    metrics->drain_latency_ns.store(now_ns - first_pending,
+                                    std::memory_order_relaxed);
+  }
+}
+
+void clamp_protocol::GuiMonitor::drained(size_t bytes)
+{
+  metrics->fifo_read.fetch_add(bytes, std::memory_order_relaxed);
+}
+
+void clamp_protocol::GuiMonitor::analysisQueued(size_t chunks)
+{
+  metrics->analysis_queued.store(chunks, std::memory_order_relaxed);
+}
+
+void clamp_protocol::GuiMonitor::replotted(int64_t start_ns, int64_t end_ns)
+{
+  metrics->replot_ns.store(end_ns - start_ns, std::memory_order_relaxed);
+  if (fps_window_start < 0) {
+    fps_window_start = start_ns;
+  }
+  ++fps_frames;
+  const int64_t elapsed = end_ns - fps_window_start;
+  if (elapsed >= 1000000000) {
+    metrics->replot_fps.store(static_cast<double>(fps_frames) * 1e9
+                                  / static_cast<double>(elapsed),
+                              std::memory_order_relaxed);
+    fps_window_start = end_ns;
+    fps_frames = 0;
+  }
+}
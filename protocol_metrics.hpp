@@ -0,0 +1,133 @@
+/*
+ * Copyright (C) 2011 Weill Medical College of Cornell University
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License as
+ *  published by the Free Software Foundation; either version 2 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+namespace clamp_protocol
+{
+
+// Histogram of durations with four buckets per power of two, so
+// percentiles come within 25% without keeping the samples. Fixed size and
+// allocation free.
+class LatencyHistogram
+{
+public:
+  static constexpr size_t bucket_count = 4 * 48;
+
+  void add(int64_t ns);
+  void reset();
+  uint64_t count() const { return total; }
+  int64_t max() const { return largest; }
+  // Upper bound of the bucket holding the q-th quantile (0 < q <= 1), or
+  // zero when empty
+  int64_t percentile(double q) const;
+  uint64_t bucket(size_t index) const { return buckets[index]; }
+  static int64_t bucketUpperBound(size_t index);
+
+private:
+  static size_t bucketOf(int64_t ns);
+
+  std::array<uint64_t, bucket_count> buckets {};
+  uint64_t total = 0;
+  int64_t largest = 0;
+};
+
+// Live operational metrics shared by the RT thread and the GUI. Each field
+// has a single writer; the RT thread publishes its fields at a decimated
+// rate through RtMonitor.
+struct runtime_metrics
+{
+  // RT thread
+  std::atomic<int64_t> execute_last_ns {0};
+  std::atomic<int64_t> execute_max_ns {0};
+  std::atomic<int64_t> execute_p99_ns {0};  // Over the last window
+  std::atomic<uint64_t> fifo_written {0};  // Bytes
+  std::atomic<uint64_t> fifo_high_water {0};  // Bytes
+  std::atomic<uint64_t> dropped {0};  // Records that did not fit
+  std::atomic<int64_t> first_pending_ns {-1};  // Oldest undrained write
+
+  // GUI thread
+  std::atomic<uint64_t> fifo_read {0};  // Bytes
+  std::atomic<int64_t> drain_latency_ns {0};
+  std::atomic<int64_t> replot_ns {0};
+  std::atomic<double> replot_fps {0.0};
+  std::atomic<uint64_t> analysis_queued {0};  // Chunks in the pipeline
+
+  uint64_t fifoFill() const { return fifo_written.load() - fifo_read.load(); }
+};
+
+// RT side bookkeeping for runtime_metrics. Call fifoWrite() for every
+// record and executeTime() once per execute(); the atomics are written
+// once every `window` ticks.
+class RtMonitor
+{
+public:
+  explicit RtMonitor(runtime_metrics* shared, uint32_t window = 1000);
+
+  void fifoWrite(int64_t now_ns, size_t bytes, bool written);
+  // Bytes written and not yet drained, as of the GUI's last drain
+  uint64_t fifoFill() const
+  {
+    return written - metrics->fifo_read.load(std::memory_order_relaxed);
+  }
+  // Returns true when the tick closed a window and the metrics were
+  // published
+  bool executeTime(int64_t ns);
+  // The FIFO was replaced with whatever it held: counts it all as read and
+  // publishes that. Call from the GUI thread with the RT thread idle.
+  void fifoReplaced();
+
+private:
+  runtime_metrics* metrics;
+  uint32_t window;
+  uint32_t ticks = 0;
+  LatencyHistogram histogram;
+  int64_t max_ns = 0;
+  uint64_t written = 0;
+  uint64_t high_water = 0;
+  uint64_t dropped = 0;
+};
+
+// GUI side bookkeeping for runtime_metrics. Drains add to the shared read
+// count, so a monitor created when the plot reopens carries on from the
+// last one.
+class GuiMonitor
+{
+public:
+  explicit GuiMonitor(runtime_metrics* shared);
+
+  // Call right before reading the FIFO, with the RT clock, and then with
+  // the bytes read
+  void draining(int64_t now_ns);
+  void drained(size_t bytes);
+  void replotted(int64_t start_ns, int64_t end_ns);
+  // After each drain, with AnalysisPipeline::queuedChunks()
+  void analysisQueued(size_t chunks);
+
+private:
+  runtime_metrics* metrics;
+  int64_t fps_window_start = -1;
+  uint32_t fps_frames = 0;
+};
+
+}  // namespace clamp_protocol
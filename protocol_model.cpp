@@ -0,0 +1,377 @@
+/*
+ * Copyright (C) 2011 Weill Medical College of Cornell University
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License as
+ *  published by the Free Software Foundation; either version 2 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+
+#include "protocol_model.hpp"
+
+void clamp_protocol::Protocol::addStep(size_t seg_id)
+{
+  if (seg_id >= segments.size()) {  // If segment doesn't exist or not at end
+    return;
+  }
+  clamp_protocol::ProtocolSegment& segment = getSegment(seg_id);
+  segment.steps.push_back({});
+}
+
+void clamp_protocol::Protocol::insertStep(size_t seg_id, size_t step_id)
+{
+  if (seg_id >= segments.size() || step_id > segments.at(seg_id).steps.size()) {
+    return;
+  }
+  auto iter = segments.at(seg_id).steps.begin() + static_cast<int>(step_id);
+  segments.at(seg_id).steps.insert(iter, {});
+}
+
+void clamp_protocol::Protocol::deleteStep(size_t seg_id, size_t step_id)
+{
+  if (seg_id >= segments.size() || step_id >= segments.at(seg_id).steps.size()) {
+    return;
+  }
+
+  clamp_protocol::ProtocolSegment& segment = getSegment(seg_id);
+  auto it = segment.steps.begin() + static_cast<int>(step_id);
+  segment.steps.erase(it);
+}
+
+void clamp_protocol::Protocol::modifyStep(
+    size_t seg_id, size_t step_id, const clamp_protocol::ProtocolStep& step)
+{
+  segments.at(seg_id).steps.at(step_id) = step;
+}
+
+std::array<std::vector<double>, 2> clamp_protocol::Protocol::dryrun(
+    int64_t period_ns) const
+{
+  // Interprets the segments directly rather than through compile() and
+  // ProtocolEngine, so the two can be checked against each other. The
+  // sample rules must stay the same as the engine's.
+  std::array<std::vector<double>, 2> result;
+  if (period_ns <= 0) {
+    return result;
+  }
+  const auto period = static_cast<double>(period_ns);
+  int64_t current_sample = 0;
+  for (const auto& segment : segments) {
+    if (segment.steps.empty()) {  // Nothing to play, however many sweeps
+      continue;
+    }
+    for (size_t sweepIdx = 0; sweepIdx < segment.numSweeps; ++sweepIdx) {
+      const auto sweep = static_cast<double>(sweepIdx);
+      for (const auto& step : segment.steps) {
+        const double duration_ms = std::max(
+            0.0,
+            step.parameters[clamp_protocol::STEP_DURATION]
+                + step.parameters[clamp_protocol::DELTA_STEP_DURATION]
+                    * sweep);
+        const int64_t samples = std::llround(duration_ms * 1e6 / period);
+        const double y1 = step.parameters[clamp_protocol::HOLDING_LEVEL_1]
+            + step.parameters[clamp_protocol::DELTA_HOLDING_LEVEL_1] * sweep;
+        double slope = 0.0;
+        switch (step.stepType) {
+          case clamp_protocol::STEP:
+            break;
+          case clamp_protocol::RAMP: {
+            const double y2 = step.parameters[clamp_protocol::HOLDING_LEVEL_2]
+                + step.parameters[clamp_protocol::DELTA_HOLDING_LEVEL_2]
+                    * sweep;
+            if (samples > 0) {
+              slope = (y2 - y1) / static_cast<double>(samples);
+            }
+            break;
+          }
+          default:
+            std::cerr << "ERROR - In function Protocol::dryrun() switch( "
+                         "stepType ) default case called\n";
+            return {};
+        }
+        for (int64_t k = 0; k < samples; ++k) {
+          result[0].push_back(static_cast<double>(current_sample) * period
+                              * 1e-6);
+          result[1].push_back(y1 + slope * static_cast<double>(k));
+          ++current_sample;
+        }
+      }  // step loop
+    }  // sweep loop
+  }  // segment loop
+
+  return result;
+}
+
+double clamp_protocol::Protocol::segmentDuration(size_t seg_id) const
+{
+  const ProtocolSegment& segment = segments.at(seg_id);
+  double duration_ms = 0.0;
+  if (segment.steps.empty()) {
+    return duration_ms;
+  }
+  for (size_t sweep = 0; sweep < segment.numSweeps; ++sweep) {
+    for (const auto& step : segment.steps) {
+      duration_ms += std::max(
+          0.0,
+          step.parameters[clamp_protocol::STEP_DURATION]
+              + step.parameters[clamp_protocol::DELTA_STEP_DURATION]
+                  * static_cast<double>(sweep));
+    }
+  }
+  return duration_ms;
+}
+
+std::array<std::vector<double>, 2> clamp_protocol::Protocol::segmentVertices(
+    size_t seg_id) const
+{
+  const ProtocolSegment& segment = segments.at(seg_id);
+  std::array<std::vector<double>, 2> result;
+  result[0].reserve(2 * segment.numSweeps * segment.steps.size());
+  result[1].reserve(2 * segment.numSweeps * segment.steps.size());
+  double time_ms = 0.0;
+  if (segment.steps.empty()) {
+    return result;
+  }
+  for (size_t sweep = 0; sweep < segment.numSweeps; ++sweep) {
+    const auto sweep_d = static_cast<double>(sweep);
+    for (const auto& step : segment.steps) {
+      const double duration = std::max(
+          0.0,
+          step.parameters[clamp_protocol::STEP_DURATION]
+              + step.parameters[clamp_protocol::DELTA_STEP_DURATION] * sweep_d);
+      const double y1 = step.parameters[clamp_protocol::HOLDING_LEVEL_1]
+          + step.parameters[clamp_protocol::DELTA_HOLDING_LEVEL_1] * sweep_d;
+      double y2 = y1;
+      if (step.stepType == clamp_protocol::RAMP) {
+        y2 = step.parameters[clamp_protocol::HOLDING_LEVEL_2]
+            + step.parameters[clamp_protocol::DELTA_HOLDING_LEVEL_2] * sweep_d;
+      }
+      result[0].push_back(time_ms);
+      result[1].push_back(y1);
+      time_ms += duration;
+      result[0].push_back(time_ms);
+      result[1].push_back(y2);
+    }
+  }
+  return result;
+}
+
+void clamp_protocol::Protocol::addSegment()
+{
+  segments.emplace_back();
+}
+
+void clamp_protocol::Protocol::deleteSegment(size_t seg_id)
+{
+  if (seg_id >= segments.size()) {
+    return;
+  }
+
+  auto it = segments.begin();
+  segments.erase(it + static_cast<int>(seg_id));
+}
+
+void clamp_protocol::Protocol::modifySegment(
+    size_t seg_id, const clamp_protocol::ProtocolSegment& segment)
+{
+  segments.at(seg_id) = segment;
+}
+
+clamp_protocol::ProtocolStep clamp_protocol::ProtocolStep::hold(
+    sweep_expr duration, sweep_expr level, ampMode_t mode)
+{
+  ProtocolStep step;
+  step.ampMode = mode;
+  step.stepType = clamp_protocol::STEP;
+  step.parameters[clamp_protocol::STEP_DURATION] = duration.base;
+  step.parameters[clamp_protocol::DELTA_STEP_DURATION] = duration.delta;
+  step.parameters[clamp_protocol::HOLDING_LEVEL_1] = level.base;
+  step.parameters[clamp_protocol::DELTA_HOLDING_LEVEL_1] = level.delta;
+  return step;
+}
+
+clamp_protocol::ProtocolStep clamp_protocol::ProtocolStep::ramp(
+    sweep_expr duration, sweep_expr from, sweep_expr to, ampMode_t mode)
+{
+  ProtocolStep step = hold(duration, from, mode);
+  step.stepType = clamp_protocol::RAMP;
+  step.parameters[clamp_protocol::HOLDING_LEVEL_2] = to.base;
+  step.parameters[clamp_protocol::DELTA_HOLDING_LEVEL_2] = to.delta;
+  return step;
+}
+
+clamp_protocol::ProtocolSegment& clamp_protocol::ProtocolSegment::sweeps(
+    size_t count)
+{
+  numSweeps = count;
+  return *this;
+}
+
+clamp_protocol::ProtocolSegment& clamp_protocol::ProtocolSegment::step(
+    const ProtocolStep& step)
+{
+  steps.push_back(step);
+  return *this;
+}
+
+clamp_protocol::ProtocolSegment& clamp_protocol::ProtocolSegment::hold(
+    sweep_expr duration, sweep_expr level, ampMode_t mode)
+{
+  return step(ProtocolStep::hold(duration, level, mode));
+}
+
+clamp_protocol::ProtocolSegment& clamp_protocol::ProtocolSegment::ramp(
+    sweep_expr duration, sweep_expr from, sweep_expr to, ampMode_t mode)
+{
+  return step(ProtocolStep::ramp(duration, from, to, mode));
+}
+
+clamp_protocol::ProtocolSegment& clamp_protocol::ProtocolSegment::repeat(
+    size_t times)
+{
+  const std::vector<ProtocolStep> pattern = steps;
+  steps.reserve(pattern.size() * std::max<size_t>(times, 1));
+  for (size_t i = 1; i < times; ++i) {
+    steps.insert(steps.end(), pattern.begin(), pattern.end());
+  }
+  return *this;
+}
+
+clamp_protocol::ProtocolSegment& clamp_protocol::Protocol::appendSegment(
+    size_t sweeps)
+{
+  segments.emplace_back();
+  segments.back().numSweeps = sweeps;
+  return segments.back();
+}
+
+clamp_protocol::Protocol& clamp_protocol::Protocol::append(
+    const clamp_protocol::ProtocolSegment& segment)
+{
+  segments.push_back(segment);
+  return *this;
+}
+
+clamp_protocol::CompiledProtocol clamp_protocol::Protocol::compile() const
+{
+  CompiledProtocol compiled;
+  size_t total_steps = 0;
+  for (const auto& segment : segments) {
+    total_steps += segment.numSweeps * segment.steps.size();
+  }
+  compiled.steps.reserve(total_steps);
+
+  for (size_t seg_id = 0; seg_id < segments.size(); ++seg_id) {
+    const ProtocolSegment& segment = segments[seg_id];
+    if (segment.steps.empty()) {
+      continue;
+    }
+    for (size_t sweep = 0; sweep < segment.numSweeps; ++sweep) {
+      const auto sweep_d = static_cast<double>(sweep);
+      for (size_t step_id = 0; step_id < segment.steps.size(); ++step_id) {
+        const ProtocolStep& step = segment.steps[step_id];
+        compiled_step_t instruction;
+        instruction.duration = std::max(
+            0.0,
+            step.parameters[clamp_protocol::STEP_DURATION]
+                + step.parameters[clamp_protocol::DELTA_STEP_DURATION]
+                    * sweep_d);
+        instruction.level1 = step.parameters[clamp_protocol::HOLDING_LEVEL_1]
+            + step.parameters[clamp_protocol::DELTA_HOLDING_LEVEL_1] * sweep_d;
+        instruction.level2 = instruction.level1;
+        if (step.stepType == clamp_protocol::RAMP) {
+          instruction.level2 =
+              step.parameters[clamp_protocol::HOLDING_LEVEL_2]
+              + step.parameters[clamp_protocol::DELTA_HOLDING_LEVEL_2]
+                  * sweep_d;
+        }
+        instruction.segment = static_cast<uint32_t>(seg_id);
+        instruction.sweep = static_cast<uint32_t>(sweep);
+        instruction.step = static_cast<uint32_t>(step_id);
+        instruction.ampMode = step.ampMode;
+        instruction.stepType = step.stepType;
+        compiled.steps.push_back(instruction);
+      }
+    }
+  }
+  return compiled;
+}
+
+bool clamp_protocol::validStep(const compiled_step_t& step)
+{
+  return std::isfinite(step.duration) && std::isfinite(step.level1)
+      && std::isfinite(step.level2)
+      && (step.ampMode == VOLTAGE || step.ampMode == CURRENT)
+      && (step.stepType == STEP || step.stepType == RAMP);
+}
+
+double clamp_protocol::CompiledProtocol::duration() const
+{
+  double duration_ms = 0.0;
+  for (const auto& step : steps) {
+    duration_ms += step.duration;
+  }
+  return duration_ms;
+}
+
+size_t clamp_protocol::Protocol::numSweeps(size_t seg_id) const
+{
+  return segments.at(seg_id).numSweeps;
+}
+
+void clamp_protocol::Protocol::setSweeps(size_t seg_id, uint32_t sweeps)
+{
+  segments.at(seg_id).numSweeps = sweeps;
+}
+
+clamp_protocol::ProtocolSegment& clamp_protocol::Protocol::getSegment(
+    size_t seg_id)
+{
+  return segments.at(seg_id);
+}
+
+const clamp_protocol::ProtocolSegment& clamp_protocol::Protocol::getSegment(
+    size_t seg_id) const
+{
+  return segments.at(seg_id);
+}
+
+clamp_protocol::ProtocolStep& clamp_protocol::Protocol::getStep(size_t segment,
+                                                                size_t step)
+{
+  return segments.at(segment).steps.at(step);
+}
+
+const clamp_protocol::ProtocolStep& clamp_protocol::Protocol::getStep(
+    size_t segment, size_t step) const
+{
+  return segments.at(segment).steps.at(step);
+}
+
+size_t clamp_protocol::Protocol::numSegments() const
+{
+  return segments.size();
+}
+
+size_t clamp_protocol::Protocol::segmentSize(size_t seg_id) const
+{
+  return segments.at(seg_id).steps.size();
+}
+
+void clamp_protocol::Protocol::clear()
+{
+  segments.clear();
+}
@@ -0,0 +1,214 @@
+/*
+ * Copyright (C) 2011 Weill Medical College of Cornell University
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License as
+ *  published by the Free Software Foundation; either version 2 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Qt is optional for the protocol core. With it, protocols convert to and
+// from QDomDocument; without it they are read with readCsp().
+#ifdef CLAMP_PROTOCOL_WITH_QT
+#include <QDomDocument>
+#endif
+
+namespace clamp_protocol
+{
+
+enum ampMode_t : int
+{
+  VOLTAGE = 0,
+  CURRENT
+};
+
+enum stepType_t : int
+{
+  STEP = 0,
+  RAMP,
+};
+
+// DO NOT REORDER! IF ADDING MORE PARAMETERS INSERT RIGHT BEFORE
+// PROTOCOL_PARAMETERS_SIZE!
+enum protocol_parameters : size_t
+{
+  STEP_DURATION = 0,
+  DELTA_STEP_DURATION,
+  HOLDING_LEVEL_1,
+  DELTA_HOLDING_LEVEL_1,
+  HOLDING_LEVEL_2,
+  DELTA_HOLDING_LEVEL_2,
+  PROTOCOL_PARAMETERS_SIZE
+};
+
+// Step parameter as a function of the sweep index: base + delta * sweep.
+// Converts implicitly from a plain value so builder calls can mix both.
+struct sweep_expr
+{
+  sweep_expr(double value)  // NOLINT(google-explicit-constructor)
+      : base(value)
+  {
+  }
+  sweep_expr(double base_value, double delta_value)
+      : base(base_value)
+      , delta(delta_value)
+  {
+  }
+  double base = 0.0;
+  double delta = 0.0;
+};
+
+// Most sweeps a segment may have; compiled steps store the sweep as 32 bits
+constexpr int64_t max_sweeps = UINT32_MAX;
+
+// Individual step within a protocol
+struct ProtocolStep
+{
+  static ProtocolStep hold(sweep_expr duration,
+                           sweep_expr level,
+                           ampMode_t mode = VOLTAGE);
+  static ProtocolStep ramp(sweep_expr duration,
+                           sweep_expr from,
+                           sweep_expr to,
+                           ampMode_t mode = VOLTAGE);
+
+  ampMode_t ampMode = VOLTAGE;
+  stepType_t stepType = STEP;
+  std::array<double,
+             static_cast<size_t>(protocol_parameters::PROTOCOL_PARAMETERS_SIZE)>
+      parameters {};
+};  // struct ProtocolStep
+
+// A segment within a protocol, made up of ProtocolSteps. The builder calls
+// return the segment so steps can be chained:
+//   protocol.appendSegment(9).hold(50, -80).hold(100, {-80, 10}).hold(50, -80);
+struct ProtocolSegment
+{
+  ProtocolSegment& sweeps(size_t count);  // Set number of sweeps
+  ProtocolSegment& step(const ProtocolStep& step);  // Append a step
+  ProtocolSegment& hold(sweep_expr duration,
+                        sweep_expr level,
+                        ampMode_t mode = VOLTAGE);
+  ProtocolSegment& ramp(sweep_expr duration,
+                        sweep_expr from,
+                        sweep_expr to,
+                        ampMode_t mode = VOLTAGE);
+  // Repeat the steps added so far until they appear `times` times in total
+  ProtocolSegment& repeat(size_t times);
+
+  std::vector<ProtocolStep> steps;
+  size_t numSweeps = 1;
+};
+
+// One step of one sweep with the sweep deltas already applied. A compiled
+// protocol is the flat sequence the protocol runs through, in order.
+// The layout is stored verbatim in protocol archives, so keep it free of
+// padding and bump the archive version when it changes.
+struct compiled_step_t
+{
+  double duration = 0.0;  // ms
+  double level1 = 0.0;  // Level at the start of the step
+  double level2 = 0.0;  // Level at the end of the step, same as level1 for STEP
+  uint32_t segment = 0;
+  uint32_t sweep = 0;
+  uint32_t step = 0;
+  ampMode_t ampMode = VOLTAGE;
+  stepType_t stepType = STEP;
+  uint32_t reserved = 0;
+};
+static_assert(sizeof(compiled_step_t) == 48,
+              "compiled_step_t must stay padding free");
+
+// Read-only view of compiled steps, owned either by a CompiledProtocol or by
+// a memory-mapped protocol archive
+struct compiled_view
+{
+  const compiled_step_t* steps = nullptr;
+  size_t size = 0;
+};
+
+// True for steps compile() could have produced: finite durations and levels
+// and a known mode and type. Steps read back from files are checked with it
+// before anything plays them.
+bool validStep(const compiled_step_t& step);
+
+struct CompiledProtocol
+{
+  double duration() const;  // Length of the whole protocol (ms)
+  compiled_view view() const { return {steps.data(), steps.size()}; }
+
+  std::vector<compiled_step_t> steps;
+};
+
+class Protocol
+{
+public:
+  ProtocolSegment& getSegment(size_t seg_id);  // Return a segment
+  const ProtocolSegment& getSegment(size_t seg_id) const;
+  size_t numSegments() const;  // Number of segments in a protocol
+  size_t numSweeps(size_t seg_id) const;  // Number of sweeps in a segment
+  void setSweeps(size_t seg_id, uint32_t sweeps);  // Set sweeps for a segment
+  ProtocolStep& getStep(size_t segment,
+                        size_t step);  // Return step in a segment
+  const ProtocolStep& getStep(size_t segment, size_t step) const;
+  size_t segmentSize(size_t seg_id) const;  // Return number of steps in segment
+#ifdef CLAMP_PROTOCOL_WITH_QT
+  void toDoc();  // Convert protocol to QDomDocument
+  // Load protocol from a QDomDocument. Rejects the document, leaving the
+  // protocol untouched, under the same rules as readCsp().
+  bool fromDoc(const QDomDocument& doc);
+#endif
+  void clear();  // Clears container
+
+  void addSegment();  // Add a segment to container
+  void deleteSegment(size_t seg_id);  // Delete a segment from container
+  void modifySegment(size_t seg_id, const ProtocolSegment& segment);
+  void addStep(size_t seg_id);  // Add a step to a segment in container
+  void insertStep(size_t seg_id, size_t step_id);
+  void deleteStep(size_t seg_id,
+                  size_t step_id);  // Delete a step from segment in container
+  void modifyStep(size_t seg_id, size_t step_id, const ProtocolStep& step);
+
+  // Builder interface. The returned segment reference is valid until the
+  // next segment is added.
+  ProtocolSegment& appendSegment(size_t sweeps = 1);
+  Protocol& append(const ProtocolSegment& segment);
+  CompiledProtocol compile() const;  // Expand sweeps into a flat step sequence
+
+#ifdef CLAMP_PROTOCOL_WITH_QT
+  QDomDocument& getProtocolDoc() { return protocolDoc; }
+#endif
+  // Time (ms) and amplitude of every sample the protocol plays at the given
+  // period, sample for sample what ProtocolEngine produces
+  std::array<std::vector<double>, 2> dryrun(int64_t period_ns) const;
+  double segmentDuration(size_t seg_id) const;  // Length of all sweeps (ms)
+  // Corner points of a segment (two per step per sweep), time relative to the
+  // start of the segment (ms)
+  std::array<std::vector<double>, 2> segmentVertices(size_t seg_id) const;
+
+private:
+#ifdef CLAMP_PROTOCOL_WITH_QT
+  QDomElement segmentToNode(QDomDocument& doc, size_t seg_id);
+  QDomElement stepToNode(QDomDocument& doc, size_t seg_id, size_t stepNum);
+  QDomDocument protocolDoc;
+#endif
+  std::vector<ProtocolSegment> segments;
+};  // class Protocol
+
+}  // namespace clamp_protocol
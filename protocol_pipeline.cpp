@@ -0,0 +1,684 @@
+/*
+ * Copyright (C) 2011 Weill Medical College of Cornell University
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License as
+ *  published by the Free Software Foundation; either version 2 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <utility>
+
+#include "protocol_pipeline.hpp"
+
+namespace
+{
+
+constexpr double two_pi = 6.283185307179586;
+
+int64_t steadyNow()
+{
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+bool sameSweep(const clamp_protocol::data_token_t& a,
+               const clamp_protocol::data_token_t& b)
+{
+  return a.protocolHash == b.protocolHash && a.trial == b.trial
+      && a.segment == b.segment && a.sweep == b.sweep;
+}
+
+}  // namespace
+
+const char* clamp_protocol::stageName(pipeline_stage stage)
+{
+  switch (stage) {
+    case STAGE_FILTER:
+      return "filter";
+    case STAGE_BASELINE:
+      return "baseline";
+    case STAGE_MEASURE:
+      return "measure";
+    case STAGE_AVERAGE:
+      return "average";
+    case STAGE_DISPLAY:
+      return "display";
+    default:
+      return "unknown";
+  }
+}
+
+clamp_protocol::chunk_handle::chunk_handle(pipeline_chunk* chunk)
+    : chunk(chunk)
+{
+  if (chunk != nullptr) {
+    chunk->refs.fetch_add(1, std::memory_order_relaxed);
+  }
+}
+
+clamp_protocol::chunk_handle::chunk_handle(const chunk_handle& other)
+    : chunk_handle(other.chunk)
+{
+}
+
+clamp_protocol::chunk_handle::chunk_handle(chunk_handle&& other) noexcept
+    : chunk(other.chunk)
+{
+  other.chunk = nullptr;
+}
+
+clamp_protocol::chunk_handle& clamp_protocol::chunk_handle::operator=(
+    const chunk_handle& other)
+{
+  if (other.chunk != chunk) {
+    chunk_handle copy(other);
+    std::swap(chunk, copy.chunk);
+  }
+  return *this;
+}
+
+clamp_protocol::chunk_handle& clamp_protocol::chunk_handle::operator=(
+    chunk_handle&& other) noexcept
+{
+  if (&other != this) {
+    reset();
+    std::swap(chunk, other.chunk);
+  }
+  return *this;
+}
+
+clamp_protocol::chunk_handle::~chunk_handle()
+{
+  reset();
+}
+
+void clamp_protocol::chunk_handle::reset()
+{
+  pipeline_chunk* released = std::exchange(chunk, nullptr);
+  if (released == nullptr
+      || released->refs.fetch_sub(1, std::memory_order_acq_rel) != 1)
+  {
+    return;
+  }
+  if (released->owner != nullptr) {
+    released->owner->recycle(released);
+  } else {
+    delete released;
+  }
+}
+
+clamp_protocol::chunk_handle clamp_protocol::makeChunk()
+{
+  return chunk_handle(new pipeline_chunk);
+}
+
+clamp_protocol::ChunkPool::ChunkPool(size_t chunks, size_t records)
+{
+  this->chunks.reserve(chunks);
+  free_chunks.reserve(chunks);
+  for (size_t i = 0; i < chunks; ++i) {
+    auto chunk = std::make_unique<pipeline_chunk>();
+    chunk->tokens.reserve(records);
+    chunk->owner = this;
+    free_chunks.push_back(chunk.get());
+    this->chunks.push_back(std::move(chunk));
+  }
+}
+
+clamp_protocol::ChunkPool::~ChunkPool() = default;
+
+clamp_protocol::chunk_handle clamp_protocol::ChunkPool::acquire()
+{
+  pipeline_chunk* chunk = nullptr;
+  {
+    const std::lock_guard<std::mutex> guard(lock);
+    if (free_chunks.empty()) {
+      return nullptr;
+    }
+    chunk = free_chunks.back();
+    free_chunks.pop_back();
+  }
+  return chunk_handle(chunk);
+}
+
+size_t clamp_protocol::ChunkPool::available() const
+{
+  const std::lock_guard<std::mutex> guard(lock);
+  return free_chunks.size();
+}
+
+void clamp_protocol::ChunkPool::recycle(pipeline_chunk* chunk)
+{
+  // Clearing keeps the capacity, including any a merge added
+  chunk->tokens.clear();
+  chunk->summaries.clear();
+  chunk->decimation = 1;
+  const std::lock_guard<std::mutex> guard(lock);
+  free_chunks.push_back(chunk);
+}
+
+void clamp_protocol::decimateMinMax(pipeline_chunk& chunk, uint32_t factor)
+{
+  if (factor < 2) {
+    return;
+  }
+  auto& tokens = chunk.tokens;
+  size_t out = 0;
+  size_t first = 0;
+  while (first < tokens.size()) {
+    size_t last = first + 1;
+    size_t low = first;
+    size_t high = first;
+    uint32_t span = tokens[first].decimation;
+    while (last < tokens.size() && last - first < factor
+           && sameSweep(tokens[first], tokens[last]))
+    {
+      span = std::max(span, tokens[last].decimation);
+      if (tokens[last].value < tokens[low].value) {
+        low = last;
+      }
+      if (tokens[last].value > tokens[high].value) {
+        high = last;
+      }
+      ++last;
+    }
+    // Both extremes in the order they were sampled; reading ahead of `out`
+    // is safe as out never passes first
+    span *= static_cast<uint32_t>(last - first);
+    const data_token_t a = tokens[std::min(low, high)];
+    const data_token_t b = tokens[std::max(low, high)];
+    tokens[out] = a;
+    tokens[out++].decimation = span;
+    if (low != high) {
+      tokens[out] = b;
+      tokens[out++].decimation = span;
+    }
+    first = last;
+  }
+  tokens.resize(out);
+  chunk.decimation *= factor;
+}
+
+bool clamp_protocol::AnalysisPipeline::sweep_cursor::advance(
+    const data_token_t& token)
+{
+  if (token.protocolHash == hash && token.trial == trial
+      && token.segment == segment && token.sweep == sweep
+      && token.step >= step)
+  {
+    ++position;
+    step = token.step;
+    lossless = lossless && token.decimation <= 1;
+    return false;
+  }
+  hash = token.protocolHash;
+  trial = token.trial;
+  segment = token.segment;
+  sweep = token.sweep;
+  step = token.step;
+  position = 0;
+  whole = token.step == 0 && token.time == token.stepStart;
+  lossless = token.decimation <= 1;
+  return true;
+}
+
+clamp_protocol::AnalysisPipeline::AnalysisPipeline(
+    WorkStealingPool& pool, const pipeline_params& params)
+    : workers(pool)
+    , settings(params)
+    , created_ns(steadyNow())
+{
+  for (size_t i = 0; i < STAGE_COUNT; ++i) {
+    if (settings.stages[i]) {
+      stage_list[i] =
+          std::make_unique<stage_t>(std::max<size_t>(settings.queue_chunks, 2));
+    }
+  }
+  first_stage = next(STAGE_COUNT);
+}
+
+clamp_protocol::AnalysisPipeline::~AnalysisPipeline()
+{
+  tasks.cancel();
+  workers.wait(tasks);
+}
+
+void clamp_protocol::AnalysisPipeline::setProtocol(compiled_view steps,
+                                                   uint64_t hash,
+                                                   int64_t period_ns)
+{
+  auto next_layout = std::make_shared<protocol_layout>();
+  next_layout->steps.assign(steps.steps, steps.steps + steps.size);
+  next_layout->hash = hash;
+  next_layout->period_ns = period_ns;
+  std::atomic_store(
+      &layout, std::shared_ptr<const protocol_layout>(std::move(next_layout)));
+}
+
+size_t clamp_protocol::AnalysisPipeline::next(size_t stage) const
+{
+  // STAGE_COUNT stands for the drain ahead of the first stage
+  size_t index = stage == STAGE_COUNT ? 0 : stage + 1;
+  while (index < STAGE_COUNT && stage_list[index] == nullptr) {
+    ++index;
+  }
+  return index;
+}
+
+bool clamp_protocol::AnalysisPipeline::push(chunk_handle& chunk)
+{
+  if (first_stage == STAGE_DISPLAY) {
+    // Also retries what an earlier call held back
+    forward(drain, STAGE_DISPLAY, chunk);
+    return true;
+  }
+  if (chunk == nullptr) {
+    return true;
+  }
+  if (first_stage == STAGE_COUNT) {
+    chunk.reset();
+    return true;
+  }
+  if (!stage_list[first_stage]->input.push(chunk)) {
+    rejected.fetch_add(1, std::memory_order_relaxed);
+    return false;
+  }
+  schedule(first_stage);
+  return true;
+}
+
+bool clamp_protocol::AnalysisPipeline::pop(chunk_handle& chunk)
+{
+  stage_t* display = stage_list[STAGE_DISPLAY].get();
+  if (display == nullptr) {
+    return false;
+  }
+  if (!display->input.pop(chunk)) {
+    resume(STAGE_DISPLAY);
+    return false;
+  }
+  display->chunks.fetch_add(1, std::memory_order_relaxed);
+  display->records.fetch_add(chunk->tokens.size(), std::memory_order_relaxed);
+  return true;
+}
+
+void clamp_protocol::AnalysisPipeline::wait()
+{
+  workers.wait(tasks);
+}
+
+void clamp_protocol::AnalysisPipeline::schedule(size_t stage)
+{
+  if (stage_list[stage]->scheduled.exchange(true)) {
+    return;
+  }
+  workers.submit(
+      tasks, [this, stage]() { run(stage); }, PRIORITY_LIVE);
+}
+
+void clamp_protocol::AnalysisPipeline::resume(size_t stage)
+{
+  size_t producer = stage;
+  while (producer > 0 && stage_list[--producer] == nullptr) {
+  }
+  if (producer == stage || stage_list[producer] == nullptr) {
+    return;  // Fed by the drain, which retries on its next push
+  }
+  stage_t& from = *stage_list[producer];
+  if (from.blocked.load()) {
+    from.wake.store(true);
+    schedule(producer);
+  }
+}
+
+void clamp_protocol::AnalysisPipeline::run(size_t index)
+{
+  stage_t& stage = *stage_list[index];
+  const size_t to = next(index);
+  for (;;) {
+    stage.wake.store(false);
+    bool stalled = false;
+    if (stage.held != nullptr) {
+      chunk_handle retry = std::move(stage.held);
+      stage.blocked.store(false);
+      stalled = !forward(stage, to, retry);
+    }
+    chunk_handle chunk;
+    while (!stalled && stage.input.pop(chunk)) {
+      resume(index);
+      process(index, *chunk);
+      stalled = !forward(stage, to, chunk);
+    }
+    stage.scheduled.store(false);
+    // A push or resume that found the stage still scheduled left its work
+    // to this run
+    const bool more = stalled ? stage.wake.load() : stage.input.size() > 0;
+    if (!more || stage.scheduled.exchange(true)) {
+      return;
+    }
+  }
+}
+
+bool clamp_protocol::AnalysisPipeline::forward(stage_t& from,
+                                               size_t to,
+                                               chunk_handle& chunk)
+{
+  if (to == STAGE_COUNT) {
+    chunk.reset();
+    return true;
+  }
+  stage_t& target = *stage_list[to];
+  if (to != STAGE_DISPLAY) {
+    if (target.input.push(chunk)) {
+      schedule(to);
+      return true;
+    }
+    from.held = std::move(chunk);
+    from.blocked.store(true);
+    // The target may have emptied its queue before it saw the flag
+    if (target.input.push(from.held)) {
+      from.blocked.store(false);
+      schedule(to);
+      return true;
+    }
+    return false;
+  }
+
+  // Chunks merged into the held one are brought down to its resolution
+  uint32_t factor =
+      target.input.size() * 2 >= target.input.capacity()
+      ? settings.display_decimation
+      : 1;
+  if (from.held != nullptr) {
+    factor = std::max(factor, from.held->decimation);
+  }
+  if (chunk != nullptr) {
+    if (factor > chunk->decimation) {
+      decimateMinMax(*chunk, factor / chunk->decimation);
+      target.degraded.fetch_add(1, std::memory_order_relaxed);
+    }
+    if (from.held != nullptr) {
+      if (chunk->decimation > from.held->decimation) {
+        decimateMinMax(*from.held,
+                       chunk->decimation / from.held->decimation);
+      }
+      from.held->tokens.insert(
+          from.held->tokens.end(), chunk->tokens.begin(), chunk->tokens.end());
+      from.held->summaries.insert(from.held->summaries.end(),
+                                  chunk->summaries.begin(),
+                                  chunk->summaries.end());
+      from.held->decimation =
+          std::max(from.held->decimation, chunk->decimation);
+      chunk = std::move(from.held);
+    }
+  } else if (from.held != nullptr) {
+    chunk = std::move(from.held);
+  } else {
+    return true;
+  }
+  from.blocked.store(false);
+  if (target.input.push(chunk)) {
+    return true;
+  }
+  while (chunk->tokens.size() > settings.display_held_records) {
+    decimateMinMax(*chunk, 2);
+  }
+  from.held = std::move(chunk);
+  from.blocked.store(true);
+  if (target.input.push(from.held)) {
+    from.blocked.store(false);
+  }
+  return true;
+}
+
+void clamp_protocol::AnalysisPipeline::process(size_t index,
+                                               pipeline_chunk& chunk)
+{
+  stage_t& stage = *stage_list[index];
+  const int64_t start_ns = steadyNow();
+  stage.chunks.fetch_add(1, std::memory_order_relaxed);
+  stage.records.fetch_add(chunk.tokens.size(), std::memory_order_relaxed);
+  switch (index) {
+    case STAGE_FILTER:
+      filter(stage, chunk);
+      break;
+    case STAGE_BASELINE:
+      baseline(stage, chunk);
+      break;
+    case STAGE_MEASURE:
+      measure(stage, chunk);
+      break;
+    case STAGE_AVERAGE:
+      average(stage, chunk);
+      break;
+    default:
+      break;
+  }
+  stage.busy_ns.fetch_add(steadyNow() - start_ns, std::memory_order_relaxed);
+}
+
+void clamp_protocol::AnalysisPipeline::filter(stage_t& stage,
+                                              pipeline_chunk& chunk)
+{
+  const auto protocol = std::atomic_load(&layout);
+  if (protocol == nullptr || protocol->period_ns <= 0) {
+    return;
+  }
+  const double dt_s = static_cast<double>(protocol->period_ns) * 1e-9;
+  const double alpha = 1.0 - std::exp(-two_pi * settings.filter_hz * dt_s);
+  for (auto& token : chunk.tokens) {
+    if (stage.cursor.advance(token)) {
+      filtered = token.value;
+    }
+    filtered += alpha * (token.value - filtered);
+    token.value = filtered;
+  }
+}
+
+void clamp_protocol::AnalysisPipeline::baseline(stage_t& stage,
+                                                pipeline_chunk& chunk)
+{
+  const auto baseline_step = static_cast<int>(settings.analysis.baseline_step);
+  const auto release = [this]()
+  {
+    const double mean = baseline_count > 0
+        ? baseline_sum / static_cast<double>(baseline_count)
+        : 0.0;
+    for (auto& token : baseline_held) {
+      token.value -= mean;
+      baseline_out.push_back(token);
+    }
+    baseline_held.clear();
+  };
+
+  baseline_out.clear();
+  for (auto token : chunk.tokens) {
+    if (stage.cursor.advance(token)) {
+      release();
+      baseline_sum = 0.0;
+      baseline_count = 0;
+      baseline_known = !stage.cursor.whole;
+    }
+    if (!stage.cursor.whole) {
+      baseline_out.push_back(token);
+      continue;
+    }
+    if (!baseline_known) {
+      if (token.step <= baseline_step) {
+        if (token.step == baseline_step) {
+          baseline_sum += token.value;
+          ++baseline_count;
+        }
+        baseline_held.push_back(token);
+        continue;
+      }
+      release();
+      baseline_known = true;
+    }
+    token.value -= baseline_count > 0
+        ? baseline_sum / static_cast<double>(baseline_count)
+        : 0.0;
+    baseline_out.push_back(token);
+  }
+  chunk.tokens.swap(baseline_out);
+}
+
+void clamp_protocol::AnalysisPipeline::measure(stage_t& stage,
+                                               pipeline_chunk& chunk)
+{
+  for (const auto& token : chunk.tokens) {
+    if (stage.cursor.advance(token)) {
+      measuring_open = false;
+      const auto protocol = std::atomic_load(&layout);
+      if (stage.cursor.whole && protocol != nullptr
+          && protocol->hash == token.protocolHash)
+      {
+        // Keeps the sample buffer of the last sweep
+        std::vector<double> samples = std::move(measuring.samples);
+        measuring = layoutSweep(
+            {protocol->steps.data(), protocol->steps.size()},
+            static_cast<uint32_t>(token.segment),
+            static_cast<uint32_t>(token.sweep),
+            token.protocolHash,
+            protocol->period_ns);
+        measuring.trial = token.trial;
+        measuring.start_ns = token.sweepStart;
+        measuring.start_sample = token.sweepSample;
+        samples.clear();
+        measuring.samples = std::move(samples);
+        measuring_open = !measuring.steps.empty();
+      }
+    }
+    // Sweeps thinned on the RT side cannot be measured
+    if (!measuring_open || !stage.cursor.lossless) {
+      measuring_open = false;
+      continue;
+    }
+    const auto step = static_cast<size_t>(token.step);
+    const auto sample = static_cast<int64_t>(measuring.samples.size());
+    if (step >= measuring.steps.size() || sample < measuring.step_starts[step]
+        || sample >= measuring.step_starts[step + 1])
+    {
+      measuring_open = false;
+      continue;
+    }
+    measuring.samples.push_back(token.value);
+    if (sample + 1 == measuring.step_starts.back()) {
+      chunk.summaries.push_back(measureSweep(measuring, settings.analysis));
+      measuring_open = false;
+      // The next token starts a sweep even if it is the same one again
+      stage.cursor = {};
+    }
+  }
+}
+
+void clamp_protocol::AnalysisPipeline::average(stage_t& stage,
+                                               pipeline_chunk& chunk)
+{
+  for (auto& token : chunk.tokens) {
+    if (stage.cursor.advance(token)) {
+      averaging = nullptr;
+      const auto protocol = std::atomic_load(&layout);
+      if (stage.cursor.whole && protocol != nullptr
+          && protocol->hash == token.protocolHash)
+      {
+        if (!averages.empty() && averages.front().hash != protocol->hash) {
+          averages.clear();
+        }
+        const auto segment = static_cast<uint32_t>(token.segment);
+        const auto sweep = static_cast<uint32_t>(token.sweep);
+        for (auto& candidate : averages) {
+          if (candidate.segment == segment && candidate.sweep == sweep) {
+            averaging = &candidate;
+            break;
+          }
+        }
+        if (averaging == nullptr) {
+          const auto length = static_cast<size_t>(
+              layoutSweep({protocol->steps.data(), protocol->steps.size()},
+                          segment,
+                          sweep,
+                          protocol->hash,
+                          protocol->period_ns)
+                  .step_starts.back());
+          if (length > 0) {
+            averaging = &averages.emplace_back();
+            averaging->hash = protocol->hash;
+            averaging->segment = segment;
+            averaging->sweep = sweep;
+            averaging->mean.assign(length, 0.0);
+            averaging->trials.assign(length, 0);
+          }
+        }
+      }
+    }
+    if (averaging == nullptr) {
+      continue;
+    }
+    if (!stage.cursor.lossless) {
+      // Thinned on the RT side: the rest of the trial is shown as it came
+      averaging = nullptr;
+      continue;
+    }
+    const size_t position = stage.cursor.position;
+    if (position >= averaging->mean.size()) {
+      averaging = nullptr;
+      continue;
+    }
+    double& mean = averaging->mean[position];
+    const uint32_t trials = ++averaging->trials[position];
+    mean += (token.value - mean) / static_cast<double>(trials);
+    token.value = mean;
+    if (position + 1 == averaging->mean.size()) {
+      averaging = nullptr;
+      stage.cursor = {};
+    }
+  }
+}
+
+size_t clamp_protocol::AnalysisPipeline::queuedChunks() const
+{
+  size_t queued = 0;
+  for (const auto& stage : stage_list) {
+    if (stage != nullptr) {
+      queued += stage->input.size();
+    }
+  }
+  return queued;
+}
+
+clamp_protocol::pipeline_report clamp_protocol::AnalysisPipeline::report()
+    const
+{
+  pipeline_report result;
+  result.elapsed_ns = steadyNow() - created_ns;
+  result.rejected = rejected.load();
+  for (size_t i = 0; i < STAGE_COUNT; ++i) {
+    const stage_t* stage = stage_list[i].get();
+    if (stage == nullptr) {
+      continue;
+    }
+    stage_stats& stats = result.stages[i];
+    stats.enabled = true;
+    stats.chunks = stage->chunks.load();
+    stats.records = stage->records.load();
+    stats.busy_ns = stage->busy_ns.load();
+    stats.degraded = stage->degraded.load();
+    stats.queued = stage->input.size();
+  }
+  return result;
+}
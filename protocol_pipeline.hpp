@@ -0,0 +1,338 @@
+/*
+ * Copyright (C) 2011 Weill Medical College of Cornell University
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License as
+ *  published by the Free Software Foundation; either version 2 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "protocol_analysis.hpp"
+#include "protocol_pool.hpp"
+#include "protocol_record.hpp"
+
+// Online processing of the acquired data between the FIFO drain and the
+// plot, as a chain of stages connected by bounded queues of chunks
+namespace clamp_protocol
+{
+
+// Bounded lock-free queue for exactly one producer and one consumer thread
+template<typename T>
+class SpscQueue
+{
+public:
+  // Capacity is rounded up to a power of two
+  explicit SpscQueue(size_t capacity)
+  {
+    size_t size = 1;
+    while (size < capacity) {
+      size <<= 1U;
+    }
+    slots.resize(size);
+    mask = size - 1;
+  }
+
+  // Producer. Moves from `value` unless the queue is full.
+  bool push(T& value)
+  {
+    const size_t index = head.load(std::memory_order_relaxed);
+    if (index - tail.load(std::memory_order_acquire) == slots.size()) {
+      return false;
+    }
+    slots[index & mask] = std::move(value);
+    head.store(index + 1, std::memory_order_release);
+    return true;
+  }
+  // Consumer
+  bool pop(T& value)
+  {
+    const size_t index = tail.load(std::memory_order_relaxed);
+    if (index == head.load(std::memory_order_acquire)) {
+      return false;
+    }
+    value = std::move(slots[index & mask]);
+    tail.store(index + 1, std::memory_order_release);
+    return true;
+  }
+
+  // Either thread; exact only on the consumer side
+  size_t size() const
+  {
+    return head.load(std::memory_order_acquire)
+        - tail.load(std::memory_order_acquire);
+  }
+  size_t capacity() const { return slots.size(); }
+
+private:
+  std::vector<T> slots;
+  size_t mask = 0;
+  alignas(64) std::atomic<size_t> head {0};
+  alignas(64) std::atomic<size_t> tail {0};
+};
+
+// In the order data flows through them; the drain feeds the first enabled
+// stage and the GUI takes chunks from the display queue
+enum pipeline_stage : uint8_t
+{
+  STAGE_FILTER = 0,  // Single pole low pass on the input
+  // Subtracts the mean of the baseline step of each sweep, holding the sweep
+  // back until that step has played
+  STAGE_BASELINE,
+  STAGE_MEASURE,  // Measures each complete sweep, see measureSweep()
+  STAGE_AVERAGE,  // Running average of the trials of each sweep
+  STAGE_DISPLAY,  // Queue the plot drains
+  STAGE_COUNT
+};
+
+const char* stageName(pipeline_stage stage);
+
+class ChunkPool;
+
+struct pipeline_chunk
+{
+  std::vector<data_token_t> tokens;
+  std::vector<sweep_summary> summaries;  // Sweeps completed by this chunk
+  // Records each token stands for; above one the tokens are the minimum and
+  // maximum of that many records, in time order
+  uint32_t decimation = 1;
+  ChunkPool* owner = nullptr;  // Returned there when released, else deleted
+  std::atomic<uint32_t> refs {0};  // Handles sharing the chunk
+};
+
+// Counted reference to a chunk. Copies share the chunk without touching its
+// buffers; the last one released hands it back to its pool.
+class chunk_handle
+{
+public:
+  chunk_handle() = default;
+  chunk_handle(std::nullptr_t) {}  // NOLINT: implicit like a pointer
+  explicit chunk_handle(pipeline_chunk* chunk);
+  chunk_handle(const chunk_handle& other);
+  chunk_handle(chunk_handle&& other) noexcept;
+  chunk_handle& operator=(const chunk_handle& other);
+  chunk_handle& operator=(chunk_handle&& other) noexcept;
+  ~chunk_handle();
+
+  pipeline_chunk* get() const { return chunk; }
+  pipeline_chunk* operator->() const { return chunk; }
+  pipeline_chunk& operator*() const { return *chunk; }
+  explicit operator bool() const { return chunk != nullptr; }
+  void reset();
+
+  friend bool operator==(const chunk_handle& handle, std::nullptr_t)
+  {
+    return handle.chunk == nullptr;
+  }
+  friend bool operator!=(const chunk_handle& handle, std::nullptr_t)
+  {
+    return handle.chunk != nullptr;
+  }
+
+private:
+  pipeline_chunk* chunk = nullptr;
+};
+
+// Chunk of its own, freed with its last handle
+chunk_handle makeChunk();
+
+// Fixed set of chunks whose buffers are reserved up front and reused, so
+// that once the pool is built moving data from the drain to the plot
+// allocates nothing. Chunks come back from whichever thread releases them.
+class ChunkPool
+{
+public:
+  ChunkPool(size_t chunks, size_t records);
+  ChunkPool(const ChunkPool&) = delete;
+  ChunkPool& operator=(const ChunkPool&) = delete;
+  ~ChunkPool();  // Every handle must have been released
+
+  // Empty chunk with room for `records` tokens; null while all are in use
+  chunk_handle acquire();
+  size_t available() const;
+  size_t size() const { return chunks.size(); }
+
+private:
+  friend class chunk_handle;
+  void recycle(pipeline_chunk* chunk);
+
+  std::vector<std::unique_ptr<pipeline_chunk>> chunks;
+  std::vector<pipeline_chunk*> free_chunks;  // Never grows past chunks
+  mutable std::mutex lock;
+};
+
+// Replaces every `factor` tokens of the same sweep by their minimum and
+// maximum, marked with the records they now stand for
+void decimateMinMax(pipeline_chunk& chunk, uint32_t factor);
+
+struct pipeline_params
+{
+  std::array<bool, STAGE_COUNT> stages {false, false, true, false, true};
+  double filter_hz = 2000.0;  // Corner of the low pass
+  analysis_params analysis;  // Baseline and measured steps
+  size_t queue_chunks = 8;  // Capacity of each stage's input queue
+  // The display is fed decimated chunks once its queue is half full, and
+  // chunks that do not fit are merged and decimated further until it has
+  // room, so a slow plot never holds up the analysis or the drain
+  uint32_t display_decimation = 8;
+  size_t display_held_records = 1 << 16;  // Merged chunk is halved above
+};
+
+struct stage_stats
+{
+  bool enabled = false;
+  uint64_t chunks = 0;
+  uint64_t records = 0;  // Records that entered the stage
+  int64_t busy_ns = 0;  // Time spent processing them
+  uint64_t degraded = 0;  // Chunks decimated on their way to the display
+  size_t queued = 0;  // Chunks waiting in the input queue
+};
+
+struct pipeline_report
+{
+  int64_t elapsed_ns = 0;  // Since the pipeline was built
+  uint64_t rejected = 0;  // Chunks push() refused
+  std::array<stage_stats, STAGE_COUNT> stages;
+};
+
+// Runs the enabled analysis stages as tasks on `pool`, at most one task per
+// stage at a time, so each stage sees its chunks in order and keeps its
+// state without locks. A stage whose next queue is full keeps the chunk and
+// stops taking input until the next stage catches up; the hold-up reaches
+// push(), never a blocking wait. Stages are chosen when the pipeline is
+// built: rebuild it to change them.
+class AnalysisPipeline
+{
+public:
+  AnalysisPipeline(WorkStealingPool& pool, const pipeline_params& params);
+  AnalysisPipeline(const AnalysisPipeline&) = delete;
+  AnalysisPipeline& operator=(const AnalysisPipeline&) = delete;
+  ~AnalysisPipeline();  // Drops the chunks in flight
+
+  // Protocol the incoming tokens are checked against. Any thread; sweeps
+  // of other protocols pass through the baseline and measure stages and
+  // are not averaged.
+  void setProtocol(compiled_view steps, uint64_t hash, int64_t period_ns);
+
+  // Drain thread. Takes the chunk unless the first queue is full, in which
+  // case the chunk is left with the caller to retry later. With only the
+  // display on, output held back for it is retried on every call, so call
+  // with a null chunk to flush it.
+  bool push(chunk_handle& chunk);
+  // Display thread. Chunks come out in the order they were pushed.
+  bool pop(chunk_handle& chunk);
+  // Waits until every chunk pushed has reached the display queue, or been
+  // dropped if the display is off
+  void wait();
+
+  pipeline_report report() const;
+  // Chunks waiting in the stage queues, the display's included. Any thread;
+  // exact only when called from the display thread with the stages idle.
+  size_t queuedChunks() const;
+
+private:
+  struct protocol_layout
+  {
+    std::vector<compiled_step_t> steps;
+    uint64_t hash = 0;
+    int64_t period_ns = 0;
+  };
+  // Position of the tokens within their sweep
+  struct sweep_cursor
+  {
+    uint64_t hash = 0;
+    int trial = -1;
+    int segment = -1;
+    int sweep = -1;
+    int step = -1;
+    size_t position = 0;
+    bool whole = false;  // Sweep followed from its first sample
+    bool lossless = false;  // No tokens decimated on the RT side so far
+    // True if `token` starts a new sweep
+    bool advance(const data_token_t& token);
+  };
+  struct stage_t
+  {
+    explicit stage_t(size_t capacity)
+        : input(capacity)
+    {
+    }
+    SpscQueue<chunk_handle> input;
+    std::atomic<bool> scheduled {false};
+    // Output that did not fit into the next queue
+    chunk_handle held;
+    std::atomic<bool> blocked {false};
+    std::atomic<bool> wake {false};  // Resumed while running
+    sweep_cursor cursor;
+    std::atomic<uint64_t> chunks {0};
+    std::atomic<uint64_t> records {0};
+    std::atomic<int64_t> busy_ns {0};
+    std::atomic<uint64_t> degraded {0};
+  };
+
+  void schedule(size_t stage);
+  void run(size_t stage);
+  // Hands `chunk` on from `from` to stage `to`. False if `to` is an
+  // analysis stage with a full queue: the chunk is then held in `from`.
+  // Chunks for the display are decimated instead and always taken.
+  bool forward(stage_t& from, size_t to, chunk_handle& chunk);
+  size_t next(size_t stage) const;  // STAGE_COUNT past the last
+  void resume(size_t stage);  // Reschedules the stage feeding `stage`
+  void process(size_t stage, pipeline_chunk& chunk);
+
+  void filter(stage_t& stage, pipeline_chunk& chunk);
+  void baseline(stage_t& stage, pipeline_chunk& chunk);
+  void measure(stage_t& stage, pipeline_chunk& chunk);
+  void average(stage_t& stage, pipeline_chunk& chunk);
+
+  WorkStealingPool& workers;
+  pipeline_params settings;
+  std::array<std::unique_ptr<stage_t>, STAGE_COUNT> stage_list;
+  size_t first_stage = STAGE_COUNT;
+  stage_t drain {1};  // Drain thread: output held for the display
+  TaskGroup tasks;
+  std::shared_ptr<const protocol_layout> layout;  // std::atomic_load/store
+  std::atomic<uint64_t> rejected {0};
+  int64_t created_ns = 0;
+
+  // Stage state, touched only by the stage's own task
+  double filtered = 0.0;
+  std::vector<data_token_t> baseline_held;  // Until the baseline is known
+  std::vector<data_token_t> baseline_out;
+  double baseline_sum = 0.0;
+  size_t baseline_count = 0;
+  bool baseline_known = false;
+  acquired_sweep measuring;
+  bool measuring_open = false;
+  struct sweep_mean
+  {
+    uint64_t hash = 0;
+    uint32_t segment = 0;
+    uint32_t sweep = 0;
+    std::vector<double> mean;
+    std::vector<uint32_t> trials;
+  };
+  std::deque<sweep_mean> averages;
+  sweep_mean* averaging = nullptr;
+};
+
+}  // namespace clamp_protocol
@@ -0,0 +1,260 @@
+/*
+ * Copyright (C) 2011 Weill Medical College of Cornell University
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License as
+ *  published by the Free Software Foundation; either version 2 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <utility>
+
+#include "protocol_pool.hpp"
+
+#include <pthread.h>
+#include <sched.h>
+
+namespace
+{
+
+// Pool and index of the worker running on this thread
+thread_local const clamp_protocol::WorkStealingPool* current_pool = nullptr;
+thread_local size_t current_index = 0;
+
+// Sleeping threads also look for work this often
+constexpr std::chrono::milliseconds idle_poll(100);
+
+}  // namespace
+
+std::vector<int> clamp_protocol::freeCpus(int exclude)
+{
+  std::vector<int> cpus;
+  cpu_set_t mask;
+  CPU_ZERO(&mask);
+  if (sched_getaffinity(0, sizeof(mask), &mask) != 0) {
+    return cpus;
+  }
+  for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+    if (CPU_ISSET(cpu, &mask) != 0 && cpu != exclude) {
+      cpus.push_back(cpu);
+    }
+  }
+  return cpus;
+}
+
+clamp_protocol::WorkStealingPool::WorkStealingPool(size_t threads)
+{
+  if (threads == 0) {
+    threads = std::max(1U, std::thread::hardware_concurrency());
+  }
+  start(threads, {});
+}
+
+clamp_protocol::WorkStealingPool::WorkStealingPool(const pool_options& options)
+{
+  start(std::max<size_t>(
+            1, options.threads == 0 ? options.cpus.size() : options.threads),
+        options.cpus);
+}
+
+clamp_protocol::WorkStealingPool::~WorkStealingPool()
+{
+  {
+    const std::lock_guard<std::mutex> guard(sleep_lock);
+    stopping = true;
+  }
+  wake.notify_all();
+  for (auto& worker : workers) {
+    worker.join();
+  }
+}
+
+void clamp_protocol::WorkStealingPool::submit(TaskGroup& group,
+                                              std::function<void()> task,
+                                              task_priority priority)
+{
+  if (group.cancelled()) {
+    return;
+  }
+  group.pending.fetch_add(1, std::memory_order_relaxed);
+  group.queued.fetch_add(1, std::memory_order_release);
+  size_t target = currentWorker();
+  if (target == size()) {
+    target = next_queue.fetch_add(1, std::memory_order_relaxed) % size();
+  }
+  queued.fetch_add(1, std::memory_order_release);
+  {
+    const std::lock_guard<std::mutex> guard(queues[target]->lock);
+    queues[target]->tasks[std::min<size_t>(priority, PRIORITY_COUNT - 1)]
+        .push_back({&group, std::move(task)});
+  }
+  {
+    const std::lock_guard<std::mutex> guard(sleep_lock);
+  }
+  wake.notify_one();
+  finished.notify_all();
+}
+
+void clamp_protocol::WorkStealingPool::wait(TaskGroup& group)
+{
+  const size_t self = currentWorker();
+  const TaskGroup* only = self == size() ? &group : nullptr;
+  const std::atomic<size_t>& waiting = only == nullptr ? queued : group.queued;
+  while (!group.done()) {
+    if (runOne(self, only)) {
+      continue;
+    }
+    // Everything left of the group is running elsewhere: sleep until it
+    // finishes or there is something to help with
+    std::unique_lock<std::mutex> guard(sleep_lock);
+    finished.wait_for(guard,
+                      idle_poll,
+                      [&]()
+                      {
+                        return group.done()
+                            || waiting.load(std::memory_order_acquire) > 0;
+                      });
+  }
+  if (group.error) {
+    std::rethrow_exception(std::exchange(group.error, nullptr));
+  }
+}
+
+void clamp_protocol::WorkStealingPool::start(size_t threads,
+                                             const std::vector<int>& cpus)
+{
+  for (size_t i = 0; i < threads; ++i) {
+    queues.push_back(std::make_unique<worker_queue>());
+  }
+  for (size_t i = 0; i < threads; ++i) {
+    workers.emplace_back([this, i]() { work(i); });
+    if (!cpus.empty()) {
+      // Best effort: a CPU that went away leaves the worker unpinned
+      cpu_set_t mask;
+      CPU_ZERO(&mask);
+      CPU_SET(cpus[i % cpus.size()], &mask);
+      pthread_setaffinity_np(
+          workers.back().native_handle(), sizeof(mask), &mask);
+    }
+  }
+}
+
+void clamp_protocol::WorkStealingPool::work(size_t self)
+{
+  current_pool = this;
+  current_index = self;
+  while (true) {
+    if (runOne(self)) {
+      continue;
+    }
+    std::unique_lock<std::mutex> guard(sleep_lock);
+    wake.wait_for(guard,
+                  idle_poll,
+                  [this]()
+                  {
+                    return stopping
+                        || queued.load(std::memory_order_acquire) > 0;
+                  });
+    if (stopping && queued.load(std::memory_order_acquire) == 0) {
+      return;
+    }
+  }
+}
+
+bool clamp_protocol::WorkStealingPool::runOne(size_t self,
+                                              const TaskGroup* only)
+{
+  task_t task;
+  bool found = false;
+  for (size_t priority = 0; priority < PRIORITY_COUNT && !found; ++priority) {
+    found = (only == nullptr && pop(self, priority, task))
+        || steal(self, priority, task, only);
+  }
+  if (!found) {
+    return false;
+  }
+  queued.fetch_sub(1, std::memory_order_relaxed);
+  task.group->queued.fetch_sub(1, std::memory_order_relaxed);
+  if (!task.group->cancelled()) {
+    try {
+      task.run();
+    } catch (...) {
+      const std::lock_guard<std::mutex> guard(sleep_lock);
+      if (!task.group->error) {
+        task.group->error = std::current_exception();
+      }
+    }
+  }
+  finish(*task.group);
+  return true;
+}
+
+bool clamp_protocol::WorkStealingPool::pop(size_t self,
+                                           size_t priority,
+                                           task_t& task)
+{
+  if (self == size()) {
+    return false;
+  }
+  worker_queue& queue = *queues[self];
+  const std::lock_guard<std::mutex> guard(queue.lock);
+  auto& tasks = queue.tasks[priority];
+  if (tasks.empty()) {
+    return false;
+  }
+  task = std::move(tasks.back());
+  tasks.pop_back();
+  return true;
+}
+
+bool clamp_protocol::WorkStealingPool::steal(size_t self,
+                                             size_t priority,
+                                             task_t& task,
+                                             const TaskGroup* only)
+{
+  const size_t count = size();
+  const size_t first = self == count ? 0 : self + 1;
+  for (size_t i = 0; i < count; ++i) {
+    worker_queue& queue = *queues[(first + i) % count];
+    const std::lock_guard<std::mutex> guard(queue.lock);
+    auto& tasks = queue.tasks[priority];
+    const auto oldest = only == nullptr
+        ? tasks.begin()
+        : std::find_if(tasks.begin(),
+                       tasks.end(),
+                       [only](const task_t& queued_task)
+                       { return queued_task.group == only; });
+    if (oldest != tasks.end()) {
+      task = std::move(*oldest);
+      tasks.erase(oldest);
+      return true;
+    }
+  }
+  return false;
+}
+
+void clamp_protocol::WorkStealingPool::finish(TaskGroup& group)
+{
+  if (group.pending.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+    {
+      const std::lock_guard<std::mutex> guard(sleep_lock);
+    }
+    finished.notify_all();
+  }
+}
+
+size_t clamp_protocol::WorkStealingPool::currentWorker() const
+{
+  return current_pool == this ? current_index : size();
+}
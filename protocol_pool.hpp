@@ -0,0 +1,144 @@
+/*
+ * Copyright (C) 2011 Weill Medical College of Cornell University
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License as
+ *  published by the Free Software Foundation; either version 2 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace clamp_protocol
+{
+
+// Queued tasks run in priority order: live display work first, background
+// fits and exports last
+enum task_priority : uint8_t
+{
+  PRIORITY_LIVE = 0,
+  PRIORITY_NORMAL,
+  PRIORITY_BACKGROUND,
+  PRIORITY_COUNT
+};
+
+// Tasks that can be waited for or cancelled together. A group must outlive
+// its tasks.
+class TaskGroup
+{
+public:
+  bool done() const { return pending.load(std::memory_order_acquire) == 0; }
+  // Tasks of the group that have not started are dropped; running tasks
+  // may poll cancelled() to stop early
+  void cancel() { stopped.store(true, std::memory_order_release); }
+  bool cancelled() const { return stopped.load(std::memory_order_acquire); }
+  // Accepts tasks again once the group is done
+  void reset() { stopped.store(false, std::memory_order_release); }
+
+private:
+  friend class WorkStealingPool;
+  std::atomic<size_t> pending {0};
+  std::atomic<size_t> queued {0};  // Pending tasks not yet started
+  std::atomic<bool> stopped {false};
+  std::exception_ptr error;  // First exception a task threw
+};
+
+struct pool_options
+{
+  size_t threads = 0;  // Zero means one per entry of `cpus`
+  // CPUs the workers are pinned to, round robin; empty leaves them to the
+  // scheduler
+  std::vector<int> cpus;
+};
+
+// CPUs this process may run on, minus `exclude` (e.g. the RT core). CPUs
+// isolated from the scheduler are not in the process mask to begin with.
+std::vector<int> freeCpus(int exclude = -1);
+
+// Fixed set of worker threads, each with its own task deques, one per
+// priority. A worker runs its own tasks newest first, so work a task spawns
+// stays warm in its cache, and when it runs dry it steals the oldest task of
+// another worker, always taking the most urgent priority anyone has queued.
+// Tasks submitted from outside the pool are dealt round robin.
+//
+// wait() runs queued tasks while the group is unfinished, so a task may
+// submit subtasks and wait for them without tying up its worker. Outside
+// the pool it only runs tasks of the group waited for, so a GUI thread
+// never ends up running another group's background work.
+class WorkStealingPool
+{
+public:
+  // Zero threads means one per hardware thread
+  explicit WorkStealingPool(size_t threads = 0);
+  explicit WorkStealingPool(const pool_options& options);
+  WorkStealingPool(const WorkStealingPool&) = delete;
+  WorkStealingPool& operator=(const WorkStealingPool&) = delete;
+  ~WorkStealingPool();  // Finishes the queued tasks first
+
+  size_t size() const { return workers.size(); }
+  size_t queuedTasks() const { return queued.load(); }
+  // Dropped without running if the group is cancelled
+  void submit(TaskGroup& group,
+              std::function<void()> task,
+              task_priority priority = PRIORITY_NORMAL);
+  // Returns once every task of the group has run or been dropped,
+  // rethrowing the first exception one of them threw
+  void wait(TaskGroup& group);
+
+private:
+  struct task_t
+  {
+    TaskGroup* group = nullptr;
+    std::function<void()> run;
+  };
+  struct worker_queue
+  {
+    std::mutex lock;
+    std::array<std::deque<task_t>, PRIORITY_COUNT> tasks;
+  };
+
+  void start(size_t threads, const std::vector<int>& cpus);
+  void work(size_t self);
+  // Runs one queued task, of `only` if set; false if there was none
+  bool runOne(size_t self, const TaskGroup* only = nullptr);
+  bool pop(size_t self, size_t priority, task_t& task);
+  bool steal(size_t self,
+             size_t priority,
+             task_t& task,
+             const TaskGroup* only);
+  void finish(TaskGroup& group);
+  size_t currentWorker() const;  // size() outside the pool's workers
+
+  std::vector<std::unique_ptr<worker_queue>> queues;
+  std::vector<std::thread> workers;
+  std::atomic<size_t> queued {0};
+  std::atomic<size_t> next_queue {0};
+  std::mutex sleep_lock;
+  std::condition_variable wake;  // Workers waiting for tasks
+  std::condition_variable finished;  // wait() callers outside the pool
+  bool stopping = false;
+};
+
+}  // namespace clamp_protocol
@@ -0,0 +1,50 @@
+/*
+ * Copyright (C) 2011 Weill Medical College of Cornell University
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License as
+ *  published by the Free Software Foundation; either version 2 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#pragma once
+
+#include <cstdint>
+
+namespace clamp_protocol
+{
+
+// One acquired sample, written by the RT thread through the FIFO every
+// period while the protocol plot is open. Times are RT clock readings in ns
+// and samples RT sample counters, see ProtocolRunner::tick(), so tokens line
+// up with anything else stamped from the RT clock.
+struct data_token_t
+{
+  int64_t stepStart;  // Time of the first sample of the step
+  int64_t time;
+  double value;
+  int trial;
+  int segment;
+  int sweep;
+  int step;
+  uint64_t protocolHash;  // See hashProtocol()
+  int64_t sweepStart;  // Time of the first sample of the sweep
+  int64_t stepSample;  // Counters of the same three samples
+  int64_t sweepSample;
+  int64_t sample;
+  // Records the token stands for. Above one the token is the minimum or the
+  // maximum of that many records, written in place of them while the FIFO
+  // was filling up; see DisplayDecimator.
+  uint32_t decimation = 1;
+};
+
+}  // namespace clamp_protocol
@@ -0,0 +1,123 @@
+/*
+ * Copyright (C) 2011 Weill Medical College of Cornell University
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License as
+ *  published by the Free Software Foundation; either version 2 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#include <thread>
+
+#include "protocol_replay.hpp"
+
+clamp_protocol::SessionPlayer::SessionPlayer(SessionLog& log)
+    : log(log)
+{
+}
+
+bool clamp_protocol::SessionPlayer::next(replay_tick_t& tick)
+{
+  if (has_pending) {
+    tick = pending;
+    has_pending = false;
+    last_tick_ns = tick.time_ns;
+    return true;
+  }
+  session_event_t event;
+  while (log.next(event)) {
+    switch (event.type) {
+      case SESSION_TICK:
+        pace(event.time_ns);
+        if (!started) {
+          started = true;
+          first_tick_ns = event.time_ns;
+        }
+        last_tick_ns = event.time_ns;
+        tick.time_ns = event.time_ns;
+        tick.input = event.input;
+        tick.sample =
+            player.tick(event.time_ns, event.input, tick.output, tick.token);
+        return true;
+      case SESSION_PROTOCOL:
+        player.setProtocol(event.protocol, event.hash, event.period_ns);
+        break;
+      case SESSION_PERIOD:
+        player.setPeriod(event.period_ns);
+        break;
+      case SESSION_TRIALS:
+        player.setTrials(event.trials);
+        break;
+      case SESSION_SCALING:
+        player.setOutputScaling(event.junction_potential,
+                                event.output_factor);
+        break;
+      case SESSION_REWIND:
+        player.rewind();
+        break;
+      case SESSION_POSITION:
+        player.seek(event.trial, event.step, event.sample, event.time_ns);
+        break;
+      case SESSION_HASH:
+        player.setHash(event.hash);
+        break;
+      case SESSION_GAP:
+        ++gap_count;
+        break;
+      default:
+        break;
+    }
+  }
+  return false;
+}
+
+void clamp_protocol::SessionPlayer::pace(int64_t time_ns)
+{
+  if (playback_speed <= 0.0) {
+    return;
+  }
+  if (!started) {
+    wall_start = std::chrono::steady_clock::now();
+    return;
+  }
+  const auto offset = std::chrono::nanoseconds(static_cast<int64_t>(
+      static_cast<double>(time_ns - first_tick_ns) / playback_speed));
+  std::this_thread::sleep_until(wall_start + offset);
+}
+
+bool clamp_protocol::SessionPlayer::nextChunk(int64_t until_ns,
+                                              size_t limit,
+                                              std::vector<data_token_t>& out)
+{
+  const double speed = playback_speed;
+  playback_speed = 0.0;
+  replay_tick_t tick;
+  bool more = true;
+  for (size_t i = 0; i < limit; ++i) {
+    const int64_t delivered_ns = last_tick_ns;
+    if (!next(tick)) {
+      more = false;
+      break;
+    }
+    if (tick.time_ns - first_tick_ns > until_ns) {  // Keep it for later
+      pending = tick;
+      has_pending = true;
+      last_tick_ns = delivered_ns;
+      break;
+    }
+    if (tick.sample) {
+      out.push_back(tick.token);
+    }
+  }
+  playback_speed = speed;
+  return more;
+}
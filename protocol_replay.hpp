@@ -0,0 +1,85 @@
+/*
+ * Copyright (C) 2011 Weill Medical College of Cornell University
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License as
+ *  published by the Free Software Foundation; either version 2 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "protocol_record.hpp"
+#include "protocol_runner.hpp"
+#include "protocol_session.hpp"
+
+namespace clamp_protocol
+{
+
+// One replayed RT period: what the runner was given and what it produced
+struct replay_tick_t
+{
+  int64_t time_ns = 0;
+  double input = 0.0;
+  double output = 0.0;
+  bool sample = false;  // False once every trial has played; no token then
+  data_token_t token {};
+};
+
+// Feeds a session log back through a fresh ProtocolRunner, applying each
+// recorded command and tick in order, so the outputs and data tokens come
+// out exactly as they did during the run. Ticks can be paced against the
+// wall clock at any multiple of real time, or delivered as fast as the
+// caller consumes them.
+class SessionPlayer
+{
+public:
+  explicit SessionPlayer(SessionLog& log);
+
+  // 1 plays in real time, 10 ten times faster; 0 does not wait at all
+  void setSpeed(double speed) { playback_speed = speed; }
+  // Next tick, after the commands before it. False at the end of the log.
+  bool next(replay_tick_t& tick);
+  // Appends the data tokens of the ticks up to `until_ns` of session time,
+  // counted from the first tick, to `out`, stopping after `limit` ticks.
+  // Never waits, whatever the speed; callers on a timer pace themselves.
+  // False once the log is exhausted.
+  bool nextChunk(int64_t until_ns,
+                 size_t limit,
+                 std::vector<data_token_t>& out);
+  // Session time of the last tick delivered
+  int64_t elapsed() const { return last_tick_ns - first_tick_ns; }
+
+  const ProtocolRunner& runner() const { return player; }
+  uint64_t gaps() const { return gap_count; }  // SESSION_GAP events passed
+
+private:
+  void pace(int64_t time_ns);
+
+  SessionLog& log;
+  ProtocolRunner player;
+  double playback_speed = 0.0;
+  uint64_t gap_count = 0;
+  bool started = false;
+  int64_t first_tick_ns = 0;
+  int64_t last_tick_ns = 0;
+  replay_tick_t pending;  // Read by nextChunk() past its end
+  bool has_pending = false;
+  std::chrono::steady_clock::time_point wall_start;
+};
+
+}  // namespace clamp_protocol
@@ -0,0 +1,209 @@
+/*
+ * Copyright (C) 2011 Weill Medical College of Cornell University
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License as
+ *  published by the Free Software Foundation; either version 2 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#include <algorithm>
+
+#include "protocol_runner.hpp"
+
+namespace
+{
+
+// Nearest whole number of periods in `ns`, either sign
+int64_t roundPeriods(int64_t ns, int64_t period_ns)
+{
+  const int64_t shifted = ns + period_ns / 2;
+  const int64_t periods = shifted / period_ns;
+  return shifted % period_ns < 0 ? periods - 1 : periods;
+}
+
+}  // namespace
+
+void clamp_protocol::ProtocolRunner::setProtocol(compiled_view new_protocol,
+                                                 uint64_t hash,
+                                                 int64_t new_period_ns)
+{
+  protocol = new_protocol;
+  protocolHash = hash;
+  anchorClock();
+  period_ns = new_period_ns;
+  if (session != nullptr) {
+    session->protocol(protocol, protocolHash, period_ns);
+  }
+  player.load(protocol, period_ns);
+  trialIdx = 0;
+}
+
+void clamp_protocol::ProtocolRunner::setPeriod(int64_t new_period_ns)
+{
+  anchorClock();
+  period_ns = new_period_ns;
+  if (session != nullptr) {
+    session->period(period_ns);
+  }
+  player.load(protocol, period_ns);
+}
+
+void clamp_protocol::ProtocolRunner::setTrials(int trials)
+{
+  numTrials = trials;
+  if (session != nullptr) {
+    session->trials(numTrials);
+  }
+}
+
+void clamp_protocol::ProtocolRunner::setOutputScaling(
+    double junction_potential, double output_factor)
+{
+  junctionPotential = junction_potential;
+  outputFactor = output_factor;
+  if (session != nullptr) {
+    session->scaling(junctionPotential, outputFactor);
+  }
+}
+
+void clamp_protocol::ProtocolRunner::rewind()
+{
+  if (session != nullptr) {
+    session->rewind();
+  }
+  player.load(protocol, period_ns);
+  trialIdx = 0;
+}
+
+void clamp_protocol::ProtocolRunner::setHash(uint64_t hash)
+{
+  protocolHash = hash;
+  if (session != nullptr) {
+    session->hash(protocolHash);
+  }
+}
+
+void clamp_protocol::ProtocolRunner::setSession(SessionRecorder* recorder)
+{
+  session = recorder;
+  if (session == nullptr) {
+    return;
+  }
+  session->protocol(protocol, protocolHash, period_ns);
+  session->trials(numTrials);
+  session->scaling(junctionPotential, outputFactor);
+  session->position(
+      trialIdx, player.stepIndex(), player.stepSample(), reference_time);
+}
+
+void clamp_protocol::ProtocolRunner::seek(int trial,
+                                          size_t step,
+                                          int64_t sample,
+                                          int64_t reference)
+{
+  trialIdx = trial;
+  player.seek(step, sample);
+  reference_time = reference;
+  // The log holds the time of the step only; the rest follows from the
+  // clock, exactly so unless the period changed before recording started
+  reference_sample = sampleAt(reference);
+  const int64_t offset = step < protocol.size ? sweepOffset(step) : 0;
+  sweep_time = reference_time - offset * period_ns;
+  sweep_sample = reference_sample - offset;
+}
+
+int64_t clamp_protocol::ProtocolRunner::sampleAt(int64_t now) const
+{
+  return clock_sample
+      + roundPeriods(now - clock_time, std::max<int64_t>(period_ns, 1));
+}
+
+void clamp_protocol::ProtocolRunner::anchorClock()
+{
+  if (ticked) {
+    clock_time = last_time;
+    clock_sample = last_sample;
+  }
+}
+
+int64_t clamp_protocol::ProtocolRunner::sweepOffset(size_t step) const
+{
+  const compiled_step_t& current = protocol.steps[step];
+  int64_t offset = 0;
+  while (step > 0 && protocol.steps[step - 1].segment == current.segment
+         && protocol.steps[step - 1].sweep == current.sweep)
+  {
+    offset += stepSamples(protocol.steps[--step], period_ns);
+  }
+  return offset;
+}
+
+bool clamp_protocol::ProtocolRunner::startsSweep(size_t step) const
+{
+  if (step == 0) {
+    return true;
+  }
+  const compiled_step_t& previous = protocol.steps[step - 1];
+  return previous.segment != protocol.steps[step].segment
+      || previous.sweep != protocol.steps[step].sweep;
+}
+
+bool clamp_protocol::ProtocolRunner::tick(int64_t now,
+                                          double input,
+                                          double& output,
+                                          data_token_t& token)
+{
+  if (session != nullptr) {
+    session->tick(now, input);
+  }
+  const int64_t sample =
+      ticked ? std::max(last_sample + 1, sampleAt(now)) : sampleAt(now);
+  last_time = now;
+  last_sample = sample;
+  ticked = true;
+  if (player.finished()) {  // Start the next trial, if any
+    player.rewind();
+    if (++trialIdx >= numTrials || player.finished()) {
+      output = 0.0;
+      return false;
+    }
+  }
+
+  const compiled_step_t& step = player.step();
+  if (player.stepSample() == 0) {
+    reference_time = now;
+    reference_sample = sample;
+    if (startsSweep(player.stepIndex())) {
+      sweep_time = now;
+      sweep_sample = sample;
+    }
+    if (trace != nullptr) {
+      trace->instant(TRACE_STEP, player.stepIndex());
+    }
+  }
+  const double voltage_mv = player.next();
+  output = (voltage_mv + junctionPotential) * outputFactor;
+  token = {reference_time,
+           now,
+           input,
+           trialIdx,
+           static_cast<int>(step.segment),
+           static_cast<int>(step.sweep),
+           static_cast<int>(step.step),
+           protocolHash,
+           sweep_time,
+           reference_sample,
+           sweep_sample,
+           sample};
+  return true;
+}
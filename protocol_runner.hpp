@@ -0,0 +1,111 @@
+/*
+ * Copyright (C) 2011 Weill Medical College of Cornell University
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License as
+ *  published by the Free Software Foundation; either version 2 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#pragma once
+
+#include <cstdint>
+
+#include "protocol_engine.hpp"
+#include "protocol_record.hpp"
+#include "protocol_session.hpp"
+#include "protocol_trace.hpp"
+
+namespace clamp_protocol
+{
+
+// Real-time side of the plugin without the RTXI plumbing: plays the armed
+// protocol for the configured number of trials and produces one output
+// sample and one data token per RT period. Component::execute() drives it
+// on the RT thread and the simulated RT harness drives it with a mock
+// clock.
+class ProtocolRunner
+{
+public:
+  // The steps must outlive the runner or the next call
+  void setProtocol(compiled_view new_protocol,
+                   uint64_t hash,
+                   int64_t new_period_ns);
+  void setPeriod(int64_t new_period_ns);  // Restarts the current trial
+  void setTrials(int trials);
+  void setOutputScaling(double junction_potential, double output_factor);
+  void rewind();  // Back to the first sample of the first trial
+  // Hash the tokens are stamped with from the next tick, for when the
+  // period or output scaling it covers has changed mid-run
+  void setHash(uint64_t hash);
+  // Marks step boundaries in `ring`, which must be written only by the
+  // thread calling tick()
+  void setTrace(TraceRing* ring) { trace = ring; }
+  // Records every command and tick into `recorder` from now on, starting
+  // with the current protocol, settings and position. Call like
+  // setProtocol(), with the runner thread idle; null stops recording.
+  void setSession(SessionRecorder* recorder);
+  // Continue from a recorded position; used when replaying sessions
+  void seek(int trial, size_t step, int64_t sample, int64_t reference);
+
+  // One RT period. `now` is the RT time of the sample and `input` the value
+  // read from the input channel. Sets `output` to the value for the output
+  // channel, (amplitude + junction potential) * output factor, and fills
+  // `token`. Returns false once every trial has played, with `output` set to
+  // zero.
+  //
+  // Tokens are stamped with `now` and with the RT sample counter: the
+  // number of periods from the RT clock's zero, round(now / period), so
+  // other modules can find the same sample from its time alone. After a
+  // period change the counter carries on from the last tick at the new
+  // period. It advances at least one per tick, and by the missed periods
+  // when ticks are skipped, e.g. while paused.
+  bool tick(int64_t now, double input, double& output, data_token_t& token);
+
+  const ProtocolEngine& engine() const { return player; }
+  compiled_view steps() const { return protocol; }
+  int64_t period() const { return period_ns; }
+  int64_t lastSample() const { return last_sample; }  // Counter of last tick
+  int trial() const { return trialIdx; }
+  uint64_t hash() const { return protocolHash; }
+
+private:
+  int64_t sampleAt(int64_t now) const;  // Counter reading for an RT time
+  void anchorClock();  // Before a period change
+  // Periods played by the steps of its sweep that come before `step`; walks
+  // back over them, so only seek() uses it
+  int64_t sweepOffset(size_t step) const;
+  bool startsSweep(size_t step) const;  // Step is the first of its sweep
+
+  compiled_view protocol;
+  ProtocolEngine player;
+  int64_t period_ns = 1;
+  int trialIdx = 0;
+  int numTrials = 1;
+  double junctionPotential = 0.0;
+  double outputFactor = 1.0;
+  int64_t reference_time = 0;  // RT time of the first sample of the step
+  int64_t reference_sample = 0;
+  int64_t sweep_time = 0;  // Same for the first sample of the sweep
+  int64_t sweep_sample = 0;
+  // The counter reads clock_sample at clock_time
+  int64_t clock_time = 0;
+  int64_t clock_sample = 0;
+  int64_t last_time = 0;
+  int64_t last_sample = -1;
+  bool ticked = false;
+  uint64_t protocolHash = 0;
+  TraceRing* trace = nullptr;
+  SessionRecorder* session = nullptr;
+};
+
+}  // namespace clamp_protocol
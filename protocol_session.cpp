@@ -0,0 +1,493 @@
+/*
+ * Copyright (C) 2011 Weill Medical College of Cornell University
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License as
+ *  published by the Free Software Foundation; either version 2 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#include <algorithm>
+#include <cstring>
+
+#include "protocol_session.hpp"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "protocol_hash.hpp"
+
+namespace
+{
+
+constexpr char session_magic[8] = {'C', 'P', 'S', 'E', 'S', 'S', 'N', '\0'};
+// Version 2 added SESSION_HASH, version 3 the checksum of SESSION_PROTOCOL
+// steps; older logs are still read
+constexpr uint32_t session_version = 3;
+constexpr uint32_t byte_order_mark = 0x01020304;
+constexpr size_t header_size = sizeof(session_magic) + 2 * sizeof(uint32_t);
+constexpr size_t max_event_size = 48;  // Largest event pushed through the ring
+
+// Little helpers for the event payloads: LEB128 varints, zigzag for signed
+// values and raw 8 byte doubles
+class Encoder
+{
+public:
+  explicit Encoder(clamp_protocol::session_event type) { bytes[size++] = type; }
+
+  void unsignedValue(uint64_t value)
+  {
+    while (value >= 0x80) {
+      bytes[size++] = static_cast<unsigned char>(value | 0x80U);
+      value >>= 7U;
+    }
+    bytes[size++] = static_cast<unsigned char>(value);
+  }
+  void signedValue(int64_t value)
+  {
+    unsignedValue((static_cast<uint64_t>(value) << 1U)
+                  ^ static_cast<uint64_t>(value >> 63));
+  }
+  void number(double value) { raw(&value, sizeof(value)); }
+  void raw(const void* data, size_t count)
+  {
+    std::memcpy(bytes + size, data, count);
+    size += count;
+  }
+
+  unsigned char bytes[max_event_size] {};
+  size_t size = 0;
+};
+
+class Decoder
+{
+public:
+  Decoder(const unsigned char* data, size_t size, size_t& pos)
+      : data(data)
+      , size(size)
+      , pos(pos)
+  {
+  }
+
+  bool unsignedValue(uint64_t& value)
+  {
+    value = 0;
+    for (unsigned shift = 0; shift < 64; shift += 7) {
+      if (pos >= size) {
+        return false;
+      }
+      const unsigned char byte = data[pos++];
+      value |= static_cast<uint64_t>(byte & 0x7FU) << shift;
+      if ((byte & 0x80U) == 0) {
+        return true;
+      }
+    }
+    return false;
+  }
+  bool signedValue(int64_t& value)
+  {
+    uint64_t raw = 0;
+    if (!unsignedValue(raw)) {
+      return false;
+    }
+    value = static_cast<int64_t>(raw >> 1U) ^ -static_cast<int64_t>(raw & 1U);
+    return true;
+  }
+  bool number(double& value)
+  {
+    if (size - pos < sizeof(value)) {
+      return false;
+    }
+    std::memcpy(&value, data + pos, sizeof(value));
+    pos += sizeof(value);
+    return true;
+  }
+  bool bytes(void* out, size_t count)
+  {
+    if (size - pos < count) {
+      return false;
+    }
+    std::memcpy(out, data + pos, count);
+    pos += count;
+    return true;
+  }
+
+private:
+  const unsigned char* data;
+  size_t size;
+  size_t& pos;
+};
+
+}  // namespace
+
+clamp_protocol::SessionRecorder::SessionRecorder(size_t capacity)
+    : ring(std::max<size_t>(capacity, 2 * max_event_size))
+    , scratch(ring.size())
+{
+}
+
+clamp_protocol::SessionRecorder::~SessionRecorder()
+{
+  close();
+}
+
+bool clamp_protocol::SessionRecorder::open(const std::string& path)
+{
+  close();
+  file = std::fopen(path.c_str(), "wb");
+  if (file == nullptr) {
+    return false;
+  }
+  file_ok = true;
+  bytes_written = 0;
+  head.store(0);
+  tail.store(0);
+  lost_events.store(0);
+  gap = false;
+  last_tick = 0;
+  current_period = 0;
+  const uint32_t fields[2] = {session_version, byte_order_mark};
+  if (!write(session_magic, sizeof(session_magic))
+      || !write(fields, sizeof(fields)))
+  {
+    close();
+    return false;
+  }
+  recording.store(true, std::memory_order_release);
+  return true;
+}
+
+void clamp_protocol::SessionRecorder::close()
+{
+  if (file == nullptr) {
+    return;
+  }
+  recording.store(false, std::memory_order_release);
+  flush();
+  std::fclose(file);
+  file = nullptr;
+}
+
+void clamp_protocol::SessionRecorder::push(const unsigned char* event,
+                                           size_t size)
+{
+  const size_t current_head = head.load(std::memory_order_relaxed);
+  size_t free_bytes =
+      ring.size() - (current_head - tail.load(std::memory_order_acquire));
+  if (gap) {
+    if (free_bytes < size + 1) {
+      lost_events.fetch_add(1, std::memory_order_relaxed);
+      return;
+    }
+    ring[current_head % ring.size()] = SESSION_GAP;
+    head.store(current_head + 1, std::memory_order_release);
+    gap = false;
+    push(event, size);
+    return;
+  }
+  if (free_bytes < size) {
+    lost_events.fetch_add(1, std::memory_order_relaxed);
+    gap = true;
+    return;
+  }
+  const size_t offset = current_head % ring.size();
+  const size_t first = std::min(size, ring.size() - offset);
+  std::memcpy(ring.data() + offset, event, first);
+  std::memcpy(ring.data(), event + first, size - first);
+  head.store(current_head + size, std::memory_order_release);
+}
+
+void clamp_protocol::SessionRecorder::tick(int64_t now, double input)
+{
+  if (!recording.load(std::memory_order_relaxed)) {
+    return;
+  }
+  Encoder event(SESSION_TICK);
+  event.signedValue(now - last_tick - current_period);
+  event.number(input);
+  const uint64_t lost = lost_events.load(std::memory_order_relaxed);
+  push(event.bytes, event.size);
+  if (lost_events.load(std::memory_order_relaxed) == lost) {
+    last_tick = now;  // Times are relative to the last tick in the log
+  }
+}
+
+void clamp_protocol::SessionRecorder::period(int64_t period_ns)
+{
+  if (!recording.load(std::memory_order_relaxed)) {
+    return;
+  }
+  Encoder event(SESSION_PERIOD);
+  event.signedValue(period_ns);
+  const uint64_t lost = lost_events.load(std::memory_order_relaxed);
+  push(event.bytes, event.size);
+  if (lost_events.load(std::memory_order_relaxed) == lost) {
+    current_period = period_ns;
+  }
+}
+
+void clamp_protocol::SessionRecorder::trials(int count)
+{
+  if (!recording.load(std::memory_order_relaxed)) {
+    return;
+  }
+  Encoder event(SESSION_TRIALS);
+  event.signedValue(count);
+  push(event.bytes, event.size);
+}
+
+void clamp_protocol::SessionRecorder::scaling(double junction_potential,
+                                              double output_factor)
+{
+  if (!recording.load(std::memory_order_relaxed)) {
+    return;
+  }
+  Encoder event(SESSION_SCALING);
+  event.number(junction_potential);
+  event.number(output_factor);
+  push(event.bytes, event.size);
+}
+
+void clamp_protocol::SessionRecorder::rewind()
+{
+  if (!recording.load(std::memory_order_relaxed)) {
+    return;
+  }
+  const Encoder event(SESSION_REWIND);
+  push(event.bytes, event.size);
+}
+
+void clamp_protocol::SessionRecorder::position(int trial,
+                                               size_t step,
+                                               int64_t sample,
+                                               int64_t reference)
+{
+  if (!recording.load(std::memory_order_relaxed)) {
+    return;
+  }
+  Encoder event(SESSION_POSITION);
+  event.signedValue(trial);
+  event.unsignedValue(step);
+  event.signedValue(sample);
+  event.signedValue(reference);
+  push(event.bytes, event.size);
+}
+
+void clamp_protocol::SessionRecorder::hash(uint64_t hash)
+{
+  if (!recording.load(std::memory_order_relaxed)) {
+    return;
+  }
+  Encoder event(SESSION_HASH);
+  event.raw(&hash, sizeof(hash));
+  push(event.bytes, event.size);
+}
+
+void clamp_protocol::SessionRecorder::protocol(compiled_view steps,
+                                               uint64_t hash,
+                                               int64_t period_ns)
+{
+  if (!recording.load(std::memory_order_relaxed)) {
+    return;
+  }
+  flush();  // Keep the events in order
+  // The stored hash is whatever the caller named the protocol by, so the
+  // steps get a checksum of their own
+  const uint64_t checksum = hashProtocol(steps, period_ns, 0.0, 1.0);
+  Encoder event(SESSION_PROTOCOL);
+  event.raw(&hash, sizeof(hash));
+  event.signedValue(period_ns);
+  event.unsignedValue(steps.size);
+  event.raw(&checksum, sizeof(checksum));
+  if (write(event.bytes, event.size)
+      && write(steps.steps, steps.size * sizeof(compiled_step_t)))
+  {
+    current_period = period_ns;
+  }
+}
+
+bool clamp_protocol::SessionRecorder::flush()
+{
+  if (file == nullptr) {
+    return false;
+  }
+  const size_t current_tail = tail.load(std::memory_order_relaxed);
+  const size_t size = head.load(std::memory_order_acquire) - current_tail;
+  const size_t offset = current_tail % ring.size();
+  const size_t first = std::min(size, ring.size() - offset);
+  std::memcpy(scratch.data(), ring.data() + offset, first);
+  std::memcpy(scratch.data() + first, ring.data(), size - first);
+  tail.store(current_tail + size, std::memory_order_release);
+  return write(scratch.data(), size) && std::fflush(file) == 0;
+}
+
+bool clamp_protocol::SessionRecorder::write(const void* data, size_t size)
+{
+  if (size > 0 && file_ok) {
+    file_ok = std::fwrite(data, 1, size, file) == size;
+    bytes_written += file_ok ? size : 0;
+  }
+  return file_ok;
+}
+
+clamp_protocol::SessionLog::~SessionLog()
+{
+  close();
+}
+
+bool clamp_protocol::SessionLog::load(const std::string& path)
+{
+  close();
+  const int fd = ::open(path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    return false;
+  }
+  struct stat info {};
+  if (fstat(fd, &info) != 0
+      || static_cast<size_t>(info.st_size) < header_size)
+  {
+    ::close(fd);
+    return false;
+  }
+  const auto file_size = static_cast<size_t>(info.st_size);
+  void* mapping = mmap(nullptr, file_size, PROT_READ, MAP_SHARED, fd, 0);
+  ::close(fd);
+  if (mapping == MAP_FAILED) {
+    return false;
+  }
+  // Logs are read front to back once: let the kernel read ahead and drop
+  // pages behind
+  madvise(mapping, file_size, MADV_SEQUENTIAL);
+  data = static_cast<const unsigned char*>(mapping);
+  mapped_length = file_size;
+  length = file_size;
+
+  uint32_t fields[2] = {};
+  std::memcpy(fields, data + sizeof(session_magic), sizeof(fields));
+  if (std::memcmp(data, session_magic, sizeof(session_magic)) != 0
+      || fields[0] < 1 || fields[0] > session_version
+      || fields[1] != byte_order_mark)
+  {
+    close();
+    return false;
+  }
+  version = fields[0];
+  rewind();
+  return true;
+}
+
+void clamp_protocol::SessionLog::close()
+{
+  if (data != nullptr) {
+    munmap(const_cast<unsigned char*>(data), mapped_length);
+  }
+  data = nullptr;
+  mapped_length = 0;
+  length = 0;
+  pos = 0;
+  protocols.clear();
+}
+
+void clamp_protocol::SessionLog::rewind()
+{
+  pos = header_size;
+  damaged = false;
+  last_tick = 0;
+  current_period = 0;
+  protocols.clear();
+}
+
+bool clamp_protocol::SessionLog::next(session_event_t& event)
+{
+  if (pos >= length) {
+    return false;
+  }
+  const size_t start = pos;
+  Decoder in(data, length, pos);
+  event = {};
+  event.type = static_cast<session_event>(data[pos++]);
+  bool ok = true;
+  switch (event.type) {
+    case SESSION_TICK: {
+      int64_t delta = 0;
+      ok = in.signedValue(delta) && in.number(event.input);
+      event.time_ns = last_tick + current_period + delta;
+      last_tick = event.time_ns;
+      break;
+    }
+    case SESSION_PROTOCOL: {
+      uint64_t count = 0;
+      uint64_t checksum = 0;
+      ok = in.bytes(&event.hash, sizeof(event.hash))
+          && in.signedValue(event.period_ns) && in.unsignedValue(count)
+          && (version < 3 || in.bytes(&checksum, sizeof(checksum)))
+          && count <= (length - pos) / sizeof(compiled_step_t);
+      if (!ok) {
+        break;
+      }
+      // Replay hands these steps to a runner, so they get the same checks
+      // as an archive's
+      std::vector<compiled_step_t>& steps = protocols.emplace_back(count);
+      in.bytes(steps.data(), count * sizeof(compiled_step_t));
+      event.protocol = {steps.data(), steps.size()};
+      ok = std::all_of(steps.begin(), steps.end(), validStep)
+          && (version < 3
+              || hashProtocol(event.protocol, event.period_ns, 0.0, 1.0)
+                  == checksum);
+      if (!ok) {
+        protocols.pop_back();
+        break;
+      }
+      current_period = event.period_ns;
+      break;
+    }
+    case SESSION_PERIOD:
+      ok = in.signedValue(event.period_ns);
+      current_period = event.period_ns;
+      break;
+    case SESSION_TRIALS: {
+      int64_t trials = 0;
+      ok = in.signedValue(trials);
+      event.trials = static_cast<int>(trials);
+      break;
+    }
+    case SESSION_SCALING:
+      ok = in.number(event.junction_potential) && in.number(event.output_factor);
+      break;
+    case SESSION_POSITION: {
+      int64_t trial = 0;
+      uint64_t step = 0;
+      ok = in.signedValue(trial) && in.unsignedValue(step)
+          && in.signedValue(event.sample) && in.signedValue(event.time_ns);
+      event.trial = static_cast<int>(trial);
+      event.step = static_cast<size_t>(step);
+      break;
+    }
+    case SESSION_HASH:
+      ok = in.bytes(&event.hash, sizeof(event.hash));
+      break;
+    case SESSION_REWIND:
+    case SESSION_GAP:
+      break;
+    default:
+      ok = false;
+      break;
+  }
+  if (!ok) {
+    pos = start;
+    damaged = true;
+    length = start;  // Stop here from now on
+  }
+  return ok;
+}
@@ -0,0 +1,163 @@
+/*
+ * Copyright (C) 2011 Weill Medical College of Cornell University
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License as
+ *  published by the Free Software Foundation; either version 2 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <deque>
+#include <string>
+#include <vector>
+
+#include "protocol_model.hpp"
+
+namespace clamp_protocol
+{
+
+// Session logs (*.cps) hold everything a ProtocolRunner consumed during a
+// run: the tick times and input samples and every command applied to it
+// (protocol, period, trials, output scaling, rewind, hash), so the run can be
+// replayed offline sample for sample. After a short header the file is a
+// stream of events, each a one byte tag and a compact payload. Tick times
+// are stored as the variation from the current period, usually one byte,
+// and inputs verbatim, about ten bytes per tick in total.
+//
+// Like protocol archives, logs use the byte order of the machine that wrote
+// them.
+enum session_event : uint8_t
+{
+  SESSION_TICK = 0,  // time_ns, input
+  SESSION_PROTOCOL,  // protocol, hash, period_ns
+  SESSION_PERIOD,  // period_ns
+  SESSION_TRIALS,  // trials
+  SESSION_SCALING,  // junction_potential, output_factor
+  SESSION_REWIND,
+  SESSION_POSITION,  // trial, step, sample, time_ns: runner state when
+                     // recording started mid-run
+  SESSION_GAP,  // Events were lost here because the buffer was full
+  SESSION_HASH,  // hash: tokens are stamped with it from here on
+  SESSION_EVENT_COUNT
+};
+
+// Writes session logs. The runner thread records into a preallocated ring;
+// flush() moves the ring into the file from another thread. Events that do
+// not fit are dropped and leave a SESSION_GAP in the log. Recording a
+// protocol writes its steps straight to the file, so it must only happen
+// while the runner thread is idle, as ProtocolRunner::setProtocol() already
+// requires.
+class SessionRecorder
+{
+public:
+  explicit SessionRecorder(size_t capacity = 1 << 20);
+  SessionRecorder(const SessionRecorder&) = delete;
+  SessionRecorder& operator=(const SessionRecorder&) = delete;
+  ~SessionRecorder();
+
+  bool open(const std::string& path);  // Writes the header
+  void close();  // Flushes what is left
+  bool isOpen() const { return recording.load(std::memory_order_acquire); }
+
+  // Runner thread. No-ops while closed.
+  void tick(int64_t now, double input);
+  void period(int64_t period_ns);
+  void trials(int count);
+  void scaling(double junction_potential, double output_factor);
+  void rewind();
+  void position(int trial, size_t step, int64_t sample, int64_t reference);
+  void hash(uint64_t hash);
+  // Runner thread idle
+  void protocol(compiled_view steps, uint64_t hash, int64_t period_ns);
+
+  // Writer thread. False once writing to the file has failed.
+  bool flush();
+  uint64_t lostEvents() const { return lost_events.load(); }
+  uint64_t bytesWritten() const { return bytes_written; }
+
+private:
+  void push(const unsigned char* event, size_t size);
+  bool write(const void* data, size_t size);
+
+  std::vector<unsigned char> ring;
+  std::atomic<size_t> head {0};
+  std::atomic<size_t> tail {0};
+  std::atomic<bool> recording {false};
+  std::atomic<uint64_t> lost_events {0};
+  bool gap = false;  // Runner thread: a SESSION_GAP is owed
+  int64_t last_tick = 0;  // Runner thread: time of the last tick recorded
+  int64_t current_period = 0;
+
+  FILE* file = nullptr;
+  bool file_ok = false;
+  uint64_t bytes_written = 0;
+  std::vector<unsigned char> scratch;  // Writer thread copy of the ring
+};
+
+struct session_event_t
+{
+  session_event type = SESSION_TICK;
+  int64_t time_ns = 0;
+  double input = 0.0;
+  int64_t period_ns = 0;
+  int trials = 0;
+  int trial = 0;
+  double junction_potential = 0.0;
+  double output_factor = 1.0;
+  compiled_view protocol;  // Owned by the SessionLog
+  uint64_t hash = 0;
+  size_t step = 0;
+  int64_t sample = 0;
+};
+
+// Reads a session log back, one event at a time. The file is memory mapped
+// and decoded in place, so logs of any size load at once and stream from
+// the page cache.
+class SessionLog
+{
+public:
+  SessionLog() = default;
+  SessionLog(const SessionLog&) = delete;
+  SessionLog& operator=(const SessionLog&) = delete;
+  ~SessionLog();
+
+  bool load(const std::string& path);  // False if missing or malformed
+  void close();
+  // Bytes of the log and how far next() has read into them
+  size_t size() const { return length; }
+  size_t position() const { return pos; }
+  void rewind();  // Back to the first event
+  // False at the end, or where the log is truncated or corrupt. A corrupt
+  // log is cut short there; that includes protocol steps that are not
+  // valid or no longer match their checksum.
+  bool next(session_event_t& event);
+  bool corrupt() const { return damaged; }
+
+private:
+  const unsigned char* data = nullptr;
+  size_t mapped_length = 0;
+  size_t length = 0;  // Shorter than the mapping once found corrupt
+  size_t pos = 0;
+  uint32_t version = 0;
+  bool damaged = false;
+  int64_t last_tick = 0;
+  int64_t current_period = 0;
+  std::deque<std::vector<compiled_step_t>> protocols;
+};
+
+}  // namespace clamp_protocol
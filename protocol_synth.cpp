@@ -0,0 +1,137 @@
+/*
+ * Copyright (C) 2011 Weill Medical College of Cornell University
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License as
+ *  published by the Free Software Foundation; either version 2 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#include <algorithm>
+#include <array>
+#include <charconv>
+
+#include "protocol_model.hpp"
+#include "protocol_synth.hpp"
+
+namespace
+{
+
+class SplitMix64
+{
+public:
+  explicit SplitMix64(uint64_t seed)
+      : state(seed)
+  {
+  }
+
+  uint64_t next()
+  {
+    uint64_t z = (state += 0x9e3779b97f4a7c15ULL);
+    z = (z ^ (z >> 30U)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27U)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31U);
+  }
+
+  // Uniform in [0, 1)
+  double unit() { return static_cast<double>(next() >> 11U) * 0x1.0p-53; }
+  double uniform(double low, double high)
+  {
+    return low + (high - low) * unit();
+  }
+  // Uniform in [low, high]
+  size_t count(size_t low, size_t high)
+  {
+    if (high <= low) {
+      return low;
+    }
+    return low + static_cast<size_t>(next() % (high - low + 1));
+  }
+
+private:
+  uint64_t state;
+};
+
+// Shortest text that reads back as the same double
+void writeNumber(std::ostream& out, double value)
+{
+  std::array<char, 32> buffer {};
+  const auto result =
+      std::to_chars(buffer.data(), buffer.data() + buffer.size(), value);
+  out.write(buffer.data(), result.ptr - buffer.data());
+}
+
+void writeAttribute(std::ostream& out, const char* name, double value)
+{
+  out << ' ' << name << "=\"";
+  writeNumber(out, value);
+  out << '"';
+}
+
+}  // namespace
+
+void clamp_protocol::writeSyntheticCsp(std::ostream& out,
+                                       const synth_params& params)
+{
+  SplitMix64 random(params.seed);
+  out << "<?xml version=\"1.0\"?>\n<!DOCTYPE ClampProtocolML>\n"
+         "<Clamp-Suite-Protocol-v2.0>\n";
+  for (size_t seg = 0; seg < params.segments; ++seg) {
+    const size_t sweeps = random.count(params.min_sweeps, params.max_sweeps);
+    const size_t steps = random.count(params.min_steps, params.max_steps);
+    out << " <segment numSweeps=\"" << sweeps << "\">\n";
+    for (size_t i = 0; i < steps; ++i) {
+      const bool extreme = random.unit() < params.extreme_fraction;
+      const bool ramp = random.unit() < params.ramp_fraction;
+      const double scale = extreme ? 100.0 : 1.0;
+      double duration = 0.0;
+      double delta_duration = 0.0;
+      if (extreme && random.unit() < 0.5) {
+        // Sub-period step that shrinks to nothing over the sweeps
+        duration = random.uniform(0.0, 0.01);
+        delta_duration = sweeps > 1
+            ? -duration / static_cast<double>(sweeps - 1)
+            : 0.0;
+      } else {
+        duration = random.uniform(params.min_duration, params.max_duration);
+        // Keep the last sweep at or above zero
+        const double shortest = sweeps > 1
+            ? -duration / static_cast<double>(sweeps - 1)
+            : 0.0;
+        delta_duration = std::max(
+            shortest, random.uniform(-0.1, 0.1) * params.max_duration);
+      }
+      const double level1 =
+          random.uniform(-params.max_level, params.max_level) * scale;
+      const double delta1 =
+          random.uniform(-params.max_delta, params.max_delta) * scale;
+      const double level2 = ramp
+          ? random.uniform(-params.max_level, params.max_level) * scale
+          : 0.0;
+      const double delta2 = ramp
+          ? random.uniform(-params.max_delta, params.max_delta) * scale
+          : 0.0;
+
+      out << "  <step stepNumber=\"" << i << "\" ampMode=\"" << VOLTAGE
+          << "\" stepType=\"" << (ramp ? RAMP : STEP) << '"';
+      writeAttribute(out, "stepDuration", duration);
+      writeAttribute(out, "deltaStepDuration", delta_duration);
+      writeAttribute(out, "holdingLevel1", level1);
+      writeAttribute(out, "deltaHoldingLevel1", delta1);
+      writeAttribute(out, "holdingLevel2", level2);
+      writeAttribute(out, "deltaHoldingLevel2", delta2);
+      out << "/>\n";
+    }
+    out << " </segment>\n";
+  }
+  out << "</Clamp-Suite-Protocol-v2.0>\n";
+}
@@ -0,0 +1,56 @@
+/*
+ * Copyright (C) 2011 Weill Medical College of Cornell University
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License as
+ *  published by the Free Software Foundation; either version 2 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+
+namespace clamp_protocol
+{
+
+// Shape of a synthetic protocol. Counts are drawn uniformly from the closed
+// ranges, durations in ms and levels in mV.
+struct synth_params
+{
+  uint64_t seed = 1;
+  size_t segments = 10;
+  size_t min_sweeps = 1;
+  size_t max_sweeps = 10;
+  size_t min_steps = 1;  // Per segment
+  size_t max_steps = 10;
+  double ramp_fraction = 0.25;  // Share of steps that are ramps
+  double min_duration = 1.0;
+  double max_duration = 100.0;
+  double max_level = 120.0;  // Levels lie in [-max_level, max_level]
+  double max_delta = 10.0;  // Per sweep level deltas lie in [-max_delta, ..]
+  // Share of steps with extreme values: levels and deltas 100 times the
+  // limits above, or durations shorter than a period, shrinking to zero
+  double extreme_fraction = 0.0;
+};
+
+// Writes a random protocol in the .csp format the editor saves, one element
+// at a time without building a document, so protocols of any size can be
+// generated in constant memory. The output depends only on `params`: the
+// generator is a fixed splitmix64 stream, not a standard library
+// distribution, so the same seed gives the same file on every platform.
+// Step durations never go negative over the sweeps of a segment.
+void writeSyntheticCsp(std::ostream& out, const synth_params& params);
+
+}  // namespace clamp_protocol
@@ -0,0 +1,230 @@
+/*
+ * Copyright (C) 2011 Weill Medical College of Cornell University
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License as
+ *  published by the Free Software Foundation; either version 2 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#include <array>
+#include <charconv>
+#include <cmath>
+#include <cstring>
+
+#include "protocol_table.hpp"
+
+namespace
+{
+
+enum column : size_t
+{
+  SEGMENT_COLUMN = 0,
+  SWEEPS_COLUMN,
+  MODE_COLUMN,
+  TYPE_COLUMN,
+  DURATION_COLUMN,
+  DELTA_DURATION_COLUMN,
+  LEVEL_1_COLUMN,
+  DELTA_LEVEL_1_COLUMN,
+  LEVEL_2_COLUMN,
+  DELTA_LEVEL_2_COLUMN,
+  COLUMN_COUNT
+};
+
+constexpr size_t required_columns = LEVEL_2_COLUMN;
+
+std::string_view trim(std::string_view field)
+{
+  while (!field.empty()
+         && (field.front() == ' ' || field.front() == '"'
+             || field.front() == '\r'))
+  {
+    field.remove_prefix(1);
+  }
+  while (!field.empty()
+         && (field.back() == ' ' || field.back() == '"' || field.back() == '\r'))
+  {
+    field.remove_suffix(1);
+  }
+  return field;
+}
+
+// Finite numbers only: from_chars also takes "nan", "inf" and exponents
+// beyond double range
+bool parse_number(std::string_view field, double& value)
+{
+  if (!field.empty() && field.front() == '+') {
+    field.remove_prefix(1);
+  }
+  const char* last = field.data() + field.size();
+  auto [ptr, ec] = std::from_chars(field.data(), last, value);
+  return ec == std::errc() && ptr == last && std::isfinite(value);
+}
+
+bool equals_nocase(std::string_view field, std::string_view word)
+{
+  if (field.size() != word.size()) {
+    return false;
+  }
+  for (size_t i = 0; i < field.size(); ++i) {
+    if ((field[i] | 0x20) != word[i]) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// Accepts either the name (case insensitive) or the enum value
+bool parse_enum(std::string_view field,
+                std::string_view name0,
+                std::string_view name1,
+                int& value)
+{
+  if (equals_nocase(field, name0) || field == "0") {
+    value = 0;
+    return true;
+  }
+  if (equals_nocase(field, name1) || field == "1") {
+    value = 1;
+    return true;
+  }
+  return false;
+}
+
+}  // namespace
+
+clamp_protocol::table_import_result clamp_protocol::importStepTable(
+    std::string_view text, Protocol& protocol)
+{
+  table_import_result result;
+  Protocol parsed;
+
+  // Tab separated if the first line has a tab, comma separated otherwise
+  const size_t first_eol = text.find('\n');
+  const char delimiter =
+      text.substr(0, first_eol).find('\t') != std::string_view::npos ? '\t'
+                                                                       : ',';
+
+  auto fail = [&result](size_t line, const char* message)
+  {
+    result.ok = false;
+    result.line = line;
+    result.message = message;
+    return result;
+  };
+
+  std::array<std::string_view, COLUMN_COUNT> fields {};
+  double segment_label = 0.0;
+  size_t line_number = 0;
+  bool header_checked = false;
+  while (!text.empty()) {
+    const size_t eol = text.find('\n');
+    const std::string_view line = text.substr(0, eol);
+    text.remove_prefix(eol == std::string_view::npos ? text.size() : eol + 1);
+    ++line_number;
+
+    if (trim(line).empty() || trim(line).front() == '#') {
+      continue;
+    }
+
+    // Split the row into fields
+    size_t field_count = 0;
+    size_t begin = 0;
+    while (begin <= line.size()) {
+      size_t end = line.find(delimiter, begin);
+      if (end == std::string_view::npos) {
+        end = line.size();
+      }
+      if (field_count == COLUMN_COUNT) {
+        return fail(line_number, "Too many columns");
+      }
+      fields[field_count++] = trim(line.substr(begin, end - begin));
+      begin = end + 1;
+    }
+
+    double value = 0.0;
+    if (!header_checked) {
+      header_checked = true;
+      if (!parse_number(fields[SEGMENT_COLUMN], value)) {
+        continue;  // Header row
+      }
+    }
+    if (field_count < required_columns) {
+      return fail(line_number, "Expected at least 8 columns");
+    }
+
+    // Segment and sweeps
+    double label = 0.0;
+    double sweeps = 0.0;
+    if (!parse_number(fields[SEGMENT_COLUMN], label)) {
+      return fail(line_number, "Segment is not a number");
+    }
+    // Range checked before the cast, which is undefined outside it
+    if (!parse_number(fields[SWEEPS_COLUMN], sweeps) || sweeps < 1
+        || sweeps > static_cast<double>(max_sweeps)
+        || sweeps != std::floor(sweeps))
+    {
+      return fail(line_number, "Sweeps must be an integer from 1 to 2^32 - 1");
+    }
+    if (parsed.numSegments() == 0 || label > segment_label) {
+      parsed.appendSegment(static_cast<size_t>(sweeps));
+      segment_label = label;
+    } else if (label < segment_label) {
+      return fail(line_number, "Segments must be listed in increasing order");
+    } else if (parsed.numSweeps(parsed.numSegments() - 1)
+               != static_cast<size_t>(sweeps))
+    {
+      return fail(line_number, "Sweeps differ within a segment");
+    }
+
+    // Step
+    ProtocolStep step;
+    int mode = 0;
+    int type = 0;
+    if (!parse_enum(fields[MODE_COLUMN], "voltage", "current", mode)) {
+      return fail(line_number, "Mode must be voltage or current");
+    }
+    if (!parse_enum(fields[TYPE_COLUMN], "step", "ramp", type)) {
+      return fail(line_number, "Type must be step or ramp");
+    }
+    step.ampMode = static_cast<ampMode_t>(mode);
+    step.stepType = static_cast<stepType_t>(type);
+    if (step.stepType == RAMP
+        && (field_count < COLUMN_COUNT
+            || fields[LEVEL_2_COLUMN].empty()
+            || fields[DELTA_LEVEL_2_COLUMN].empty()))
+    {
+      return fail(line_number, "Ramp needs level 2 and delta level 2");
+    }
+    for (size_t col = DURATION_COLUMN; col < field_count; ++col) {
+      if (col >= required_columns && fields[col].empty()) {
+        continue;  // Optional level 2 columns
+      }
+      if (!parse_number(fields[col], value)) {
+        return fail(line_number, "Step parameter is not a number");
+      }
+      step.parameters.at(col - DURATION_COLUMN) = value;
+    }
+    if (step.parameters[STEP_DURATION] < 0) {
+      return fail(line_number, "Step duration is negative");
+    }
+    parsed.getSegment(parsed.numSegments() - 1).step(step);
+  }
+
+  if (parsed.numSegments() == 0) {
+    return fail(line_number, "Table does not contain any steps");
+  }
+
+  protocol = parsed;
+  return result;
+}
@@ -0,0 +1,53 @@
+/*
+ * Copyright (C) 2011 Weill Medical College of Cornell University
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License as
+ *  published by the Free Software Foundation; either version 2 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#pragma once
+
+#include <string>
+#include <string_view>
+
+#include "protocol_model.hpp"
+
+namespace clamp_protocol
+{
+
+// Result of importing a step table. `line` is 1-based and points at the row
+// that failed validation.
+struct table_import_result
+{
+  bool ok = true;
+  size_t line = 0;
+  std::string message;
+};
+
+// Builds a protocol from a comma or tab separated step table with one row
+// per step:
+//
+//   segment, sweeps, mode, type, duration, delta duration,
+//   level 1, delta level 1 [, level 2, delta level 2]
+//
+// Rows with the same segment label belong to the same segment, and labels
+// must increase down the file. Mode is "voltage"/"current" or 0/1, type is
+// "step"/"ramp" or 0/1. The level 2 columns may be left out or empty for
+// steps but are required for ramps, which have nowhere else to end. A header
+// row and blank or '#' lines are skipped. The
+// table is validated in a single pass and `protocol` is only replaced when
+// every row is valid.
+table_import_result importStepTable(std::string_view text, Protocol& protocol);
+
+}  // namespace clamp_protocol
@@ -0,0 +1,142 @@
+/*
+ * Copyright (C) 2011 Weill Medical College of Cornell University
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License as
+ *  published by the Free Software Foundation; either version 2 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#include <algorithm>
+#include <chrono>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#include "protocol_trace.hpp"
+
+namespace
+{
+
+constexpr const char* trace_names[clamp_protocol::TRACE_NAME_COUNT] = {
+    "tick", "step", "fifo write", "command", "drain", "addCurve", "replot"};
+
+int64_t steadyNow()
+{
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+}  // namespace
+
+uint64_t clamp_protocol::traceClock()
+{
+#if defined(__x86_64__) || defined(__i386__)
+  return __rdtsc();
+#else
+  return static_cast<uint64_t>(steadyNow());
+#endif
+}
+
+clamp_protocol::TraceRing::TraceRing(std::string ring_name, size_t capacity)
+    : label(std::move(ring_name))
+{
+  size_t size = 1;
+  while (size < capacity) {
+    size <<= 1U;
+  }
+  events.resize(size);
+  mask = size - 1;
+}
+
+void clamp_protocol::TraceRing::snapshot(std::vector<trace_event_t>& out) const
+{
+  const uint64_t first_head = head.load(std::memory_order_acquire);
+  const uint64_t size = events.size();
+  const uint64_t first = first_head > size ? first_head - size : 0;
+  const size_t offset = out.size();
+  for (uint64_t i = first; i < first_head; ++i) {
+    out.push_back(events[i & mask]);
+  }
+  // Slots the writer reached while we copied may hold newer or torn events
+  const uint64_t last_head = head.load(std::memory_order_acquire);
+  const uint64_t valid = last_head >= size ? last_head - size + 1 : 0;
+  if (valid > first) {
+    const auto stale = static_cast<std::ptrdiff_t>(
+        std::min(valid - first, first_head - first));
+    out.erase(out.begin() + static_cast<std::ptrdiff_t>(offset),
+              out.begin() + static_cast<std::ptrdiff_t>(offset) + stale);
+  }
+}
+
+clamp_protocol::TraceRecorder::TraceRecorder()
+    : start_tsc(traceClock())
+    , start_ns(steadyNow())
+{
+}
+
+clamp_protocol::TraceRing* clamp_protocol::TraceRecorder::addRing(
+    std::string name, size_t capacity)
+{
+  rings.push_back(std::make_unique<TraceRing>(std::move(name), capacity));
+  return rings.back().get();
+}
+
+void clamp_protocol::TraceRecorder::writeChromeTrace(std::ostream& out,
+                                                     int64_t window_ns) const
+{
+  // Convert clock ticks to ns with the rate seen since construction
+  const uint64_t now_tsc = traceClock();
+  const int64_t now_ns = steadyNow();
+  double ticks_per_ns = 1.0;
+  if (now_ns > start_ns && now_tsc > start_tsc) {
+    ticks_per_ns = static_cast<double>(now_tsc - start_tsc)
+        / static_cast<double>(now_ns - start_ns);
+  }
+  const double window_ticks = static_cast<double>(window_ns) * ticks_per_ns;
+  const uint64_t since = static_cast<double>(now_tsc - start_tsc) > window_ticks
+      ? now_tsc - static_cast<uint64_t>(window_ticks)
+      : start_tsc;
+
+  out << "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[";
+  bool first = true;
+  std::vector<trace_event_t> events;
+  for (size_t tid = 0; tid < rings.size(); ++tid) {
+    out << (first ? "" : ",") << "\n{\"name\":\"thread_name\",\"ph\":\"M\","
+        << "\"pid\":1,\"tid\":" << tid << ",\"args\":{\"name\":\""
+        << rings[tid]->name() << "\"}}";
+    first = false;
+
+    events.clear();
+    rings[tid]->snapshot(events);
+    for (const auto& event : events) {
+      if (event.tsc < since || event.name >= TRACE_NAME_COUNT) {
+        continue;
+      }
+      const double ts_us =
+          static_cast<double>(event.tsc - start_tsc) / ticks_per_ns * 1e-3;
+      const char* phase = event.phase == TRACE_BEGIN ? "B"
+          : event.phase == TRACE_END                 ? "E"
+                                                     : "i";
+      out << ",\n{\"name\":\"" << trace_names[event.name] << "\",\"ph\":\""
+          << phase << "\",\"ts\":" << std::fixed << ts_us
+          << std::defaultfloat << ",\"pid\":1,\"tid\":" << tid;
+      if (event.phase == TRACE_INSTANT) {
+        out << ",\"s\":\"t\"";
+      }
+      out << ",\"args\":{\"arg\":" << event.arg << "}}";
+    }
+  }
+  out << "\n]}\n";
+}
@@ -0,0 +1,124 @@
+/*
+ * Copyright (C) 2011 Weill Medical College of Cornell University
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License as
+ *  published by the Free Software Foundation; either version 2 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <ostream>
+#include <string>
+#include <vector>
+
+// Lightweight hot-path tracing. Each thread writes fixed-size events into
+// its own preallocated ring, overwriting the oldest, so recording never
+// allocates or locks. A TraceRecorder owns the rings and dumps a window of
+// their events as Chrome trace_event JSON (chrome://tracing, Perfetto).
+namespace clamp_protocol
+{
+
+enum trace_name : uint16_t
+{
+  TRACE_TICK = 0,  // Component::execute()
+  TRACE_STEP,  // First sample of a step, arg is the compiled step index
+  TRACE_FIFO_WRITE,  // arg is the bytes written, 0 when the FIFO was full
+  TRACE_COMMAND,  // RT state change applied, arg is the RT::State
+  TRACE_DRAIN,  // FIFO drained by the GUI, arg is the records read
+  TRACE_ADD_CURVE,  // ClampProtocolWindow::addCurve, arg is the records
+  TRACE_REPLOT,
+  TRACE_NAME_COUNT
+};
+
+enum trace_phase : uint16_t
+{
+  TRACE_BEGIN = 0,
+  TRACE_END,
+  TRACE_INSTANT
+};
+
+struct trace_event_t
+{
+  uint64_t tsc = 0;  // traceClock() ticks
+  uint64_t arg = 0;
+  uint16_t name = 0;
+  uint16_t phase = 0;
+  uint32_t reserved = 0;
+};
+
+// The TSC where available, otherwise steady clock nanoseconds
+uint64_t traceClock();
+
+// Single writer ring of trace events. Readers may snapshot it while the
+// writer keeps going.
+class TraceRing
+{
+public:
+  // Capacity is rounded up to a power of two
+  TraceRing(std::string ring_name, size_t capacity);
+
+  void begin(trace_name name, uint64_t arg = 0)
+  {
+    record(name, TRACE_BEGIN, arg);
+  }
+  void end(trace_name name, uint64_t arg = 0) { record(name, TRACE_END, arg); }
+  void instant(trace_name name, uint64_t arg = 0)
+  {
+    record(name, TRACE_INSTANT, arg);
+  }
+  void record(trace_name name, trace_phase phase, uint64_t arg)
+  {
+    const uint64_t index = head.load(std::memory_order_relaxed);
+    trace_event_t& event = events[index & mask];
+    event.tsc = traceClock();
+    event.arg = arg;
+    event.name = name;
+    event.phase = phase;
+    head.store(index + 1, std::memory_order_release);
+  }
+
+  // Appends the events still in the ring, oldest first, to `out`
+  void snapshot(std::vector<trace_event_t>& out) const;
+  const std::string& name() const { return label; }
+
+private:
+  std::string label;
+  std::vector<trace_event_t> events;
+  uint64_t mask = 0;
+  std::atomic<uint64_t> head {0};
+};
+
+class TraceRecorder
+{
+public:
+  TraceRecorder();
+
+  // Rings must be added before their threads start writing. The pointer
+  // stays valid for the life of the recorder.
+  TraceRing* addRing(std::string name, size_t capacity = 1U << 16U);
+
+  // Writes the events of the last `window_ns` of every ring as a Chrome
+  // trace_event JSON document, one trace thread per ring
+  void writeChromeTrace(std::ostream& out, int64_t window_ns) const;
+
+private:
+  std::vector<std::unique_ptr<TraceRing>> rings;
+  uint64_t start_tsc;
+  int64_t start_ns;
+};
+
+}  // namespace clamp_protocol
@@ -0,0 +1,164 @@
+/*
+ * Copyright (C) 2011 Weill Medical College of Cornell University
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License as
+ *  published by the Free Software Foundation; either version 2 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#include <cmath>
+
+#include "protocol_model.hpp"
+
+QDomElement clamp_protocol::Protocol::stepToNode(QDomDocument& doc,
+                                                 size_t seg_id,
+                                                 size_t stepNum)
+{
+  // Converts protocol step to XML node
+  QDomElement stepElement = doc.createElement("step");  // Step element
+  clamp_protocol::ProtocolStep step = segments.at(seg_id).steps.at(stepNum);
+
+  // Set attributes of step to element
+  stepElement.setAttribute("stepNumber", QString::number(stepNum));
+  stepElement.setAttribute("ampMode", QString::number(step.ampMode));
+  stepElement.setAttribute("stepType", QString::number(step.stepType));
+  stepElement.setAttribute(
+      "stepDuration",
+      QString::number(step.parameters.at(clamp_protocol::STEP_DURATION)));
+  stepElement.setAttribute(
+      "deltaStepDuration",
+      QString::number(step.parameters.at(clamp_protocol::DELTA_STEP_DURATION)));
+  stepElement.setAttribute(
+      "holdingLevel1",
+      QString::number(step.parameters.at(clamp_protocol::HOLDING_LEVEL_1)));
+  stepElement.setAttribute("deltaHoldingLevel1",
+                           QString::number(step.parameters.at(
+                               clamp_protocol::DELTA_HOLDING_LEVEL_1)));
+  stepElement.setAttribute(
+      "holdingLevel2",
+      QString::number(step.parameters.at(clamp_protocol::HOLDING_LEVEL_2)));
+  stepElement.setAttribute("deltaHoldingLevel2",
+                           QString::number(step.parameters.at(
+                               clamp_protocol::DELTA_HOLDING_LEVEL_2)));
+
+  return stepElement;
+}
+
+// Converts protocol segment to XML node
+QDomElement clamp_protocol::Protocol::segmentToNode(QDomDocument& doc,
+                                                    size_t seg_id)
+{
+  QDomElement segmentElement = doc.createElement("segment");  // Segment element
+  const clamp_protocol::ProtocolSegment& segment = segments.at(seg_id);
+  segmentElement.setAttribute("numSweeps", QString::number(segment.numSweeps));
+
+  // Add each step as a child to segment element
+  for (size_t i = 0; i < segment.steps.size(); ++i) {
+    segmentElement.appendChild(stepToNode(doc, seg_id, i));
+  }
+
+  return segmentElement;
+}
+
+// Convert protocol to QDomDocument
+void clamp_protocol::Protocol::toDoc()
+{
+  QDomDocument doc("ClampProtocolML");
+
+  QDomElement root = doc.createElement("Clamp-Suite-Protocol-v2.0");
+  doc.appendChild(root);
+
+  // Add segment elements to protocolDoc
+  for (size_t i = 0; i < segments.size(); ++i) {
+    root.appendChild(segmentToNode(doc, i));
+  }
+
+  protocolDoc = doc;  // Shallow copy
+}
+
+// Load protocol from QDomDocument
+bool clamp_protocol::Protocol::fromDoc(const QDomDocument& doc)
+{
+  QDomElement root = doc.documentElement();  // Get root element from document
+  std::vector<ProtocolSegment> loaded;
+
+  // Numeric attribute, `fallback` when missing. False if it is malformed.
+  auto readInt = [](const QDomElement& element, const char* name,
+                    qlonglong fallback, qlonglong& value)
+  {
+    bool ok = true;
+    value = element.hasAttribute(name)
+        ? element.attribute(name).toLongLong(&ok)
+        : fallback;
+    return ok;
+  };
+  auto readDouble = [](const QDomElement& element, const char* name,
+                       double& value)
+  {
+    bool ok = true;
+    value = element.hasAttribute(name) ? element.attribute(name).toDouble(&ok)
+                                       : 0.0;
+    return ok && std::isfinite(value);
+  };
+
+  // Retrieve information from document
+  for (QDomElement segmentElement = root.firstChildElement();
+       !segmentElement.isNull();
+       segmentElement = segmentElement.nextSiblingElement())
+  {  // Segment iteration
+    qlonglong sweeps = 0;
+    if (!readInt(segmentElement, "numSweeps", 1, sweeps) || sweeps < 0
+        || sweeps > max_sweeps)
+    {
+      return false;
+    }
+    ProtocolSegment& segment = loaded.emplace_back();
+    segment.numSweeps = static_cast<size_t>(sweeps);
+
+    for (QDomElement stepElement = segmentElement.firstChildElement();
+         !stepElement.isNull();
+         stepElement = stepElement.nextSiblingElement())
+    {  // Step iteration
+      ProtocolStep& step = segment.steps.emplace_back();
+      qlonglong ampMode = 0;
+      qlonglong stepType = 0;
+      if (!readInt(stepElement, "ampMode", VOLTAGE, ampMode)
+          || !readInt(stepElement, "stepType", STEP, stepType)
+          || (ampMode != VOLTAGE && ampMode != CURRENT)
+          || (stepType != STEP && stepType != RAMP))
+      {
+        return false;
+      }
+      step.ampMode = static_cast<ampMode_t>(ampMode);
+      step.stepType = static_cast<stepType_t>(stepType);
+      if (!readDouble(stepElement, "stepDuration",
+                      step.parameters[STEP_DURATION])
+          || !readDouble(stepElement, "deltaStepDuration",
+                         step.parameters[DELTA_STEP_DURATION])
+          || !readDouble(stepElement, "holdingLevel1",
+                         step.parameters[HOLDING_LEVEL_1])
+          || !readDouble(stepElement, "deltaHoldingLevel1",
+                         step.parameters[DELTA_HOLDING_LEVEL_1])
+          || !readDouble(stepElement, "holdingLevel2",
+                         step.parameters[HOLDING_LEVEL_2])
+          || !readDouble(stepElement, "deltaHoldingLevel2",
+                         step.parameters[DELTA_HOLDING_LEVEL_2]))
+      {
+        return false;
+      }
+    }  // End step iteration
+  }  // End segment iteration
+
+  segments = std::move(loaded);
+  return true;
+}
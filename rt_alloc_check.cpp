@@ -0,0 +1,154 @@
+/*
+ * Copyright (C) 2011 Weill Medical College of Cornell University
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License as
+ *  published by the Free Software Foundation; either version 2 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#include <atomic>
+#include <cerrno>
+#include <csignal>
+#include <cstdlib>
+
+#include "rt_alloc_check.hpp"
+
+// glibc's own allocator entry points, used by the replacements below
+extern "C"
+{
+void* __libc_malloc(size_t size);
+void* __libc_calloc(size_t count, size_t size);
+void* __libc_realloc(void* ptr, size_t size);
+void* __libc_memalign(size_t alignment, size_t size);
+void __libc_free(void* ptr);
+}
+
+namespace
+{
+
+// initial-exec keeps TLS access itself from calling malloc
+thread_local int depth __attribute__((tls_model("initial-exec"))) = 0;
+std::atomic<uint64_t> allocations {0};
+std::atomic<uint64_t> frees {0};
+std::atomic<bool> trap {false};
+std::atomic<bool> seen {false};
+
+void note(std::atomic<uint64_t>& counter)
+{
+  if (!seen.load(std::memory_order_relaxed)) {
+    seen.store(true, std::memory_order_relaxed);
+  }
+  if (depth == 0) {
+    return;
+  }
+  counter.fetch_add(1, std::memory_order_relaxed);
+  if (trap.load(std::memory_order_relaxed)) {
+    std::raise(SIGTRAP);
+  }
+}
+
+__attribute__((constructor)) void readEnvironment()
+{
+  trap.store(std::getenv("CLAMP_PROTOCOL_RT_ALLOC_TRAP") != nullptr);
+}
+
+}  // namespace
+
+void clamp_protocol::rt_alloc::enter()
+{
+  ++depth;
+}
+
+void clamp_protocol::rt_alloc::leave()
+{
+  --depth;
+}
+
+clamp_protocol::rt_alloc::counts_t clamp_protocol::rt_alloc::counts()
+{
+  return {allocations.load(std::memory_order_relaxed),
+          frees.load(std::memory_order_relaxed)};
+}
+
+void clamp_protocol::rt_alloc::reset()
+{
+  allocations.store(0);
+  frees.store(0);
+}
+
+void clamp_protocol::rt_alloc::setTrap(bool on)
+{
+  trap.store(on);
+}
+
+bool clamp_protocol::rt_alloc::hooked()
+{
+  return seen.load(std::memory_order_relaxed);
+}
+
+extern "C"
+{
+
+void* malloc(size_t size)
+{
+  note(allocations);
+  return __libc_malloc(size);
+}
+
+void* calloc(size_t count, size_t size)
+{
+  note(allocations);
+  return __libc_calloc(count, size);
+}
+
+void* realloc(void* ptr, size_t size)
+{
+  note(allocations);
+  return __libc_realloc(ptr, size);
+}
+
+void* memalign(size_t alignment, size_t size)
+{
+  note(allocations);
+  return __libc_memalign(alignment, size);
+}
+
+void* aligned_alloc(size_t alignment, size_t size)
+{
+  note(allocations);
+  return __libc_memalign(alignment, size);
+}
+
+int posix_memalign(void** out, size_t alignment, size_t size)
+{
+  if (alignment % sizeof(void*) != 0 || (alignment & (alignment - 1)) != 0) {
+    return EINVAL;
+  }
+  note(allocations);
+  void* ptr = __libc_memalign(alignment, size);
+  if (ptr == nullptr) {
+    return ENOMEM;
+  }
+  *out = ptr;
+  return 0;
+}
+
+void free(void* ptr)
+{
+  if (ptr != nullptr) {
+    note(frees);
+  }
+  __libc_free(ptr);
+}
+
+}  // extern "C"
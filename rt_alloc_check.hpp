@@ -0,0 +1,68 @@
+/*
+ * Copyright (C) 2011 Weill Medical College of Cornell University
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License as
+ *  published by the Free Software Foundation; either version 2 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#pragma once
+
+#include <cstdint>
+
+// Allocation checks for the real-time thread. The clamp_protocol_alloc_check
+// library replaces malloc, calloc, realloc, free and the aligned variants
+// (operator new and delete go through them). Every call made on a thread
+// inside a Guard is counted and, with trapping on, raises SIGTRAP so a
+// debugger stops at the offending call.
+//
+// The replacement only sees calls when it comes before libc in symbol
+// lookup: link it into executables, or LD_PRELOAD it into RTXI. Plugins
+// built with -DCLAMP_PROTOCOL_RT_ALLOC_CHECK=ON guard Component::execute()
+// and report the counts as states. Setting CLAMP_PROTOCOL_RT_ALLOC_TRAP in
+// the environment turns trapping on at load.
+//
+// Nothing Component::execute() reaches may allocate once the protocol is
+// armed: ProtocolRunner, ProtocolEngine, DisplayDecimator, DisplayWriter
+// and what they call. The simulated RT harness runs every tick inside a
+// Guard and its tests expect no allocations at all.
+namespace clamp_protocol::rt_alloc
+{
+
+struct counts_t
+{
+  uint64_t allocations = 0;
+  uint64_t frees = 0;
+};
+
+void enter();  // Start checking this thread, nests
+void leave();
+counts_t counts();  // Totals over all threads since the last reset()
+void reset();
+void setTrap(bool trap);
+// True once the replacement allocator has handled a call, i.e. it is
+// actually interposed
+bool hooked();
+
+class Guard
+{
+public:
+  Guard() { enter(); }
+  ~Guard() { leave(); }
+  Guard(const Guard&) = delete;
+  Guard& operator=(const Guard&) = delete;
+  Guard(Guard&&) = delete;
+  Guard& operator=(Guard&&) = delete;
+};
+
+}  // namespace clamp_protocol::rt_alloc
@@ -0,0 +1,276 @@
+/*
+ * Copyright (C) 2011 Weill Medical College of Cornell University
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License as
+ *  published by the Free Software Foundation; either version 2 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#include <cmath>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include <unistd.h>
+
+#include <gtest/gtest.h>
+
+#include "protocol_analysis.hpp"
+#include "protocol_batch.hpp"
+#include "protocol_columns.hpp"
+#include "protocol_csp.hpp"
+#include "protocol_generators.hpp"
+#include "protocol_pool.hpp"
+#include "protocol_session.hpp"
+#include "rt_harness.hpp"
+
+namespace
+{
+
+std::filesystem::path scratchDirectory(const char* name)
+{
+  const auto path = std::filesystem::temp_directory_path()
+      / ("clamp_protocol_" + std::to_string(getpid()) + "_" + name);
+  std::filesystem::remove_all(path);
+  std::filesystem::create_directories(path);
+  return path;
+}
+
+// Three sweeps of 10 ms at -80 mV, 20 ms at -80, -70, -60 mV, 10 ms at -80
+constexpr const char* three_sweeps = R"(<!DOCTYPE ClampProtocolML>
+<Clamp-Suite-Protocol-v2.0>
+ <segment numSweeps="3">
+  <step stepNumber="0" ampMode="0" stepType="0" stepDuration="10" holdingLevel1="-80"/>
+  <step stepNumber="1" ampMode="0" stepType="0" stepDuration="20" holdingLevel1="-80" deltaHoldingLevel1="10"/>
+  <step stepNumber="2" ampMode="0" stepType="0" stepDuration="10" holdingLevel1="-80"/>
+ </segment>
+</Clamp-Suite-Protocol-v2.0>
+)";
+
+// Raw input for three_sweeps at 0.1 ms: an offset of 1 with a decaying
+// response of amplitude 2 per sweep and tau 2 ms over the middle step
+std::vector<double> threeSweepSamples(int trials)
+{
+  std::vector<double> samples;
+  for (int trial = 0; trial < trials; ++trial) {
+    for (int sweep = 0; sweep < 3; ++sweep) {
+      samples.insert(samples.end(), 100, 1.0);
+      for (int i = 0; i < 200; ++i) {
+        samples.push_back(1.0 + 2.0 * sweep * std::exp(-0.1 * i / 2.0));
+      }
+      samples.insert(samples.end(), 100, 1.0);
+    }
+  }
+  return samples;
+}
+
+TEST(ColumnTable, RoundTrips)
+{
+  const auto directory = scratchDirectory("columns");
+  const std::string path = directory / "table.cpc";
+  clamp_protocol::ColumnTable table;
+  table.strings("file") = {"a.cps", "", "c/d.f64"};
+  table.ints("sweep") = {0, -1, INT64_MAX};
+  table.doubles("peak") = {1.5, std::nan(""), -0.0};
+  ASSERT_TRUE(table.save(path));
+
+  clamp_protocol::ColumnTable loaded;
+  ASSERT_TRUE(loaded.load(path));
+  ASSERT_EQ(loaded.rows(), 3U);
+  ASSERT_EQ(loaded.columns().size(), 3U);
+  EXPECT_EQ(loaded.find("file")->strings, table.strings("file"));
+  EXPECT_EQ(loaded.find("sweep")->ints, table.ints("sweep"));
+  const auto& peak = loaded.find("peak")->doubles;
+  EXPECT_EQ(peak[0], 1.5);
+  EXPECT_TRUE(std::isnan(peak[1]));
+  EXPECT_TRUE(std::signbit(peak[2]));
+  EXPECT_EQ(loaded.find("missing"), nullptr);
+
+  // Truncated files are rejected
+  const auto size = std::filesystem::file_size(path);
+  std::filesystem::resize_file(path, size - 1);
+  EXPECT_FALSE(loaded.load(path));
+  EXPECT_EQ(loaded.rows(), 3U);  // Untouched
+
+  // Columns of different lengths are not saved
+  table.doubles("peak").pop_back();
+  EXPECT_FALSE(table.save(path));
+  std::filesystem::remove_all(directory);
+}
+
+TEST(Analysis, FitRecoversAnExponential)
+{
+  std::vector<double> samples;
+  for (int i = 0; i < 500; ++i) {
+    samples.push_back(-3.0 * std::exp(-0.05 * i / 1.7) + 0.25);
+  }
+  const auto fit =
+      clamp_protocol::fitExponential(samples.data(), samples.size(), 0.05);
+  ASSERT_TRUE(fit.ok);
+  EXPECT_NEAR(fit.tau, 1.7, 1.7e-6);
+  EXPECT_NEAR(fit.amplitude, -3.0, 1e-6);
+  EXPECT_NEAR(fit.offset, 0.25, 1e-6);
+  EXPECT_LT(fit.rms, 1e-6);
+
+  EXPECT_FALSE(clamp_protocol::fitExponential(samples.data(), 2, 0.05).ok);
+}
+
+TEST(Analysis, SplitsRawRecordingsAndMeasuresThem)
+{
+  clamp_protocol::Protocol protocol;
+  ASSERT_TRUE(clamp_protocol::readCsp(three_sweeps, protocol));
+  const auto compiled = protocol.compile();
+  auto samples = threeSweepSamples(2);
+  samples.resize(samples.size() + 150, 1.0);  // Part of a third trial
+  const auto sweeps = clamp_protocol::splitSweeps(
+      compiled.view(), 7, 100000, samples.data(), samples.size());
+  ASSERT_EQ(sweeps.size(), 6U);
+  EXPECT_EQ(sweeps[4].trial, 1);
+  EXPECT_EQ(sweeps[4].sweep, 1U);
+  EXPECT_EQ(sweeps[4].step_starts, (std::vector<int64_t> {0, 100, 300, 400}));
+
+  const auto averaged = clamp_protocol::averageTrials(sweeps);
+  ASSERT_EQ(averaged.size(), 3U);
+  EXPECT_EQ(averaged[2].trial, -1);
+  EXPECT_EQ(averaged[2].trials, 2);
+
+  clamp_protocol::analysis_params params;
+  params.steady_ms = 2.0;
+  const auto summary = clamp_protocol::measureSweep(averaged[2], params);
+  EXPECT_DOUBLE_EQ(summary.command, -60.0);
+  EXPECT_DOUBLE_EQ(summary.holding, -80.0);
+  EXPECT_DOUBLE_EQ(summary.baseline, 1.0);
+  EXPECT_DOUBLE_EQ(summary.peak, 4.0);
+  EXPECT_DOUBLE_EQ(summary.peak_time, 0.0);
+  EXPECT_NEAR(summary.steady, 4.0 * std::exp(-19.0 / 2.0), 1e-4);
+  ASSERT_TRUE(summary.fit.ok);
+  EXPECT_NEAR(summary.fit.tau, 2.0, 1e-6);
+  EXPECT_NEAR(summary.fit.offset, 0.0, 1e-6);
+}
+
+TEST(Analysis, BatchOfSessionsAndRawRecordings)
+{
+  const auto directory = scratchDirectory("batch");
+
+  // Two sessions of a passive model cell running an I-V family twice
+  const auto iv = clamp_protocol::generators::iv({}).compile();
+  for (const char* name : {"cell1.cps", "day2/cell2.cps"}) {
+    std::filesystem::create_directories((directory / name).parent_path());
+    clamp_protocol::SessionRecorder recorder;
+    ASSERT_TRUE(recorder.open(directory / name));
+    clamp_protocol::cell_params passive;
+    passive.e_leak = -80.0;  // At rest at the holding level from the start
+    clamp_protocol::CellPopulation cell(1, passive);
+    clamp_protocol::testing::harness_config config;
+    config.period_ns = 50000;
+    config.ticks = 110000;
+    config.trials = 2;
+    config.cell = &cell;
+    config.session = &recorder;
+    config.keep_outputs = false;
+    config.keep_records = false;
+    clamp_protocol::testing::runHarness(iv.view(), config);
+    recorder.close();
+  }
+  // A raw recording with its protocol, and one whose protocol is missing
+  std::ofstream(directory / "raw.csp") << three_sweeps;
+  const auto samples = threeSweepSamples(2);
+  for (const char* name : {"raw.f64", "orphan.f64"}) {
+    std::ofstream(directory / name, std::ios::binary)
+        .write(reinterpret_cast<const char*>(samples.data()),
+               static_cast<std::streamsize>(samples.size() * sizeof(double)));
+  }
+
+  const auto paths = clamp_protocol::findRecordings(directory);
+  ASSERT_EQ(paths.size(), 4U);
+  EXPECT_EQ(std::filesystem::path(paths[0]).filename(), "cell1.cps");
+
+  clamp_protocol::batch_params params;
+  params.raw_period_ns = 100000;
+  params.analysis.skip_ms = 0.0;
+  clamp_protocol::WorkStealingPool pool(4);
+  const auto report = clamp_protocol::analyzeRecordings(paths, params, pool);
+  ASSERT_EQ(report.errors.size(), 1U);
+  EXPECT_NE(report.errors[0].find("orphan.f64"), std::string::npos);
+  EXPECT_EQ(report.files, 3U);
+  EXPECT_EQ(report.sweeps, 13U * 2 + 3);
+  EXPECT_EQ(report.incomplete, 0U);
+
+  const std::string output = directory / "summary.cpc";
+  ASSERT_TRUE(report.table.save(output));
+  clamp_protocol::ColumnTable table;
+  ASSERT_TRUE(table.load(output));
+  ASSERT_EQ(table.rows(), report.sweeps);
+  const auto& trials = table.find("trials")->ints;
+  const auto& command = table.find("command")->doubles;
+  const auto& steady = table.find("steady")->doubles;
+  const auto& tau = table.find("tau")->doubles;
+  const auto& leak = table.find("leak")->doubles;
+  const auto& corrected = table.find("steady_corrected")->doubles;
+  const auto& sweep = table.find("sweep")->ints;
+  // Passive cell: tau is Cm (Rs || Rm), the steady current follows
+  // (V - holding) / (Rs + Rm) and leak subtraction takes it all away. The
+  // first sample of a session reads the current before the protocol
+  // started, which throws off the baseline of the first sweep.
+  const double cell_tau = 20.0 * 10.0 * 500.0 / 510.0 * 1e-3;
+  for (size_t row = 0; row < 26; ++row) {
+    EXPECT_EQ(trials[row], 2);
+    if (sweep[row] == 0) {
+      continue;
+    }
+    EXPECT_NEAR(steady[row], (command[row] + 80.0) / 510.0, 1e-9);
+    EXPECT_NEAR(leak[row], steady[row], 1e-9);
+    EXPECT_NEAR(corrected[row], 0.0, 1e-9);
+    if (command[row] != -80.0) {
+      EXPECT_NEAR(tau[row], cell_tau, cell_tau * 1e-4);
+    }
+  }
+  EXPECT_NEAR(tau[27], 2.0, 1e-6);  // raw.f64, second sweep
+  std::filesystem::remove_all(directory);
+}
+
+TEST(Analysis, ScanReportsWhatItCannotRead)
+{
+  std::vector<std::string> errors;
+  const auto directory = scratchDirectory("scan");
+  EXPECT_TRUE(
+      clamp_protocol::findRecordings(directory / "missing", &errors).empty());
+  ASSERT_EQ(errors.size(), 1U);
+  EXPECT_NE(errors[0].find("missing"), std::string::npos);
+
+  // An unreadable directory is named, and the scan carries on past it
+  for (const char* name : {"a/one.cps", "locked/two.cps", "z/three.f64"}) {
+    std::filesystem::create_directories((directory / name).parent_path());
+    std::ofstream(directory / name) << "x";
+  }
+  std::filesystem::permissions(directory / "locked",
+                               std::filesystem::perms::none);
+  errors.clear();
+  const auto paths = clamp_protocol::findRecordings(directory, &errors);
+  std::filesystem::permissions(directory / "locked",
+                               std::filesystem::perms::owner_all);
+  if (geteuid() == 0) {  // Permissions do not stop root
+    EXPECT_EQ(paths.size(), 3U);
+    EXPECT_TRUE(errors.empty());
+  } else {
+    ASSERT_EQ(paths.size(), 2U);
+    EXPECT_EQ(std::filesystem::path(paths[1]).filename(), "three.f64");
+    ASSERT_EQ(errors.size(), 1U);
+    EXPECT_NE(errors[0].find("locked"), std::string::npos);
+  }
+  std::filesystem::remove_all(directory);
+}
+
+}  // namespace
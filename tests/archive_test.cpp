@@ -0,0 +1,182 @@
+/*
+ * Copyright (C) 2011 Weill Medical College of Cornell University
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License as
+ *  published by the Free Software Foundation; either version 2 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <limits>
+#include <string>
+
+#include <unistd.h>
+
+#include <gtest/gtest.h>
+
+#include "protocol_archive.hpp"
+#include "protocol_generators.hpp"
+#include "protocol_hash.hpp"
+
+namespace
+{
+
+// Byte offsets of the first index entry: 24 byte header, 112 byte name
+constexpr long first_hash = 24 + 112;
+constexpr long first_offset = first_hash + 8;
+
+std::string scratchPath(const char* name)
+{
+  return "/tmp/clamp_protocol_" + std::to_string(getpid()) + "_" + name
+      + ".cpa";
+}
+
+void expectSameSteps(clamp_protocol::compiled_view stored,
+                     const clamp_protocol::CompiledProtocol& expected)
+{
+  ASSERT_EQ(stored.size, expected.steps.size());
+  EXPECT_EQ(std::memcmp(stored.steps,
+                        expected.steps.data(),
+                        stored.size * sizeof(clamp_protocol::compiled_step_t)),
+            0);
+}
+
+template<typename T>
+T readAt(const std::string& path, long position)
+{
+  T value {};
+  FILE* file = std::fopen(path.c_str(), "rb");
+  EXPECT_NE(file, nullptr);
+  std::fseek(file, position, SEEK_SET);
+  EXPECT_EQ(std::fread(&value, sizeof(value), 1, file), 1U);
+  std::fclose(file);
+  return value;
+}
+
+template<typename T>
+void writeAt(const std::string& path, long position, const T& value)
+{
+  FILE* file = std::fopen(path.c_str(), "r+b");
+  ASSERT_NE(file, nullptr);
+  std::fseek(file, position, SEEK_SET);
+  ASSERT_EQ(std::fwrite(&value, sizeof(value), 1, file), 1U);
+  std::fclose(file);
+}
+
+TEST(ProtocolArchive, StoredProtocolsOpenAndAreFoundByName)
+{
+  const std::string path = scratchPath("round_trip");
+  std::remove(path.c_str());
+  const auto iv = clamp_protocol::generators::iv({}).compile();
+  const auto tail = clamp_protocol::generators::tail({}).compile();
+  ASSERT_TRUE(clamp_protocol::ProtocolArchive::store(path, "iv", iv));
+  ASSERT_TRUE(clamp_protocol::ProtocolArchive::store(path, "tail", tail));
+
+  clamp_protocol::ProtocolArchive archive;
+  ASSERT_TRUE(archive.open(path));
+  ASSERT_EQ(archive.size(), 2U);
+  EXPECT_EQ(archive.name(0), "iv");
+  EXPECT_EQ(archive.hash(0),
+            clamp_protocol::hashProtocol(iv.view(), 0, 0.0, 1.0));
+  expectSameSteps(archive.find("iv"), iv);
+  expectSameSteps(archive.find("tail"), tail);
+  EXPECT_EQ(archive.find("missing").steps, nullptr);
+  archive.close();
+  std::remove(path.c_str());
+}
+
+TEST(ProtocolArchive, StoringAnExistingNameReplacesIt)
+{
+  const std::string path = scratchPath("replace");
+  std::remove(path.c_str());
+  const auto iv = clamp_protocol::generators::iv({}).compile();
+  const auto tail = clamp_protocol::generators::tail({}).compile();
+  ASSERT_TRUE(clamp_protocol::ProtocolArchive::store(path, "iv", iv));
+  ASSERT_TRUE(clamp_protocol::ProtocolArchive::store(path, "tail", tail));
+  ASSERT_TRUE(clamp_protocol::ProtocolArchive::store(path, "iv", tail));
+
+  clamp_protocol::ProtocolArchive archive;
+  ASSERT_TRUE(archive.open(path));
+  ASSERT_EQ(archive.size(), 2U);
+  expectSameSteps(archive.find("iv"), tail);
+  expectSameSteps(archive.find("tail"), tail);
+  archive.close();
+  std::remove(path.c_str());
+}
+
+TEST(ProtocolArchive, RejectsACorruptIndex)
+{
+  const std::string path = scratchPath("corrupt_index");
+  std::remove(path.c_str());
+  const auto iv = clamp_protocol::generators::iv({}).compile();
+  ASSERT_TRUE(clamp_protocol::ProtocolArchive::store(path, "iv", iv));
+
+  // Steps running past the end of the file
+  writeAt(path, first_offset, uint64_t {1} << 40U);
+  clamp_protocol::ProtocolArchive archive;
+  EXPECT_FALSE(archive.open(path));
+  EXPECT_FALSE(archive.isOpen());
+
+  // Nor is the damaged archive replaced by storing into it
+  EXPECT_FALSE(clamp_protocol::ProtocolArchive::store(path, "iv", iv));
+  EXPECT_EQ(readAt<uint64_t>(path, first_offset), uint64_t {1} << 40U);
+  std::remove(path.c_str());
+}
+
+TEST(ProtocolArchive, RejectsStepsThatDoNotMatchTheirHash)
+{
+  const std::string path = scratchPath("corrupt_steps");
+  std::remove(path.c_str());
+  const auto iv = clamp_protocol::generators::iv({}).compile();
+  ASSERT_TRUE(clamp_protocol::ProtocolArchive::store(path, "iv", iv));
+  const auto blob = static_cast<long>(readAt<uint64_t>(path, first_offset));
+  const long level1 = blob + 8;
+  const long amp_mode = blob + 36;
+  clamp_protocol::ProtocolArchive archive;
+
+  writeAt(path, level1, iv.steps[0].level1 + 1.0);
+  EXPECT_FALSE(archive.open(path));
+  writeAt(path, level1, std::numeric_limits<double>::quiet_NaN());
+  EXPECT_FALSE(archive.open(path));
+  writeAt(path, level1, iv.steps[0].level1);
+  ASSERT_TRUE(archive.open(path));
+  archive.close();
+
+  // Out of range enums are refused even with a hash to match
+  auto forged = iv;
+  forged.steps[0].ampMode = static_cast<clamp_protocol::ampMode_t>(7);
+  writeAt(path, amp_mode, forged.steps[0].ampMode);
+  writeAt(path,
+          first_hash,
+          clamp_protocol::hashProtocol(forged.view(), 0, 0.0, 1.0));
+  EXPECT_FALSE(archive.open(path));
+  std::remove(path.c_str());
+}
+
+TEST(ProtocolArchive, StoreLeavesOtherFilesAlone)
+{
+  const std::string path = scratchPath("not_an_archive");
+  FILE* file = std::fopen(path.c_str(), "wb");
+  ASSERT_NE(file, nullptr);
+  std::fputs("segment,sweeps\n", file);
+  std::fclose(file);
+
+  const auto iv = clamp_protocol::generators::iv({}).compile();
+  EXPECT_FALSE(clamp_protocol::ProtocolArchive::store(path, "iv", iv));
+  EXPECT_EQ(readAt<char>(path, 0), 's');
+  std::remove(path.c_str());
+}
+
+}  // namespace
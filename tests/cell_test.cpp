@@ -0,0 +1,158 @@
+/*
+ * Copyright (C) 2011 Weill Medical College of Cornell University
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License as
+ *  published by the Free Software Foundation; either version 2 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#include <cmath>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "protocol_cell.hpp"
+#include "protocol_model.hpp"
+#include "rt_harness.hpp"
+
+namespace
+{
+
+// Default cell: 10 MOhm access, 500 MOhm membrane, 20 pF, leak at -70 mV
+constexpr double rs = 10.0;
+constexpr double rm = 500.0;
+constexpr double tau_ms = 20.0 * rs * rm / (rs + rm) * 1e-3;
+
+TEST(ModelCell, PassiveStepMatchesTheRcSolution)
+{
+  clamp_protocol::CellPopulation cell(1);
+  double current = 0.0;
+  cell.step(-70.0, 0.0, &current);
+  EXPECT_DOUBLE_EQ(current, 0.0);
+
+  // 10 mV step: 1 nA through Rs at the edge, decaying to 10 / (Rs + Rm)
+  const double edge = 10.0 / rs;
+  const double steady = 10.0 / (rs + rm);
+  cell.step(-60.0, 0.0, &current);
+  EXPECT_NEAR(current, edge, 1e-12);
+  for (double t = 0.05; t < 2.0; t += 0.05) {
+    cell.step(-60.0, 0.05, &current);
+    const double want = steady + (edge - steady) * std::exp(-t / tau_ms);
+    ASSERT_NEAR(current, want, 1e-9) << "t = " << t;
+  }
+}
+
+TEST(ModelCell, PassiveResultDoesNotDependOnTheStep)
+{
+  clamp_protocol::CellPopulation coarse(1);
+  clamp_protocol::CellPopulation fine(1);
+  double coarse_current = 0.0;
+  double fine_current = 0.0;
+  coarse.step(0.0, 1.0, &coarse_current);
+  for (int i = 0; i < 100; ++i) {
+    fine.step(0.0, 0.01, &fine_current);
+  }
+  EXPECT_NEAR(coarse.membranePotential(0), fine.membranePotential(0), 1e-9);
+  EXPECT_NEAR(coarse_current, fine_current, 1e-9);
+}
+
+TEST(ModelCell, HodgkinHuxleyStepGivesSodiumThenPotassiumCurrent)
+{
+  clamp_protocol::CellPopulation cell(1, clamp_protocol::hodgkinHuxleyCell());
+  double current = 0.0;
+  for (int i = 0; i < 2000; ++i) {  // 100 ms at -80 mV
+    cell.step(-80.0, 0.05, &current);
+  }
+  double peak_inward = 0.0;
+  for (int i = 0; i < 400; ++i) {  // 20 ms at 0 mV
+    cell.step(0.0, 0.05, &current);
+    if (i > 2) {  // Past the capacitive transient
+      peak_inward = std::min(peak_inward, current);
+    }
+  }
+  EXPECT_LT(peak_inward, -1.0);  // nA
+  EXPECT_GT(current, 1.0);  // Late outward potassium current
+}
+
+TEST(ModelCell, HodgkinHuxleyLeakIsThreeTenthsMilliSiemensPerSquareCm)
+{
+  // 0.3 mS/cm^2 over 2e-5 cm^2
+  const clamp_protocol::cell_params params =
+      clamp_protocol::hodgkinHuxleyCell();
+  EXPECT_NEAR(1000.0 / params.rm, 0.3 * 2e-5 * 1e6, 1e-9);  // nS
+
+  // At -100 mV the channels are shut and the steady current is the leak
+  clamp_protocol::CellPopulation cell(1, params);
+  double current = 0.0;
+  for (int i = 0; i < 2000; ++i) {  // 100 ms
+    cell.step(-100.0, 0.05, &current);
+  }
+  const double v = cell.membranePotential(0);
+  EXPECT_NEAR(current, (v - params.e_leak) / params.rm, 1e-3);
+  EXPECT_NEAR(
+      current, (-100.0 - params.e_leak) / (params.rs + params.rm), 1e-3);
+}
+
+TEST(ModelCell, PopulationMatchesSingleCells)
+{
+  std::vector<clamp_protocol::cell_params> params(4);
+  params[1].rs = 5.0;
+  params[2] = clamp_protocol::hodgkinHuxleyCell();
+  params[3].cm = 50.0;
+  clamp_protocol::CellPopulation population(params.size());
+  for (size_t i = 0; i < params.size(); ++i) {
+    population.setCell(i, params[i]);
+  }
+  const std::vector<double> command {-80.0, -40.0, 0.0, 20.0};
+  std::vector<double> currents(params.size());
+  for (int i = 0; i < 100; ++i) {
+    population.step(command.data(), 0.05, currents.data());
+  }
+  for (size_t cell = 0; cell < params.size(); ++cell) {
+    clamp_protocol::CellPopulation single(1, params[cell]);
+    double current = 0.0;
+    for (int i = 0; i < 100; ++i) {
+      single.step(command[cell], 0.05, &current);
+    }
+    EXPECT_NEAR(currents[cell], current, 1e-9) << "cell " << cell;
+  }
+}
+
+// Closed loop through the simulated RT harness: the recorded input follows
+// the protocol's command
+TEST(ModelCell, FeedsTheHarnessInput)
+{
+  clamp_protocol::Protocol protocol;
+  protocol.appendSegment().hold(20.0, -70.0).hold(20.0, -50.0);
+  const auto compiled = protocol.compile();
+
+  clamp_protocol::CellPopulation cell(1);
+  clamp_protocol::testing::harness_config config;
+  config.period_ns = 50000;
+  config.ticks = 800;
+  config.output_factor = 1e-3;  // mV to V
+  config.cell = &cell;
+  const auto report = runHarness(compiled.view(), config);
+
+  ASSERT_EQ(report.records.size(), 800U);
+  EXPECT_NEAR(report.records[399].value, 0.0, 1e-9);  // At leak reversal
+  // One period after the edge
+  const double steady = 20.0 / (rs + rm);
+  EXPECT_NEAR(report.records[401].value,
+              steady + (20.0 / rs - steady) * std::exp(-0.05 / tau_ms),
+              1e-9);
+  EXPECT_NEAR(report.records.back().value, steady, 1e-6);
+  EXPECT_EQ(report.allocations, 0U);
+}
+
+}  // namespace
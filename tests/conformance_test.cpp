@@ -0,0 +1,262 @@
+/*
+ * Copyright (C) 2011 Weill Medical College of Cornell University
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License as
+ *  published by the Free Software Foundation; either version 2 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "protocol_engine.hpp"
+#include "protocol_generators.hpp"
+#include "protocol_hash.hpp"
+#include "protocol_runner.hpp"
+
+// Golden waveform conformance. Every protocol interpreter renders a corpus
+// of protocols at several periods and must match Protocol::dryrun() sample
+// for sample, bit for bit. The dryrun waveforms themselves are pinned by
+// tests/golden/conformance.txt; set CLAMP_PROTOCOL_UPDATE_GOLDEN=1 to
+// rewrite it after an intended change to the stimulus. New engines join by
+// adding an entry to renderers().
+
+namespace
+{
+
+namespace gen = clamp_protocol::generators;
+
+using waveform = std::vector<double>;
+using renderer = std::function<waveform(const clamp_protocol::Protocol&,
+                                        int64_t period_ns)>;
+
+const std::vector<int64_t> periods = {10000, 25000, 33333, 50000, 100000};
+
+clamp_protocol::Protocol edgeCases()
+{
+  clamp_protocol::Protocol protocol;
+  protocol.appendSegment(3)
+      .hold(0.0, -80.0)  // Never plays
+      .hold({0.025, 0.01}, -70.0)  // Rounds to half samples at some periods
+      .ramp({1.0, -0.5}, -80.0, 20.0)  // Shrinks to nothing by sweep 2
+      .hold({2.0, 0.333}, {-60.0, -5.5})
+      .ramp(3.3, {-90.0, 7.0}, {40.0, -3.0}, clamp_protocol::CURRENT);
+  protocol.appendSegment(0).hold(10.0, 0.0);  // No sweeps
+  protocol.appendSegment(2).ramp(0.05, 40.0, -40.0).hold(0.07, -80.0);
+  return protocol;
+}
+
+std::map<std::string, clamp_protocol::Protocol> corpus()
+{
+  std::map<std::string, clamp_protocol::Protocol> protocols;
+  protocols["empty"] = clamp_protocol::Protocol();
+  protocols["edge_cases"] = edgeCases();
+  protocols["iv"] = gen::iv({});
+  protocols["steady_state_inactivation"] = gen::steady_state_inactivation({});
+  protocols["recovery_from_inactivation"] =
+      gen::recovery_from_inactivation({});
+  protocols["ramp"] = gen::ramp({});
+  protocols["tail"] = gen::tail({});
+  return protocols;
+}
+
+waveform renderDryrun(const clamp_protocol::Protocol& protocol,
+                      int64_t period_ns)
+{
+  return protocol.dryrun(period_ns)[1];
+}
+
+waveform renderEngineNext(const clamp_protocol::Protocol& protocol,
+                          int64_t period_ns)
+{
+  const auto compiled = protocol.compile();
+  clamp_protocol::ProtocolEngine engine;
+  engine.load(compiled.view(), period_ns);
+  waveform out;
+  while (!engine.finished()) {
+    out.push_back(engine.next());
+  }
+  return out;
+}
+
+waveform renderEngineBlocks(const clamp_protocol::Protocol& protocol,
+                            int64_t period_ns)
+{
+  const auto compiled = protocol.compile();
+  clamp_protocol::ProtocolEngine engine;
+  engine.load(compiled.view(), period_ns);
+  waveform out;
+  waveform block(1021);
+  size_t written = 0;
+  while ((written = engine.render(block.data(), block.size())) > 0) {
+    out.insert(out.end(),
+               block.begin(),
+               block.begin() + static_cast<std::ptrdiff_t>(written));
+  }
+  return out;
+}
+
+waveform renderWindows(const clamp_protocol::Protocol& protocol,
+                       int64_t period_ns)
+{
+  const auto compiled = protocol.compile();
+  clamp_protocol::SampleIndex index;
+  index.build(compiled.view(), period_ns);
+  waveform out(static_cast<size_t>(index.totalSamples()));
+  constexpr size_t window = 4093;
+  for (size_t first = 0; first < out.size(); first += window) {
+    clamp_protocol::renderProtocol(compiled.view(),
+                                   period_ns,
+                                   static_cast<int64_t>(first),
+                                   out.data() + first,
+                                   std::min(window, out.size() - first));
+  }
+  return out;
+}
+
+waveform renderRunner(const clamp_protocol::Protocol& protocol,
+                      int64_t period_ns)
+{
+  const auto compiled = protocol.compile();
+  clamp_protocol::ProtocolRunner runner;
+  runner.setProtocol(compiled.view(), 0, period_ns);
+  waveform out;
+  double output = 0.0;
+  clamp_protocol::data_token_t token {};
+  int64_t now = 0;
+  while (runner.tick(now, 0.0, output, token)) {
+    out.push_back(output);
+    now += period_ns;
+  }
+  return out;
+}
+
+std::map<std::string, renderer> renderers()
+{
+  return {{"engine_next", renderEngineNext},
+          {"engine_blocks", renderEngineBlocks},
+          {"render_windows", renderWindows},
+          {"runner", renderRunner}};
+}
+
+// FNV-1a over the little-endian IEEE 754 bits of every sample
+uint64_t hashWaveform(const waveform& samples)
+{
+  uint64_t hash = 0xcbf29ce484222325ULL;
+  for (const double sample : samples) {
+    uint64_t bits = 0;
+    std::memcpy(&bits, &sample, sizeof(bits));
+    for (int byte = 0; byte < 8; ++byte) {
+      hash ^= (bits >> (8 * byte)) & 0xff;
+      hash *= 0x100000001b3ULL;
+    }
+  }
+  return hash;
+}
+
+std::string goldenKey(const std::string& name, int64_t period_ns)
+{
+  return name + " " + std::to_string(period_ns);
+}
+
+std::string goldenPath()
+{
+  return std::string(CLAMP_PROTOCOL_GOLDEN_DIR) + "/conformance.txt";
+}
+
+// "<protocol> <period_ns>" -> "<samples> <hash>"
+std::map<std::string, std::string> readGolden()
+{
+  std::map<std::string, std::string> golden;
+  std::ifstream file(goldenPath());
+  std::string line;
+  while (std::getline(file, line)) {
+    if (line.empty() || line.front() == '#') {
+      continue;
+    }
+    std::istringstream fields(line);
+    std::string name;
+    std::string period;
+    std::string samples;
+    std::string hash;
+    fields >> name >> period >> samples >> hash;
+    golden[name + " " + period] = samples + " " + hash;
+  }
+  return golden;
+}
+
+TEST(Conformance, DryrunMatchesGoldenWaveforms)
+{
+  const bool update = std::getenv("CLAMP_PROTOCOL_UPDATE_GOLDEN") != nullptr;
+  const auto golden = readGolden();
+  std::ostringstream updated;
+  updated << "# <protocol> <period ns> <samples> <FNV-1a of the sample bits>\n"
+          << "# Written by conformance_test with "
+             "CLAMP_PROTOCOL_UPDATE_GOLDEN=1\n";
+
+  for (const auto& [name, protocol] : corpus()) {
+    for (const int64_t period_ns : periods) {
+      const auto run = protocol.dryrun(period_ns);
+      const std::string entry = std::to_string(run[1].size()) + " "
+          + clamp_protocol::hashToString(hashWaveform(run[1]));
+      updated << goldenKey(name, period_ns) << " " << entry << "\n";
+      if (update) {
+        continue;
+      }
+      const auto it = golden.find(goldenKey(name, period_ns));
+      ASSERT_NE(it, golden.end())
+          << "no golden waveform for " << goldenKey(name, period_ns);
+      EXPECT_EQ(entry, it->second) << goldenKey(name, period_ns);
+
+      for (size_t i = 0; i < run[0].size(); ++i) {
+        ASSERT_EQ(run[0][i],
+                  static_cast<double>(static_cast<int64_t>(i))
+                      * static_cast<double>(period_ns) * 1e-6);
+      }
+    }
+  }
+
+  if (update) {
+    std::ofstream(goldenPath()) << updated.str();
+  }
+}
+
+TEST(Conformance, EveryEngineMatchesDryrunSampleForSample)
+{
+  const auto engines = renderers();
+  for (const auto& [name, protocol] : corpus()) {
+    for (const int64_t period_ns : periods) {
+      const waveform expected = renderDryrun(protocol, period_ns);
+      for (const auto& [engine, render] : engines) {
+        const waveform actual = render(protocol, period_ns);
+        ASSERT_EQ(actual.size(), expected.size())
+            << engine << " on " << goldenKey(name, period_ns);
+        for (size_t i = 0; i < expected.size(); ++i) {
+          ASSERT_EQ(actual[i], expected[i])
+              << engine << " on " << goldenKey(name, period_ns) << " sample "
+              << i;
+        }
+      }
+    }
+  }
+}
+
+}  // namespace
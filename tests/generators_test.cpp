@@ -0,0 +1,186 @@
+/*
+ * Copyright (C) 2011 Weill Medical College of Cornell University
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License as
+ *  published by the Free Software Foundation; either version 2 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#include <gtest/gtest.h>
+
+#include "protocol_generators.hpp"
+#include "protocol_model.hpp"
+
+namespace
+{
+
+namespace generators = clamp_protocol::generators;
+
+// Compiled step `step` of sweep `sweep`, for protocols of one segment whose
+// sweeps all have `steps` steps
+const clamp_protocol::compiled_step_t& stepOf(
+    const clamp_protocol::CompiledProtocol& compiled,
+    size_t steps,
+    size_t sweep,
+    size_t step)
+{
+  const auto& found = compiled.steps.at(sweep * steps + step);
+  EXPECT_EQ(found.sweep, sweep);
+  EXPECT_EQ(found.step, step);
+  return found;
+}
+
+void expectHold(const clamp_protocol::compiled_step_t& step,
+                double duration,
+                double level)
+{
+  EXPECT_EQ(step.stepType, clamp_protocol::STEP);
+  EXPECT_EQ(step.ampMode, clamp_protocol::VOLTAGE);
+  EXPECT_DOUBLE_EQ(step.duration, duration);
+  EXPECT_DOUBLE_EQ(step.level1, level);
+  EXPECT_DOUBLE_EQ(step.level2, level);
+}
+
+TEST(Generators, SweepCountCoversTheRangeInclusively)
+{
+  EXPECT_EQ(generators::sweep_count(-80, 40, 10), 13U);
+  EXPECT_EQ(generators::sweep_count(40, -80, -10), 13U);
+  EXPECT_EQ(generators::sweep_count(0, 1, 0.1), 11U);  // Not 10 from rounding
+  EXPECT_EQ(generators::sweep_count(0, 24, 10), 3U);
+  EXPECT_EQ(generators::sweep_count(-80, -80, 10), 1U);
+  // No increment, or one pointing away from `to`: a single sweep
+  EXPECT_EQ(generators::sweep_count(-80, 40, 0), 1U);
+  EXPECT_EQ(generators::sweep_count(-80, 40, -10), 1U);
+}
+
+TEST(Generators, IvStepsTheTestLevel)
+{
+  generators::iv_params params;
+  params.from = -60;
+  params.to = 20;
+  params.increment = 20;
+  const auto protocol = generators::iv(params);
+  ASSERT_EQ(protocol.numSegments(), 1U);
+  EXPECT_EQ(protocol.numSweeps(0), 5U);
+  const auto& test = protocol.getStep(0, 1);
+  EXPECT_EQ(test.parameters[clamp_protocol::HOLDING_LEVEL_1], -60.0);
+  EXPECT_EQ(test.parameters[clamp_protocol::DELTA_HOLDING_LEVEL_1], 20.0);
+
+  const auto compiled = protocol.compile();
+  ASSERT_EQ(compiled.steps.size(), 15U);
+  for (size_t sweep = 0; sweep < 5; ++sweep) {
+    expectHold(stepOf(compiled, 3, sweep, 0), 50, -80);
+    expectHold(stepOf(compiled, 3, sweep, 1), 100, -60 + 20.0 * sweep);
+    expectHold(stepOf(compiled, 3, sweep, 2), 50, -80);
+  }
+  EXPECT_DOUBLE_EQ(compiled.duration(), 5 * 200.0);
+}
+
+TEST(Generators, InactivationStepsTheConditioningLevel)
+{
+  const auto compiled = generators::steady_state_inactivation({}).compile();
+  ASSERT_EQ(compiled.steps.size(), 13U * 3);
+  for (size_t sweep = 0; sweep < 13; ++sweep) {
+    expectHold(stepOf(compiled, 3, sweep, 0), 500, -120 + 10.0 * sweep);
+    expectHold(stepOf(compiled, 3, sweep, 1), 50, 0);
+    expectHold(stepOf(compiled, 3, sweep, 2), 50, -80);
+  }
+}
+
+TEST(Generators, RecoveryLengthensTheInterval)
+{
+  generators::recovery_params params;
+  params.sweeps = 4;
+  const auto compiled =
+      generators::recovery_from_inactivation(params).compile();
+  ASSERT_EQ(compiled.steps.size(), 4U * 4);
+  for (size_t sweep = 0; sweep < 4; ++sweep) {
+    expectHold(stepOf(compiled, 4, sweep, 0), 50, 0);
+    expectHold(stepOf(compiled, 4, sweep, 1), 1 + 5.0 * sweep, -80);
+    expectHold(stepOf(compiled, 4, sweep, 2), 50, 0);
+    expectHold(stepOf(compiled, 4, sweep, 3), 50, -80);
+  }
+}
+
+TEST(Generators, RampGoesFromOneLevelToTheOther)
+{
+  generators::ramp_params params;
+  params.sweeps = 2;
+  const auto compiled = generators::ramp(params).compile();
+  ASSERT_EQ(compiled.steps.size(), 2U * 3);
+  for (size_t sweep = 0; sweep < 2; ++sweep) {
+    expectHold(stepOf(compiled, 3, sweep, 0), 50, -80);
+    const auto& ramp = stepOf(compiled, 3, sweep, 1);
+    EXPECT_EQ(ramp.stepType, clamp_protocol::RAMP);
+    EXPECT_DOUBLE_EQ(ramp.duration, 500);
+    EXPECT_DOUBLE_EQ(ramp.level1, -100);
+    EXPECT_DOUBLE_EQ(ramp.level2, 50);
+    expectHold(stepOf(compiled, 3, sweep, 2), 50, -80);
+  }
+}
+
+TEST(Generators, TailStepsTheTailLevel)
+{
+  const auto compiled = generators::tail({}).compile();
+  ASSERT_EQ(compiled.steps.size(), 13U * 3);
+  for (size_t sweep = 0; sweep < 13; ++sweep) {
+    expectHold(stepOf(compiled, 3, sweep, 0), 100, 20);
+    expectHold(stepOf(compiled, 3, sweep, 1), 200, -120 + 10.0 * sweep);
+    expectHold(stepOf(compiled, 3, sweep, 2), 50, -80);
+  }
+}
+
+TEST(Builder, ChainsSegmentsStepsAndRepeats)
+{
+  clamp_protocol::Protocol protocol;
+  protocol.appendSegment(2)
+      .hold(10, -80)
+      .ramp({20, 5}, {-80, -10}, {0, 10}, clamp_protocol::CURRENT);
+  protocol.appendSegment().hold(5, -60).repeat(3).sweeps(2);
+  clamp_protocol::ProtocolSegment train;
+  train.hold(1, 0).hold(1, -80).repeat(2);
+  protocol.append(train);
+
+  ASSERT_EQ(protocol.numSegments(), 3U);
+  EXPECT_EQ(protocol.segmentSize(1), 3U);
+  EXPECT_EQ(protocol.numSweeps(1), 2U);
+  EXPECT_EQ(protocol.segmentSize(2), 4U);
+
+  const auto compiled = protocol.compile();
+  ASSERT_EQ(compiled.steps.size(), 2U * 2 + 2 * 3 + 4);
+  const auto& ramp = compiled.steps[3];  // Second sweep of the first segment
+  EXPECT_EQ(ramp.segment, 0U);
+  EXPECT_EQ(ramp.sweep, 1U);
+  EXPECT_EQ(ramp.step, 1U);
+  EXPECT_EQ(ramp.stepType, clamp_protocol::RAMP);
+  EXPECT_EQ(ramp.ampMode, clamp_protocol::CURRENT);
+  EXPECT_DOUBLE_EQ(ramp.duration, 25);
+  EXPECT_DOUBLE_EQ(ramp.level1, -90);
+  EXPECT_DOUBLE_EQ(ramp.level2, 10);
+  EXPECT_EQ(compiled.steps[4].segment, 1U);
+  EXPECT_EQ(compiled.steps.back().segment, 2U);
+  EXPECT_EQ(compiled.steps.back().step, 3U);
+  EXPECT_DOUBLE_EQ(compiled.steps.back().level1, -80);
+}
+
+TEST(Builder, CompiledDurationsNeverGoNegative)
+{
+  clamp_protocol::Protocol protocol;
+  protocol.appendSegment(3).hold({10, -8}, -80);
+  const auto compiled = protocol.compile();
+  ASSERT_EQ(compiled.steps.size(), 3U);
+  EXPECT_DOUBLE_EQ(compiled.steps[1].duration, 2);
+  EXPECT_DOUBLE_EQ(compiled.steps[2].duration, 0);
+}
+
+}  // namespace
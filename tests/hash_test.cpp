@@ -0,0 +1,121 @@
+/*
+ * Copyright (C) 2011 Weill Medical College of Cornell University
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License as
+ *  published by the Free Software Foundation; either version 2 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#include <cmath>
+#include <limits>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "protocol_hash.hpp"
+
+namespace
+{
+
+constexpr int64_t period_ns = 50000;
+
+std::vector<clamp_protocol::compiled_step_t> fixedSteps()
+{
+  std::vector<clamp_protocol::compiled_step_t> steps(3);
+  steps[0].duration = 10.0;
+  steps[0].level1 = -80.0;
+  steps[0].level2 = -80.0;
+  steps[1].duration = 20.5;
+  steps[1].level1 = -80.0;
+  steps[1].level2 = 40.0;
+  steps[1].step = 1;
+  steps[1].ampMode = clamp_protocol::CURRENT;
+  steps[1].stepType = clamp_protocol::RAMP;
+  steps[2].duration = 5.0;
+  steps[2].level1 = -60.0;
+  steps[2].level2 = -60.0;
+  steps[2].segment = 1;
+  steps[2].sweep = 2;
+  return steps;
+}
+
+uint64_t hashOf(const std::vector<clamp_protocol::compiled_step_t>& steps,
+                int64_t period = period_ns,
+                double junction_potential = -5.0,
+                double output_factor = 20.0)
+{
+  return clamp_protocol::hashProtocol(
+      {steps.data(), steps.size()}, period, junction_potential, output_factor);
+}
+
+// Hashes are stored in archives, session logs and every data token, so the
+// encoding must never change without bumping its version. These values were
+// worked out from the documented encoding, not taken from the code.
+TEST(ProtocolHash, MatchesTheGoldenValues)
+{
+  EXPECT_EQ(hashOf(fixedSteps()), 0xcda3bb306a4ec7f0ULL);
+  EXPECT_EQ(clamp_protocol::hashProtocol({}, 0, 0.0, 1.0),
+            0x1fd0da99595e5799ULL);
+  EXPECT_EQ(clamp_protocol::hashToString(0xcda3bb306a4ec7f0ULL),
+            "cda3bb306a4ec7f0");
+  EXPECT_EQ(clamp_protocol::hashToString(0x1fULL), "000000000000001f");
+}
+
+TEST(ProtocolHash, CoversPeriodScalingAndEveryStepField)
+{
+  const auto steps = fixedSteps();
+  const uint64_t reference = hashOf(steps);
+  EXPECT_NE(hashOf(steps, period_ns / 2), reference);
+  EXPECT_NE(hashOf(steps, period_ns, -4.0), reference);
+  EXPECT_NE(hashOf(steps, period_ns, -5.0, 10.0), reference);
+
+  const auto changed = [&](auto change)
+  {
+    auto copy = steps;
+    change(copy[1]);
+    return hashOf(copy) != reference;
+  };
+  using step_t = clamp_protocol::compiled_step_t;
+  EXPECT_TRUE(changed([](step_t& step) { step.duration += 1e-9; }));
+  EXPECT_TRUE(changed([](step_t& step) { step.level1 = -70.0; }));
+  EXPECT_TRUE(changed([](step_t& step) { step.level2 = 30.0; }));
+  EXPECT_TRUE(changed([](step_t& step) { step.segment = 1; }));
+  EXPECT_TRUE(changed([](step_t& step) { step.sweep = 1; }));
+  EXPECT_TRUE(changed([](step_t& step) { step.step = 2; }));
+  EXPECT_TRUE(
+      changed([](step_t& step) { step.ampMode = clamp_protocol::VOLTAGE; }));
+  EXPECT_TRUE(
+      changed([](step_t& step) { step.stepType = clamp_protocol::STEP; }));
+  // Not part of the stimulus
+  EXPECT_FALSE(changed([](step_t& step) { step.reserved = 1; }));
+
+  auto shorter = steps;
+  shorter.pop_back();
+  EXPECT_NE(hashOf(shorter), reference);
+}
+
+TEST(ProtocolHash, NormalizesZeroAndNan)
+{
+  auto steps = fixedSteps();
+  steps[0].level1 = 0.0;
+  const uint64_t positive = hashOf(steps, period_ns, 0.0);
+  steps[0].level1 = -0.0;
+  EXPECT_EQ(hashOf(steps, period_ns, -0.0), positive);
+
+  steps[0].level1 = std::numeric_limits<double>::quiet_NaN();
+  const uint64_t quiet = hashOf(steps);
+  steps[0].level1 = -std::numeric_limits<double>::signaling_NaN();
+  EXPECT_EQ(hashOf(steps), quiet);
+}
+
+}  // namespace
@@ -0,0 +1,105 @@
+/*
+ * Copyright (C) 2011 Weill Medical College of Cornell University
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License as
+ *  published by the Free Software Foundation; either version 2 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#include <atomic>
+#include <thread>
+
+#include <gtest/gtest.h>
+
+#include "protocol_latency.hpp"
+
+namespace
+{
+
+TEST(Latency, TagsResolveOnTheFrameThatShowsThem)
+{
+  clamp_protocol::LatencyProbe probe(10, 16);
+  for (int64_t i = 0; i < 25; ++i) {  // Tags records 0, 10 and 20
+    probe.recordWritten(1000 * i, i);
+  }
+  probe.samplesPlotted(9);  // Records 0-9 on screen
+  probe.framePainted(50000);
+  ASSERT_EQ(probe.histogram().count(), 1U);
+  EXPECT_EQ(probe.histogram().max(), 50000);
+
+  probe.samplesPlotted(20);  // Up to record 20
+  probe.framePainted(60000);
+  ASSERT_EQ(probe.histogram().count(), 3U);
+  EXPECT_EQ(probe.histogram().max(), 60000 - 10000);  // Record 10
+
+  probe.framePainted(70000);  // Nothing new on screen
+  EXPECT_EQ(probe.histogram().count(), 3U);
+  EXPECT_EQ(probe.droppedTags(), 0U);
+}
+
+// Thinning leaves tagged records out of the plot; a later record on screen
+// still resolves them
+TEST(Latency, TagsResolveThroughDecimation)
+{
+  clamp_protocol::LatencyProbe probe(2, 16);
+  for (int64_t i = 0; i < 8; ++i) {  // Tags samples 0, 2, 4 and 6
+    probe.recordWritten(1000 * i, i);
+  }
+  probe.samplesPlotted(3);  // Min/max pair of samples 0-3 at 1 and 3
+  probe.framePainted(10000);
+  ASSERT_EQ(probe.histogram().count(), 2U);
+  probe.samplesPlotted(1);  // Older data does not go back
+  probe.samplesPlotted(6);
+  probe.framePainted(20000);
+  EXPECT_EQ(probe.histogram().count(), 4U);
+}
+
+TEST(Latency, FullTagRingDropsTags)
+{
+  clamp_protocol::LatencyProbe probe(1, 4);
+  for (int64_t i = 0; i < 10; ++i) {
+    probe.recordWritten(i, i);
+  }
+  EXPECT_EQ(probe.droppedTags(), 6U);
+  probe.samplesPlotted(9);
+  probe.framePainted(100);
+  EXPECT_EQ(probe.histogram().count(), 4U);
+}
+
+TEST(Latency, ConcurrentWriterAndPainter)
+{
+  constexpr uint64_t records = 1000000;
+  clamp_protocol::LatencyProbe probe(100, 64);
+  std::atomic<uint64_t> published {0};
+  std::thread rt(
+      [&]
+      {
+        for (uint64_t i = 0; i < records; ++i) {
+          probe.recordWritten(static_cast<int64_t>(i),
+                              static_cast<int64_t>(i));
+          published.store(i + 1, std::memory_order_release);
+        }
+      });
+  uint64_t ingested = 0;
+  while (ingested < records) {
+    const uint64_t available = published.load(std::memory_order_acquire);
+    probe.samplesPlotted(static_cast<int64_t>(available) - 1);
+    ingested = available;
+    probe.framePainted(static_cast<int64_t>(ingested));
+  }
+  rt.join();
+  EXPECT_EQ(probe.histogram().count() + probe.droppedTags(), records / 100);
+  EXPECT_GE(probe.histogram().percentile(0.0), 0);
+}
+
+}  // namespace
@@ -0,0 +1,150 @@
+/*
+ * Copyright (C) 2011 Weill Medical College of Cornell University
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License as
+ *  published by the Free Software Foundation; either version 2 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#include <algorithm>
+#include <random>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "protocol_metrics.hpp"
+
+namespace
+{
+
+TEST(Metrics, HistogramPercentilesBoundTheExactValue)
+{
+  std::mt19937_64 rng(3);
+  std::lognormal_distribution<double> latency(8.0, 1.0);
+  clamp_protocol::LatencyHistogram histogram;
+  std::vector<int64_t> samples;
+  for (int i = 0; i < 100000; ++i) {
+    samples.push_back(static_cast<int64_t>(latency(rng)));
+    histogram.add(samples.back());
+  }
+  std::sort(samples.begin(), samples.end());
+  for (const double q : {0.5, 0.9, 0.99, 0.999}) {
+    const int64_t exact =
+        samples[static_cast<size_t>(q * static_cast<double>(samples.size()))
+                - 1];
+    const int64_t estimate = histogram.percentile(q);
+    EXPECT_GE(estimate, exact) << q;
+    EXPECT_LE(static_cast<double>(estimate),
+              static_cast<double>(exact) * 1.25 + 1)
+        << q;
+  }
+  EXPECT_EQ(histogram.max(), samples.back());
+  EXPECT_EQ(histogram.percentile(1.0), samples.back());
+}
+
+TEST(Metrics, BucketsCoverEveryValueOnce)
+{
+  int64_t previous = -1;
+  for (size_t i = 0; i < clamp_protocol::LatencyHistogram::bucket_count; ++i)
+  {
+    const int64_t bound = clamp_protocol::LatencyHistogram::bucketUpperBound(i);
+    ASSERT_GT(bound, previous) << i;
+    clamp_protocol::LatencyHistogram histogram;
+    histogram.add(bound);
+    histogram.add(previous + 1);
+    ASSERT_EQ(histogram.bucket(i), 2U) << i;
+    previous = bound;
+  }
+}
+
+TEST(Metrics, RtMonitorPublishesOncePerWindow)
+{
+  clamp_protocol::runtime_metrics metrics;
+  clamp_protocol::RtMonitor monitor(&metrics, 100);
+  for (int i = 1; i <= 99; ++i) {
+    monitor.fifoWrite(i, 48, i % 10 != 0);
+    EXPECT_FALSE(monitor.executeTime(i));
+  }
+  EXPECT_EQ(metrics.execute_max_ns.load(), 0);
+  EXPECT_EQ(metrics.fifo_written.load(), 0U);
+
+  monitor.fifoWrite(100, 48, true);
+  EXPECT_TRUE(monitor.executeTime(100));
+  EXPECT_EQ(metrics.execute_last_ns.load(), 100);
+  EXPECT_EQ(metrics.execute_max_ns.load(), 100);
+  EXPECT_GE(metrics.execute_p99_ns.load(), 99);
+  EXPECT_EQ(metrics.dropped.load(), 9U);
+  EXPECT_EQ(metrics.fifo_written.load(), 91U * 48);
+  EXPECT_EQ(metrics.fifo_high_water.load(), 91U * 48);
+  EXPECT_EQ(metrics.first_pending_ns.load(), 1);
+}
+
+TEST(Metrics, GuiMonitorTracksDrainsAndReplots)
+{
+  clamp_protocol::runtime_metrics metrics;
+  clamp_protocol::RtMonitor rt(&metrics, 1);
+  clamp_protocol::GuiMonitor gui(&metrics);
+
+  rt.fifoWrite(1000, 480, true);
+  rt.executeTime(10);
+  EXPECT_EQ(metrics.fifoFill(), 480U);
+  gui.draining(5000);
+  gui.drained(480);
+  EXPECT_EQ(metrics.drain_latency_ns.load(), 4000);
+  EXPECT_EQ(metrics.fifoFill(), 0U);
+  EXPECT_EQ(metrics.first_pending_ns.load(), -1);
+
+  for (int64_t frame = 0; frame <= 20; ++frame) {
+    gui.replotted(frame * 100000000, frame * 100000000 + 2000000);
+  }
+  EXPECT_EQ(metrics.replot_ns.load(), 2000000);
+  EXPECT_NEAR(metrics.replot_fps.load(), 10.0, 0.5);
+
+  gui.analysisQueued(3);
+  EXPECT_EQ(metrics.analysis_queued.load(), 3U);
+}
+
+// Closing and reopening the plot makes a new GuiMonitor; replacing the FIFO
+// throws away what was left in it. Neither may leave the fill off.
+TEST(Metrics, FillSurvivesReopeningAndFifoSwaps)
+{
+  clamp_protocol::runtime_metrics metrics;
+  clamp_protocol::RtMonitor rt(&metrics, 1);
+  {
+    clamp_protocol::GuiMonitor first(&metrics);
+    rt.fifoWrite(1000, 480, true);
+    first.drained(480);
+    rt.fifoWrite(2000, 96, true);
+    rt.executeTime(10);
+  }
+  EXPECT_EQ(rt.fifoFill(), 96U);
+  EXPECT_EQ(metrics.fifoFill(), 96U);
+
+  clamp_protocol::GuiMonitor reopened(&metrics);
+  EXPECT_EQ(rt.fifoFill(), 96U);
+  reopened.drained(48);
+  EXPECT_EQ(rt.fifoFill(), 48U);
+  EXPECT_EQ(metrics.fifoFill(), 48U);
+
+  rt.fifoReplaced();
+  EXPECT_EQ(rt.fifoFill(), 0U);
+  EXPECT_EQ(metrics.fifoFill(), 0U);
+  EXPECT_EQ(metrics.first_pending_ns.load(), -1);
+  rt.fifoWrite(3000, 48, true);
+  rt.executeTime(10);
+  reopened.drained(48);
+  EXPECT_EQ(rt.fifoFill(), 0U);
+  EXPECT_EQ(metrics.fifo_high_water.load(), 480U);  // Never inflated
+}
+
+}  // namespace
@@ -0,0 +1,398 @@
+/*
+ * Copyright (C) 2011 Weill Medical College of Cornell University
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License as
+ *  published by the Free Software Foundation; either version 2 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <thread>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "protocol_analysis.hpp"
+#include "protocol_csp.hpp"
+#include "protocol_pipeline.hpp"
+#include "protocol_pool.hpp"
+#include "protocol_runner.hpp"
+#include "rt_alloc_check.hpp"
+
+namespace
+{
+
+constexpr int64_t period_ns = 100000;
+constexpr uint64_t hash = 7;
+
+// Three sweeps of 10 ms at -80 mV, 20 ms at -80, -70, -60 mV, 10 ms at -80
+constexpr const char* three_sweeps = R"(<!DOCTYPE ClampProtocolML>
+<Clamp-Suite-Protocol-v2.0>
+ <segment numSweeps="3">
+  <step stepNumber="0" ampMode="0" stepType="0" stepDuration="10" holdingLevel1="-80"/>
+  <step stepNumber="1" ampMode="0" stepType="0" stepDuration="20" holdingLevel1="-80" deltaHoldingLevel1="10"/>
+  <step stepNumber="2" ampMode="0" stepType="0" stepDuration="10" holdingLevel1="-80"/>
+ </segment>
+</Clamp-Suite-Protocol-v2.0>
+)";
+
+// Input for three_sweeps at 0.1 ms: an offset of 1 with a decaying response
+// of amplitude 2 per sweep and tau 2 ms over the middle step, all scaled by
+// the trial number plus one
+std::vector<double> threeSweepSamples(int trials)
+{
+  std::vector<double> samples;
+  for (int trial = 0; trial < trials; ++trial) {
+    const double scale = trial + 1.0;
+    for (int sweep = 0; sweep < 3; ++sweep) {
+      samples.insert(samples.end(), 100, scale);
+      for (int i = 0; i < 200; ++i) {
+        samples.push_back(scale * (1.0 + 2.0 * sweep * std::exp(-0.1 * i / 2.0)));
+      }
+      samples.insert(samples.end(), 100, scale);
+    }
+  }
+  return samples;
+}
+
+std::vector<clamp_protocol::data_token_t> play(
+    const clamp_protocol::CompiledProtocol& compiled,
+    const std::vector<double>& samples,
+    int trials)
+{
+  clamp_protocol::ProtocolRunner runner;
+  runner.setProtocol(compiled.view(), hash, period_ns);
+  runner.setTrials(trials);
+  std::vector<clamp_protocol::data_token_t> tokens;
+  double output = 0.0;
+  clamp_protocol::data_token_t token {};
+  int64_t now = 0;
+  while (tokens.size() < samples.size()
+         && runner.tick(now, samples[tokens.size()], output, token))
+  {
+    tokens.push_back(token);
+    now += period_ns;
+  }
+  return tokens;
+}
+
+clamp_protocol::chunk_handle chunkOf(
+    const std::vector<clamp_protocol::data_token_t>& tokens,
+    size_t first,
+    size_t count)
+{
+  auto chunk = clamp_protocol::makeChunk();
+  const size_t last = std::min(tokens.size(), first + count);
+  chunk->tokens.assign(tokens.begin() + static_cast<std::ptrdiff_t>(first),
+                       tokens.begin() + static_cast<std::ptrdiff_t>(last));
+  return chunk;
+}
+
+// Everything the display queue has and will get
+std::vector<clamp_protocol::chunk_handle> drainDisplay(
+    clamp_protocol::AnalysisPipeline& pipeline)
+{
+  std::vector<clamp_protocol::chunk_handle> chunks;
+  for (;;) {
+    pipeline.wait();
+    clamp_protocol::chunk_handle chunk;
+    if (pipeline.pop(chunk)) {
+      chunks.push_back(std::move(chunk));
+      continue;
+    }
+    // An empty display queue may have let held output through
+    pipeline.wait();
+    if (!pipeline.pop(chunk)) {
+      return chunks;
+    }
+    chunks.push_back(std::move(chunk));
+  }
+}
+
+TEST(SpscQueue, FillsWrapsAndDrainsInOrder)
+{
+  clamp_protocol::SpscQueue<int> queue(3);
+  EXPECT_EQ(queue.capacity(), 4U);
+  int next = 0;
+  int expected = 0;
+  for (int round = 0; round < 5; ++round) {
+    int value = next;
+    while (queue.push(value)) {
+      value = ++next;
+    }
+    EXPECT_EQ(queue.size(), 4U);
+    int out = -1;
+    while (queue.pop(out)) {
+      EXPECT_EQ(out, expected++);
+    }
+  }
+  EXPECT_EQ(expected, next);
+}
+
+TEST(Pipeline, DecimationKeepsExtremesInOrderWithinSweeps)
+{
+  clamp_protocol::pipeline_chunk chunk;
+  const double values[] = {3, 1, 4, 1, 5, 9, 2, 6};
+  for (size_t i = 0; i < 8; ++i) {
+    clamp_protocol::data_token_t token {};
+    token.value = values[i];
+    token.sweep = i < 6 ? 0 : 1;
+    chunk.tokens.push_back(token);
+  }
+  clamp_protocol::decimateMinMax(chunk, 4);
+  EXPECT_EQ(chunk.decimation, 4U);
+  std::vector<double> kept;
+  for (const auto& token : chunk.tokens) {
+    kept.push_back(token.value);
+  }
+  // {3 1 4 1}, {5 9} and the next sweep {2 6}
+  EXPECT_EQ(kept, (std::vector<double> {1, 4, 5, 9, 2, 6}));
+  EXPECT_EQ(chunk.tokens[0].decimation, 4U);
+  EXPECT_EQ(chunk.tokens[2].decimation, 2U);
+}
+
+TEST(Pipeline, BaselinesMeasuresAndAveragesOnline)
+{
+  clamp_protocol::Protocol protocol;
+  ASSERT_TRUE(clamp_protocol::readCsp(three_sweeps, protocol));
+  const auto compiled = protocol.compile();
+  const auto samples = threeSweepSamples(2);
+  const auto tokens = play(compiled, samples, 2);
+  ASSERT_EQ(tokens.size(), samples.size());
+
+  clamp_protocol::WorkStealingPool pool(2);
+  clamp_protocol::pipeline_params params;
+  params.stages = {false, true, true, true, true};
+  params.analysis.steady_ms = 2.0;
+  params.queue_chunks = 64;
+  clamp_protocol::AnalysisPipeline pipeline(pool, params);
+  pipeline.setProtocol(compiled.view(), hash, period_ns);
+  for (size_t first = 0; first < tokens.size(); first += 170) {
+    auto chunk = chunkOf(tokens, first, 170);
+    ASSERT_TRUE(pipeline.push(chunk));
+  }
+  const auto chunks = drainDisplay(pipeline);
+
+  std::vector<clamp_protocol::data_token_t> shown;
+  std::vector<clamp_protocol::sweep_summary> summaries;
+  for (const auto& chunk : chunks) {
+    EXPECT_EQ(chunk->decimation, 1U);
+    shown.insert(shown.end(), chunk->tokens.begin(), chunk->tokens.end());
+    summaries.insert(
+        summaries.end(), chunk->summaries.begin(), chunk->summaries.end());
+  }
+  ASSERT_EQ(shown.size(), tokens.size());
+  for (size_t i = 0; i < shown.size(); ++i) {
+    ASSERT_EQ(shown[i].time, tokens[i].time);
+    ASSERT_EQ(shown[i].sweep, tokens[i].sweep);
+  }
+  // Baseline subtracted, then the second trial averaged with the first
+  EXPECT_DOUBLE_EQ(shown[50].value, 0.0);
+  EXPECT_DOUBLE_EQ(shown[500].value, 2.0);
+  EXPECT_DOUBLE_EQ(shown[1200 + 500].value, 3.0);
+
+  // One summary per trial and sweep, measured like the offline analysis
+  ASSERT_EQ(summaries.size(), 6U);
+  const auto sweeps = clamp_protocol::splitSweeps(
+      compiled.view(), hash, period_ns, samples.data(), samples.size());
+  ASSERT_EQ(sweeps.size(), 6U);
+  for (size_t i = 0; i < 6; ++i) {
+    const auto offline = clamp_protocol::measureSweep(sweeps[i], params.analysis);
+    EXPECT_EQ(summaries[i].trial, sweeps[i].trial);
+    EXPECT_EQ(summaries[i].sweep, sweeps[i].sweep);
+    EXPECT_DOUBLE_EQ(summaries[i].command, offline.command);
+    EXPECT_NEAR(summaries[i].baseline, 0.0, 1e-12);
+    EXPECT_NEAR(summaries[i].peak, offline.peak, 1e-12);
+    EXPECT_NEAR(summaries[i].steady, offline.steady, 1e-12);
+  }
+
+  const auto report = pipeline.report();
+  EXPECT_FALSE(report.stages[clamp_protocol::STAGE_FILTER].enabled);
+  for (size_t stage = clamp_protocol::STAGE_BASELINE;
+       stage < clamp_protocol::STAGE_COUNT;
+       ++stage)
+  {
+    EXPECT_TRUE(report.stages[stage].enabled);
+    EXPECT_EQ(report.stages[stage].records, tokens.size());
+    EXPECT_EQ(report.stages[stage].queued, 0U);
+  }
+  EXPECT_EQ(pipeline.queuedChunks(), 0U);
+  EXPECT_EQ(report.rejected, 0U);
+}
+
+TEST(Pipeline, DegradesTheDisplayInsteadOfStalling)
+{
+  clamp_protocol::Protocol protocol;
+  ASSERT_TRUE(clamp_protocol::readCsp(three_sweeps, protocol));
+  const auto compiled = protocol.compile();
+  const auto samples = threeSweepSamples(4);
+  const auto tokens = play(compiled, samples, 4);
+
+  clamp_protocol::WorkStealingPool pool(1);
+  clamp_protocol::pipeline_params params;
+  params.stages = {false, false, true, false, true};
+  params.queue_chunks = 4;
+  params.display_held_records = 300;
+  clamp_protocol::AnalysisPipeline pipeline(pool, params);
+  pipeline.setProtocol(compiled.view(), hash, period_ns);
+  // Nobody takes from the display until the end
+  for (size_t first = 0; first < tokens.size(); first += 100) {
+    auto chunk = chunkOf(tokens, first, 100);
+    ASSERT_TRUE(pipeline.push(chunk));
+    pipeline.wait();
+  }
+  EXPECT_EQ(pipeline.queuedChunks(), params.queue_chunks);
+  const auto chunks = drainDisplay(pipeline);
+  EXPECT_EQ(pipeline.queuedChunks(), 0U);
+  ASSERT_LE(chunks.size(), 5U);
+
+  // Full resolution until the queue was half full, then decimated, and the
+  // held back chunk cut down to size
+  EXPECT_EQ(chunks.front()->decimation, 1U);
+  EXPECT_GT(chunks.back()->decimation, params.display_decimation);
+  EXPECT_LE(chunks.back()->tokens.size(), 2 * params.display_held_records);
+  // Every sweep was still measured at full resolution
+  size_t summaries = 0;
+  double highest = -INFINITY;
+  for (const auto& chunk : chunks) {
+    summaries += chunk->summaries.size();
+    for (const auto& token : chunk->tokens) {
+      highest = std::max(highest, token.value);
+    }
+  }
+  EXPECT_EQ(summaries, 12U);
+  EXPECT_DOUBLE_EQ(highest, *std::max_element(samples.begin(), samples.end()));
+
+  const auto report = pipeline.report();
+  EXPECT_EQ(report.stages[clamp_protocol::STAGE_MEASURE].records,
+            tokens.size());
+  EXPECT_GT(report.stages[clamp_protocol::STAGE_DISPLAY].degraded, 0U);
+}
+
+TEST(Pipeline, LeavesChunksWithTheDrainWhenAnalysisFallsBehind)
+{
+  clamp_protocol::WorkStealingPool pool(1);
+  std::atomic<bool> release {false};
+  std::atomic<bool> started {false};
+  clamp_protocol::TaskGroup blocker;
+  pool.submit(blocker,
+              [&]()
+              {
+                started = true;
+                while (!release) {
+                  std::this_thread::yield();
+                }
+              });
+  while (!started) {
+    std::this_thread::yield();
+  }
+
+  clamp_protocol::pipeline_params params;
+  params.stages = {true, false, false, false, true};
+  params.queue_chunks = 2;
+  clamp_protocol::AnalysisPipeline pipeline(pool, params);
+  std::vector<clamp_protocol::data_token_t> tokens(10);
+  auto chunk = chunkOf(tokens, 0, 10);
+  ASSERT_TRUE(pipeline.push(chunk));
+  chunk = chunkOf(tokens, 0, 10);
+  ASSERT_TRUE(pipeline.push(chunk));
+  chunk = chunkOf(tokens, 0, 10);
+  EXPECT_FALSE(pipeline.push(chunk));
+  ASSERT_NE(chunk, nullptr);
+  EXPECT_EQ(pipeline.report().rejected, 1U);
+
+  release = true;
+  pool.wait(blocker);
+  pipeline.wait();
+  EXPECT_TRUE(pipeline.push(chunk));
+  EXPECT_EQ(drainDisplay(pipeline).size(), 3U);
+}
+
+TEST(ChunkPool, SharesAndRecyclesChunks)
+{
+  clamp_protocol::ChunkPool chunks(2, 64);
+  auto first = chunks.acquire();
+  ASSERT_NE(first, nullptr);
+  EXPECT_GE(first->tokens.capacity(), 64U);
+  first->tokens.resize(10);
+  first->decimation = 4;
+  const auto* buffer = first->tokens.data();
+
+  auto shared = first;
+  auto second = chunks.acquire();
+  EXPECT_NE(second, nullptr);
+  EXPECT_EQ(chunks.acquire(), nullptr);
+  first.reset();
+  EXPECT_EQ(chunks.available(), 0U);  // Still shared
+  shared.reset();
+  EXPECT_EQ(chunks.available(), 1U);
+
+  // Back empty, with the same buffer
+  const auto again = chunks.acquire();
+  ASSERT_NE(again, nullptr);
+  EXPECT_TRUE(again->tokens.empty());
+  EXPECT_EQ(again->decimation, 1U);
+  EXPECT_EQ(again->tokens.data(), buffer);
+}
+
+// The drain to display path with pooled chunks allocates nothing once the
+// pipeline and the pool are built
+TEST(ChunkPool, DisplayPathRunsWithoutAllocations)
+{
+  ASSERT_TRUE(clamp_protocol::rt_alloc::hooked());
+  clamp_protocol::Protocol protocol;
+  ASSERT_TRUE(clamp_protocol::readCsp(three_sweeps, protocol));
+  const auto compiled = protocol.compile();
+  const auto tokens = play(compiled, threeSweepSamples(2), 2);
+
+  clamp_protocol::WorkStealingPool pool(1);
+  clamp_protocol::pipeline_params params;
+  params.stages = {false, false, false, false, true};
+  clamp_protocol::AnalysisPipeline pipeline(pool, params);
+  clamp_protocol::ChunkPool chunks(4, 100);
+  size_t plotted = 0;
+  const auto cycle = [&]()
+  {
+    for (size_t first = 0; first < tokens.size(); first += 100) {
+      auto chunk = chunks.acquire();
+      ASSERT_NE(chunk, nullptr);
+      const size_t last = std::min(tokens.size(), first + 100);
+      chunk->tokens.assign(
+          tokens.begin() + static_cast<std::ptrdiff_t>(first),
+          tokens.begin() + static_cast<std::ptrdiff_t>(last));
+      ASSERT_TRUE(pipeline.push(chunk));
+      clamp_protocol::chunk_handle shown;
+      while (pipeline.pop(shown)) {
+        const auto copy = shown;  // As a queued signal would
+        plotted += copy->tokens.size();
+      }
+    }
+  };
+  cycle();
+  const auto before = clamp_protocol::rt_alloc::counts();
+  {
+    const clamp_protocol::rt_alloc::Guard guard;
+    for (int round = 0; round < 20; ++round) {
+      cycle();
+    }
+  }
+  const auto after = clamp_protocol::rt_alloc::counts();
+  EXPECT_EQ(after.allocations - before.allocations, 0U);
+  EXPECT_EQ(after.frees - before.frees, 0U);
+  EXPECT_EQ(plotted, 21 * tokens.size());
+  EXPECT_EQ(chunks.available(), chunks.size());
+}
+
+}  // namespace
@@ -0,0 +1,195 @@
+/*
+ * Copyright (C) 2011 Weill Medical College of Cornell University
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License as
+ *  published by the Free Software Foundation; either version 2 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#include <atomic>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+#include <sched.h>
+
+#include <gtest/gtest.h>
+
+#include "protocol_pool.hpp"
+
+namespace
+{
+
+// Holds the only worker of a pool until release()
+class Blocker
+{
+public:
+  explicit Blocker(clamp_protocol::WorkStealingPool& pool)
+  {
+    pool.submit(group,
+                [this]()
+                {
+                  started = true;
+                  while (!released) {
+                    std::this_thread::yield();
+                  }
+                });
+    while (!started) {
+      std::this_thread::yield();
+    }
+  }
+  void release() { released = true; }
+  clamp_protocol::TaskGroup group;
+
+private:
+  std::atomic<bool> started {false};
+  std::atomic<bool> released {false};
+};
+
+TEST(WorkStealingPool, RunsEveryTaskAndNestedGroups)
+{
+  clamp_protocol::WorkStealingPool pool(4);
+  std::atomic<int> count {0};
+  clamp_protocol::TaskGroup outer;
+  for (int i = 0; i < 100; ++i) {
+    pool.submit(outer,
+                [&]()
+                {
+                  clamp_protocol::TaskGroup inner;
+                  for (int j = 0; j < 10; ++j) {
+                    pool.submit(inner, [&]() { ++count; });
+                  }
+                  pool.wait(inner);
+                  EXPECT_TRUE(inner.done());
+                });
+  }
+  pool.wait(outer);
+  EXPECT_EQ(count.load(), 1000);
+}
+
+TEST(WorkStealingPool, WaitRethrowsTaskExceptions)
+{
+  clamp_protocol::WorkStealingPool pool(2);
+  clamp_protocol::TaskGroup group;
+  std::atomic<int> count {0};
+  for (int i = 0; i < 10; ++i) {
+    pool.submit(group,
+                [&, i]()
+                {
+                  ++count;
+                  if (i == 3) {
+                    throw std::runtime_error("bad sweep");
+                  }
+                });
+  }
+  EXPECT_THROW(pool.wait(group), std::runtime_error);
+  EXPECT_EQ(count.load(), 10);
+}
+
+TEST(WorkStealingPool, LiveTasksRunBeforeBackgroundTasks)
+{
+  clamp_protocol::WorkStealingPool pool(1);
+  Blocker blocker(pool);
+  std::mutex lock;
+  std::vector<int> order;
+  clamp_protocol::TaskGroup group;
+  const auto record = [&](int value)
+  {
+    return [&, value]()
+    {
+      const std::lock_guard<std::mutex> guard(lock);
+      order.push_back(value);
+    };
+  };
+  pool.submit(group, record(2), clamp_protocol::PRIORITY_BACKGROUND);
+  pool.submit(group, record(1), clamp_protocol::PRIORITY_NORMAL);
+  pool.submit(group, record(0), clamp_protocol::PRIORITY_LIVE);
+  pool.submit(group, record(0), clamp_protocol::PRIORITY_LIVE);
+  EXPECT_EQ(pool.queuedTasks(), 4U);
+  blocker.release();
+  pool.wait(group);
+  pool.wait(blocker.group);
+  EXPECT_EQ(order, (std::vector<int> {0, 0, 1, 2}));
+}
+
+TEST(WorkStealingPool, CancelledTasksAreDropped)
+{
+  clamp_protocol::WorkStealingPool pool(1);
+  Blocker blocker(pool);
+  std::atomic<int> count {0};
+  clamp_protocol::TaskGroup group;
+  for (int i = 0; i < 10; ++i) {
+    pool.submit(group, [&]() { ++count; });
+  }
+  group.cancel();
+  pool.submit(group, [&]() { ++count; });  // Not even queued
+  EXPECT_EQ(pool.queuedTasks(), 10U);
+  blocker.release();
+  pool.wait(group);
+  EXPECT_EQ(count.load(), 0);
+  EXPECT_EQ(pool.queuedTasks(), 0U);
+
+  group.reset();
+  pool.submit(group, [&]() { ++count; });
+  pool.wait(group);
+  EXPECT_EQ(count.load(), 1);
+}
+
+TEST(WorkStealingPool, ForeignWaitRunsOnlyItsOwnGroup)
+{
+  clamp_protocol::WorkStealingPool pool(1);
+  Blocker blocker(pool);
+  std::atomic<bool> exported {false};
+  clamp_protocol::TaskGroup exports;
+  pool.submit(exports,
+              [&]() { exported = true; },
+              clamp_protocol::PRIORITY_BACKGROUND);
+  std::thread::id ran_on;
+  clamp_protocol::TaskGroup group;
+  pool.submit(group,
+              [&]() { ran_on = std::this_thread::get_id(); },
+              clamp_protocol::PRIORITY_BACKGROUND);
+
+  // The worker is held, so this thread has to run the task itself, and
+  // must leave the other group's export queued
+  pool.wait(group);
+  EXPECT_EQ(ran_on, std::this_thread::get_id());
+  EXPECT_FALSE(exported.load());
+  EXPECT_EQ(pool.queuedTasks(), 1U);
+
+  blocker.release();
+  pool.wait(blocker.group);
+  pool.wait(exports);
+  EXPECT_TRUE(exported.load());
+}
+
+TEST(WorkStealingPool, PinsWorkersToTheGivenCpus)
+{
+  const auto cpus = clamp_protocol::freeCpus();
+  ASSERT_FALSE(cpus.empty());
+  const auto others = clamp_protocol::freeCpus(cpus.front());
+  EXPECT_EQ(others.size(), cpus.size() - 1);
+
+  clamp_protocol::pool_options options;
+  options.cpus = {cpus.back()};
+  clamp_protocol::WorkStealingPool pool(options);
+  EXPECT_EQ(pool.size(), 1U);
+  std::atomic<int> cpu {-1};
+  clamp_protocol::TaskGroup group;
+  pool.submit(group, [&]() { cpu = sched_getcpu(); });
+  pool.wait(group);
+  EXPECT_EQ(cpu.load(), cpus.back());
+}
+
+}  // namespace
@@ -0,0 +1,198 @@
+/*
+ * Copyright (C) 2011 Weill Medical College of Cornell University
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License as
+ *  published by the Free Software Foundation; either version 2 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <random>
+
+#include "rt_alloc_check.hpp"
+#include "rt_harness.hpp"
+
+clamp_protocol::testing::MemoryFifo::MemoryFifo(size_t capacity)
+    : buffer(capacity)
+{
+}
+
+size_t clamp_protocol::testing::MemoryFifo::writeRT(const void* data,
+                                                    size_t size)
+{
+  const size_t current_head = head.load(std::memory_order_relaxed);
+  const size_t used = current_head - tail.load(std::memory_order_acquire);
+  if (buffer.size() - used < size) {
+    ++drops;
+    return 0;
+  }
+  const auto* in = static_cast<const char*>(data);
+  const size_t offset = current_head % buffer.size();
+  const size_t first = std::min(size, buffer.size() - offset);
+  std::memcpy(buffer.data() + offset, in, first);
+  std::memcpy(buffer.data(), in + first, size - first);
+  head.store(current_head + size, std::memory_order_release);
+  return size;
+}
+
+size_t clamp_protocol::testing::MemoryFifo::read(void* data, size_t size)
+{
+  const size_t current_tail = tail.load(std::memory_order_relaxed);
+  size = std::min(size, head.load(std::memory_order_acquire) - current_tail);
+  auto* out = static_cast<char*>(data);
+  const size_t offset = current_tail % buffer.size();
+  const size_t first = std::min(size, buffer.size() - offset);
+  std::memcpy(out, buffer.data() + offset, first);
+  std::memcpy(out + first, buffer.data(), size - first);
+  tail.store(current_tail + size, std::memory_order_release);
+  return size;
+}
+
+clamp_protocol::testing::harness_report clamp_protocol::testing::runHarness(
+    compiled_view protocol, const harness_config& config)
+{
+  harness_report report;
+  report.ticks = config.ticks;
+  const auto ticks = static_cast<size_t>(config.ticks);
+  report.times.resize(ticks);
+  if (config.keep_outputs) {
+    report.outputs.resize(ticks);
+  }
+
+  // Mock clock: the nominal tick time plus uniform jitter, worked out up
+  // front so the random generator stays out of the timed region
+  std::mt19937_64 rng(config.seed);
+  std::uniform_int_distribution<int64_t> jitter(-config.jitter_ns,
+                                                config.jitter_ns);
+  for (size_t i = 0; i < ticks; ++i) {
+    report.times[i] = static_cast<int64_t>(i) * config.period_ns
+        + (config.jitter_ns > 0 ? jitter(rng) : 0);
+  }
+
+  ProtocolRunner runner;
+  runner.setProtocol(protocol, 0, config.period_ns);
+  runner.setTrials(config.trials);
+  runner.setOutputScaling(config.junction_potential, config.output_factor);
+  runner.setSession(config.session);
+
+  // The display path of Component::execute(), over an in-memory FIFO
+  MemoryFifo fifo(config.fifo_capacity);
+  runtime_metrics metrics;
+  RtMonitor monitor(&metrics);
+  GuiMonitor gui_monitor(&metrics);
+  LatencyProbe probe;
+  DisplayWriter<MemoryFifo> display(monitor, probe, config.decimator);
+  display.setFifo(&fifo, config.decimate ? config.fifo_capacity : 0);
+  display.setPlotting(config.plotting);
+  std::vector<data_token_t> drain(config.fifo_capacity / sizeof(data_token_t));
+  std::vector<int64_t> tick_ns(ticks);
+  const int64_t ticks_per_drain =
+      std::max<int64_t>(config.drain_period_ns / config.period_ns, 1);
+  bool paused = false;
+  std::vector<double> cell_current(config.cell != nullptr ? config.cell->size()
+                                                         : 0);
+  double command_mv = 0.0;
+  if (config.cell != nullptr) {
+    command_mv = config.junction_potential;  // Output before the first tick
+    config.cell->step(command_mv, 0.0, cell_current.data());
+  }
+  const rt_alloc::counts_t before = rt_alloc::counts();
+
+  for (size_t i = 0; i < ticks; ++i) {
+    double input = 0.0;
+    if (config.cell != nullptr) {
+      input = cell_current[0] * config.cell_gain;
+    } else if (config.input != nullptr) {
+      input = config.input(static_cast<int64_t>(i));
+    }
+
+    double output = 0.0;
+    std::chrono::steady_clock::time_point start;
+    std::chrono::steady_clock::time_point stop;
+    {
+      const rt_alloc::Guard guard;
+      start = std::chrono::steady_clock::now();
+      data_token_t token {};
+      if (!paused) {  // Mirrors the EXEC and PAUSE cases of execute()
+        if (!runner.tick(report.times[i], input, output, token)) {
+          paused = true;
+          display.finish(report.times[i], nullptr);
+        } else {
+          ++report.samples;
+          display.write(token, report.times[i], nullptr);
+        }
+      }
+      stop = std::chrono::steady_clock::now();
+    }
+
+    tick_ns[i] = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                     stop - start)
+                     .count();
+    if (config.keep_outputs) {
+      report.outputs[i] = output;
+    }
+    if (config.cell != nullptr) {
+      if (!paused && config.output_factor != 0.0) {
+        command_mv = output / config.output_factor;
+      }
+      config.cell->step(command_mv,
+                        static_cast<double>(config.period_ns) * 1e-6,
+                        cell_current.data());
+    }
+    report.fifo_high_water = std::max(report.fifo_high_water, fifo.fill());
+    if ((static_cast<int64_t>(i) + 1) % ticks_per_drain == 0 || i + 1 == ticks)
+    {
+      gui_monitor.draining(report.times[i]);
+      const size_t bytes =
+          fifo.read(drain.data(), drain.size() * sizeof(data_token_t));
+      gui_monitor.drained(bytes);
+      if (bytes >= sizeof(data_token_t)) {
+        probe.samplesPlotted(drain[bytes / sizeof(data_token_t) - 1].sample);
+        probe.framePainted(report.times[i]);
+      }
+      if (config.keep_records) {
+        report.records.insert(report.records.end(),
+                              drain.begin(),
+                              drain.begin()
+                                  + static_cast<std::ptrdiff_t>(
+                                      bytes / sizeof(data_token_t)));
+      }
+      if (config.session != nullptr) {
+        config.session->flush();
+      }
+    }
+  }
+  runner.setSession(nullptr);
+  report.dropped = fifo.dropped();
+  report.folded = display.foldedRecords();
+  report.latency = probe.histogram();
+  const rt_alloc::counts_t after = rt_alloc::counts();
+  report.allocations = after.allocations - before.allocations;
+  report.frees = after.frees - before.frees;
+
+  if (!tick_ns.empty()) {
+    double total = 0.0;
+    for (const int64_t ns : tick_ns) {
+      total += static_cast<double>(ns);
+    }
+    report.tick_time.mean_ns = total / static_cast<double>(tick_ns.size());
+    report.tick_time.max_ns = *std::max_element(tick_ns.begin(), tick_ns.end());
+    auto p99 = tick_ns.begin()
+        + static_cast<std::ptrdiff_t>((tick_ns.size() - 1) * 99 / 100);
+    std::nth_element(tick_ns.begin(), p99, tick_ns.end());
+    report.tick_time.p99_ns = *p99;
+  }
+  return report;
+}
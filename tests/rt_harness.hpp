@@ -0,0 +1,119 @@
+/*
+ * Copyright (C) 2011 Weill Medical College of Cornell University
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License as
+ *  published by the Free Software Foundation; either version 2 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "protocol_cell.hpp"
+#include "protocol_decimator.hpp"
+#include "protocol_display.hpp"
+#include "protocol_model.hpp"
+#include "protocol_record.hpp"
+#include "protocol_runner.hpp"
+
+// Simulated RT environment for ProtocolRunner, the RT half of Component.
+// Ticks run on a mock clock with injected jitter, read a mock input channel,
+// write data tokens through the component's own DisplayWriter into an
+// in-memory FIFO that is drained on the Panel's plot timer cadence, and are
+// timed and checked for heap allocations one by one. Nothing here needs
+// RTXI, Qt or an RT kernel.
+namespace clamp_protocol::testing
+{
+
+// In-memory stand-in for RT::OS::Fifo: a single producer, single consumer
+// byte ring with the same writeRT()/read() calls. Writes that do not fit are
+// dropped whole, as on the RT side.
+class MemoryFifo
+{
+public:
+  explicit MemoryFifo(size_t capacity);
+  size_t writeRT(const void* data, size_t size);
+  size_t read(void* data, size_t size);
+  size_t fill() const { return head.load() - tail.load(); }
+  size_t capacity() const { return buffer.size(); }
+  uint64_t dropped() const { return drops; }
+
+private:
+  std::vector<char> buffer;
+  std::atomic<size_t> head {0};
+  std::atomic<size_t> tail {0};
+  uint64_t drops = 0;
+};
+
+struct harness_config
+{
+  int64_t period_ns = 100000;
+  int64_t ticks = 1000000;
+  int64_t jitter_ns = 0;  // Each tick lands uniformly within +/- jitter
+  uint64_t seed = 1;
+  int trials = 1;
+  double junction_potential = 0.0;
+  double output_factor = 1.0;
+  bool plotting = true;  // Write a token per tick, as with the plot open
+  int64_t drain_period_ns = 100000000;  // Panel plot timer, 100 ms
+  size_t fifo_capacity = 10 * 1048576;
+  // Thin the tokens through a DisplayDecimator as the FIFO fills
+  bool decimate = false;
+  decimator_params decimator;
+  bool keep_outputs = true;
+  bool keep_records = true;
+  double (*input)(int64_t tick) = nullptr;  // Input channel, zero if unset
+  // Voltage clamped model cell in place of the amplifier: each tick reads the
+  // pipette current of cell 0 after the previous command was held for a
+  // period, in units of `cell_gain` per nA. Takes precedence over `input`.
+  CellPopulation* cell = nullptr;
+  double cell_gain = 1.0;
+  // Open recorder the run is logged to, flushed on the drain cadence
+  SessionRecorder* session = nullptr;
+};
+
+struct tick_stats
+{
+  double mean_ns = 0.0;
+  int64_t p99_ns = 0;
+  int64_t max_ns = 0;
+};
+
+struct harness_report
+{
+  int64_t ticks = 0;
+  int64_t samples = 0;  // Ticks that played a protocol sample
+  std::vector<int64_t> times;  // Mock RT time of every tick
+  std::vector<double> outputs;  // Output channel, one per tick
+  std::vector<data_token_t> records;  // Tokens drained from the FIFO
+  uint64_t dropped = 0;  // Tokens that did not fit in the FIFO
+  uint64_t folded = 0;  // Records that reached the FIFO as min/max pairs
+  size_t fifo_high_water = 0;  // Bytes
+  // Write to drain, through the component's LatencyProbe, with each drain
+  // standing in for a painted frame
+  LatencyHistogram latency;
+  tick_stats tick_time;
+  // Heap calls made inside ticks, seen through rt_alloc_check
+  uint64_t allocations = 0;
+  uint64_t frees = 0;
+};
+
+// Arms `protocol` and runs `config.ticks` RT periods the way
+// Component::execute() does, pausing when the last trial ends
+harness_report runHarness(compiled_view protocol, const harness_config& config);
+
+}  // namespace clamp_protocol::testing
@@ -0,0 +1,354 @@
+/*
+ * Copyright (C) 2011 Weill Medical College of Cornell University
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License as
+ *  published by the Free Software Foundation; either version 2 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#include <cmath>
+#include <algorithm>
+#include <iostream>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "protocol_engine.hpp"
+#include "protocol_fifo.hpp"
+#include "protocol_generators.hpp"
+#include "protocol_runner.hpp"
+#include "rt_alloc_check.hpp"
+#include "rt_harness.hpp"
+
+namespace
+{
+
+using clamp_protocol::testing::harness_config;
+using clamp_protocol::testing::MemoryFifo;
+using clamp_protocol::testing::runHarness;
+
+constexpr int64_t period_ns = 50000;  // 20 kHz
+
+clamp_protocol::CompiledProtocol ivProtocol()
+{
+  return clamp_protocol::generators::iv({}).compile();
+}
+
+int64_t totalSamples(const clamp_protocol::CompiledProtocol& compiled)
+{
+  clamp_protocol::SampleIndex index;
+  index.build(compiled.view(), period_ns);
+  return index.totalSamples();
+}
+
+double inputSignal(int64_t tick)
+{
+  return std::sin(static_cast<double>(tick) * 1e-3);
+}
+
+TEST(RtHarness, OutputsMatchRenderedProtocolForEveryTrial)
+{
+  const auto compiled = ivProtocol();
+  const int64_t samples = totalSamples(compiled);
+  std::vector<double> expected(static_cast<size_t>(samples));
+  clamp_protocol::renderProtocol(
+      compiled.view(), period_ns, 0, expected.data(), expected.size());
+
+  harness_config config;
+  config.period_ns = period_ns;
+  config.ticks = 2 * samples + 1000;
+  config.jitter_ns = 20000;
+  config.trials = 2;
+  config.junction_potential = 5.0;
+  config.output_factor = 1e-3;
+  const auto report = runHarness(compiled.view(), config);
+
+  ASSERT_EQ(report.samples, 2 * samples);
+  for (int64_t i = 0; i < config.ticks; ++i) {
+    const double want = i < 2 * samples
+        ? (expected[static_cast<size_t>(i % samples)] + 5.0) * 1e-3
+        : 0.0;
+    ASSERT_DOUBLE_EQ(report.outputs[static_cast<size_t>(i)], want)
+        << "tick " << i;
+  }
+}
+
+TEST(RtHarness, RecordsCarryTheMockClockAndInput)
+{
+  const auto compiled = ivProtocol();
+  harness_config config;
+  config.period_ns = period_ns;
+  config.ticks = totalSamples(compiled);
+  config.jitter_ns = 10000;
+  config.seed = 7;
+  config.input = inputSignal;
+  const auto report = runHarness(compiled.view(), config);
+
+  ASSERT_EQ(report.dropped, 0U);
+  ASSERT_EQ(static_cast<int64_t>(report.records.size()), config.ticks);
+  clamp_protocol::SampleIndex index;
+  index.build(compiled.view(), period_ns);
+  for (size_t i = 0; i < report.records.size(); ++i) {
+    const auto& token = report.records[i];
+    ASSERT_EQ(token.time, report.times[i]);
+    ASSERT_EQ(token.value, inputSignal(static_cast<int64_t>(i)));
+    const size_t step = index.locate(static_cast<int64_t>(i));
+    ASSERT_EQ(token.stepStart,
+              report.times[static_cast<size_t>(index.stepStart(step))]);
+    // Jitter stays within half a period, so the counter is the tick number
+    ASSERT_EQ(token.sample, static_cast<int64_t>(i));
+    ASSERT_EQ(token.stepSample, index.stepStart(step));
+    size_t first = step;
+    while (first > 0
+           && compiled.steps[first - 1].segment == compiled.steps[step].segment
+           && compiled.steps[first - 1].sweep == compiled.steps[step].sweep)
+    {
+      --first;
+    }
+    ASSERT_EQ(token.sweepSample, index.stepStart(first));
+    ASSERT_EQ(token.sweepStart,
+              report.times[static_cast<size_t>(index.stepStart(first))]);
+    ASSERT_EQ(token.segment, static_cast<int>(compiled.steps[step].segment));
+    ASSERT_EQ(token.sweep, static_cast<int>(compiled.steps[step].sweep));
+    ASSERT_EQ(token.step, static_cast<int>(compiled.steps[step].step));
+  }
+}
+
+// The counter is the RT clock in periods: it counts the periods a paused
+// component missed and carries on across a period change
+TEST(RtHarness, SampleCounterFollowsTheRtClock)
+{
+  const auto compiled = ivProtocol();
+  clamp_protocol::ProtocolRunner runner;
+  runner.setProtocol(compiled.view(), 1, period_ns);
+  double output = 0.0;
+  clamp_protocol::data_token_t token {};
+  const int64_t boot = 1000 * period_ns + 3000;
+  ASSERT_TRUE(runner.tick(boot, 0.0, output, token));
+  EXPECT_EQ(token.sample, 1000);
+  EXPECT_EQ(token.stepSample, 1000);
+  EXPECT_EQ(token.sweepStart, boot);
+  EXPECT_EQ(token.sweepSample, 1000);
+
+  // Paused for 500 periods
+  ASSERT_TRUE(runner.tick(boot + 501 * period_ns, 0.0, output, token));
+  EXPECT_EQ(token.sample, 1501);
+  EXPECT_EQ(token.stepSample, 1000);
+  EXPECT_EQ(token.sweepStart, boot);
+  // Late and early ticks within half a period count one each
+  ASSERT_TRUE(runner.tick(boot + 502 * period_ns + period_ns / 2 - 4000,
+                          0.0,
+                          output,
+                          token));
+  EXPECT_EQ(token.sample, 1502);
+  ASSERT_TRUE(runner.tick(boot + 503 * period_ns - period_ns / 2 + 2000,
+                          0.0,
+                          output,
+                          token));
+  EXPECT_EQ(token.sample, 1503);
+
+  // At twice the rate the counter goes on from the last tick, and the
+  // trial starts over with new headers
+  const int64_t last = token.time;
+  runner.setPeriod(period_ns / 2);
+  ASSERT_TRUE(runner.tick(last + period_ns / 2, 0.0, output, token));
+  EXPECT_EQ(token.sample, 1504);
+  EXPECT_EQ(token.stepSample, 1504);
+  EXPECT_EQ(token.sweepSample, 1504);
+  EXPECT_EQ(token.sweepStart, last + period_ns / 2);
+  ASSERT_TRUE(runner.tick(last + 11 * period_ns / 2, 0.0, output, token));
+  EXPECT_EQ(token.sample, 1514);
+}
+
+// Component::execute() writes through a DisplayWriter, which stays silent
+// until the panel has opened the plot and handed it a FIFO
+TEST(RtHarness, TokensReachTheFifoOnlyWhilePlotting)
+{
+  const auto compiled = ivProtocol();
+  harness_config config;
+  config.period_ns = period_ns;
+  config.ticks = 1000;
+  config.plotting = false;
+  const auto closed = runHarness(compiled.view(), config);
+  EXPECT_EQ(closed.samples, 1000);
+  EXPECT_TRUE(closed.records.empty());
+
+  MemoryFifo fifo(16 * sizeof(clamp_protocol::data_token_t));
+  clamp_protocol::runtime_metrics metrics;
+  clamp_protocol::RtMonitor monitor(&metrics);
+  clamp_protocol::LatencyProbe probe;
+  clamp_protocol::DisplayWriter<MemoryFifo> display(monitor, probe);
+  clamp_protocol::data_token_t token {};
+  display.write(token, 0, nullptr);
+  display.setPlotting(true);
+  display.write(token, 0, nullptr);  // No FIFO yet
+  EXPECT_FALSE(display.writing());
+  display.setFifo(&fifo, fifo.capacity());
+  display.write(token, 0, nullptr);
+  display.finish(0, nullptr);
+  EXPECT_EQ(fifo.fill(), sizeof(token));
+  display.setPlotting(false);
+  display.write(token, 0, nullptr);
+  EXPECT_EQ(fifo.fill(), sizeof(token));
+}
+
+TEST(RtHarness, SmallFifoDropsWholeTokens)
+{
+  const auto compiled = ivProtocol();
+  harness_config config;
+  config.period_ns = period_ns;
+  config.ticks = 10000;
+  config.fifo_capacity = 100 * sizeof(clamp_protocol::data_token_t) + 7;
+  const auto report = runHarness(compiled.view(), config);
+
+  EXPECT_GT(report.dropped, 0U);
+  EXPECT_EQ(report.records.size() + report.dropped, 10000U);
+  EXPECT_LE(report.fifo_high_water, config.fifo_capacity);
+}
+
+// The same slow drain with decimation: nothing is dropped, every record
+// reaches the FIFO on its own or inside a min/max pair, and the extremes
+// survive
+TEST(RtHarness, FillingFifoDecimatesInsteadOfDropping)
+{
+  const auto compiled = ivProtocol();
+  harness_config config;
+  config.period_ns = period_ns;
+  config.ticks = 100000;
+  config.input = inputSignal;
+  config.fifo_capacity = 1000 * sizeof(clamp_protocol::data_token_t);
+  const auto lossy = runHarness(compiled.view(), config);
+  EXPECT_GT(lossy.dropped, 0U);
+
+  config.decimate = true;
+  const auto report = runHarness(compiled.view(), config);
+  EXPECT_EQ(report.dropped, 0U);
+  EXPECT_EQ(report.allocations, 0U);
+  EXPECT_GT(report.folded, 0U);
+  uint64_t full = 0;
+  double highest = -1.0;
+  double lowest = 1.0;
+  for (const auto& token : report.records) {
+    full += token.decimation == 1 ? 1 : 0;
+    ASSERT_LE(token.decimation, config.decimator.factor);
+    highest = std::max(highest, token.value);
+    lowest = std::min(lowest, token.value);
+  }
+  EXPECT_EQ(full + report.folded, static_cast<uint64_t>(report.samples));
+  EXPECT_LT(report.records.size(), static_cast<size_t>(report.samples));
+  double expected_high = -1.0;
+  double expected_low = 1.0;
+  for (int64_t i = 0; i < report.samples; ++i) {
+    expected_high = std::max(expected_high, inputSignal(i));
+    expected_low = std::min(expected_low, inputSignal(i));
+  }
+  EXPECT_EQ(highest, expected_high);
+  EXPECT_EQ(lowest, expected_low);
+
+  // Every tagged record resolves on the drain that took it, thinned or not
+  EXPECT_EQ(report.latency.count(), (report.records.size() + 999) / 1000);
+  EXPECT_GT(report.latency.max(), 0);
+  EXPECT_LE(report.latency.max(), config.drain_period_ns);
+}
+
+TEST(FifoSizing, ScalesWithRateAndBudgetInWholePages)
+{
+  clamp_protocol::fifo_sizing sizing;
+  sizing.period_ns = 100000;
+  const size_t at_10khz = clamp_protocol::fifoCapacity(sizing);
+  sizing.period_ns = 50000;
+  const size_t at_20khz = clamp_protocol::fifoCapacity(sizing);
+  EXPECT_EQ(at_10khz % 4096, 0U);
+  EXPECT_EQ(at_20khz % 4096, 0U);
+  EXPECT_NEAR(static_cast<double>(at_20khz) / static_cast<double>(at_10khz),
+              2.0,
+              0.01);
+  // 1.1 s of 20 kHz tokens below the half full mark
+  EXPECT_GE(at_20khz, 2 * 22001 * sizeof(clamp_protocol::data_token_t));
+
+  sizing.period_ns = 1000000000;
+  EXPECT_EQ(clamp_protocol::fifoCapacity(sizing), sizing.min_bytes);
+  sizing.period_ns = 1000;
+  sizing.max_bytes = 1000000;
+  EXPECT_EQ(clamp_protocol::fifoCapacity(sizing), 999424U);
+}
+
+// Every drain arrives a full stall budget late: a FIFO sized for that budget
+// never has to decimate, and one twice as late is thinned but loses nothing
+TEST(RtHarness, SizedFifoRidesOutTheStallBudget)
+{
+  const auto compiled = ivProtocol();
+  clamp_protocol::fifo_sizing sizing;
+  sizing.period_ns = period_ns;
+  sizing.stall_budget_ns = 400000000;
+  harness_config config;
+  config.period_ns = period_ns;
+  config.ticks = 100000;
+  config.input = inputSignal;
+  config.decimate = true;
+  config.fifo_capacity = clamp_protocol::fifoCapacity(sizing);
+  config.drain_period_ns = sizing.drain_period_ns + sizing.stall_budget_ns;
+  const auto on_budget = runHarness(compiled.view(), config);
+  EXPECT_EQ(on_budget.dropped, 0U);
+  EXPECT_EQ(on_budget.folded, 0U);
+  EXPECT_EQ(on_budget.records.size(),
+            static_cast<size_t>(on_budget.samples));
+
+  config.drain_period_ns += sizing.stall_budget_ns;
+  const auto over_budget = runHarness(compiled.view(), config);
+  EXPECT_EQ(over_budget.dropped, 0U);
+  EXPECT_GT(over_budget.folded, 0U);
+}
+
+TEST(RtHarness, AllocationCheckSeesNewAndDelete)
+{
+  ASSERT_TRUE(clamp_protocol::rt_alloc::hooked());
+  const auto before = clamp_protocol::rt_alloc::counts();
+  {
+    const clamp_protocol::rt_alloc::Guard guard;
+    delete new std::vector<double>(16);
+  }
+  delete new int(1);  // Outside the guard
+  const auto after = clamp_protocol::rt_alloc::counts();
+  EXPECT_EQ(after.allocations - before.allocations, 2U);
+  EXPECT_EQ(after.frees - before.frees, 2U);
+}
+
+// Millions of ticks with jitter: no heap allocations inside a tick, and the
+// per-tick cost is reported for inspection
+TEST(RtHarness, MillionsOfTicksWithoutAllocations)
+{
+  const auto compiled = ivProtocol();
+  harness_config config;
+  config.period_ns = period_ns;
+  config.ticks = 2000000;
+  config.jitter_ns = 25000;
+  config.trials = 1000;
+  config.keep_outputs = false;
+  config.keep_records = false;
+  const auto report = runHarness(compiled.view(), config);
+
+  EXPECT_EQ(report.allocations, 0U);
+  EXPECT_EQ(report.frees, 0U);
+  EXPECT_EQ(report.samples, config.ticks);
+  EXPECT_EQ(report.dropped, 0U);
+  EXPECT_LE(report.tick_time.p99_ns, report.tick_time.max_ns);
+  std::cout << "tick cpu time: mean " << report.tick_time.mean_ns
+            << " ns, p99 " << report.tick_time.p99_ns << " ns, max "
+            << report.tick_time.max_ns << " ns\n";
+  RecordProperty("tick_mean_ns", static_cast<int>(report.tick_time.mean_ns));
+  RecordProperty("tick_p99_ns", static_cast<int>(report.tick_time.p99_ns));
+  RecordProperty("tick_max_ns", static_cast<int>(report.tick_time.max_ns));
+}
+
+}  // namespace
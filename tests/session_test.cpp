@@ -0,0 +1,351 @@
+/*
+ * Copyright (C) 2011 Weill Medical College of Cornell University
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License as
+ *  published by the Free Software Foundation; either version 2 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <iterator>
+#include <limits>
+#include <string>
+#include <vector>
+
+#include <unistd.h>
+
+#include <gtest/gtest.h>
+
+#include "protocol_generators.hpp"
+#include "protocol_replay.hpp"
+#include "protocol_session.hpp"
+#include "rt_harness.hpp"
+
+namespace
+{
+
+constexpr int64_t period_ns = 50000;
+
+std::string scratchPath(const char* name)
+{
+  return "/tmp/clamp_protocol_" + std::to_string(getpid()) + "_" + name
+      + ".cps";
+}
+
+double noisyInput(int64_t tick)
+{
+  return std::sin(static_cast<double>(tick) * 0.01) * 1e-9
+      + static_cast<double>(tick % 7) * 1e-12;
+}
+
+TEST(Session, ReplayReproducesTheRun)
+{
+  const auto compiled = clamp_protocol::generators::iv({}).compile();
+  const std::string path = scratchPath("replay");
+  clamp_protocol::SessionRecorder recorder;
+  ASSERT_TRUE(recorder.open(path));
+
+  clamp_protocol::testing::harness_config config;
+  config.period_ns = period_ns;
+  config.ticks = 200000;
+  config.jitter_ns = 5000;
+  config.trials = 2;
+  config.junction_potential = 5.0;
+  config.output_factor = 1e-3;
+  config.input = noisyInput;
+  config.session = &recorder;
+  const auto report =
+      clamp_protocol::testing::runHarness(compiled.view(), config);
+  recorder.close();
+  EXPECT_EQ(recorder.lostEvents(), 0U);
+  EXPECT_EQ(report.allocations, 0U);
+  // Ticks dominate the log: about ten bytes each
+  EXPECT_LT(recorder.bytesWritten(),
+            static_cast<uint64_t>(config.ticks) * 12 + 50000);
+
+  clamp_protocol::SessionLog log;
+  ASSERT_TRUE(log.load(path));
+  clamp_protocol::SessionPlayer player(log);
+  clamp_protocol::replay_tick_t tick;
+  size_t ticks = 0;
+  size_t samples = 0;
+  while (player.next(tick)) {
+    ASSERT_LT(ticks, report.outputs.size());
+    ASSERT_EQ(tick.time_ns, report.times[ticks]);
+    ASSERT_EQ(tick.input, noisyInput(static_cast<int64_t>(ticks)));
+    ASSERT_EQ(tick.output, report.outputs[ticks]) << "tick " << ticks;
+    if (tick.sample) {
+      const auto& want = report.records[samples++];
+      ASSERT_EQ(tick.token.time, want.time);
+      ASSERT_EQ(tick.token.stepStart, want.stepStart);
+      ASSERT_EQ(tick.token.sample, want.sample);
+      ASSERT_EQ(tick.token.stepSample, want.stepSample);
+      ASSERT_EQ(tick.token.sweepStart, want.sweepStart);
+      ASSERT_EQ(tick.token.sweepSample, want.sweepSample);
+      ASSERT_EQ(tick.token.value, want.value);
+      ASSERT_EQ(tick.token.trial, want.trial);
+      ASSERT_EQ(tick.token.step, want.step);
+      ASSERT_EQ(tick.token.sweep, want.sweep);
+    }
+    ++ticks;
+  }
+  EXPECT_FALSE(log.corrupt());
+  // Paused components do not tick: the log ends with the tick that found
+  // every trial played
+  EXPECT_EQ(ticks, static_cast<size_t>(report.samples) + 1);
+  EXPECT_EQ(samples, report.records.size());
+  std::remove(path.c_str());
+}
+
+// Chunks as a plot window on a timer pulls them: every token once, in
+// order, never past the requested session time or the chunk limit
+TEST(Session, ChunkedReplayDeliversEveryToken)
+{
+  const auto compiled = clamp_protocol::generators::iv({}).compile();
+  const std::string path = scratchPath("chunks");
+  clamp_protocol::SessionRecorder recorder;
+  ASSERT_TRUE(recorder.open(path));
+  clamp_protocol::testing::harness_config config;
+  config.period_ns = period_ns;
+  config.ticks = 60000;
+  config.input = noisyInput;
+  config.session = &recorder;
+  const auto report =
+      clamp_protocol::testing::runHarness(compiled.view(), config);
+  recorder.close();
+
+  clamp_protocol::SessionLog log;
+  ASSERT_TRUE(log.load(path));
+  EXPECT_EQ(log.size(), recorder.bytesWritten());
+  clamp_protocol::SessionPlayer player(log);
+  std::vector<clamp_protocol::data_token_t> chunk;
+  size_t delivered = 0;
+  size_t chunks = 0;
+  int64_t until_ns = 0;
+  bool more = true;
+  while (more) {
+    until_ns += 100000000;  // 100 ms of session per timer tick
+    chunk.clear();
+    more = player.nextChunk(until_ns, 1500, chunk);
+    ASSERT_LE(chunk.size(), 1500U);
+    ASSERT_LE(player.elapsed(), until_ns);
+    for (const auto& token : chunk) {
+      const auto& want = report.records.at(delivered++);
+      ASSERT_EQ(token.time, want.time);
+      ASSERT_EQ(token.value, want.value);
+    }
+    if (chunk.size() < 1500 && more) {
+      ASSERT_GT(until_ns - player.elapsed(), 0);
+    }
+    ++chunks;
+  }
+  EXPECT_EQ(delivered, report.records.size());
+  EXPECT_GT(chunks, static_cast<size_t>(report.samples) / 1500);
+  EXPECT_EQ(log.position(), log.size());
+  std::remove(path.c_str());
+}
+
+// Recording that starts half way through a trial, with commands applied
+// while it runs
+TEST(Session, RecordingStartedMidRun)
+{
+  const auto compiled = clamp_protocol::generators::tail({}).compile();
+  clamp_protocol::ProtocolRunner live;
+  live.setProtocol(compiled.view(), 7, period_ns);
+  live.setTrials(3);
+  double output = 0.0;
+  clamp_protocol::data_token_t token {};
+  int64_t now = 0;
+  for (int i = 0; i < 12345; ++i, now += period_ns) {
+    live.tick(now, 0.0, output, token);
+  }
+
+  const std::string path = scratchPath("mid_run");
+  clamp_protocol::SessionRecorder recorder;
+  ASSERT_TRUE(recorder.open(path));
+  live.setSession(&recorder);
+  std::vector<double> outputs;
+  std::vector<clamp_protocol::data_token_t> tokens;
+  for (int i = 0; i < 50000; ++i, now += period_ns) {
+    if (i == 20000) {
+      live.setOutputScaling(-3.0, 2.0);
+    }
+    if (i == 30000) {
+      live.setPeriod(period_ns / 2);
+    }
+    if (i == 25000) {
+      live.setHash(8);
+    }
+    if (i == 40000) {
+      live.rewind();
+    }
+    live.tick(now, static_cast<double>(i), output, token);
+    outputs.push_back(output);
+    tokens.push_back(token);
+  }
+  live.setSession(nullptr);
+  recorder.close();
+
+  clamp_protocol::SessionLog log;
+  ASSERT_TRUE(log.load(path));
+  clamp_protocol::SessionPlayer player(log);
+  clamp_protocol::replay_tick_t tick;
+  size_t ticks = 0;
+  while (player.next(tick)) {
+    ASSERT_EQ(tick.output, outputs.at(ticks)) << "tick " << ticks;
+    // Sweep and step headers rebuilt from the recorded position
+    const auto& want = tokens.at(ticks);
+    ASSERT_EQ(tick.token.sample, want.sample) << "tick " << ticks;
+    ASSERT_EQ(tick.token.stepSample, want.stepSample);
+    ASSERT_EQ(tick.token.sweepStart, want.sweepStart);
+    ASSERT_EQ(tick.token.sweepSample, want.sweepSample);
+    ASSERT_EQ(tick.token.protocolHash, want.protocolHash);
+    ++ticks;
+  }
+  EXPECT_EQ(ticks, outputs.size());
+  EXPECT_EQ(tokens.front().protocolHash, 7U);
+  EXPECT_EQ(player.runner().hash(), 8U);
+  std::remove(path.c_str());
+}
+
+TEST(Session, FullBufferLeavesGaps)
+{
+  const std::string path = scratchPath("gaps");
+  clamp_protocol::SessionRecorder recorder(256);
+  ASSERT_TRUE(recorder.open(path));
+  for (int i = 0; i < 100; ++i) {
+    recorder.tick(i * period_ns, 1.0);
+  }
+  recorder.flush();
+  for (int i = 100; i < 110; ++i) {
+    recorder.tick(i * period_ns, 2.0);
+  }
+  recorder.close();
+  EXPECT_GT(recorder.lostEvents(), 0U);
+
+  clamp_protocol::SessionLog log;
+  ASSERT_TRUE(log.load(path));
+  clamp_protocol::session_event_t event;
+  size_t ticks = 0;
+  size_t gaps = 0;
+  int64_t last = -1;
+  while (log.next(event)) {
+    if (event.type == clamp_protocol::SESSION_GAP) {
+      ++gaps;
+    } else if (event.type == clamp_protocol::SESSION_TICK) {
+      EXPECT_GT(event.time_ns, last);  // Times survive the gap
+      EXPECT_EQ(event.time_ns % period_ns, 0);
+      last = event.time_ns;
+      ++ticks;
+    }
+  }
+  EXPECT_EQ(gaps, 1U);
+  EXPECT_EQ(ticks + recorder.lostEvents(), 110U);
+  EXPECT_EQ(last, 109 * period_ns);
+  std::remove(path.c_str());
+}
+
+TEST(Session, TruncatedLogStopsCleanly)
+{
+  const std::string path = scratchPath("truncated");
+  {
+    clamp_protocol::SessionRecorder recorder;
+    ASSERT_TRUE(recorder.open(path));
+    for (int i = 0; i < 10; ++i) {
+      recorder.tick(i * period_ns, 0.5);
+    }
+  }
+  std::FILE* file = std::fopen(path.c_str(), "r+b");
+  ASSERT_NE(file, nullptr);
+  std::fseek(file, 0, SEEK_END);
+  const long size = std::ftell(file);
+  std::fclose(file);
+  ASSERT_EQ(truncate(path.c_str(), size - 3), 0);
+
+  clamp_protocol::SessionLog log;
+  ASSERT_TRUE(log.load(path));
+  clamp_protocol::session_event_t event;
+  size_t ticks = 0;
+  while (log.next(event)) {
+    ++ticks;
+  }
+  EXPECT_EQ(ticks, 9U);
+  EXPECT_TRUE(log.corrupt());
+  std::remove(path.c_str());
+}
+
+// Rewrites the first occurrence of `from` in the log at `path` with `to`
+void patchLog(const std::string& path, double from, double to)
+{
+  std::FILE* file = std::fopen(path.c_str(), "r+b");
+  ASSERT_NE(file, nullptr);
+  std::vector<unsigned char> bytes(1 << 16);
+  bytes.resize(std::fread(bytes.data(), 1, bytes.size(), file));
+  unsigned char pattern[sizeof(double)];
+  std::memcpy(pattern, &from, sizeof(from));
+  const auto found = std::search(
+      bytes.begin(), bytes.end(), std::begin(pattern), std::end(pattern));
+  ASSERT_NE(found, bytes.end());
+  std::fseek(file, found - bytes.begin(), SEEK_SET);
+  std::fwrite(&to, sizeof(to), 1, file);
+  std::fclose(file);
+}
+
+// Replay feeds logged steps to a runner, so altered ones must not load
+TEST(Session, AlteredProtocolStepsAreCorrupt)
+{
+  clamp_protocol::CompiledProtocol compiled;
+  compiled.steps.resize(2);
+  compiled.steps[0].duration = 10.0;
+  compiled.steps[0].level1 = compiled.steps[0].level2 = -73.25;
+  compiled.steps[1].duration = 20.0;
+
+  const auto events = [&](double level, size_t& protocols)
+  {
+    const std::string path = scratchPath("altered");
+    {
+      clamp_protocol::SessionRecorder recorder;
+      EXPECT_TRUE(recorder.open(path));
+      recorder.protocol(compiled.view(), 7, period_ns);
+      recorder.tick(0, 0.5);
+    }
+    if (level != -73.25) {
+      patchLog(path, -73.25, level);
+    }
+    clamp_protocol::SessionLog log;
+    EXPECT_TRUE(log.load(path));
+    clamp_protocol::session_event_t event;
+    size_t count = 0;
+    protocols = 0;
+    while (log.next(event)) {
+      protocols += event.type == clamp_protocol::SESSION_PROTOCOL ? 1 : 0;
+      ++count;
+    }
+    std::remove(path.c_str());
+    return log.corrupt() ? 0 : count;
+  };
+
+  size_t protocols = 0;
+  EXPECT_EQ(events(-73.25, protocols), 2U);
+  EXPECT_EQ(protocols, 1U);
+  // Finite but not what was recorded
+  EXPECT_EQ(events(-73.5, protocols), 0U);
+  EXPECT_EQ(protocols, 0U);
+  EXPECT_EQ(events(std::numeric_limits<double>::quiet_NaN(), protocols), 0U);
+  EXPECT_EQ(events(std::numeric_limits<double>::infinity(), protocols), 0U);
+}
+
+}  // namespace
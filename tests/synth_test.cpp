@@ -0,0 +1,106 @@
+/*
+ * Copyright (C) 2011 Weill Medical College of Cornell University
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License as
+ *  published by the Free Software Foundation; either version 2 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#include <sstream>
+#include <string>
+
+#include <gtest/gtest.h>
+
+#include "protocol_csp.hpp"
+#include "protocol_engine.hpp"
+#include "protocol_model.hpp"
+#include "protocol_synth.hpp"
+
+namespace
+{
+
+std::string synthesize(const clamp_protocol::synth_params& params)
+{
+  std::ostringstream out;
+  clamp_protocol::writeSyntheticCsp(out, params);
+  return out.str();
+}
+
+TEST(Synth, SameSeedSameFile)
+{
+  clamp_protocol::synth_params params;
+  params.seed = 42;
+  EXPECT_EQ(synthesize(params), synthesize(params));
+  clamp_protocol::synth_params other = params;
+  other.seed = 43;
+  EXPECT_NE(synthesize(params), synthesize(other));
+}
+
+TEST(Synth, ReadsBackWithTheRequestedShape)
+{
+  clamp_protocol::synth_params params;
+  params.seed = 3;
+  params.segments = 200;
+  params.min_sweeps = 2;
+  params.max_sweeps = 5;
+  params.min_steps = 3;
+  params.max_steps = 8;
+  params.ramp_fraction = 0.5;
+  params.extreme_fraction = 0.2;
+  clamp_protocol::Protocol protocol;
+  ASSERT_TRUE(clamp_protocol::readCsp(synthesize(params), protocol));
+  ASSERT_EQ(protocol.numSegments(), params.segments);
+
+  size_t ramps = 0;
+  size_t steps = 0;
+  for (size_t seg = 0; seg < protocol.numSegments(); ++seg) {
+    EXPECT_GE(protocol.numSweeps(seg), params.min_sweeps);
+    EXPECT_LE(protocol.numSweeps(seg), params.max_sweeps);
+    EXPECT_GE(protocol.segmentSize(seg), params.min_steps);
+    EXPECT_LE(protocol.segmentSize(seg), params.max_steps);
+    for (size_t i = 0; i < protocol.segmentSize(seg); ++i) {
+      ramps += protocol.getStep(seg, i).stepType == clamp_protocol::RAMP;
+      ++steps;
+    }
+  }
+  EXPECT_GT(ramps, steps / 4);
+  EXPECT_LT(ramps, steps * 3 / 4);
+
+  for (const auto& step : protocol.compile().steps) {
+    EXPECT_GE(step.duration, -1e-9);
+  }
+}
+
+// Extreme steps (huge levels, sub-period and shrinking durations) still
+// compile and play to the end
+TEST(Synth, ExtremeProtocolsPlayToTheEnd)
+{
+  clamp_protocol::synth_params params;
+  params.seed = 11;
+  params.segments = 20;
+  params.extreme_fraction = 0.5;
+  clamp_protocol::Protocol protocol;
+  ASSERT_TRUE(clamp_protocol::readCsp(synthesize(params), protocol));
+  const auto compiled = protocol.compile();
+
+  clamp_protocol::ProtocolEngine engine;
+  engine.load(compiled.view(), 50000);
+  size_t samples = 0;
+  while (!engine.finished() && samples < 100000000) {
+    engine.next();
+    ++samples;
+  }
+  EXPECT_TRUE(engine.finished());
+}
+
+}  // namespace
@@ -0,0 +1,156 @@
+/*
+ * Copyright (C) 2011 Weill Medical College of Cornell University
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License as
+ *  published by the Free Software Foundation; either version 2 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#include <string>
+
+#include <gtest/gtest.h>
+
+#include "protocol_table.hpp"
+
+namespace
+{
+
+constexpr const char* header =
+    "segment,sweeps,mode,type,duration,delta duration,level 1,delta level 1,"
+    "level 2,delta level 2\n";
+
+// Imports `rows` under the header into a protocol that already holds one
+// segment, which must survive a failed import
+clamp_protocol::table_import_result importRows(const std::string& rows,
+                                               clamp_protocol::Protocol& out)
+{
+  out = clamp_protocol::Protocol();
+  out.appendSegment(2).hold(10, -70);
+  return clamp_protocol::importStepTable(header + rows, out);
+}
+
+void expectRejected(const std::string& rows, size_t line)
+{
+  clamp_protocol::Protocol protocol;
+  const auto result = importRows(rows, protocol);
+  EXPECT_FALSE(result.ok) << rows;
+  EXPECT_EQ(result.line, line) << rows;
+  EXPECT_FALSE(result.message.empty());
+  ASSERT_EQ(protocol.numSegments(), 1U);
+  EXPECT_EQ(protocol.numSweeps(0), 2U);
+}
+
+TEST(StepTable, ImportsSegmentsAndSteps)
+{
+  clamp_protocol::Protocol protocol;
+  const auto result = importRows(
+      "# IV\n"
+      "1,9,voltage,step,50,0,-80,0\n"
+      "1,9,voltage,step,100,0,-80,10\n"
+      "\n"
+      "2,1,0,ramp,500,5,-100,0,50,0\n",
+      protocol);
+  ASSERT_TRUE(result.ok) << result.message;
+  ASSERT_EQ(protocol.numSegments(), 2U);
+  EXPECT_EQ(protocol.numSweeps(0), 9U);
+  EXPECT_EQ(protocol.segmentSize(0), 2U);
+  EXPECT_EQ(protocol.numSweeps(1), 1U);
+  const auto& test = protocol.getStep(0, 1);
+  EXPECT_EQ(test.stepType, clamp_protocol::STEP);
+  EXPECT_EQ(test.parameters[clamp_protocol::STEP_DURATION], 100.0);
+  EXPECT_EQ(test.parameters[clamp_protocol::DELTA_HOLDING_LEVEL_1], 10.0);
+  const auto& ramp = protocol.getStep(1, 0);
+  EXPECT_EQ(ramp.stepType, clamp_protocol::RAMP);
+  EXPECT_EQ(ramp.parameters[clamp_protocol::DELTA_STEP_DURATION], 5.0);
+  EXPECT_EQ(ramp.parameters[clamp_protocol::HOLDING_LEVEL_2], 50.0);
+}
+
+TEST(StepTable, LevelTwoColumnsAreOptional)
+{
+  clamp_protocol::Protocol protocol;
+  const auto result = importRows(
+      "1,1,voltage,step,100,0,-80,0,,\n"
+      "1,1,voltage,ramp,100,0,-80,0,20,1\n",
+      protocol);
+  ASSERT_TRUE(result.ok) << result.message;
+  EXPECT_EQ(protocol.getStep(0, 0).parameters[clamp_protocol::HOLDING_LEVEL_2],
+            0.0);
+  const auto& second = protocol.getStep(0, 1);
+  EXPECT_EQ(second.parameters[clamp_protocol::HOLDING_LEVEL_2], 20.0);
+  EXPECT_EQ(second.parameters[clamp_protocol::DELTA_HOLDING_LEVEL_2], 1.0);
+
+  // Tab separated works the same
+  const auto tabbed = clamp_protocol::importStepTable(
+      "1\t3\tcurrent\tstep\t5\t0\t0.5\t0\n", protocol);
+  ASSERT_TRUE(tabbed.ok) << tabbed.message;
+  EXPECT_EQ(protocol.numSweeps(0), 3U);
+  EXPECT_EQ(protocol.getStep(0, 0).ampMode, clamp_protocol::CURRENT);
+}
+
+TEST(StepTable, RampsRequireLevelTwo)
+{
+  // A ramp without its end level would silently ramp to 0
+  expectRejected("1,1,voltage,ramp,100,0,-80,0\n", 2);
+  expectRejected("1,1,voltage,ramp,100,0,-80,0,,\n", 2);
+  expectRejected("1,1,voltage,ramp,100,0,-80,0,20,\n", 2);
+  expectRejected("1,1,voltage,ramp,100,0,-80,0,,1\n", 2);
+  expectRejected("1,1,voltage,step,10,0,-80,0\n1,1,current,1,100,0,0,0\n", 3);
+
+  clamp_protocol::Protocol protocol;
+  const auto result =
+      importRows("1,1,voltage,ramp,100,0,-80,0,-80,0\n", protocol);
+  ASSERT_TRUE(result.ok) << result.message;
+  EXPECT_EQ(protocol.getStep(0, 0).parameters[clamp_protocol::HOLDING_LEVEL_2],
+            -80.0);
+}
+
+TEST(StepTable, RejectsNonFiniteParameters)
+{
+  expectRejected("1,1,voltage,step,nan,0,-80,0\n", 2);
+  expectRejected("1,1,voltage,step,inf,0,-80,0\n", 2);
+  expectRejected("1,1,voltage,step,-inf,0,-80,0\n", 2);
+  expectRejected("1,1,voltage,step,10,0,1e999,0\n", 2);
+  expectRejected("1,1,voltage,step,10,0,-80,0,NaN,0\n", 2);
+  expectRejected("1,1,voltage,step,-5,0,-80,0\n", 2);
+  expectRejected("nan,1,voltage,step,10,0,-80,0\n", 2);
+}
+
+TEST(StepTable, RejectsSweepsThatAreNotACount)
+{
+  expectRejected("1,2.5,voltage,step,10,0,-80,0\n", 2);
+  expectRejected("1,0,voltage,step,10,0,-80,0\n", 2);
+  expectRejected("1,-3,voltage,step,10,0,-80,0\n", 2);
+  expectRejected("1,1e30,voltage,step,10,0,-80,0\n", 2);
+  expectRejected("1,4294967296,voltage,step,10,0,-80,0\n", 2);
+  expectRejected("1,nan,voltage,step,10,0,-80,0\n", 2);
+  expectRejected("1,inf,voltage,step,10,0,-80,0\n", 2);
+
+  clamp_protocol::Protocol protocol;
+  ASSERT_TRUE(importRows("1,4294967295,voltage,step,10,0,-80,0\n", protocol).ok);
+  EXPECT_EQ(protocol.numSweeps(0), 4294967295U);
+}
+
+TEST(StepTable, RejectsMalformedRows)
+{
+  expectRejected("1,1,voltage,step,10,0,-80\n", 2);  // Missing column
+  expectRejected("1,1,voltage,step,10,0,-80,0,0,0,0\n", 2);
+  expectRejected("1,1,voltage,step,10,0,-80,0\n1,1,volts,step,10,0,-80,0\n",
+                 3);
+  expectRejected("2,1,voltage,step,10,0,-80,0\n1,1,voltage,step,10,0,-80,0\n",
+                 3);
+  expectRejected("1,1,voltage,step,10,0,-80,0\n1,2,voltage,step,10,0,-80,0\n",
+                 3);
+  expectRejected("# nothing\n", 2);
+}
+
+}  // namespace
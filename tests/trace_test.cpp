@@ -0,0 +1,119 @@
+/*
+ * Copyright (C) 2011 Weill Medical College of Cornell University
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License as
+ *  published by the Free Software Foundation; either version 2 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#include <atomic>
+#include <sstream>
+#include <thread>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "protocol_generators.hpp"
+#include "protocol_runner.hpp"
+#include "protocol_trace.hpp"
+
+namespace
+{
+
+TEST(Trace, RingKeepsTheNewestEventsInOrder)
+{
+  clamp_protocol::TraceRing ring("test", 6);  // Rounded up to 8
+  for (uint64_t i = 0; i < 20; ++i) {
+    ring.instant(clamp_protocol::TRACE_STEP, i);
+  }
+  std::vector<clamp_protocol::trace_event_t> events;
+  ring.snapshot(events);
+  ASSERT_GE(events.size(), 7U);
+  ASSERT_LE(events.size(), 8U);
+  for (size_t i = 0; i < events.size(); ++i) {
+    EXPECT_EQ(events[i].arg, 20 - events.size() + i);
+    EXPECT_EQ(events[i].phase, clamp_protocol::TRACE_INSTANT);
+  }
+}
+
+TEST(Trace, SnapshotsWhileWritingAreConsistent)
+{
+  clamp_protocol::TraceRing ring("test", 64);
+  std::atomic<bool> done {false};
+  std::thread writer(
+      [&]
+      {
+        for (uint64_t i = 0; i < 2000000; ++i) {
+          ring.instant(clamp_protocol::TRACE_TICK, i);
+        }
+        done = true;
+      });
+  std::vector<clamp_protocol::trace_event_t> events;
+  while (!done) {
+    events.clear();
+    ring.snapshot(events);
+    for (size_t i = 1; i < events.size(); ++i) {
+      ASSERT_EQ(events[i].arg, events[i - 1].arg + 1);
+      ASSERT_GE(events[i].tsc, events[i - 1].tsc);
+    }
+  }
+  writer.join();
+}
+
+TEST(Trace, WritesChromeTraceJson)
+{
+  clamp_protocol::TraceRecorder recorder;
+  auto* rt = recorder.addRing("RT thread", 16);
+  auto* gui = recorder.addRing("GUI thread", 16);
+  rt->begin(clamp_protocol::TRACE_TICK);
+  rt->instant(clamp_protocol::TRACE_FIFO_WRITE, 48);
+  rt->end(clamp_protocol::TRACE_TICK);
+  gui->begin(clamp_protocol::TRACE_DRAIN);
+  gui->end(clamp_protocol::TRACE_DRAIN, 1);
+
+  std::ostringstream out;
+  recorder.writeChromeTrace(out, 1000000000);
+  const std::string json = out.str();
+  EXPECT_EQ(json.rfind("{\"displayTimeUnit\":\"ns\",\"traceEvents\":[", 0), 0U);
+  EXPECT_NE(json.find("\"args\":{\"name\":\"RT thread\"}"), std::string::npos);
+  EXPECT_NE(json.find("\"args\":{\"name\":\"GUI thread\"}"), std::string::npos);
+  EXPECT_NE(json.find("{\"name\":\"tick\",\"ph\":\"B\""), std::string::npos);
+  EXPECT_NE(json.find("{\"name\":\"tick\",\"ph\":\"E\""), std::string::npos);
+  EXPECT_NE(json.find("{\"name\":\"fifo write\",\"ph\":\"i\""),
+            std::string::npos);
+  EXPECT_NE(json.find("\"s\":\"t\",\"args\":{\"arg\":48}"), std::string::npos);
+  EXPECT_NE(json.find("{\"name\":\"drain\",\"ph\":\"E\""), std::string::npos);
+  EXPECT_EQ(json.substr(json.size() - 4), "\n]}\n");
+}
+
+TEST(Trace, RunnerMarksEveryStepBoundary)
+{
+  const auto compiled = clamp_protocol::generators::iv({}).compile();
+  clamp_protocol::TraceRing ring("RT thread", 1U << 12U);
+  clamp_protocol::ProtocolRunner runner;
+  runner.setProtocol(compiled.view(), 0, 100000);
+  runner.setTrace(&ring);
+  double output = 0.0;
+  clamp_protocol::data_token_t token {};
+  while (runner.tick(0, 0.0, output, token)) {
+  }
+  std::vector<clamp_protocol::trace_event_t> events;
+  ring.snapshot(events);
+  ASSERT_EQ(events.size(), compiled.steps.size());
+  for (size_t i = 0; i < events.size(); ++i) {
+    EXPECT_EQ(events[i].name, clamp_protocol::TRACE_STEP);
+    EXPECT_EQ(events[i].arg, i);
+  }
+}
+
+}  // namespace
@@ -0,0 +1,139 @@
+/*
+ * Copyright (C) 2011 Weill Medical College of Cornell University
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License as
+ *  published by the Free Software Foundation; either version 2 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "protocol_batch.hpp"
+
+// Measures every sweep of a directory of recordings and writes one summary
+// table, e.g.
+//   clamp_protocol_analyze --measure-step 1 --skip 0.5 recordings/ iv.cpc
+
+namespace
+{
+
+void usage()
+{
+  std::fprintf(
+      stderr,
+      "usage: clamp_protocol_analyze [options] directory summary.cpc\n"
+      "Reads session logs (*.cps) and raw recordings (*.f64 with a .csp of\n"
+      "the same name) under the directory.\n"
+      "  --threads N        worker threads (one per hardware thread)\n"
+      "  --period US        RT period of the raw recordings\n"
+      "  --baseline-step N  step of the sweep averaged for the baseline (0)\n"
+      "  --measure-step N   step measured (1)\n"
+      "  --skip MS          left out at the start of the measured step (0)\n"
+      "  --steady MS        end of the step averaged for steady state (5)\n"
+      "  --leak-below MV    passive sweeps for leak subtraction (-60, nan "
+      "for none)\n"
+      "  --no-average       measure every trial instead of their average\n"
+      "  --no-fit           skip the exponential fits\n");
+}
+
+}  // namespace
+
+int main(int argc, char** argv)
+{
+  clamp_protocol::batch_params params;
+  size_t threads = 0;
+  std::string directory;
+  std::string output;
+  for (int i = 1; i < argc; ++i) {
+    const char* arg = argv[i];
+    if (std::strncmp(arg, "--", 2) != 0) {
+      if (directory.empty()) {
+        directory = arg;
+      } else if (output.empty()) {
+        output = arg;
+      } else {
+        usage();
+        return EXIT_FAILURE;
+      }
+      continue;
+    }
+    if (std::strcmp(arg, "--no-average") == 0) {
+      params.average = false;
+      continue;
+    }
+    if (std::strcmp(arg, "--no-fit") == 0) {
+      params.analysis.fit = false;
+      continue;
+    }
+    if (std::strcmp(arg, "--help") == 0 || i + 1 == argc) {
+      usage();
+      return std::strcmp(arg, "--help") == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+    const char* value = argv[++i];
+    const auto count = static_cast<size_t>(std::strtoull(value, nullptr, 10));
+    const double number = std::strtod(value, nullptr);
+    if (std::strcmp(arg, "--threads") == 0) {
+      threads = count;
+    } else if (std::strcmp(arg, "--period") == 0) {
+      params.raw_period_ns = std::llround(number * 1e3);
+    } else if (std::strcmp(arg, "--baseline-step") == 0) {
+      params.analysis.baseline_step = count;
+    } else if (std::strcmp(arg, "--measure-step") == 0) {
+      params.analysis.measure_step = count;
+    } else if (std::strcmp(arg, "--skip") == 0) {
+      params.analysis.skip_ms = number;
+    } else if (std::strcmp(arg, "--steady") == 0) {
+      params.analysis.steady_ms = number;
+    } else if (std::strcmp(arg, "--leak-below") == 0) {
+      params.analysis.leak_below = number;
+    } else {
+      usage();
+      return EXIT_FAILURE;
+    }
+  }
+  if (directory.empty() || output.empty()) {
+    usage();
+    return EXIT_FAILURE;
+  }
+
+  const auto start = std::chrono::steady_clock::now();
+  std::vector<std::string> scan_errors;
+  const auto paths = clamp_protocol::findRecordings(directory, &scan_errors);
+  clamp_protocol::WorkStealingPool pool(threads);
+  auto report = clamp_protocol::analyzeRecordings(paths, params, pool);
+  report.errors.insert(
+      report.errors.begin(), scan_errors.begin(), scan_errors.end());
+  for (const auto& error : report.errors) {
+    std::fprintf(stderr, "%s\n", error.c_str());
+  }
+  if (!report.table.save(output)) {
+    std::fprintf(stderr, "cannot write %s\n", output.c_str());
+    return EXIT_FAILURE;
+  }
+  const double wall_s = std::chrono::duration<double>(
+                            std::chrono::steady_clock::now() - start)
+                            .count();
+  std::printf("files      %zu of %zu\n", report.files, paths.size());
+  std::printf("sweeps     %zu (%zu incomplete left out)\n",
+              report.sweeps,
+              report.incomplete);
+  std::printf("threads    %zu\n", pool.size());
+  std::printf("time       %.3f s\n", wall_s);
+  return report.errors.empty() ? EXIT_SUCCESS : EXIT_FAILURE;
+}
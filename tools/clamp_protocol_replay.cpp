@@ -0,0 +1,133 @@
+/*
+ * Copyright (C) 2011 Weill Medical College of Cornell University
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License as
+ *  published by the Free Software Foundation; either version 2 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+#include "protocol_replay.hpp"
+#include "protocol_session.hpp"
+
+// Replays a session log (*.cps) through the protocol runner and reports
+// what it played, e.g.
+//   clamp_protocol_replay --speed 10 --csv run.csv run.cps
+
+namespace
+{
+
+void usage()
+{
+  std::fprintf(stderr,
+               "usage: clamp_protocol_replay [options] session.cps\n"
+               "  --speed X   pace ticks at X times real time (default: as "
+               "fast as possible)\n"
+               "  --csv FILE  write time, RT sample, input, output, trial, segment, "
+               "sweep and step per tick\n");
+}
+
+}  // namespace
+
+int main(int argc, char** argv)
+{
+  double speed = 0.0;
+  std::string csv_path;
+  std::string path;
+  for (int i = 1; i < argc; ++i) {
+    if (std::strcmp(argv[i], "--speed") == 0 && i + 1 < argc) {
+      speed = std::strtod(argv[++i], nullptr);
+    } else if (std::strcmp(argv[i], "--csv") == 0 && i + 1 < argc) {
+      csv_path = argv[++i];
+    } else if (argv[i][0] != '-' && path.empty()) {
+      path = argv[i];
+    } else {
+      usage();
+      return EXIT_FAILURE;
+    }
+  }
+  if (path.empty()) {
+    usage();
+    return EXIT_FAILURE;
+  }
+
+  clamp_protocol::SessionLog log;
+  if (!log.load(path)) {
+    std::fprintf(stderr, "%s is not a session log\n", path.c_str());
+    return EXIT_FAILURE;
+  }
+  FILE* csv = nullptr;
+  if (!csv_path.empty()) {
+    csv = std::fopen(csv_path.c_str(), "w");
+    if (csv == nullptr) {
+      std::fprintf(stderr, "cannot open %s\n", csv_path.c_str());
+      return EXIT_FAILURE;
+    }
+    std::fprintf(csv, "time_ns,sample,input,output,trial,segment,sweep,step\n");
+  }
+
+  clamp_protocol::SessionPlayer player(log);
+  player.setSpeed(speed);
+  clamp_protocol::replay_tick_t tick;
+  int64_t ticks = 0;
+  int64_t samples = 0;
+  int64_t first_ns = 0;
+  int64_t last_ns = 0;
+  const auto start = std::chrono::steady_clock::now();
+  while (player.next(tick)) {
+    if (ticks == 0) {
+      first_ns = tick.time_ns;
+    }
+    last_ns = tick.time_ns;
+    ++ticks;
+    samples += tick.sample ? 1 : 0;
+    if (csv != nullptr) {
+      std::fprintf(csv,
+                   "%lld,%lld,%.17g,%.17g,%d,%d,%d,%d\n",
+                   static_cast<long long>(tick.time_ns),
+                   static_cast<long long>(tick.sample ? tick.token.sample : -1),
+                   tick.input,
+                   tick.output,
+                   tick.sample ? tick.token.trial : -1,
+                   tick.sample ? tick.token.segment : -1,
+                   tick.sample ? tick.token.sweep : -1,
+                   tick.sample ? tick.token.step : -1);
+    }
+  }
+  const double wall_s = std::chrono::duration<double>(
+                            std::chrono::steady_clock::now() - start)
+                            .count();
+  if (csv != nullptr) {
+    std::fclose(csv);
+  }
+
+  const double session_s = static_cast<double>(last_ns - first_ns) * 1e-9;
+  std::printf("ticks      %lld\n", static_cast<long long>(ticks));
+  std::printf("samples    %lld\n", static_cast<long long>(samples));
+  std::printf("gaps       %llu\n",
+              static_cast<unsigned long long>(player.gaps()));
+  std::printf("session    %.3f s\n", session_s);
+  std::printf("replay     %.3f s (%.0f ticks/s, %.1fx real time)\n",
+              wall_s,
+              wall_s > 0.0 ? static_cast<double>(ticks) / wall_s : 0.0,
+              wall_s > 0.0 ? session_s / wall_s : 0.0);
+  if (log.corrupt()) {
+    std::printf("log is truncated or corrupt after the last tick\n");
+  }
+  return EXIT_SUCCESS;
+}
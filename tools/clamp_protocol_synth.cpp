@@ -0,0 +1,118 @@
+/*
+ * Copyright (C) 2011 Weill Medical College of Cornell University
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License as
+ *  published by the Free Software Foundation; either version 2 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <string>
+
+#include "protocol_synth.hpp"
+
+// Writes a synthetic .csp protocol for scaling tests, e.g.
+//   clamp_protocol_synth --seed 7 --segments 1000 --max-steps 50 big.csp
+
+namespace
+{
+
+void usage()
+{
+  std::cerr
+      << "usage: clamp_protocol_synth [options] [output.csp]\n"
+         "Writes to standard output when no file is given.\n"
+         "  --seed N             random seed (1)\n"
+         "  --segments N         number of segments (10)\n"
+         "  --min-sweeps N       sweeps per segment, lower bound (1)\n"
+         "  --max-sweeps N       sweeps per segment, upper bound (10)\n"
+         "  --min-steps N        steps per segment, lower bound (1)\n"
+         "  --max-steps N        steps per segment, upper bound (10)\n"
+         "  --ramp-fraction F    share of ramp steps (0.25)\n"
+         "  --min-duration MS    shortest step (1)\n"
+         "  --max-duration MS    longest step (100)\n"
+         "  --max-level MV       largest level magnitude (120)\n"
+         "  --max-delta MV       largest per sweep level delta (10)\n"
+         "  --extreme-fraction F share of steps with extreme values (0)\n";
+}
+
+}  // namespace
+
+int main(int argc, char** argv)
+{
+  clamp_protocol::synth_params params;
+  std::string path;
+  for (int i = 1; i < argc; ++i) {
+    const char* arg = argv[i];
+    if (std::strncmp(arg, "--", 2) != 0) {
+      if (!path.empty()) {
+        usage();
+        return EXIT_FAILURE;
+      }
+      path = arg;
+      continue;
+    }
+    if (std::strcmp(arg, "--help") == 0 || i + 1 == argc) {
+      usage();
+      return std::strcmp(arg, "--help") == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+    const char* value = argv[++i];
+    const auto count = static_cast<size_t>(std::strtoull(value, nullptr, 10));
+    const double number = std::strtod(value, nullptr);
+    if (std::strcmp(arg, "--seed") == 0) {
+      params.seed = std::strtoull(value, nullptr, 10);
+    } else if (std::strcmp(arg, "--segments") == 0) {
+      params.segments = count;
+    } else if (std::strcmp(arg, "--min-sweeps") == 0) {
+      params.min_sweeps = count;
+    } else if (std::strcmp(arg, "--max-sweeps") == 0) {
+      params.max_sweeps = count;
+    } else if (std::strcmp(arg, "--min-steps") == 0) {
+      params.min_steps = count;
+    } else if (std::strcmp(arg, "--max-steps") == 0) {
+      params.max_steps = count;
+    } else if (std::strcmp(arg, "--ramp-fraction") == 0) {
+      params.ramp_fraction = number;
+    } else if (std::strcmp(arg, "--min-duration") == 0) {
+      params.min_duration = number;
+    } else if (std::strcmp(arg, "--max-duration") == 0) {
+      params.max_duration = number;
+    } else if (std::strcmp(arg, "--max-level") == 0) {
+      params.max_level = number;
+    } else if (std::strcmp(arg, "--max-delta") == 0) {
+      params.max_delta = number;
+    } else if (std::strcmp(arg, "--extreme-fraction") == 0) {
+      params.extreme_fraction = number;
+    } else {
+      std::cerr << "unknown option " << arg << "\n";
+      usage();
+      return EXIT_FAILURE;
+    }
+  }
+
+  if (path.empty()) {
+    clamp_protocol::writeSyntheticCsp(std::cout, params);
+    return std::cout ? EXIT_SUCCESS : EXIT_FAILURE;
+  }
+  std::ofstream file(path, std::ios::binary);
+  if (!file) {
+    std::cerr << "cannot open " << path << "\n";
+    return EXIT_FAILURE;
+  }
+  clamp_protocol::writeSyntheticCsp(file, params);
+  file.close();
+  return file ? EXIT_SUCCESS : EXIT_FAILURE;
+}
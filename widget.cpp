@@ -22,290 +22,28 @@
 #include <QInputDialog>
 #include <QMdiArea>
 #include <QMdiSubWindow>
+#include <QMenu>
 #include <QMessageBox>
 #include <QScrollBar>
+#include <QSignalBlocker>
 #include <QSignalMapper>
 #include <QTimer>
 #include <cmath>
+#include <cstdio>
+#include <fstream>
 
+#include "protocol_archive.hpp"
+#include "protocol_hash.hpp"
+#include "protocol_table.hpp"
 #include "widget.hpp"
 
 #include <qwt_legend.h>
 #include <rtxi/debug.hpp>
 #include <rtxi/rt.hpp>
+#include <sched.h>
 
 // namespace length is pretty long so this is to keep things short and sweet.
 
-void clamp_protocol::Protocol::addStep(size_t seg_id)
-{
-  if (seg_id >= segments.size()) {  // If segment doesn't exist or not at end
-    return;
-  }
-  clamp_protocol::ProtocolSegment segment = getSegment(seg_id);
-  segment.steps.push_back({});
-}
-
-void clamp_protocol::Protocol::insertStep(size_t seg_id, size_t step_id)
-{
-  if (seg_id > segments.size() || step_id > segments.at(seg_id).steps.size()) {
-    return;
-  }
-  auto iter = segments.at(seg_id).steps.begin() + static_cast<int>(step_id);
-  segments.at(seg_id).steps.insert(iter, {});
-}
-
-void clamp_protocol::Protocol::deleteStep(size_t seg_id, size_t step_id)
-{
-  if (seg_id > segments.size() || step_id > segments.at(seg_id).steps.size()) {
-    return;
-  }
-
-  clamp_protocol::ProtocolSegment segment = getSegment(seg_id);
-  auto it = segment.steps.begin() + static_cast<int>(step_id);
-  segment.steps.erase(it);
-}
-
-void clamp_protocol::Protocol::modifyStep(
-    size_t seg_id, size_t step_id, const clamp_protocol::ProtocolStep& step)
-{
-  segments.at(seg_id).steps.at(step_id) = step;
-}
-
-std::array<std::vector<double>, 2> clamp_protocol::Protocol::dryrun(
-    double period)
-{
-  std::array<std::vector<double>, 2> result;
-  int segmentIdx = 0;
-  int sweepsIdx = 0;
-  int stepIdx = 0;
-  double time_elapsed_ms = 0.0;
-  double current_time_ms = 0.0;
-  double voltage_mv = 0.0;
-  while (segmentIdx < segments.size()) {
-    while (sweepsIdx < segments.at(segmentIdx).numSweeps) {
-      while (stepIdx < segments.at(segmentIdx).steps.size()) {
-        ProtocolStep& step = getStep(segmentIdx, stepIdx);
-        switch (step.stepType) {
-          case clamp_protocol::STEP: {
-            voltage_mv = step.parameters[clamp_protocol::HOLDING_LEVEL_1]
-                + step.parameters[clamp_protocol::DELTA_HOLDING_LEVEL_1]
-                    * sweepsIdx;
-            break;
-          }
-          case clamp_protocol::RAMP: {
-            const double y2 = step.parameters[clamp_protocol::HOLDING_LEVEL_2]
-                + step.parameters[clamp_protocol::DELTA_HOLDING_LEVEL_2]
-                    * sweepsIdx;
-            const double y1 = step.parameters[clamp_protocol::HOLDING_LEVEL_1]
-                + step.parameters[clamp_protocol::DELTA_HOLDING_LEVEL_1]
-                    * sweepsIdx;
-            const double max_time =
-                step.parameters[clamp_protocol::STEP_DURATION]
-                + step.parameters[clamp_protocol::DELTA_STEP_DURATION]
-                    * sweepsIdx;
-            const double slope = (y2 - y1) / max_time;
-            const double time_ms = std::min(max_time, time_elapsed_ms);
-            voltage_mv = slope * time_ms;
-            break;
-          }
-          default:
-            ERROR_MSG(
-                "ERROR - In function Protocol::dryrun() switch( stepType ) "
-                "default case called");
-            return {};
-        }
-        // update parameters
-        result[0].push_back(current_time_ms);
-        result[1].push_back(voltage_mv);
-        current_time_ms += period;
-        stepIdx += static_cast<int>(
-            time_elapsed_ms
-            > (step.parameters[clamp_protocol::STEP_DURATION]
-               + step.parameters[clamp_protocol::DELTA_STEP_DURATION]
-                   * segmentIdx));
-      }  // step loop
-      ++sweepsIdx;
-    }  // sweep loop
-    ++segmentIdx;
-  }  // segment loop
-
-  return result;
-}
-
-void clamp_protocol::Protocol::addSegment()
-{
-  segments.emplace_back();
-}
-
-void clamp_protocol::Protocol::deleteSegment(size_t seg_id)
-{
-  if (seg_id >= segments.size()) {
-    return;
-  }
-
-  auto it = segments.begin();
-  segments.erase(it + static_cast<int>(seg_id));
-}
-
-void clamp_protocol::Protocol::modifySegment(
-    size_t seg_id, const clamp_protocol::ProtocolSegment& segment)
-{
-  segments.at(seg_id) = segment;
-}
-
-size_t clamp_protocol::Protocol::numSweeps(size_t seg_id)
-{
-  return segments.at(seg_id).numSweeps;
-}
-
-void clamp_protocol::Protocol::setSweeps(size_t seg_id, uint32_t sweeps)
-{
-  segments.at(seg_id).numSweeps = sweeps;
-}
-
-clamp_protocol::ProtocolSegment& clamp_protocol::Protocol::getSegment(
-    size_t seg_id)
-{
-  return segments.at(seg_id);
-}
-
-clamp_protocol::ProtocolStep& clamp_protocol::Protocol::getStep(size_t segment,
-                                                                size_t step)
-{
-  return segments.at(segment).steps.at(step);
-}
-
-size_t clamp_protocol::Protocol::numSegments()
-{
-  return segments.size();
-}
-
-size_t clamp_protocol::Protocol::segmentSize(size_t seg_id)
-{
-  return segments.at(seg_id).steps.size();
-}
-
-QDomElement clamp_protocol::Protocol::stepToNode(QDomDocument& doc,
-                                                 size_t seg_id,
-                                                 size_t stepNum)
-{
-  // Converts protocol step to XML node
-  QDomElement stepElement = doc.createElement("step");  // Step element
-  clamp_protocol::ProtocolStep step = segments.at(seg_id).steps.at(stepNum);
-
-  // Set attributes of step to element
-  stepElement.setAttribute("stepNumber", QString::number(stepNum));
-  stepElement.setAttribute("ampMode", QString::number(step.ampMode));
-  stepElement.setAttribute("stepType", QString::number(step.stepType));
-  stepElement.setAttribute(
-      "stepDuration",
-      QString::number(step.parameters.at(clamp_protocol::STEP_DURATION)));
-  stepElement.setAttribute(
-      "deltaStepDuration",
-      QString::number(step.parameters.at(clamp_protocol::DELTA_STEP_DURATION)));
-  stepElement.setAttribute(
-      "holdingLevel1",
-      QString::number(step.parameters.at(clamp_protocol::HOLDING_LEVEL_1)));
-  stepElement.setAttribute("deltaHoldingLevel1",
-                           QString::number(step.parameters.at(
-                               clamp_protocol::DELTA_HOLDING_LEVEL_1)));
-  stepElement.setAttribute(
-      "holdingLevel2",
-      QString::number(step.parameters.at(clamp_protocol::HOLDING_LEVEL_2)));
-  stepElement.setAttribute("deltaHoldingLevel2",
-                           QString::number(step.parameters.at(
-                               clamp_protocol::DELTA_HOLDING_LEVEL_2)));
-
-  return stepElement;
-}
-
-// Converts protocol segment to XML node
-QDomElement clamp_protocol::Protocol::segmentToNode(QDomDocument& doc,
-                                                    size_t seg_id)
-{
-  QDomElement segmentElement = doc.createElement("segment");  // Segment element
-  const clamp_protocol::ProtocolSegment& segment = segments.at(seg_id);
-  segmentElement.setAttribute("numSweeps", QString::number(segment.numSweeps));
-
-  // Add each step as a child to segment element
-  for (size_t i = 0; i < segment.steps.size(); ++i) {
-    segmentElement.appendChild(stepToNode(doc, seg_id, i));
-  }
-
-  return segmentElement;
-}
-
-void clamp_protocol::Protocol::clear()
-{
-  segments.clear();
-}
-
-// Convert protocol to QDomDocument
-void clamp_protocol::Protocol::toDoc()
-{
-  QDomDocument doc("ClampProtocolML");
-
-  QDomElement root = doc.createElement("Clamp-Suite-Protocol-v2.0");
-  doc.appendChild(root);
-
-  // Add segment elements to protocolDoc
-  for (size_t i = 0; i < segments.size(); ++i) {
-    root.appendChild(segmentToNode(doc, i));
-  }
-
-  protocolDoc = doc;  // Shallow copy
-}
-
-// Load protocol from QDomDocument
-void clamp_protocol::Protocol::fromDoc(const QDomDocument& doc)
-{
-  QDomElement root = doc.documentElement();  // Get root element from document
-
-  // Retrieve information from document and set to protocolContainer
-  QDomNode segmentNode = root.firstChild();  // Retrieve first segment
-  clear();  // Clear vector containing protocol
-  size_t segmentCount = 0;
-
-  while (!segmentNode.isNull()) {  // Segment iteration
-    QDomElement segmentElement = segmentNode.toElement();
-    size_t stepCount = 0;
-    segments.emplace_back();  // Add segment to protocol container
-    segments.at(segmentCount).numSweeps =
-        segmentElement.attribute("numSweeps").toInt();
-    QDomNode stepNode = segmentNode.firstChild();
-
-    while (!stepNode.isNull()) {  // Step iteration
-      clamp_protocol::ProtocolStep step =
-          getStep(segmentCount, stepCount);  // Retrieve step pointer
-      QDomElement stepElement = stepNode.toElement();
-
-      // Retrieve attributes
-      step.ampMode = static_cast<clamp_protocol::ampMode_t>(
-          stepElement.attribute("ampMode").toInt());
-      step.stepType = static_cast<clamp_protocol::stepType_t>(
-          stepElement.attribute("stepType").toInt());
-      step.parameters.at(clamp_protocol::STEP_DURATION) =
-          stepElement.attribute("stepDuration").toDouble();
-      step.parameters.at(clamp_protocol::DELTA_STEP_DURATION) =
-          stepElement.attribute("deltaStepDuration").toDouble();
-      step.parameters.at(clamp_protocol::HOLDING_LEVEL_1) =
-          stepElement.attribute("holdingLevel1").toDouble();
-      step.parameters.at(clamp_protocol::DELTA_HOLDING_LEVEL_1) =
-          stepElement.attribute("deltaHoldingLevel1").toDouble();
-      step.parameters.at(clamp_protocol::HOLDING_LEVEL_2) =
-          stepElement.attribute("holdingLevel2").toDouble();
-      step.parameters.at(clamp_protocol::DELTA_HOLDING_LEVEL_2) =
-          stepElement.attribute("deltaHoldingLevel2").toDouble();
-
-      stepNode = stepNode.nextSibling();  // Move to next step
-      stepCount++;
-    }  // End step iteration
-
-    segmentNode = segmentNode.nextSibling();  // Move to next segment
-    segmentCount++;
-  }  // End segment iteration
-}
-
 clamp_protocol::ClampProtocolEditor::ClampProtocolEditor(QWidget* parent)
     : QWidget(parent)
 {
@@ -342,6 +80,7 @@ void clamp_protocol::ClampProtocolEditor::addSegment()
   segmentListWidget->setCurrentItem(element);  // Focus on newly created segment
 
   updateSegment(element);
+  emit segmentChanged(static_cast<int>(protocol.numSegments()) - 1);
 }
 
 void clamp_protocol::ClampProtocolEditor::deleteSegment()
@@ -370,9 +109,10 @@ void clamp_protocol::ClampProtocolEditor::deleteSegment()
   if (protocol.numSegments() == 1)
   {  // If only 1 segment exists, clear protocol
     protocol.clear();
+    emit protocolReset();
   } else {
-    protocol.deleteSegment(currentSegmentNumber
-                           - 1);  // - 1 since parameter is an index
+    protocol.deleteSegment(currentSegmentNumber);
+    emit segmentRemoved(currentSegmentNumber);
   }
 
   segmentListWidget->clear();  // Clear list view
@@ -417,7 +157,7 @@ void clamp_protocol::ClampProtocolEditor::deleteSegment()
 
 void clamp_protocol::ClampProtocolEditor::addStep()
 {  // Adds step to a protocol segment: updates protocol container
-  if (segmentListWidget->currentRow() != 0)
+  if (segmentListWidget->currentRow() < 0)
   {  // If no segment exists, return and output error box
     QMessageBox::warning(
         this, "Error", "No segment has been created or selected.");
@@ -427,6 +167,7 @@ void clamp_protocol::ClampProtocolEditor::addStep()
   protocol.addStep(segmentListWidget->currentRow());  // Add step to segment
 
   updateTable();  // Rebuild table
+  emit segmentChanged(segmentListWidget->currentRow());
 
   // Set scroll bar all the way to the right when step is added
   QScrollBar* hbar = protocolTable->horizontalScrollBar();
@@ -435,7 +176,7 @@ void clamp_protocol::ClampProtocolEditor::addStep()
 
 void clamp_protocol::ClampProtocolEditor::insertStep()
 {  // Insert step to a protocol segment: updates protocol container
-  if (segmentListWidget->currentRow() != 0)
+  if (segmentListWidget->currentRow() < 0)
   {  // If no segment exists, return and output error box
     QMessageBox::warning(
         this, "Error", "No segment has been created or selected.");
@@ -449,12 +190,13 @@ void clamp_protocol::ClampProtocolEditor::insertStep()
     protocol.addStep(segmentListWidget->currentRow());  // Add step to segment
   }
   updateTable();  // Rebuild table
+  emit segmentChanged(segmentListWidget->currentRow());
 }
 
 void clamp_protocol::ClampProtocolEditor::deleteStep()
 {  // Delete step from a protocol segment: updates table, listview, and protocol
    // container
-  if (segmentListWidget->currentRow() == 0)
+  if (segmentListWidget->currentRow() < 0)
   {  // If no segment exists, return and output error box
     QMessageBox::warning(
         this, "Error", "No segment has been created or selected.");
@@ -485,6 +227,7 @@ void clamp_protocol::ClampProtocolEditor::deleteStep()
   }
   protocol.deleteStep(segmentListWidget->currentRow(), stepNum);
   updateTable();
+  emit segmentChanged(segmentListWidget->currentRow());
 }
 
 void clamp_protocol::ClampProtocolEditor::createStep(int stepNum)
@@ -546,7 +289,7 @@ void clamp_protocol::ClampProtocolEditor::createStep(int stepNum)
       clamp_protocol::HOLDING_LEVEL_1));  // Retrieve attribute value
   item->setText(text);
   item->setFlags(item->flags() ^ Qt::ItemIsEditable);
-  protocolTable->setItem(6, stepNum, item);
+  protocolTable->setItem(4, stepNum, item);
 
   item = new QTableWidgetItem;
   item->setTextAlignment(Qt::AlignCenter);
@@ -554,7 +297,7 @@ void clamp_protocol::ClampProtocolEditor::createStep(int stepNum)
       clamp_protocol::DELTA_HOLDING_LEVEL_1));  // Retrieve attribute value
   item->setText(text);
   item->setFlags(item->flags() ^ Qt::ItemIsEditable);
-  protocolTable->setItem(7, stepNum, item);
+  protocolTable->setItem(5, stepNum, item);
 
   item = new QTableWidgetItem;
   item->setTextAlignment(Qt::AlignCenter);
@@ -562,7 +305,7 @@ void clamp_protocol::ClampProtocolEditor::createStep(int stepNum)
       clamp_protocol::HOLDING_LEVEL_2));  // Retrieve attribute value
   item->setText(text);
   item->setFlags(item->flags() ^ Qt::ItemIsEditable);
-  protocolTable->setItem(8, stepNum, item);
+  protocolTable->setItem(6, stepNum, item);
 
   item = new QTableWidgetItem;
   item->setTextAlignment(Qt::AlignCenter);
@@ -570,7 +313,7 @@ void clamp_protocol::ClampProtocolEditor::createStep(int stepNum)
       clamp_protocol::DELTA_HOLDING_LEVEL_2));  // Retrieve attribute value
   item->setText(text);
   item->setFlags(item->flags() ^ Qt::ItemIsEditable);
-  protocolTable->setItem(9, stepNum, item);
+  protocolTable->setItem(7, stepNum, item);
 
   updateStepAttribute(1, stepNum);  // Update column based on step type
 }
@@ -604,8 +347,13 @@ void clamp_protocol::ClampProtocolEditor::updateSegment(
 void clamp_protocol::ClampProtocolEditor::updateSegmentSweeps(int sweepNum)
 {  // Update container that holds number of segment sweeps when spinbox value is
    // changed
-  protocol.setSweeps(segmentListWidget->currentRow(),
+  const int seg_id = segmentListWidget->currentRow();
+  if (seg_id < 0) {
+    return;
+  }
+  protocol.setSweeps(seg_id,
                      sweepNum);  // Set segment sweep value to spin box value
+  emit segmentChanged(seg_id);
 }
 
 void clamp_protocol::ClampProtocolEditor::updateTableLabel()
@@ -629,18 +377,34 @@ void clamp_protocol::ClampProtocolEditor::updateTable()
   protocolTable->setColumnCount(static_cast<int>(segment.steps.size()));
 
   // Load steps from current clicked segment into protocol
+  tableRebuilding = true;
   for (int i = 0; i < segment.steps.size(); i++) {
     createStep(i);  // Update step in protocol table
   }
+  tableRebuilding = false;
+}
+
+void clamp_protocol::ClampProtocolEditor::notifySegmentChanged(int seg_id)
+{
+  // Table rebuilds write every cell back into the protocol; callers emit once
+  // after the rebuild instead of once per cell.
+  if (!tableRebuilding) {
+    emit segmentChanged(seg_id);
+  }
 }
 
 void clamp_protocol::ClampProtocolEditor::updateStepAttribute(int row, int col)
 {  // Updates protocol container when a table cell is changed
-  clamp_protocol::ProtocolStep& step =
-      protocol.getStep(segmentListWidget->currentRow() - 1, col);
+  const int seg_id = segmentListWidget->currentRow();
+  clamp_protocol::ProtocolStep& step = protocol.getStep(seg_id, col);
   QComboBox* comboItem = nullptr;
-  QString text;
-  QVariant val = protocolTable->item(row, col)->data(Qt::UserRole);
+  QTableWidgetItem* item = protocolTable->item(row, col);
+  if (row >= param_2_row_offset
+      && (item == nullptr || !(item->flags() & Qt::ItemIsEditable)))
+  {
+    return;  // Cell not created yet, or "---" for a parameter the type ignores
+  }
+  const double value = item != nullptr ? item->text().toDouble() : 0.0;
 
   // Check which row and update corresponding attribute in step container
   switch (row) {
@@ -660,38 +424,39 @@ void clamp_protocol::ClampProtocolEditor::updateStepAttribute(int row, int col)
       break;
 
     case 2:
-      step.parameters.at(clamp_protocol::STEP_DURATION) = val.value<double>();
+      step.parameters.at(clamp_protocol::STEP_DURATION) = value;
       break;
 
     case 3:
       step.parameters.at(clamp_protocol::DELTA_STEP_DURATION) =
-          val.value<double>();
+          value;
       break;
 
     case 4:
-      step.parameters.at(clamp_protocol::HOLDING_LEVEL_1) = val.value<double>();
+      step.parameters.at(clamp_protocol::HOLDING_LEVEL_1) = value;
       break;
 
     case 5:
       step.parameters.at(clamp_protocol::DELTA_HOLDING_LEVEL_1) =
-          val.value<double>();
+          value;
       break;
 
     case 6:
-      step.parameters.at(clamp_protocol::HOLDING_LEVEL_2) = val.value<double>();
+      step.parameters.at(clamp_protocol::HOLDING_LEVEL_2) = value;
       break;
 
     case 7:
       step.parameters.at(clamp_protocol::DELTA_HOLDING_LEVEL_2) =
-          val.value<double>();
+          value;
       break;
 
     default:
       std::cout
           << "Error - ProtocolEditor::updateStepAttribute() - default case"
           << std::endl;
-      break;
+      return;
   }
+  notifySegmentChanged(seg_id);
 }
 
 void clamp_protocol::ClampProtocolEditor::updateStepType(
@@ -700,9 +465,12 @@ void clamp_protocol::ClampProtocolEditor::updateStepType(
   // Disable unneeded attributes depending on step type
   // Enable needed attributes and set text to stored value
   clamp_protocol::ProtocolStep step =
-      protocol.getStep(segmentListWidget->currentRow() - 1, stepNum);
+      protocol.getStep(segmentListWidget->currentRow(), stepNum);
   QTableWidgetItem* item;
   const QString nullentry = "---";
+  // The cells are redrawn from the step, so there is nothing to write back;
+  // the caller announces the type change once
+  const QSignalBlocker blocker(protocolTable);
   switch (stepType) {
     case clamp_protocol::STEP:
       for (size_t i = clamp_protocol::HOLDING_LEVEL_2;
@@ -744,9 +512,6 @@ void clamp_protocol::ClampProtocolEditor::updateStepType(
     default:
       break;
   }
-  for (int i = 0; i < protocolTable->rowCount(); i++) {
-    updateStepAttribute(i, stepNum);
-  }
 }
 
 int clamp_protocol::ClampProtocolEditor::loadFileToProtocol(
@@ -782,7 +547,10 @@ int clamp_protocol::ClampProtocolEditor::loadFileToProtocol(
   }
   file.close();
 
-  protocol.fromDoc(doc);  // Translate document into protocol
+  if (!protocol.fromDoc(doc)) {  // Translate document into protocol
+    QMessageBox::warning(this, "Error", "Protocol file is not valid");
+    return 0;
+  }
 
   if (protocol.numSegments() < 0) {
     QMessageBox::warning(
@@ -790,6 +558,16 @@ int clamp_protocol::ClampProtocolEditor::loadFileToProtocol(
     return 0;
   }
 
+  refreshProtocolView();
+
+  return 1;
+}
+
+// Rebuilds the segment list and step table from the protocol container
+void clamp_protocol::ClampProtocolEditor::refreshProtocolView()
+{
+  segmentListWidget->clear();
+
   // Build segment listview
   for (int i = 0; i < protocol.numSegments(); i++) {
     QString segmentName = "Segment ";
@@ -808,8 +586,53 @@ int clamp_protocol::ClampProtocolEditor::loadFileToProtocol(
   updateSegment(segmentListWidget->item(0));
 
   updateTable();
+  emit protocolReset();
+}
 
-  return 1;
+void clamp_protocol::ClampProtocolEditor::importProtocol()
+{  // Replace the protocol with one built from a CSV/TSV step table
+  if (protocol.numSegments() != 0
+      && QMessageBox::warning(this,
+                              "Import Protocol",
+                              "All unsaved changes to current protocol will be "
+                              "lost.\nDo you wish to continue?",
+                              QMessageBox::Yes | QMessageBox::No)
+          != QMessageBox::Yes)
+  {
+    return;
+  }
+
+  QString fileName = QFileDialog::getOpenFileName(
+      this,
+      "Import a step table",
+      "~/",
+      "Step Tables (*.csv *.tsv *.txt);;All Files(*.*)");
+  if (fileName == nullptr) {
+    return;  // Null if user cancels dialog
+  }
+
+  QFile file(fileName);
+  if (!file.open(QIODevice::ReadOnly)) {
+    QMessageBox::warning(this, "Error", "Unable to open step table");
+    return;
+  }
+  const QByteArray contents = file.readAll();
+  file.close();
+
+  const clamp_protocol::table_import_result result =
+      clamp_protocol::importStepTable(
+          std::string_view(contents.constData(),
+                           static_cast<size_t>(contents.size())),
+          protocol);
+  if (!result.ok) {
+    QMessageBox::warning(this,
+                         "Error",
+                         "Line " + QString::number(result.line) + ": "
+                             + QString::fromStdString(result.message));
+    return;
+  }
+
+  refreshProtocolView();
 }
 
 QString clamp_protocol::ClampProtocolEditor::loadProtocol()
@@ -883,6 +706,50 @@ void clamp_protocol::ClampProtocolEditor::saveProtocol()
   file.close();  // Close file
 }
 
+void clamp_protocol::ClampProtocolEditor::saveToArchive()
+{  // Compiles the protocol and stores it in a protocol archive under a name
+  if (protocolEmpty()) {  // Exit if protocol is empty
+    return;
+  }
+
+  QString fileName =
+      QFileDialog::getSaveFileName(this,
+                                   "Save to protocol archive",
+                                   "~/",
+                                   "Protocol Archives (*.cpa)",
+                                   nullptr,
+                                   QFileDialog::DontConfirmOverwrite);
+  if (fileName == nullptr) {
+    return;  // Null if user cancels dialog
+  }
+  if (!(fileName.endsWith(".cpa"))) {
+    fileName.append(".cpa");
+  }
+
+  bool ok = false;
+  const QString name = QInputDialog::getText(this,
+                                             "Save to protocol archive",
+                                             "Protocol name:",
+                                             QLineEdit::Normal,
+                                             "",
+                                             &ok);
+  if (!ok || name.isEmpty()) {
+    return;
+  }
+
+  if (!clamp_protocol::ProtocolArchive::store(
+          fileName.toStdString(), name.toStdString(), protocol.compile()))
+  {
+    QMessageBox::warning(this,
+                         "Error",
+                         "Unable to save to archive: check folder permissions "
+                         "and that the name is at most "
+                             + QString::number(
+                                 clamp_protocol::ProtocolArchive::max_name_length)
+                             + " characters.");
+  }
+}
+
 void clamp_protocol::ClampProtocolEditor::clearProtocol()
 {  // Clear protocol
   protocol.clear();
@@ -899,6 +766,7 @@ void clamp_protocol::ClampProtocolEditor::clearProtocol()
                    SIGNAL(valueChanged(int)),
                    this,
                    SLOT(updateSegmentSweeps(int)));
+  emit protocolReset();
 }
 
 void clamp_protocol::ClampProtocolEditor::exportProtocol()
@@ -958,61 +826,115 @@ void clamp_protocol::ClampProtocolEditor::exportProtocol()
     return;  // Null if user cancels dialog
   }
 
-  // Run protocol with user specified period
-  std::array<std::vector<double>, 2> run;
-  run = protocol.dryrun(period);
-  std::vector<double> time = run.at(0);
-  std::vector<double> output = run.at(1);
-
-  QTextStream ts(&file);
+  file.close();
 
-  for (auto itx = time.begin(), ity = output.begin(); itx < time.end();
-       itx++, ity++)
-  {  // Iterate through vectors and output to file
-    ts << *itx << " " << *ity << "\n";
+  // Play the protocol at the user specified period and write it out. Long
+  // protocols at short periods take a while, so this runs as a background
+  // task and the editor stays responsive.
+  const int64_t period_ns = std::llround(period * 1e6);
+  auto write = [this, snapshot = protocol, period_ns, path = fileName.toStdString()]()
+  {
+    const auto run = snapshot.dryrun(period_ns);
+    std::ofstream out(path);
+    for (size_t i = 0; i < run[0].size() && out; ++i) {
+      if (i % 65536 == 0 && exportTasks.cancelled()) {
+        out.close();
+        std::remove(path.c_str());
+        return;
+      }
+      out << run[0][i] << " " << run[1][i] << "\n";
+    }
+    out.close();
+    if (!out) {
+      QMetaObject::invokeMethod(
+          this,
+          [this]()
+          {
+            QMessageBox::warning(
+                this, "Error", "Writing the exported protocol failed");
+          },
+          Qt::QueuedConnection);
+    }
+  };
+  if (pool == nullptr) {
+    write();
+    return;
   }
-
-  file.close();  // Close file
+  pool->submit(exportTasks, std::move(write), PRIORITY_BACKGROUND);
 }
 
 void clamp_protocol::ClampProtocolEditor::previewProtocol()
-{  // Graph protocol output in a simple plot window
-  if (protocolEmpty()) {
-    return;  // Exit if protocol is empty
-  }
-
-  // Create a dialog with a BasicPlot
-  auto* dlg = new QDialog(this, Qt::Dialog);
-  dlg->setAttribute(Qt::WA_DeleteOnClose);
-  dlg->setWindowTitle("Protocol Preview");
-  auto* layout = new QVBoxLayout(dlg);
-  auto* plot = new QwtPlot(dlg);
-  layout->addWidget(plot);
-  dlg->resize(500, 500);
-  dlg->show();
-
-  // Add close button to bottom of the window
-  auto* closeButton = new QPushButton("Close", dlg);
-  QObject::connect(closeButton, SIGNAL(clicked()), dlg, SLOT(accept()));
-  layout->addWidget(closeButton);
+{  // Show or hide the docked protocol preview
+  preview->setVisible(!preview->isVisible());
+}
 
+clamp_protocol::ProtocolPreview::ProtocolPreview(
+    clamp_protocol::Protocol* protocol, QWidget* parent)
+    : QwtPlot(parent)
+    , protocol(protocol)
+    , curve(new QwtPlotCurve(""))
+{
   // Plot Settings
-  plot->setCanvasBackground(QColor(70, 128, 186));
+  setCanvasBackground(QColor(70, 128, 186));
   QwtText xAxisTitle;
   QwtText yAxisTitle;
   xAxisTitle.setText("Time (ms)");
   yAxisTitle.setText("Voltage (mV)");
-  plot->setAxisTitle(QwtPlot::xBottom, xAxisTitle);
-  plot->setAxisTitle(QwtPlot::yLeft, yAxisTitle);
-  plot->show();
+  setAxisTitle(QwtPlot::xBottom, xAxisTitle);
+  setAxisTitle(QwtPlot::yLeft, yAxisTitle);
+  setMinimumHeight(200);
 
-  // Run protocol and plot
-  std::array<std::vector<double>, 2> run = protocol.dryrun(0.1);
+  curve->attach(this);
+}
 
-  auto* curve = new QwtPlotCurve("");
-  curve->setSamples(run.at(0).data(), run.at(1).data(), run.at(0).size());
-  curve->attach(plot);
-  plot->replot();
+void clamp_protocol::ProtocolPreview::updateSegment(int seg_id)
+{
+  if (seg_id < 0 || static_cast<size_t>(seg_id) >= protocol->numSegments()) {
+    return;
+  }
+  if (segment_vertices.size() < protocol->numSegments()) {
+    segment_vertices.resize(protocol->numSegments());
+  }
+  segment_vertices.at(seg_id) = protocol->segmentVertices(seg_id);
+  redraw();
+}
+
+void clamp_protocol::ProtocolPreview::removeSegment(int seg_id)
+{
+  if (seg_id < 0 || static_cast<size_t>(seg_id) >= segment_vertices.size()) {
+    return;
+  }
+  segment_vertices.erase(segment_vertices.begin() + seg_id);
+  redraw();
+}
+
+void clamp_protocol::ProtocolPreview::reset()
+{
+  segment_vertices.clear();
+  for (size_t i = 0; i < protocol->numSegments(); ++i) {
+    segment_vertices.push_back(protocol->segmentVertices(i));
+  }
+  redraw();
+}
+
+void clamp_protocol::ProtocolPreview::redraw()
+{
+  // Segments are cached in segment-relative time, so only the offsets of the
+  // following segments move when one of them changes length
+  time_ms.resize(0);
+  amplitude.resize(0);
+  double offset_ms = 0.0;
+  for (const auto& vertices : segment_vertices) {
+    for (size_t i = 0; i < vertices[0].size(); ++i) {
+      time_ms.push_back(offset_ms + vertices[0][i]);
+      amplitude.push_back(vertices[1][i]);
+    }
+    if (!vertices[0].empty()) {
+      offset_ms += vertices[0].back();
+    }
+  }
+  curve->setRawSamples(time_ms.data(), amplitude.data(), time_ms.size());
+  replot();
 }
 
 bool clamp_protocol::ClampProtocolEditor::protocolEmpty()
@@ -1036,6 +958,19 @@ bool clamp_protocol::ClampProtocolEditor::protocolEmpty()
   return false;
 }
 
+clamp_protocol::ClampProtocolEditor::~ClampProtocolEditor()
+{
+  stopExports();
+}
+
+void clamp_protocol::ClampProtocolEditor::stopExports()
+{
+  exportTasks.cancel();
+  if (!exportTasks.done()) {
+    pool->wait(exportTasks);
+  }
+}
+
 void clamp_protocol::ClampProtocolEditor::createGUI()
 {
   auto* panel = dynamic_cast<Widgets::Panel*>(parentWidget());
@@ -1056,8 +991,12 @@ void clamp_protocol::ClampProtocolEditor::createGUI()
 
   saveProtocolButton = new QPushButton("Save");
   saveProtocolButton->setSizePolicy(QSizePolicy::Fixed, QSizePolicy::Fixed);
+  archiveProtocolButton = new QPushButton("Archive");
+  archiveProtocolButton->setSizePolicy(QSizePolicy::Fixed, QSizePolicy::Fixed);
   loadProtocolButton = new QPushButton("Load");
   loadProtocolButton->setSizePolicy(QSizePolicy::Fixed, QSizePolicy::Fixed);
+  importProtocolButton = new QPushButton("Import");
+  importProtocolButton->setSizePolicy(QSizePolicy::Fixed, QSizePolicy::Fixed);
   exportProtocolButton = new QPushButton("Export");
   exportProtocolButton->setSizePolicy(QSizePolicy::Fixed, QSizePolicy::Fixed);
   previewProtocolButton = new QPushButton("Preview");
@@ -1066,7 +1005,9 @@ void clamp_protocol::ClampProtocolEditor::createGUI()
   clearProtocolButton->setSizePolicy(QSizePolicy::Fixed, QSizePolicy::Fixed);
 
   layout1_left->addWidget(saveProtocolButton);
+  layout1_left->addWidget(archiveProtocolButton);
   layout1_left->addWidget(loadProtocolButton);
+  layout1_left->addWidget(importProtocolButton);
   layout1_right->addWidget(exportProtocolButton);
   layout1_right->addWidget(previewProtocolButton);
   layout1_right->addWidget(clearProtocolButton);
@@ -1192,6 +1133,9 @@ void clamp_protocol::ClampProtocolEditor::createGUI()
   layout2->setColumnStretch(1, 0);
   windowLayout->addLayout(layout2);
 
+  preview = new ProtocolPreview(&protocol, this);
+  windowLayout->addWidget(preview);
+
   // Signal and slot connections for protocol editor UI
   QObject::connect(protocolTable,
                    SIGNAL(itemClicked(QTableWidgetItem*)),
@@ -1232,14 +1176,23 @@ void clamp_protocol::ClampProtocolEditor::createGUI()
       deleteSegmentButton, SIGNAL(clicked()), this, SLOT(deleteSegment()));
   QObject::connect(
       saveProtocolButton, SIGNAL(clicked()), this, SLOT(saveProtocol()));
+  QObject::connect(
+      archiveProtocolButton, SIGNAL(clicked()), this, SLOT(saveToArchive()));
   QObject::connect(
       loadProtocolButton, SIGNAL(clicked(bool)), this, SLOT(loadProtocol()));
   QObject::connect(
       clearProtocolButton, SIGNAL(clicked()), this, SLOT(clearProtocol()));
+  QObject::connect(
+      importProtocolButton, SIGNAL(clicked()), this, SLOT(importProtocol()));
   QObject::connect(
       exportProtocolButton, SIGNAL(clicked()), this, SLOT(exportProtocol()));
   QObject::connect(
       previewProtocolButton, SIGNAL(clicked()), this, SLOT(previewProtocol()));
+  QObject::connect(
+      this, SIGNAL(segmentChanged(int)), preview, SLOT(updateSegment(int)));
+  QObject::connect(
+      this, SIGNAL(segmentRemoved(int)), preview, SLOT(removeSegment(int)));
+  QObject::connect(this, SIGNAL(protocolReset()), preview, SLOT(reset()));
 
   subWindow->setWidget(this);
   subWindow->show();
@@ -1263,7 +1216,150 @@ void clamp_protocol::ClampProtocolEditor::protocolTable_verticalSliderReleased()
 
 clamp_protocol::Plugin::Plugin(Event::Manager* ev_manager)
     : Widgets::Plugin(ev_manager, std::string(clamp_protocol::MODULE_NAME))
+    , rt_trace(traceRecorder.addRing("RT thread"))
+    , gui_trace(traceRecorder.addRing("GUI thread"))
+{
+}
+
+clamp_protocol::Plugin::~Plugin()
+{
+  // The panel first: closing the plot window still goes through the
+  // component
+  auto* panel = dynamic_cast<clamp_protocol::Panel*>(getPanel());
+  if (panel != nullptr) {
+    panel->detachPlugin();
+  }
+  setActive(false);
+  auto* component = dynamic_cast<clamp_protocol::Component*>(getComponent());
+  if (component != nullptr) {
+    component->setPlotting(false);
+    component->setFifo(nullptr, 0);
+    component->setSession(nullptr);
+    component->setTrace(nullptr);
+  }
+  // Nothing runs on the pool any more, so its workers can be joined before
+  // anything else goes
+  pool.reset();
+}
+
+clamp_protocol::WorkStealingPool& clamp_protocol::Plugin::taskPool()
+{
+  if (pool != nullptr) {
+    return *pool;
+  }
+  auto* component = dynamic_cast<clamp_protocol::Component*>(getComponent());
+  const int rt_cpu = component == nullptr ? -1 : component->rtCpu();
+  clamp_protocol::pool_options options;
+  options.cpus = clamp_protocol::freeCpus(rt_cpu);
+  if (rt_cpu < 0) {
+    // RT core unknown: keep one core clear for it and leave the workers to
+    // the scheduler
+    options.threads = std::max<size_t>(options.cpus.size(), 2) - 1;
+    options.cpus.clear();
+  }
+  pool = std::make_unique<clamp_protocol::WorkStealingPool>(options);
+  return *pool;
+}
+
+bool clamp_protocol::Plugin::resizeFifo(size_t bytes,
+                                        std::unique_ptr<RT::OS::Fifo>& retired)
+{
+  if (displayFifo != nullptr && bytes == displayFifoBytes) {
+    return true;
+  }
+  std::unique_ptr<RT::OS::Fifo> resized;
+  if (RT::OS::getFifo(resized, bytes) != 0) {
+    ERROR_MSG("clamp_protocol::Plugin::resizeFifo : unable to allocate {} "
+              "bytes",
+              bytes);
+    return false;
+  }
+  auto* component = dynamic_cast<clamp_protocol::Component*>(getComponent());
+  if (component != nullptr) {
+    const bool active = getActive();
+    setActive(false);
+    component->setFifo(resized.get(), bytes);
+    setActive(active);
+  }
+  // The RT thread has let go of the old FIFO, so the caller may drain it
+  retired = std::move(displayFifo);
+  displayFifo = std::move(resized);
+  displayFifoBytes = bytes;
+  return true;
+}
+
+void clamp_protocol::Plugin::setPlotting(bool on)
+{
+  auto* component = dynamic_cast<clamp_protocol::Component*>(getComponent());
+  if (component == nullptr) {
+    return;
+  }
+  const bool active = getActive();
+  setActive(false);
+  component->setPlotting(on);
+  setActive(active);
+}
+
+clamp_protocol::runtime_metrics* clamp_protocol::Plugin::metrics()
 {
+  auto* component = dynamic_cast<clamp_protocol::Component*>(getComponent());
+  return component == nullptr ? nullptr : component->metrics();
+}
+
+clamp_protocol::LatencyProbe* clamp_protocol::Plugin::latencyProbe()
+{
+  auto* component = dynamic_cast<clamp_protocol::Component*>(getComponent());
+  return component == nullptr ? nullptr : component->latencyProbe();
+}
+
+bool clamp_protocol::Plugin::startSession(const std::string& path)
+{
+  auto* component = dynamic_cast<clamp_protocol::Component*>(getComponent());
+  if (component == nullptr || !sessionRecorder.open(path)) {
+    return false;
+  }
+  const bool active = getActive();
+  setActive(false);
+  component->setSession(&sessionRecorder);
+  setActive(active);
+  return true;
+}
+
+void clamp_protocol::Plugin::stopSession()
+{
+  auto* component = dynamic_cast<clamp_protocol::Component*>(getComponent());
+  if (component != nullptr) {
+    const bool active = getActive();
+    setActive(false);
+    component->setSession(nullptr);
+    setActive(active);
+  }
+  sessionRecorder.close();
+}
+
+void clamp_protocol::Plugin::setProtocol(clamp_protocol::compiled_view protocol,
+                                         uint64_t hash)
+{
+  auto* component = dynamic_cast<clamp_protocol::Component*>(getComponent());
+  if (component == nullptr) {
+    return;
+  }
+  const bool active = getActive();
+  setActive(false);
+  component->setProtocol(protocol, hash);
+  setActive(active);
+}
+
+void clamp_protocol::Plugin::setProtocolHash(uint64_t hash)
+{
+  auto* component = dynamic_cast<clamp_protocol::Component*>(getComponent());
+  if (component == nullptr) {
+    return;
+  }
+  const bool active = getActive();
+  setActive(false);
+  component->setProtocolHash(hash);
+  setActive(active);
 }
 
 clamp_protocol::Panel::Panel(QMainWindow* main_window,
@@ -1284,6 +1380,17 @@ clamp_protocol::Component::Component(Widgets::Plugin* hplugin)
                          clamp_protocol::get_default_channels(),
                          clamp_protocol::get_default_vars())
 {
+  auto* plugin = dynamic_cast<clamp_protocol::Plugin*>(hplugin);
+  if (plugin != nullptr) {
+    trace = plugin->rtTrace();
+    runner.setTrace(trace);
+  }
+}
+
+void clamp_protocol::Component::setProtocol(
+    clamp_protocol::compiled_view new_protocol, uint64_t hash)
+{
+  runner.setProtocol(new_protocol, hash, RT::OS::getPeriod());
 }
 
 void clamp_protocol::Panel::initParameters()
@@ -1301,76 +1408,6 @@ void clamp_protocol::Panel::initParameters()
   plotting = false;
 }
 
-double clamp_protocol::Component::getProtocolAmplitude(int64_t current_time)
-{
-  // Verify that indices are correct
-  if (stepIdx >= protocol->getSegment(segmentIdx).steps.size()) {
-    stepIdx = 0;
-    ++segmentIdx;
-    reference_time = current_time;
-  }
-
-  if (segmentIdx >= protocol->numSegments()) {
-    segmentIdx = 0;
-    ++sweepIdx;
-  }
-
-  if (sweepIdx >= protocol->getSegment(segmentIdx).numSweeps) {
-    ++trialIdx;
-    segmentIdx = 0;
-  }
-
-  if (trialIdx >= numTrials) {
-    setState(RT::State::PAUSE);
-    return 0.0;
-  }
-
-  // Setup and generate protocol output
-  auto& step = protocol->getStep(segmentIdx, stepIdx);
-  double voltage_mv = 0.0;
-  double time_elapsed_ms =
-      static_cast<double>(current_time - reference_time) * 1e3;
-  switch (step.stepType) {
-    case clamp_protocol::STEP: {
-      voltage_mv = step.parameters[clamp_protocol::HOLDING_LEVEL_1]
-          + step.parameters[clamp_protocol::DELTA_HOLDING_LEVEL_1] * sweepIdx;
-      break;
-    }
-    case clamp_protocol::RAMP: {
-      const double y2 = step.parameters[clamp_protocol::HOLDING_LEVEL_2]
-          + step.parameters[clamp_protocol::DELTA_HOLDING_LEVEL_2] * sweepIdx;
-      const double y1 = step.parameters[clamp_protocol::HOLDING_LEVEL_1]
-          + step.parameters[clamp_protocol::DELTA_HOLDING_LEVEL_1] * sweepIdx;
-      const double max_time = step.parameters[clamp_protocol::STEP_DURATION]
-          + step.parameters[clamp_protocol::DELTA_STEP_DURATION] * sweepIdx;
-      const double slope = (y2 - y1) / max_time;
-      const double time_ms = std::min(max_time, time_elapsed_ms);
-      voltage_mv = slope * time_ms;
-      break;
-    }
-    default:
-      ERROR_MSG(
-          "ERROR - In function Panel::execute() switch( stepType ) "
-          "default case called");
-      break;
-  }
-
-  stepIdx += static_cast<int>(
-      time_elapsed_ms
-      > (step.parameters[clamp_protocol::STEP_DURATION]
-         + step.parameters[clamp_protocol::DELTA_STEP_DURATION] * segmentIdx));
-  if (plotting) {
-    clamp_protocol::data_token_t data {reference_time,
-                                       current_time,
-                                       readinput(0),
-                                       segmentIdx,
-                                       sweepIdx,
-                                       stepIdx};
-    fifo->writeRT(&data, sizeof(data_token_t));
-  };
-  return voltage_mv;
-}
-
 void clamp_protocol::Panel::customizeGUI()
 {
   auto* customLayout = dynamic_cast<QVBoxLayout*>(this->layout());
@@ -1388,6 +1425,14 @@ void clamp_protocol::Panel::customizeGUI()
   toolsRow->addWidget(loadButton);
   toolsRow->addWidget(editorButton);
   toolsRow->addWidget(viewerButton);
+  traceButton = new QPushButton("Trace");
+  traceButton->setToolTip("Save recent RT and GUI events as a Chrome trace");
+  toolsRow->addWidget(traceButton);
+  sessionButton = new QPushButton("Session");
+  sessionButton->setCheckable(true);
+  sessionButton->setToolTip(
+      "Record input samples, tick times and commands for offline replay");
+  toolsRow->addWidget(sessionButton);
   controlGroupLayout->addLayout(toolsRow);
 
   auto* runRow = new QHBoxLayout;
@@ -1403,6 +1448,7 @@ void clamp_protocol::Panel::customizeGUI()
   // setLayout(customLayout);
 
   plotTimer = new QTimer(this);
+  sessionTimer = new QTimer(this);
 
   QObject::connect(loadButton,
                    &QPushButton::clicked,
@@ -1420,6 +1466,18 @@ void clamp_protocol::Panel::customizeGUI()
                    &QPushButton::clicked,
                    this,
                    &clamp_protocol::Panel::toggleProtocol);
+  QObject::connect(traceButton,
+                   &QPushButton::clicked,
+                   this,
+                   &clamp_protocol::Panel::saveTrace);
+  QObject::connect(sessionButton,
+                   &QPushButton::clicked,
+                   this,
+                   &clamp_protocol::Panel::toggleSession);
+  QObject::connect(sessionTimer,
+                   &QTimer::timeout,
+                   this,
+                   &clamp_protocol::Panel::flushSession);
   QObject::connect(recordCheckBox,
                    &QPushButton::clicked,
                    this,
@@ -1433,12 +1491,25 @@ void clamp_protocol::Panel::customizeGUI()
 void clamp_protocol::Panel::loadProtocolFile()
 {
   QString fileName = QFileDialog::getOpenFileName(
-      this, "Open a Protocol File", "~/", "Clamp Protocol Files (*.csp)");
+      this,
+      "Open a Protocol File",
+      "~/",
+      "Clamp Protocol Files (*.csp);;Protocol Archives (*.cpa)");
 
   if (fileName == nullptr) {
     return;
   }
 
+  // The component must let go of the current steps before they are replaced
+  auto* hplugin = dynamic_cast<clamp_protocol::Plugin*>(getHostPlugin());
+  hplugin->setProtocol({}, 0);
+  armedProtocol = {};
+
+  if (fileName.endsWith(".cpa")) {
+    loadProtocolArchive(fileName);
+    return;
+  }
+
   QDomDocument doc("protocol");
   QFile file(fileName);
 
@@ -1454,14 +1525,159 @@ void clamp_protocol::Panel::loadProtocolFile()
   }
   file.close();
 
-  protocol.fromDoc(doc);
+  if (!protocol.fromDoc(doc)) {
+    QMessageBox::warning(this, "Error", "Protocol file is not valid");
+    return;
+  }
 
   if (protocol.numSegments() <= 0) {
     QMessageBox::warning(
         this, "Error", "Protocol did not contain any segments");
   }
 
+  archive.reset();
+  compiledProtocol = protocol.compile();
+  armedProtocol = compiledProtocol.view();
   setComment("Protocol Name", fileName);
+  armProtocol();
+}
+
+void clamp_protocol::Panel::loadProtocolArchive(const QString& fileName)
+{
+  archive = std::make_unique<clamp_protocol::ProtocolArchive>();
+  if (!archive->open(fileName.toStdString()) || archive->size() == 0) {
+    QMessageBox::warning(
+        this, "Error", "Unable to open protocol archive or it is empty");
+    archive.reset();
+    return;
+  }
+
+  QStringList names;
+  for (size_t i = 0; i < archive->size(); ++i) {
+    const std::string_view name = archive->name(i);
+    names.append(QString::fromUtf8(name.data(), static_cast<int>(name.size())));
+  }
+  bool ok = false;
+  const QString name = QInputDialog::getItem(
+      this, "Protocol Archive", "Protocol:", names, 0, false, &ok);
+  if (!ok) {
+    archive.reset();
+    return;
+  }
+
+  protocol.clear();
+  compiledProtocol.steps.clear();
+  armedProtocol = archive->find(name.toStdString());
+  setComment("Protocol Name", fileName + ":" + name);
+  armProtocol();
+}
+
+// Hashes the compiled protocol together with the current RT settings and
+// hands both to the real-time component. Runs once per load and once per run
+// so every acquired token names the exact stimulus that produced it.
+void clamp_protocol::Panel::armProtocol()
+{
+  sizeFifo();
+  updateHash();
+  dynamic_cast<clamp_protocol::Plugin*>(getHostPlugin())
+      ->setProtocol(armedProtocol, protocolHash);
+}
+
+void clamp_protocol::Panel::updateHash()
+{
+  auto* hplugin = dynamic_cast<clamp_protocol::Plugin*>(getHostPlugin());
+  hashPeriod = RT::OS::getPeriod();
+  hashJunctionPotential =
+      hplugin->getComponentDoubleParameter(LIQUID_JUNCT_POTENTIAL);
+  hashFactor = static_cast<double>(
+      hplugin->getComponentUIntParameter(VOLTAGE_FACTOR));
+  protocolHash = clamp_protocol::hashProtocol(
+      armedProtocol, hashPeriod, hashJunctionPotential, hashFactor);
+  setComment("Protocol Hash",
+             QString::fromStdString(clamp_protocol::hashToString(protocolHash)));
+  if (pipeline != nullptr) {
+    pipeline->setProtocol(armedProtocol, protocolHash, hashPeriod);
+  }
+}
+
+void clamp_protocol::Panel::checkHash()
+{
+  auto* hplugin = dynamic_cast<clamp_protocol::Plugin*>(getHostPlugin());
+  if (armedProtocol.size == 0
+      || (RT::OS::getPeriod() == hashPeriod
+          && hplugin->getComponentDoubleParameter(LIQUID_JUNCT_POTENTIAL)
+              == hashJunctionPotential
+          && static_cast<double>(
+                 hplugin->getComponentUIntParameter(VOLTAGE_FACTOR))
+              == hashFactor))
+  {
+    return;
+  }
+  updateHash();
+  hplugin->setProtocolHash(protocolHash);
+}
+
+void clamp_protocol::Panel::sizeFifo()
+{
+  const int64_t period_ns = RT::OS::getPeriod();
+  if (fifo != nullptr && period_ns == fifoPeriod) {
+    return;
+  }
+  clamp_protocol::fifo_sizing sizing;
+  sizing.period_ns = period_ns;
+  auto* hplugin = dynamic_cast<clamp_protocol::Plugin*>(getHostPlugin());
+  std::unique_ptr<RT::OS::Fifo> retired;
+  if (!hplugin->resizeFifo(clamp_protocol::fifoCapacity(sizing), retired)) {
+    return;
+  }
+  fifo = hplugin->fifo();
+  fifoPeriod = period_ns;
+
+  // Records written since the last drain would go down with the old FIFO.
+  // Read all of them, however many, behind any chunk still waiting for the
+  // pipeline; only a period change grows that chunk past the pooled size.
+  if (retired == nullptr || !plotting) {
+    return;
+  }
+  if (pendingChunk == nullptr) {
+    pendingChunk = clamp_protocol::makeChunk();
+  }
+  auto& data = pendingChunk->tokens;
+  while (true) {
+    const size_t used = data.size();
+    data.resize(used + drain_records);
+    const auto bytes =
+        retired->read(data.data() + used,
+                      sizeof(clamp_protocol::data_token_t) * drain_records);
+    data.resize(used
+                + static_cast<size_t>(std::max<int64_t>(bytes, 0))
+                    / sizeof(clamp_protocol::data_token_t));
+    if (data.size() == used) {
+      break;
+    }
+  }
+}
+
+void clamp_protocol::Panel::buildPipeline()
+{
+  pipeline.reset();
+  clamp_protocol::pipeline_params params;
+  params.stages = analysisStages;
+  pipeline = std::make_unique<clamp_protocol::AnalysisPipeline>(
+      dynamic_cast<clamp_protocol::Plugin*>(getHostPlugin())->taskPool(),
+      params);
+  pipeline->setProtocol(armedProtocol, protocolHash, RT::OS::getPeriod());
+  if (plotWindow != nullptr) {
+    plotWindow->setPipeline(pipeline.get());
+  }
+}
+
+void clamp_protocol::Panel::setAnalysisStages(int stages)
+{
+  for (size_t stage = 0; stage < analysisStages.size(); ++stage) {
+    analysisStages[stage] = ((static_cast<unsigned>(stages) >> stage) & 1U) != 0;
+  }
+  buildPipeline();
 }
 
 void clamp_protocol::Panel::openProtocolEditor()
@@ -1471,6 +1687,8 @@ void clamp_protocol::Panel::openProtocolEditor()
     return;
   }
   protocolEditor = new clamp_protocol::ClampProtocolEditor(this);
+  protocolEditor->setTaskPool(
+      &dynamic_cast<clamp_protocol::Plugin*>(getHostPlugin())->taskPool());
   //	protocolEditor = new
   // ClampProtocolEditor(MainWindow::getInstance()->centralWidget());
   QObject::connect(protocolEditor,
@@ -1498,15 +1716,34 @@ void clamp_protocol::Panel::openProtocolWindow()
     return;
   }
   plotWindow = new clamp_protocol::ClampProtocolWindow(this);
+  auto* hplugin = dynamic_cast<clamp_protocol::Plugin*>(getHostPlugin());
+  plotWindow->setTrace(hplugin->guiTrace());
+  if (hplugin->metrics() != nullptr) {
+    guiMonitor = std::make_unique<clamp_protocol::GuiMonitor>(hplugin->metrics());
+    plotWindow->setMonitor(guiMonitor.get());
+  }
+  plotWindow->setLatencyProbe(hplugin->latencyProbe());
+  if (chunkPool == nullptr) {
+    chunkPool =
+        std::make_unique<clamp_protocol::ChunkPool>(pooled_chunks, drain_records);
+  }
+  buildPipeline();
   plotWindow->show();
+  // Checked at compile time, so the signal and slot cannot drift apart
+  qRegisterMetaType<clamp_protocol::chunk_handle>();
   QObject::connect(this,
-                   SIGNAL(plotCurve(double*, curve_token_t)),
+                   &clamp_protocol::Panel::plotCurve,
                    plotWindow,
-                   SLOT(addCurve(double*, curve_token_t)));
+                   &clamp_protocol::ClampProtocolWindow::addChunk);
   QObject::connect(
       plotWindow, SIGNAL(emitCloseSignal()), this, SLOT(closeProtocolWindow()));
+  QObject::connect(plotWindow,
+                   SIGNAL(stagesChanged(int)),
+                   this,
+                   SLOT(setAnalysisStages(int)));
   plotWindow->setWindowTitle("Protocol Plot Window");
   plotting = true;
+  hplugin->setPlotting(true);
   plotTimer->start(100);  // 100ms refresh rate for plotting
   viewerButton->setEnabled(false);
 }
@@ -1514,6 +1751,7 @@ void clamp_protocol::Panel::openProtocolWindow()
 void clamp_protocol::Panel::closeProtocolWindow()
 {
   plotting = false;
+  dynamic_cast<clamp_protocol::Plugin*>(getHostPlugin())->setPlotting(false);
   plotTimer->stop();
 
   viewerButton->setEnabled(true);
@@ -1521,21 +1759,131 @@ void clamp_protocol::Panel::closeProtocolWindow()
 
   delete plotWindow;
   plotWindow = nullptr;
+  if (guiMonitor != nullptr) {
+    guiMonitor->analysisQueued(0);
+  }
+  guiMonitor.reset();
+  pipeline.reset();
+  pendingChunk.reset();
 }
 
 void clamp_protocol::Panel::updateProtocolWindow()
 {
-  constexpr size_t buffer_size = 10000;
-  std::vector<clamp_protocol::data_token_t> data;
-  data.reserve(buffer_size);
-  fifo->read(data.data(), sizeof(clamp_protocol::data_token_t) * buffer_size);
-  plotCurve(data);
+  checkHash();
+  TraceRing* trace =
+      dynamic_cast<clamp_protocol::Plugin*>(getHostPlugin())->guiTrace();
+  // A chunk the pipeline had no room for goes first; the FIFO keeps the
+  // records behind it meanwhile, as it does while every pooled chunk is
+  // still in use
+  if (pendingChunk == nullptr) {
+    pendingChunk = chunkPool->acquire();
+    if (pendingChunk != nullptr) {
+      trace->begin(TRACE_DRAIN);
+      auto& data = pendingChunk->tokens;
+      data.resize(drain_records);  // Within the pooled capacity
+      if (guiMonitor != nullptr) {
+        guiMonitor->draining(RT::OS::getTime());
+      }
+      const auto bytes = fifo == nullptr
+          ? 0
+          : fifo->read(data.data(),
+                       sizeof(clamp_protocol::data_token_t) * drain_records);
+      if (guiMonitor != nullptr) {
+        guiMonitor->drained(static_cast<size_t>(std::max<int64_t>(bytes, 0)));
+      }
+      data.resize(static_cast<size_t>(std::max<int64_t>(bytes, 0))
+                  / sizeof(clamp_protocol::data_token_t));
+      trace->end(TRACE_DRAIN, data.size());
+    }
+  }
+  pipeline->push(pendingChunk);
+
+  // Whatever the stages have finished, this chunk too if none are on
+  clamp_protocol::chunk_handle chunk;
+  while (pipeline->pop(chunk)) {
+    emit plotCurve(chunk);
+  }
+  if (guiMonitor != nullptr) {
+    guiMonitor->analysisQueued(pipeline->queuedChunks());
+  }
+  // A period change since the last drain needs a FIFO of another size
+  sizeFifo();
+}
+
+void clamp_protocol::Panel::saveTrace()
+{
+  bool ok = false;
+  const int window_ms = QInputDialog::getInt(this,
+                                             "Save Trace",
+                                             "Window to save (ms): ",
+                                             1000,
+                                             1,
+                                             600000,
+                                             100,
+                                             &ok);
+  if (!ok) {
+    return;
+  }
+  const QString fileName = QFileDialog::getSaveFileName(
+      this, "Save Trace", "~/", "Chrome trace (*.json);;All Files (*.*)");
+  if (fileName.isEmpty()) {
+    return;
+  }
+  std::ofstream file(fileName.toStdString());
+  if (!file) {
+    QMessageBox::warning(
+        this, "Error", "Unable to save file: Please check folder permissions.");
+    return;
+  }
+  dynamic_cast<clamp_protocol::Plugin*>(getHostPlugin())
+      ->writeTrace(file, static_cast<int64_t>(window_ms) * 1000000);
+}
+
+void clamp_protocol::Panel::toggleSession()
+{
+  auto* hplugin = dynamic_cast<clamp_protocol::Plugin*>(getHostPlugin());
+  if (!sessionButton->isChecked()) {
+    sessionTimer->stop();
+    hplugin->stopSession();
+    if (hplugin->sessionLostEvents() > 0) {
+      QMessageBox::warning(
+          this,
+          "Session",
+          QString("%1 events did not fit in the session buffer; replay will "
+                  "skip over them")
+              .arg(hplugin->sessionLostEvents()));
+    }
+    return;
+  }
+  const QString fileName = QFileDialog::getSaveFileName(
+      this, "Record Session", "~/", "Session logs (*.cps);;All Files (*.*)");
+  if (fileName.isEmpty() || !hplugin->startSession(fileName.toStdString())) {
+    if (!fileName.isEmpty()) {
+      QMessageBox::warning(
+          this, "Error", "Unable to save file: Please check folder permissions.");
+    }
+    sessionButton->setChecked(false);
+    return;
+  }
+  sessionTimer->start(100);
+}
+
+void clamp_protocol::Panel::flushSession()
+{
+  checkHash();
+  auto* hplugin = dynamic_cast<clamp_protocol::Plugin*>(getHostPlugin());
+  if (!hplugin->flushSession()) {
+    sessionTimer->stop();
+    hplugin->stopSession();
+    sessionButton->setChecked(false);
+    QMessageBox::warning(this, "Error", "Writing the session log failed");
+  }
 }
 
 void clamp_protocol::Panel::toggleProtocol()
 {
   if (runProtocolButton->isChecked()) {
-    if (protocol.numSegments() == 0) {
+    if (armedProtocol.size == 0) {
       QMessageBox::warning(
           this,
           "Error",
@@ -1544,10 +1892,8 @@ void clamp_protocol::Panel::toggleProtocol()
       protocolOn = false;
       return;
     }
+    armProtocol();
   }
-  protocol_state pstate = {
-      runProtocolButton->isChecked(), recording, &protocol};
-  fifo->write(&pstate, sizeof(protocol_state));
   // ToggleProtocolEvent event(this, runProtocolButton->isChecked(),
   // recordData); RT::System::getInstance()->postEvent(&event);
 }
@@ -1555,7 +1901,7 @@ void clamp_protocol::Panel::toggleProtocol()
 void clamp_protocol::Panel::foreignToggleProtocol(bool on)
 {
   if (on) {
-    if (protocol.numSegments() == 0) {
+    if (armedProtocol.size == 0) {
       QMessageBox::warning(
           this,
           "Error",
@@ -1572,15 +1918,50 @@ void clamp_protocol::Panel::foreignToggleProtocol(bool on)
   runProtocolButton->setChecked(on);
 }
 
+void clamp_protocol::Panel::detachPlugin()
+{
+  sessionTimer->stop();
+  if (plotWindow != nullptr) {
+    closeProtocolWindow();
+  }
+  if (protocolEditor != nullptr) {
+    protocolEditor->stopExports();
+    protocolEditor->setTaskPool(nullptr);
+  }
+  fifo = nullptr;
+  fifoPeriod = 0;
+}
+
 void clamp_protocol::Component::execute()
 {
   // This is the real-time function that will be called
-  double voltage = 0.0;
-  const int64_t current_time = RT::OS::getPeriod();
-  switch (getState()) {
+#ifdef CLAMP_PROTOCOL_RT_ALLOC_CHECK
+  const rt_alloc::Guard alloc_guard;
+#endif
+  if (trace != nullptr) {
+    trace->begin(TRACE_TICK);
+  }
+  const int64_t start_ns = RT::OS::getTime();
+  if (rt_cpu.load(std::memory_order_relaxed) < 0) {
+    rt_cpu.store(sched_getcpu(), std::memory_order_relaxed);
+  }
+  double output = 0.0;
+  clamp_protocol::data_token_t token {};
+  const auto state = getState();
+  if (trace != nullptr && state != RT::State::EXEC
+      && state != RT::State::PAUSE)
+  {
+    trace->instant(TRACE_COMMAND, static_cast<uint64_t>(state));
+  }
+  switch (state) {
     case RT::State::EXEC:
-      voltage = getProtocolAmplitude(current_time);
-      writeoutput(0, (voltage + junctionPotential) * outputFactor);
+      if (!runner.tick(start_ns, readinput(0), output, token)) {
+        setState(RT::State::PAUSE);
+        display.finish(start_ns, trace);
+      } else {
+        display.write(token, start_ns, trace);
+      }
+      writeoutput(0, output);
       break;
     case RT::State::INIT:
       setValue(TRIAL, uint64_t {0});
@@ -1589,8 +1970,10 @@ void clamp_protocol::Component::execute()
       setValue(TIME, uint64_t {0});
       break;
     case RT::State::MODIFY:
-      junctionPotential = getValue<double>(LIQUID_JUNCT_POTENTIAL) * 1e-3;
-      outputFactor = getValue<double>(VOLTAGE_FACTOR);
+      runner.setOutputScaling(
+          getValue<double>(LIQUID_JUNCT_POTENTIAL) * 1e-3,
+          getValue<double>(VOLTAGE_FACTOR));
+      runner.setTrials(static_cast<int>(getValue<int64_t>(NUM_OF_TRIALS)));
       break;
     case RT::State::PAUSE:
       writeoutput(0, 0);
@@ -1599,6 +1982,8 @@ void clamp_protocol::Component::execute()
       setState(RT::State::EXEC);
       break;
     case RT::State::PERIOD:
+      runner.setPeriod(RT::OS::getPeriod());
+      break;
     case RT::State::EXIT:
       break;
     case RT::State::UNDEFINED:
@@ -1607,6 +1992,33 @@ void clamp_protocol::Component::execute()
       setState(RT::State::PAUSE);
       break;
   }
+#ifdef CLAMP_PROTOCOL_RT_ALLOC_CHECK
+  const rt_alloc::counts_t allocs = rt_alloc::counts();
+  setValue(RT_ALLOCATIONS, allocs.allocations);
+  setValue(RT_FREES, allocs.frees);
+#endif
+  if (monitor.executeTime(RT::OS::getTime() - start_ns)) {
+    publishMetrics();
+  }
+  if (trace != nullptr) {
+    trace->end(TRACE_TICK);
+  }
+}
+
+void clamp_protocol::Component::publishMetrics()
+{
+  const auto ns = [](const std::atomic<int64_t>& value)
+  { return static_cast<uint64_t>(std::max<int64_t>(value.load(), 0)); };
+  setValue(EXECUTE_TIME_LAST, ns(runtimeMetrics.execute_last_ns));
+  setValue(EXECUTE_TIME_MAX, ns(runtimeMetrics.execute_max_ns));
+  setValue(EXECUTE_TIME_P99, ns(runtimeMetrics.execute_p99_ns));
+  setValue(FIFO_FILL, runtimeMetrics.fifoFill());
+  setValue(FIFO_HIGH_WATER, runtimeMetrics.fifo_high_water.load());
+  setValue(RECORDS_DROPPED, runtimeMetrics.dropped.load());
+  setValue(DRAIN_LATENCY, ns(runtimeMetrics.drain_latency_ns));
+  setValue(REPLOT_TIME, ns(runtimeMetrics.replot_ns));
+  setValue(REPLOT_FPS, runtimeMetrics.replot_fps.load());
+  setValue(ANALYSIS_QUEUE, runtimeMetrics.analysis_queued.load());
 }
 
 clamp_protocol::ClampProtocolWindow::ClampProtocolWindow(QWidget* parent)
@@ -1700,6 +2112,39 @@ void clamp_protocol::ClampProtocolWindow::createGUI()
 
   clearButton = new QPushButton("Clear");
   frameLayout->addWidget(clearButton);
+  latencyButton = new QPushButton("Latency");
+  latencyButton->setToolTip("Sample-to-pixel latency of the plot");
+  frameLayout->addWidget(latencyButton);
+  replayButton = new QPushButton("Replay");
+  replayButton->setCheckable(true);
+  replayButton->setToolTip("Play a recorded session (*.cps) into the plot");
+  frameLayout->addWidget(replayButton);
+  analysisButton = new QPushButton("Analysis");
+  analysisButton->setToolTip("Online analysis between the FIFO and the plot");
+  auto* analysisMenu = new QMenu(analysisButton);
+  const std::array<const char*, STAGE_DISPLAY> stageLabels = {
+      "Low-pass filter", "Baseline subtraction", "Measurements", "Trial average"};
+  for (size_t stage = 0; stage < stageActions.size(); ++stage) {
+    stageActions[stage] = analysisMenu->addAction(stageLabels[stage]);
+    stageActions[stage]->setCheckable(true);
+    QObject::connect(
+        stageActions[stage], SIGNAL(triggered()), this, SLOT(changeStages()));
+  }
+  analysisMenu->addSeparator();
+  QObject::connect(analysisMenu->addAction("Throughput..."),
+                   SIGNAL(triggered()),
+                   this,
+                   SLOT(showAnalysis()));
+  analysisButton->setMenu(analysisMenu);
+  frameLayout->addWidget(analysisButton);
+  fidelityLabel = new QLabel;
+  fidelityLabel->setToolTip(
+      "The plot fell behind, so it is shown as the minimum and maximum of "
+      "each group of samples. Recordings keep every sample.");
+  fidelityLabel->setStyleSheet("QLabel { color : darkorange; }");
+  fidelityLabel->hide();
+  frameLayout->addWidget(fidelityLabel);
+  replayTimer = new QTimer(this);
 
   // And now the plot on the bottom...
   plot = new BasicPlot(this);
@@ -1735,6 +2180,10 @@ void clamp_protocol::ClampProtocolWindow::createGUI()
   QObject::connect(
       currentY2Edit, SIGNAL(valueChanged(int)), this, SLOT(setAxes()));
   QObject::connect(clearButton, SIGNAL(clicked()), this, SLOT(clearPlot()));
+  QObject::connect(
+      latencyButton, SIGNAL(clicked()), this, SLOT(showLatency()));
+  QObject::connect(replayButton, SIGNAL(clicked()), this, SLOT(toggleReplay()));
+  QObject::connect(replayTimer, SIGNAL(timeout()), this, SLOT(replayChunk()));
   QObject::connect(
       overlaySweepsCheckBox, SIGNAL(clicked()), this, SLOT(toggleOverlay()));
   QObject::connect(
@@ -1766,6 +2215,9 @@ void clamp_protocol::ClampProtocolWindow::addCurve(
   if (data.empty()) {
     return;
   }
+  if (trace != nullptr) {
+    trace->begin(TRACE_ADD_CURVE, data.size());
+  }
   QString curveTitle;
 
   switch (colorScheme) {
@@ -1808,14 +2260,35 @@ void clamp_protocol::ClampProtocolWindow::addCurve(
     curveContainer.back()->attach(plot);
   }
   colorCurves();
-  data_token_t token {};
+  uint32_t decimation = 1;
+  for (const auto& token : data) {
+    decimation = std::max(decimation, token.decimation);
+  }
+  fidelityLabel->setText(QString("1:%1 min/max").arg(decimation));
+  fidelityLabel->setVisible(decimation > 1);
   for (const auto& token : data) {
+    // One curve per sweep, in ms from its first sample
     curve_data[0][token.sweep].push_back(
-        static_cast<double>(token.time - token.stepStart) * 1e-3);
+        static_cast<double>(token.time - token.sweepStart) * 1e-6);
     curve_data[1][token.sweep].push_back(token.value);
   }
 
+  if (trace != nullptr) {
+    trace->begin(TRACE_REPLOT);
+  }
+  const int64_t replot_start = RT::OS::getTime();
   plot->replot();  // Attaching curve does not refresh plot, must replot
+  const int64_t replot_end = RT::OS::getTime();
+  if (monitor != nullptr) {
+    monitor->replotted(replot_start, replot_end);
+  }
+  if (probe != nullptr) {
+    probe->framePainted(replot_end);
+  }
+  if (trace != nullptr) {
+    trace->end(TRACE_REPLOT);
+    trace->end(TRACE_ADD_CURVE);
+  }
 }
 
 void clamp_protocol::ClampProtocolWindow::colorCurves()
@@ -1837,6 +2310,225 @@ void clamp_protocol::ClampProtocolWindow::colorCurves()
   }
 }
 
+void clamp_protocol::ClampProtocolWindow::showLatency()
+{
+  if (probe == nullptr) {
+    QMessageBox::information(
+        this, "Latency", "The protocol component is not running");
+    return;
+  }
+  const LatencyHistogram& latencies = probe->histogram();
+  auto ms = [](int64_t ns) { return QString::number(ns * 1e-6, 'f', 2); };
+  QString text = QString("Sample-to-pixel latency over %1 tagged samples")
+                     .arg(latencies.count());
+  if (latencies.count() > 0) {
+    text += QString("\n\np50: %1 ms\np90: %2 ms\np99: %3 ms\nmax: %4 ms")
+                .arg(ms(latencies.percentile(0.5)))
+                .arg(ms(latencies.percentile(0.9)))
+                .arg(ms(latencies.percentile(0.99)))
+                .arg(ms(latencies.max()));
+  }
+  text += QString("\n\nRT period: %1 us\nOverlay sweeps: %2\nPlot after "
+                  "protocol: %3\nCurves: %4\nTags dropped: %5")
+              .arg(RT::OS::getPeriod() * 1e-3)
+              .arg(overlaySweeps ? "on" : "off")
+              .arg(plotAfter ? "on" : "off")
+              .arg(curveContainer.size())
+              .arg(probe->droppedTags());
+  QMessageBox box(
+      QMessageBox::Information, "Latency", text, QMessageBox::Ok, this);
+  QPushButton* reset = box.addButton("Reset", QMessageBox::ResetRole);
+  box.exec();
+  if (box.clickedButton() == reset) {
+    probe->reset();
+  }
+}
+
+void clamp_protocol::ClampProtocolWindow::addChunk(const chunk_handle& chunk)
+{
+  if (!chunk->summaries.empty()) {
+    addSummaries(chunk->summaries);
+  }
+  // Live records only; replayed ones carry the counters of their session
+  if (probe != nullptr && !chunk->tokens.empty()) {
+    probe->samplesPlotted(chunk->tokens.back().sample);
+  }
+  addCurve(chunk->tokens);
+}
+
+void clamp_protocol::ClampProtocolWindow::addSummaries(
+    const std::vector<sweep_summary>& summaries)
+{
+  if (summaries.empty()) {
+    return;
+  }
+  sweepsMeasured += summaries.size();
+  lastSummary = summaries.back();
+}
+
+void clamp_protocol::ClampProtocolWindow::changeStages()
+{
+  int stages = 1 << STAGE_DISPLAY;
+  for (size_t stage = 0; stage < stageActions.size(); ++stage) {
+    if (stageActions[stage]->isChecked()) {
+      stages |= 1 << stage;
+    }
+  }
+  emit stagesChanged(stages);
+}
+
+void clamp_protocol::ClampProtocolWindow::showAnalysis()
+{
+  if (pipeline == nullptr) {
+    QMessageBox::information(this, "Analysis", "The plot is not being fed");
+    return;
+  }
+  const pipeline_report report = pipeline->report();
+  const double elapsed_s = std::max(report.elapsed_ns, int64_t {1}) * 1e-9;
+  QString text =
+      QString("Throughput over %1 s").arg(elapsed_s, 0, 'f', 1);
+  for (size_t stage = 0; stage < STAGE_COUNT; ++stage) {
+    const stage_stats& stats = report.stages[stage];
+    if (!stats.enabled) {
+      continue;
+    }
+    text += QString("\n\n%1: %2 records/s in %3 chunks, busy %4%, %5 queued")
+                .arg(stageName(static_cast<pipeline_stage>(stage)))
+                .arg(static_cast<double>(stats.records) / elapsed_s, 0, 'f', 0)
+                .arg(stats.chunks)
+                .arg(stats.busy_ns * 1e-7 / elapsed_s, 0, 'f', 2)
+                .arg(stats.queued);
+    if (stage == STAGE_DISPLAY) {
+      text += QString(", %1 decimated").arg(stats.degraded);
+    }
+  }
+  text += QString("\n\nChunks left in the FIFO for lack of room: %1")
+              .arg(report.rejected);
+  if (sweepsMeasured > 0) {
+    text += QString("\n\nSweeps measured: %1\nLast: trial %2 sweep %3 at %4 "
+                    "mV, peak %5, steady %6, tau %7 ms")
+                .arg(sweepsMeasured)
+                .arg(lastSummary.trial + 1)
+                .arg(lastSummary.sweep + 1)
+                .arg(lastSummary.command)
+                .arg(lastSummary.peak)
+                .arg(lastSummary.steady)
+                .arg(lastSummary.fit.tau);
+  }
+  QMessageBox::information(this, "Analysis", text);
+}
+
+bool clamp_protocol::ClampProtocolWindow::startReplay(const QString& path,
+                                                      double speed)
+{
+  stopReplay();
+  replayLog = std::make_unique<SessionLog>();
+  if (!replayLog->load(path.toStdString())) {
+    replayLog.reset();
+    return false;
+  }
+  replayPlayer = std::make_unique<SessionPlayer>(*replayLog);
+  replaySpeed = speed;
+  replayRecords = 0;
+  replayFrames = 0;
+  // Replayed records carry no latency tags
+  liveProbe = probe;
+  probe = nullptr;
+  clearPlot();
+  replayButton->setChecked(true);
+  replayClock.start();
+  // The live plot drains every 100 ms; flat out, chunks follow each other
+  replayTimer->start(speed > 0.0 ? 100 : 0);
+  return true;
+}
+
+void clamp_protocol::ClampProtocolWindow::stopReplay()
+{
+  if (replayPlayer == nullptr) {
+    return;
+  }
+  replayTimer->stop();
+  replayPlayer.reset();
+  replayLog.reset();
+  probe = liveProbe;
+  replayButton->setChecked(false);
+}
+
+void clamp_protocol::ClampProtocolWindow::toggleReplay()
+{
+  if (!replayButton->isChecked()) {
+    stopReplay();
+    return;
+  }
+  replayButton->setChecked(false);
+  const QString fileName = QFileDialog::getOpenFileName(
+      this, "Replay Session", "~/", "Session logs (*.cps);;All Files (*.*)");
+  if (fileName.isEmpty()) {
+    return;
+  }
+  const QStringList speeds = {"1x", "10x", "As fast as possible"};
+  bool ok = false;
+  const QString choice = QInputDialog::getItem(
+      this, "Replay Session", "Speed:", speeds, 0, false, &ok);
+  if (!ok) {
+    return;
+  }
+  const double speed = choice == speeds[0] ? 1.0
+      : choice == speeds[1]                ? 10.0
+                                           : 0.0;
+  if (!startReplay(fileName, speed)) {
+    QMessageBox::warning(this, "Error", "Not a session log");
+  }
+}
+
+void clamp_protocol::ClampProtocolWindow::replayChunk()
+{
+  // Chunks as large as a live drain when flat out, otherwise whatever the
+  // session played since the last timer tick
+  constexpr size_t max_chunk = 10000;
+  constexpr size_t max_paced_chunk = 1000000;
+  const int64_t until_ns = replaySpeed > 0.0
+      ? static_cast<int64_t>(static_cast<double>(replayClock.nsecsElapsed())
+                             * replaySpeed)
+      : INT64_MAX;
+  replayTokens.clear();
+  const bool more = replayPlayer->nextChunk(
+      until_ns, replaySpeed > 0.0 ? max_paced_chunk : max_chunk, replayTokens);
+  if (!replayTokens.empty()) {
+    replayRecords += replayTokens.size();
+    ++replayFrames;
+    addCurve(replayTokens);
+  }
+  if (more) {
+    return;
+  }
+
+  const double wall_s = static_cast<double>(replayClock.nsecsElapsed()) * 1e-9;
+  const double session_s =
+      static_cast<double>(replayPlayer->elapsed()) * 1e-9;
+  const bool damaged = replayLog->corrupt();
+  stopReplay();
+  QString text =
+      QString("Replayed %1 records of %2 s in %3 s\n\n%4 records/s, "
+              "%5 frames/s, %6x real time")
+          .arg(replayRecords)
+          .arg(session_s, 0, 'f', 3)
+          .arg(wall_s, 0, 'f', 3)
+          .arg(wall_s > 0.0 ? static_cast<double>(replayRecords) / wall_s : 0.0,
+               0,
+               'f',
+               0)
+          .arg(wall_s > 0.0 ? static_cast<double>(replayFrames) / wall_s : 0.0,
+               0,
+               'f',
+               1)
+          .arg(wall_s > 0.0 ? session_s / wall_s : 0.0, 0, 'f', 1);
+  if (damaged) {
+    text += "\n\nThe log is truncated or corrupt after the last record";
+  }
+  QMessageBox::information(this, "Replay", text);
+}
+
 void clamp_protocol::ClampProtocolWindow::setAxes()
 {
   double timeFactor = NAN;
@@ -16,18 +16,41 @@
  *  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
  */
 
+#pragma once
+
 #include <QCheckBox>
 #include <QComboBox>
 #include <QDomDocument>
+#include <QElapsedTimer>
 #include <QListWidget>
+#include <QMetaType>
 #include <QSpinBox>
 #include <QTableWidget>
 
+#include <qwt_plot.h>
 #include <qwt_plot_curve.h>
 #include <rtxi/plot/basicplot.h>
 #include <rtxi/widgets.hpp>
 #include <QVector>
 
+#include "protocol_archive.hpp"
+#include "protocol_display.hpp"
+#include "protocol_engine.hpp"
+#include "protocol_fifo.hpp"
+#include "protocol_latency.hpp"
+#include "protocol_metrics.hpp"
+#include "protocol_model.hpp"
+#include "protocol_pipeline.hpp"
+#include "protocol_pool.hpp"
+#include "protocol_record.hpp"
+#include "protocol_replay.hpp"
+#include "protocol_runner.hpp"
+#include "protocol_session.hpp"
+#include "protocol_trace.hpp"
+#ifdef CLAMP_PROTOCOL_RT_ALLOC_CHECK
+#include "rt_alloc_check.hpp"
+#endif
+
 // This is an generated header file. You may change the namespace, but
 // make sure to do the same in implementation (.cpp) file
 namespace clamp_protocol
@@ -45,12 +68,28 @@ enum PARAMETER : Widgets::Variable::Id
   TRIAL,
   SEGMENT,
   SWEEP,
-  TIME
+  TIME,
+  PROTOCOL_NAME,
+  PROTOCOL_HASH,
+  EXECUTE_TIME_LAST,
+  EXECUTE_TIME_MAX,
+  EXECUTE_TIME_P99,
+  FIFO_FILL,
+  FIFO_HIGH_WATER,
+  RECORDS_DROPPED,
+  DRAIN_LATENCY,
+  REPLOT_TIME,
+  REPLOT_FPS,
+  ANALYSIS_QUEUE,
+#ifdef CLAMP_PROTOCOL_RT_ALLOC_CHECK
+  RT_ALLOCATIONS,
+  RT_FREES,
+#endif
 };
 
 inline std::vector<Widgets::Variable::Info> get_default_vars()
 {
-  return {{INTERVAL_TIME,
+  std::vector<Widgets::Variable::Info> vars = {{INTERVAL_TIME,
            "Interval Time",
            "Time allocated between intervals",
            Widgets::Variable::DOUBLE_PARAMETER,
@@ -59,7 +98,7 @@ inline std::vector<Widgets::Variable::Info> get_default_vars()
            "Number of Trials",
            "Number of times to apply the loaded protocol",
            Widgets::Variable::INT_PARAMETER,
-           int64_t {0}},
+           int64_t {1}},
           {LIQUID_JUNCT_POTENTIAL,
            "Liquid Junct. Potential (mV)",
            "(mV)",
@@ -89,8 +128,81 @@ inline std::vector<Widgets::Variable::Info> get_default_vars()
            "Time (ms)",
            "Elapsed time for current trial",
            Widgets::Variable::STATE,
+           uint64_t {0}},
+          {PROTOCOL_NAME,
+           "Protocol Name",
+           "Name of loaded protocol",
+           Widgets::Variable::COMMENT,
+           std::string("none")},
+          {PROTOCOL_HASH,
+           "Protocol Hash",
+           "Hash of the compiled protocol, period, LJP and scaling",
+           Widgets::Variable::COMMENT,
+           std::string("none")},
+          {EXECUTE_TIME_LAST,
+           "Execute Time (ns)",
+           "Duration of the last execute() call",
+           Widgets::Variable::STATE,
+           uint64_t {0}},
+          {EXECUTE_TIME_MAX,
+           "Execute Time Max (ns)",
+           "Longest execute() call since the module started",
+           Widgets::Variable::STATE,
+           uint64_t {0}},
+          {EXECUTE_TIME_P99,
+           "Execute Time p99 (ns)",
+           "99th percentile of execute() over the last 1000 periods",
+           Widgets::Variable::STATE,
+           uint64_t {0}},
+          {FIFO_FILL,
+           "FIFO Fill (bytes)",
+           "Data waiting in the FIFO for the plot window",
+           Widgets::Variable::STATE,
+           uint64_t {0}},
+          {FIFO_HIGH_WATER,
+           "FIFO High Water (bytes)",
+           "Most data ever waiting in the FIFO",
+           Widgets::Variable::STATE,
+           uint64_t {0}},
+          {RECORDS_DROPPED,
+           "Records Dropped",
+           "Samples that did not fit in the FIFO",
+           Widgets::Variable::STATE,
+           uint64_t {0}},
+          {DRAIN_LATENCY,
+           "Drain Latency (ns)",
+           "Age of the oldest sample when the plot window drained the FIFO",
+           Widgets::Variable::STATE,
+           uint64_t {0}},
+          {REPLOT_TIME,
+           "Replot Time (ns)",
+           "Duration of the last replot",
+           Widgets::Variable::STATE,
+           uint64_t {0}},
+          {REPLOT_FPS,
+           "Replot FPS",
+           "Replots per second",
+           Widgets::Variable::STATE,
+           0.0},
+          {ANALYSIS_QUEUE,
+           "Analysis Queue (chunks)",
+           "Drained chunks waiting in the analysis stages and for the plot",
+           Widgets::Variable::STATE,
            uint64_t {0}}
           };
+#ifdef CLAMP_PROTOCOL_RT_ALLOC_CHECK
+  vars.push_back({RT_ALLOCATIONS,
+                  "RT Allocations",
+                  "Heap allocations made inside execute()",
+                  Widgets::Variable::STATE,
+                  uint64_t {0}});
+  vars.push_back({RT_FREES,
+                  "RT Frees",
+                  "Heap frees made inside execute()",
+                  Widgets::Variable::STATE,
+                  uint64_t {0}});
+#endif
+  return vars;
 }
 
 inline std::vector<IO::channel_t> get_default_channels()
@@ -107,99 +219,6 @@ inline std::vector<IO::channel_t> get_default_channels()
           }};
 }
 
-struct data_token_t
-{
-  int64_t stepStart;
-  int64_t time;
-  double value;
-  int trial;
-  int segment;
-  int sweep;
-  int step;
-};
-
-enum ampMode_t : int
-{
-  VOLTAGE = 0,
-  CURRENT
-};
-
-enum stepType_t : int
-{
-  STEP = 0,
-  RAMP,
-};
-
-// DO NOT REORDER! IF ADDING MORE PARAMETERS INSERT RIGHT BEFORE
-// PROTOCOL_PARAMETERS_SIZE!
-enum protocol_parameters : size_t
-{
-  STEP_DURATION = 0,
-  DELTA_STEP_DURATION,
-  HOLDING_LEVEL_1,
-  DELTA_HOLDING_LEVEL_1,
-  HOLDING_LEVEL_2,
-  DELTA_HOLDING_LEVEL_2,
-  PROTOCOL_PARAMETERS_SIZE
-};
-
-// Individual step within a protocol
-struct ProtocolStep
-{
-  ampMode_t ampMode = VOLTAGE;
-  stepType_t stepType = STEP;
-  std::array<double,
-             static_cast<size_t>(protocol_parameters::PROTOCOL_PARAMETERS_SIZE)>
-      parameters {};
-};  // struct ProtocolStep
-
-// A segment within a protocol, made up of ProtocolSteps
-struct ProtocolSegment
-{
-  std::vector<ProtocolStep> steps;
-  size_t numSweeps = 1;
-};
-
-class Protocol
-{
-public:
-  ProtocolSegment& getSegment(size_t seg_id);  // Return a segment
-  size_t numSegments();  // Number of segments in a protocol
-  size_t numSweeps(size_t seg_id);  // Number of sweeps in a segment
-  void setSweeps(size_t seg_id, uint32_t sweeps);  // Set sweeps for a segment
-  ProtocolStep& getStep(size_t segment,
-                        size_t step);  // Return step in a segment
-  size_t segmentSize(size_t seg_id);  // Return number of steps in segment
-  void toDoc();  // Convert protocol to QDomDocument
-  void fromDoc(const QDomDocument& doc);  // Load protocol from a QDomDocument
-  void clear();  // Clears container
-
-  void addSegment();  // Add a segment to container
-  void deleteSegment(size_t seg_id);  // Delete a segment from container
-  void modifySegment(size_t seg_id, const ProtocolSegment& segment);
-  void addStep(size_t seg_id);  // Add a step to a segment in container
-  void insertStep(size_t seg_id, size_t step_id);
-  void deleteStep(size_t seg_id,
-                  size_t step_id);  // Delete a step from segment in container
-  void modifyStep(size_t seg_id, size_t step_id, const ProtocolStep& step);
-
-  QDomDocument& getProtocolDoc() { return protocolDoc; }
-  std::array<std::vector<double>, 2> dryrun(double period);
-
-private:
-  QDomElement segmentToNode(QDomDocument& doc, size_t seg_id);
-  QDomElement stepToNode(QDomDocument& doc, size_t seg_id, size_t stepNum);
-  QDomDocument protocolDoc;
-  std::vector<ProtocolSegment> segments;
-};  // class Protocol
-
-
-struct protocol_state{
-  bool running = false;
-  bool plotting = false;
-  clamp_protocol::Protocol* protocol = nullptr;
-};
-
 
 class ClampProtocolWindow : public QWidget
 {
@@ -207,9 +226,22 @@ class ClampProtocolWindow : public QWidget
 public:
   explicit ClampProtocolWindow(QWidget* /*, Panel * */);
   void createGUI();
+  void setTrace(TraceRing* ring) { trace = ring; }
+  void setMonitor(GuiMonitor* gui_monitor) { monitor = gui_monitor; }
+  void setLatencyProbe(LatencyProbe* latency_probe) { probe = latency_probe; }
+  // Pipeline the plot is fed from, reported on by the Analysis button
+  void setPipeline(AnalysisPipeline* analysis) { pipeline = analysis; }
+  // Streams the data tokens of a session log through addCurve() as if they
+  // were live: `speed` times real time, or as fast as possible when zero.
+  // False if the file is not a session log.
+  bool startReplay(const QString& path, double speed);
+  void stopReplay();
 
 public slots:
   void addCurve(const std::vector<data_token_t>& data);
+  void addSummaries(const std::vector<sweep_summary>& summaries);
+  // Plots a chunk from the pipeline and lists the sweeps it completed
+  void addChunk(const clamp_protocol::chunk_handle& chunk);
 
 private slots:
   void setAxes();
@@ -217,6 +249,11 @@ private slots:
   void toggleOverlay();
   void togglePlotAfter();
   void changeColorScheme(int);
+  void showLatency();
+  void toggleReplay();
+  void replayChunk();
+  void changeStages();
+  void showAnalysis();
 
 private:
   void colorCurves();
@@ -258,26 +295,80 @@ private:
   QLabel* textLabel1 = nullptr;
   QComboBox* colorByComboBox = nullptr;
   QPushButton* clearButton = nullptr;
+  QPushButton* latencyButton = nullptr;
+  QPushButton* replayButton = nullptr;
+  QPushButton* analysisButton = nullptr;
+  QLabel* fidelityLabel = nullptr;  // Shown while the data is decimated
+  std::array<QAction*, STAGE_DISPLAY> stageActions {};
 
   QMdiSubWindow* subWindow = nullptr;
+  TraceRing* trace = nullptr;
+  GuiMonitor* monitor = nullptr;
+  LatencyProbe* probe = nullptr;
+  AnalysisPipeline* pipeline = nullptr;
+  uint64_t sweepsMeasured = 0;
+  sweep_summary lastSummary;
+
+  // Replay of a recorded session, fed a chunk per timer tick
+  std::unique_ptr<SessionLog> replayLog;
+  std::unique_ptr<SessionPlayer> replayPlayer;
+  QTimer* replayTimer = nullptr;
+  double replaySpeed = 0.0;
+  QElapsedTimer replayClock;
+  std::vector<data_token_t> replayTokens;
+  uint64_t replayRecords = 0;
+  uint64_t replayFrames = 0;
+  LatencyProbe* liveProbe = nullptr;  // Set aside while replaying
 
 signals:
   void emitCloseSignal();
+  // Bit i set for each pipeline_stage i to run
+  void stagesChanged(int stages);
 
 };  // class ClampProtocolWindow
 
+// Docked preview of the protocol being edited. Keeps the corner points of
+// each segment and only rebuilds the segments it is told have changed.
+class ProtocolPreview : public QwtPlot
+{
+  Q_OBJECT
+
+public:
+  ProtocolPreview(Protocol* protocol, QWidget* parent);
+
+public slots:
+  void updateSegment(int seg_id);
+  void removeSegment(int seg_id);
+  void reset();
+
+private:
+  void redraw();
+
+  Protocol* protocol;
+  QwtPlotCurve* curve;
+  std::vector<std::array<std::vector<double>, 2>> segment_vertices;
+  QVector<double> time_ms;
+  QVector<double> amplitude;
+};
+
 class ClampProtocolEditor : public QWidget
 {
   Q_OBJECT
 
 public:
   explicit ClampProtocolEditor(QWidget* parent);
+  ~ClampProtocolEditor() override;
   void createGUI();
+  // Exports run on `task_pool` when set, on the GUI thread otherwise
+  void setTaskPool(WorkStealingPool* task_pool) { pool = task_pool; }
+  // Drops the exports still queued and waits for a running one to give up
+  void stopExports();
 
 public slots:
   QString loadProtocol();
   void loadProtocol(const QString&);
   void clearProtocol();
+  void importProtocol();
   void exportProtocol();
   void previewProtocol();
   void comboBoxChanged(const QString& string);
@@ -297,14 +388,23 @@ private slots:
   void updateStepAttribute(int, int);
   void updateStepType(int, stepType_t);
   void saveProtocol();
+  void saveToArchive();
 
 private:
   void createStep(int);
   int loadFileToProtocol(const QString&);
+  void refreshProtocolView();
   bool protocolEmpty();
+  void notifySegmentChanged(int seg_id);
 
   Protocol protocol;  // Clamp protocol
-  QPushButton *saveProtocolButton, *loadProtocolButton, *exportProtocolButton,
+  ProtocolPreview* preview;
+  WorkStealingPool* pool = nullptr;
+  TaskGroup exportTasks;
+  bool tableRebuilding = false;  // Suppresses change notifications
+  QPushButton *saveProtocolButton, *archiveProtocolButton, *loadProtocolButton,
+      *importProtocolButton,
+      *exportProtocolButton,
       *previewProtocolButton, *clearProtocolButton;
   QGroupBox* protocolDescriptionBox;
   QLabel* segmentStepLabel;
@@ -327,6 +427,9 @@ private:
 
 signals:
   void protocolTableScroll();
+  void segmentChanged(int);
+  void segmentRemoved(int);
+  void protocolReset();
 };
 
 // Offset from parameter index in step struct to panel's row index
@@ -342,31 +445,70 @@ public:
   void customizeGUI();
 
   void foreignToggleProtocol(bool);
+  // Closes the plot window and stops the editor's exports, which run on
+  // the plugin's pool, and forgets the plugin's FIFO. Called by the plugin
+  // before it is destroyed; the panel itself may outlive it.
+  void detachPlugin();
 
   void receiveEvent(const ::Event::Object*);
   void receiveEventRT(const ::Event::Object*);
 
 public slots:
   void loadProtocolFile();
+  void loadProtocolArchive(const QString& fileName);
   void openProtocolEditor();
   void openProtocolWindow();
   void updateProtocolWindow();
   void closeProtocolWindow();
   void closeProtocolEditor();
   void toggleProtocol();
+  void saveTrace();
+  void toggleSession();
+  void flushSession();
+  void setAnalysisStages(int stages);
 
 signals:
-  void plotCurve(std::vector<data_token_t> data);
+  // Shares the chunk with the plot; its buffers go back to the pool once
+  // every receiver has let go of it
+  void plotCurve(const clamp_protocol::chunk_handle& chunk);
 
 private:
+  void armProtocol();
+  // Hashes the armed protocol with the current period, LJP and voltage
+  // factor, and shows the hash and hands it to the pipeline
+  void updateHash();
+  // Rehashes if the period or output scaling changed since the last hash,
+  // e.g. through Modify, and stamps the component's tokens with the result
+  void checkHash();
+  // Replaces the pipeline with one running `analysisStages`. Chunks in the
+  // old one are dropped.
+  void buildPipeline();
+  // Sizes the display FIFO for the current RT period, see fifoCapacity()
+  void sizeFifo();
+
+  static constexpr size_t drain_records = 10000;  // Per chunk, each drain
+  // Enough for every stage queue to hold a few chunks; when all are in use
+  // the drain skips a tick and the records wait in the FIFO
+  static constexpr size_t pooled_chunks = 16;
+
   std::list<ClampProtocolWindow*> plotWindowList;
 
   double trial, time, sweep, segmentNumber, intervalTime;
 
   Protocol protocol;
+  CompiledProtocol compiledProtocol;  // Compiled from a loaded .csp file
+  // Open when the protocol came from an archive
+  std::unique_ptr<ProtocolArchive> archive;
+  compiled_view armedProtocol;  // Steps handed to the component
+  uint64_t protocolHash = 0;
+  // What protocolHash was computed with
+  int64_t hashPeriod = 0;
+  double hashJunctionPotential = 0.0;
+  double hashFactor = 0.0;
   double stepOutput;
   double rampIncrement;
-  RT::OS::Fifo* fifo;
+  RT::OS::Fifo* fifo = nullptr;  // Owned by the plugin
+  int64_t fifoPeriod = 0;  // RT period the FIFO was sized for
   std::vector<double> data;
 
   double prevSegmentEnd;  // Time segment ends after its first sweep
@@ -380,9 +522,17 @@ private:
 
   QCheckBox* recordCheckBox;
   QLineEdit* loadFilePath;
-  QPushButton *loadButton, *editorButton, *viewerButton, *runProtocolButton;
+  QPushButton *loadButton, *editorButton, *viewerButton, *runProtocolButton,
+      *traceButton, *sessionButton;
+  QTimer* sessionTimer;  // Moves the session log from the RT ring to disk
   ClampProtocolWindow* plotWindow=nullptr;
+  std::unique_ptr<GuiMonitor> guiMonitor;
   ClampProtocolEditor* protocolEditor=nullptr;
+  // Drained records go through the analysis stages on their way to the plot
+  std::array<bool, STAGE_COUNT> analysisStages {false, false, false, false, true};
+  std::unique_ptr<ChunkPool> chunkPool;  // Outlives every chunk below
+  std::unique_ptr<AnalysisPipeline> pipeline;
+  chunk_handle pendingChunk;  // Drained, but the pipeline had no room
 };
 
 class Component : public Widgets::Component
@@ -390,26 +540,100 @@ class Component : public Widgets::Component
 public:
   explicit Component(Widgets::Plugin* hplugin);
   void execute() override;
+  runtime_metrics* metrics() { return &runtimeMetrics; }
+  LatencyProbe* latencyProbe() { return &probe; }
+  // Only call while the component is inactive. The steps must outlive the
+  // component or the next call.
+  void setProtocol(compiled_view new_protocol, uint64_t hash);
+  // Same rules as setProtocol()
+  void setProtocolHash(uint64_t hash) { runner.setHash(hash); }
+  // FIFO the plot tokens go to and its size in bytes, which sets when
+  // decimation starts. Same rules as setProtocol().
+  void setFifo(RT::OS::Fifo* display_fifo, size_t capacity)
+  {
+    display.setFifo(display_fifo, capacity);
+  }
+  // Tokens are written only while the plot is open. Same rules as
+  // setProtocol().
+  void setPlotting(bool on) { display.setPlotting(on); }
+  // Same rules as setProtocol(); null stops recording
+  void setSession(SessionRecorder* recorder) { runner.setSession(recorder); }
+  // Same rules as setProtocol(); null stops tracing
+  void setTrace(TraceRing* ring)
+  {
+    trace = ring;
+    runner.setTrace(ring);
+  }
+  // CPU the RT thread runs on, -1 until it has run
+  int rtCpu() const { return rt_cpu.load(std::memory_order_relaxed); }
+
 private:
-  double getProtocolAmplitude(int64_t current_time);
-  int segmentIdx;
-  int sweepIdx;
-  int stepIdx;
-  int trialIdx;
-  int numTrials;
-  double voltage;
-  double junctionPotential;
-  double outputFactor;
-  int64_t reference_time=0;
-  bool plotting=false;
-  Protocol* protocol=nullptr;
-  RT::OS::Fifo* fifo = nullptr;
+  void publishMetrics();  // Copy runtime_metrics into the states
+
+  ProtocolRunner runner;
+  TraceRing* trace = nullptr;
+  runtime_metrics runtimeMetrics;
+  RtMonitor monitor {&runtimeMetrics};
+  LatencyProbe probe;
+  // Thins the plot stream as the FIFO fills
+  DisplayWriter<RT::OS::Fifo> display {monitor, probe};
+  std::atomic<int> rt_cpu {-1};
 };
 
 class Plugin : public Widgets::Plugin
 {
 public:
   explicit Plugin(Event::Manager* ev_manager);
+  // The members below go before Widgets::Plugin detaches the component, so
+  // the component and the panel are made to let go of them first
+  ~Plugin() override;
+  // Pauses the component while it is handed a new protocol
+  void setProtocol(compiled_view protocol, uint64_t hash);
+  // Same for a new hash of the current protocol
+  void setProtocolHash(uint64_t hash);
+
+  // Trace rings for the RT thread and the GUI thread
+  TraceRing* rtTrace() { return rt_trace; }
+  TraceRing* guiTrace() { return gui_trace; }
+  runtime_metrics* metrics();  // Null before the component exists
+  LatencyProbe* latencyProbe();  // Null before the component exists
+  void writeTrace(std::ostream& out, int64_t window_ns) const
+  {
+    traceRecorder.writeChromeTrace(out, window_ns);
+  }
+  // Records everything the component consumes to a session log (*.cps)
+  // until stopSession(); pauses the component while switching
+  bool startSession(const std::string& path);
+  void stopSession();
+  bool flushSession() { return sessionRecorder.flush(); }
+  uint64_t sessionLostEvents() const { return sessionRecorder.lostEvents(); }
+  // Plugin-wide scheduler for non-RT work, one worker per core the RT
+  // thread does not use. Created on first use, after the RT thread has
+  // reported its core if it has run.
+  WorkStealingPool& taskPool();
+  // Display FIFO shared by the component and the panel. Allocates one of
+  // `bytes` unless the current one already has that size, pausing the
+  // component while it is swapped. The old FIFO, which the component no
+  // longer writes, is handed back in `retired` so its records can still be
+  // read. False if the allocation failed, which leaves the current FIFO in
+  // place.
+  bool resizeFifo(size_t bytes, std::unique_ptr<RT::OS::Fifo>& retired);
+  // Starts or stops the component writing to the display FIFO, pausing it
+  // while switching
+  void setPlotting(bool on);
+  RT::OS::Fifo* fifo() { return displayFifo.get(); }
+  size_t fifoBytes() const { return displayFifoBytes; }
+
+private:
+  TraceRecorder traceRecorder;
+  SessionRecorder sessionRecorder;
+  TraceRing* rt_trace;
+  TraceRing* gui_trace;
+  std::unique_ptr<RT::OS::Fifo> displayFifo;
+  size_t displayFifoBytes = 0;
+  std::unique_ptr<WorkStealingPool> pool;
 };
 
 }  // namespace clamp_protocol
+
+Q_DECLARE_METATYPE(clamp_protocol::chunk_handle)